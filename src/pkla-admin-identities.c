@@ -29,16 +29,23 @@
 #include <polkit/polkit.h>
 
 #include "polkitbackendconfigsource.h"
+#include "polkitbackendlocalauthority.h"
+#include "polkitbackendsnapshot.h"
 
-static GList *
-polkit_backend_local_authority_get_admin_auth_identities (PolkitBackendConfigSource *config_source)
+/* Sources modified less than this many seconds before they were read could
+   be modified again without a change in the recorded state */
+#define CACHE_SETTLE_SECONDS 2
+
+/* Returns the configured identity strings, or %NULL if there are none.
+   Sets @out_cacheable to %FALSE if the value could not be read. */
+static gchar **
+get_admin_identity_strings (PolkitBackendConfigSource *config_source,
+                            gboolean                  *out_cacheable)
 {
-  GList *ret;
-  guint n;
   gchar **admin_identities;
   GError *error;
 
-  ret = NULL;
+  *out_cacheable = TRUE;
 
   error = NULL;
   admin_identities = polkit_backend_config_source_get_string_list (config_source,
@@ -52,13 +59,27 @@ polkit_backend_local_authority_get_admin_auth_identities (PolkitBackendConfigSou
 	g_debug ("Error getting admin_identities configuration item: %s",
 		 error->message);
       else
-	g_warning ("Error getting admin_identities configuration item: %s",
-		   error->message);
+	{
+	  g_warning ("Error getting admin_identities configuration item: %s",
+		     error->message);
+	  *out_cacheable = FALSE;
+	}
       g_error_free (error);
-      goto out;
     }
 
-  for (n = 0; admin_identities[n] != NULL; n++)
+  return admin_identities;
+}
+
+static GList *
+polkit_backend_local_authority_get_admin_auth_identities (gchar **admin_identities)
+{
+  GList *ret;
+  guint n;
+  GError *error;
+
+  ret = NULL;
+
+  for (n = 0; admin_identities != NULL && admin_identities[n] != NULL; n++)
     {
       PolkitIdentity *identity;
 
@@ -74,14 +95,141 @@ polkit_backend_local_authority_get_admin_auth_identities (PolkitBackendConfigSou
       ret = g_list_append (ret, identity);
     }
 
-  g_strfreev (admin_identities);
+  return ret;
+}
+
+/* Returns the configuration source for @config_path serialized in @cache,
+   or %NULL if one of the files it was read from has changed since.
+   Identities are still resolved for each query, to notice changes of users
+   and groups. */
+static PolkitBackendConfigSource *
+config_source_from_cache (GVariant    *cache,
+                          const gchar *cache_path,
+                          const gchar *config_path)
+{
+  PolkitBackendConfigSource *ret;
+  GVariant *sources;
+  const gchar *cached_config_path;
+
+  ret = NULL;
+  g_variant_get (cache, "(&s@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING "@a{sa{ss}})",
+                 &cached_config_path, &sources, NULL);
+  if (strcmp (cached_config_path, config_path) == 0
+      && polkit_backend_snapshot_sources_are_fresh (sources))
+    ret = polkit_backend_config_source_new_from_serialized (cache);
+  else
+    g_debug ("Cache `%s' is out of date", cache_path);
+  g_variant_unref (sources);
+
+  return ret;
+}
+
+/* Returns the configuration source for @config_path from the snapshot
+   shared with pkla-check-authorization(8), written by pkla-compile(8) */
+static PolkitBackendConfigSource *
+read_snapshot (const gchar *snapshot_path,
+               const gchar *config_path)
+{
+  PolkitBackendConfigSource *ret;
+  GVariant *snapshot;
+  GError *error;
+
+  error = NULL;
+  snapshot = polkit_backend_snapshot_load_section (snapshot_path,
+                                                   POLKIT_BACKEND_SNAPSHOT_SECTION_CONFIG,
+                                                   G_VARIANT_TYPE (POLKIT_BACKEND_CONFIG_SOURCE_SERIALIZED_TYPE_STRING),
+                                                   &error);
+  if (snapshot == NULL)
+    {
+      g_debug ("Not using snapshot: %s", error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  ret = config_source_from_cache (snapshot, snapshot_path, config_path);
+  g_variant_unref (snapshot);
+
+  return ret;
+}
 
- out:
+/* Returns the configuration source for @config_path serialized in
+   @cache_path by write_cache(), or %NULL if there is none or if it is out
+   of date */
+static PolkitBackendConfigSource *
+read_cache (const gchar *cache_path,
+            const gchar *config_path)
+{
+  PolkitBackendConfigSource *ret;
+  GVariant *cache;
+  GError *error;
+
+  error = NULL;
+  cache = polkit_backend_snapshot_load (cache_path,
+                                        G_VARIANT_TYPE (POLKIT_BACKEND_CONFIG_SOURCE_SERIALIZED_TYPE_STRING),
+                                        &error);
+  if (cache == NULL)
+    {
+      g_debug ("Not using cache: %s", error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  ret = config_source_from_cache (cache, cache_path, config_path);
+  g_variant_unref (cache);
 
   return ret;
 }
 
+/* Remembers the values of @config_source for read_cache(), unless the files
+   were modified too recently to reliably notice further changes */
+static void
+write_cache (const gchar               *cache_path,
+             PolkitBackendConfigSource *config_source)
+{
+  GVariant *cache;
+  GVariant *sources;
+  GError *error;
+
+  cache = g_variant_ref_sink (polkit_backend_config_source_serialize (config_source));
+  sources = g_variant_get_child_value (cache, 1);
+  if (polkit_backend_snapshot_sources_get_newest_mtime (sources)
+      > g_get_real_time () / G_USEC_PER_SEC - CACHE_SETTLE_SECONDS)
+    g_debug ("Configuration files were modified recently, not writing cache");
+  else
+    {
+      error = NULL;
+      if (!polkit_backend_snapshot_save (cache_path, cache, &error))
+        {
+          /* Only reported, the identities are still printed */
+          fprintf (stderr, _("%s: Not writing cache: %s\n"), g_get_prgname (),
+                   error->message);
+          g_error_free (error);
+        }
+    }
+  g_variant_unref (sources);
+  g_variant_unref (cache);
+}
+
 static gchar *config_path; /* = NULL; */
+static gchar *snapshot_path; /* = NULL; */
+static gchar *cache_path; /* = NULL; */
+static gboolean opt_cache; /* = FALSE; */
+
+/* Handles --cache, which takes an optional file name */
+static gboolean
+parse_cache_option (const gchar *option_name,
+                    const gchar *value,
+                    gpointer     data,
+                    GError     **error)
+{
+  opt_cache = TRUE;
+  if (value != NULL)
+    {
+      g_free (cache_path);
+      cache_path = g_strdup (value);
+    }
+  return TRUE;
+}
 
 /* Use G_OPTION_ARG_FILENAME for all strings to avoid the conversion to
    UTF-8. */
@@ -90,6 +238,13 @@ static const GOptionEntry opt_entries[] =
     { "config-path", 'c', 0, G_OPTION_ARG_FILENAME, &config_path,
       N_("Use configuration files in DIR"), N_("DIR"),
     },
+    { "snapshot", 0, 0, G_OPTION_ARG_FILENAME, &snapshot_path,
+      N_("Use the snapshot written by pkla-compile in FILE"), N_("FILE"),
+    },
+    { "cache", 0, G_OPTION_FLAG_OPTIONAL_ARG | G_OPTION_FLAG_FILENAME,
+      G_OPTION_ARG_CALLBACK, parse_cache_option,
+      N_("Remember the result, in FILE if specified"), N_("FILE"),
+    },
     { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
   };
 
@@ -98,8 +253,9 @@ main (int argc, char *argv[])
 {
   GError *error;
   GOptionContext *opt_context;
-  GFile *config_directory;
   PolkitBackendConfigSource *config_source;
+  gchar **admin_identities;
+  gboolean cacheable;
   GList *identities, *l;
 
   g_type_init ();
@@ -129,16 +285,38 @@ main (int argc, char *argv[])
     }
 
   if (config_path == NULL)
-    config_path = g_strdup (PACKAGE_SYSCONF_DIR
-			    "/polkit-1/localauthority.conf.d");
+    config_path = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_CONFIG_PATH);
+  if (snapshot_path == NULL)
+    snapshot_path = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_SNAPSHOT);
+  if (cache_path == NULL)
+    cache_path = g_strdup (PACKAGE_LOCALSTATE_DIR
+			   "/cache/polkit-1/admin-identities.snapshot");
   g_debug ("Using config directory `%s'", config_path);
-  config_directory = g_file_new_for_path (config_path);
-  g_free (config_path);
 
-  config_source = polkit_backend_config_source_new (config_directory);
-  g_object_unref (config_directory);
+  config_source = read_snapshot (snapshot_path, config_path);
+  if (config_source == NULL && opt_cache)
+    config_source = read_cache (cache_path, config_path);
+  if (config_source != NULL)
+    admin_identities = get_admin_identity_strings (config_source, &cacheable);
+  else
+    {
+      GFile *config_directory;
+
+      config_directory = g_file_new_for_path (config_path);
+      config_source = polkit_backend_config_source_new (config_directory);
+      g_object_unref (config_directory);
 
-  identities = polkit_backend_local_authority_get_admin_auth_identities (config_source);
+      admin_identities = get_admin_identity_strings (config_source, &cacheable);
+      if (opt_cache && cacheable)
+        write_cache (cache_path, config_source);
+    }
+  g_object_unref (config_source);
+  g_free (cache_path);
+  g_free (snapshot_path);
+  g_free (config_path);
+
+  identities = polkit_backend_local_authority_get_admin_auth_identities (admin_identities);
+  g_strfreev (admin_identities);
   for (l = identities; l != NULL; l = l->next)
     {
       PolkitIdentity *identity;
@@ -152,7 +330,5 @@ main (int argc, char *argv[])
   g_list_foreach (identities, (GFunc) g_object_unref, NULL);
   g_list_free (identities);
 
-  g_object_unref (config_source);
-
   return 0;
 }
@@ -21,333 +21,984 @@
 
 #include "config.h"
 #include <errno.h>
-#include <pwd.h>
 #include <grp.h>
-#include <netdb.h>
+#include <pwd.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <locale.h>
 #include <glib/gi18n.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixsocketaddress.h>
 
 #include <polkit/polkit.h>
-#include "polkitbackendlocalauthorizationstore.h"
+#include "polkitbackendlocalauthority.h"
+
+/* Seconds a daemon connection may stay idle, and a client waits for a reply */
+#define SOCKET_TIMEOUT 30
+
+/* Seconds the daemon caches group and netgroup memberships for by default */
+#define DEFAULT_GROUP_CACHE_TTL 60
+
+/* Milliseconds a daemon query waits for the groups of a user before using
+   expired ones by default */
+#define DEFAULT_GROUP_LOOKUP_TIMEOUT 500
+
+/* Milliseconds the daemon collects change notifications for by default */
+#define DEFAULT_COALESCE_TIMEOUT 250
 
-static GList *get_groups_for_user (PolkitIdentity              *user);
+/* Number of results remembered in batch and daemon mode by default */
+#define DEFAULT_RESULT_CACHE_SIZE 1024
+
+/* Seconds between updates of the daemon's metrics file by default */
+#define DEFAULT_METRICS_INTERVAL 15
+
+/* Number of connections the daemon serves at the same time by default */
+#define DEFAULT_THREADS 4
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-typedef struct
+static gchar *snapshot_path; /* = NULL; */
+static gint opt_load_threads; /* = 0; */
+static gboolean reverse_evaluation = TRUE;
+static gboolean opt_decision_table; /* = FALSE; */
+static gboolean opt_trace; /* = FALSE; */
+static gboolean opt_stats; /* = FALSE; */
+
+/* Uses the snapshot written by pkla-compile if it is up to date */
+static PolkitBackendLocalAuthority *
+new_authority (const gchar *paths)
 {
-  gchar **authorization_store_paths;
-  GList *authorization_stores;
+  PolkitBackendLocalAuthority *authority;
+  GError *error;
 
-} PolkitBackendLocalAuthorityPrivate;
+  error = NULL;
+  authority = polkit_backend_local_authority_new_from_snapshot (paths, snapshot_path, &error);
+  if (authority == NULL)
+    {
+      g_debug ("Not using snapshot: %s", error->message);
+      g_error_free (error);
+      authority = polkit_backend_local_authority_new (paths);
+    }
+  g_object_set (authority,
+                "load-threads", (guint) opt_load_threads,
+                "reverse-evaluation", reverse_evaluation,
+                NULL);
 
-/* ---------------------------------------------------------------------------------------------------- */
+  return authority;
+}
+
+static gboolean
+parse_boolean (const char *arg, GError **error)
+{
+  if (strcmp (arg, "true") == 0)
+    return TRUE;
+  if (strcmp (arg, "false") == 0)
+    return FALSE;
+  g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+	       _("Invalid boolean value"));
+  return FALSE;
+}
+
+/* Appends @value to @str, quoted if necessary */
+static void
+append_trace_value (GString     *str,
+                    const gchar *value)
+{
+  gchar *escaped;
+
+  if (value[0] != '\0' && strpbrk (value, " \t\n\"\\") == NULL)
+    {
+      g_string_append (str, value);
+      return;
+    }
+  escaped = g_strescape (value, NULL);
+  g_string_append_printf (str, "\"%s\"", escaped);
+  g_free (escaped);
+}
 
+/* Writes @trace of a query as a single line of space-separated NAME=VALUE
+   pairs to standard error.  Stores that were not read or searched are
+   left out. */
 static void
-purge_all_authorization_stores (PolkitBackendLocalAuthorityPrivate *priv)
+print_trace (const gchar                      *user_name,
+             const gchar                      *action_id,
+             PolkitImplicitAuthorization       result,
+             PolkitBackendLocalAuthorityTrace *trace)
 {
-  GList *l;
+  GString *str;
+  guint n;
 
-  for (l = priv->authorization_stores; l != NULL; l = l->next)
+  str = g_string_new ("user=");
+  append_trace_value (str, user_name);
+  g_string_append (str, " action=");
+  append_trace_value (str, action_id);
+  g_string_append_printf (str,
+                          " result=%s cached=%s total_us=%" G_GINT64_FORMAT
+                          " groups_us=%" G_GINT64_FORMAT " load_us=%" G_GINT64_FORMAT
+                          " innetgr_us=%" G_GINT64_FORMAT " match_us=%" G_GINT64_FORMAT
+                          " innetgr_calls=%u entries_scanned=%u entries_matched=%u",
+                          result != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN
+                          ? polkit_implicit_authorization_to_string (result) : "none",
+                          trace->cached ? "yes" : "no", trace->total_time,
+                          trace->groups_time, trace->load_time, trace->innetgr_time,
+                          trace->match_time, trace->innetgr_calls,
+                          trace->entries_scanned, trace->entries_matched);
+  if (trace->deciding_id != NULL)
+    {
+      g_string_append (str, " decided_by=");
+      append_trace_value (str, trace->deciding_id);
+    }
+  for (n = 0; trace->stores != NULL && n < trace->stores->len; n++)
     {
-      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
-      g_object_unref (store);
+      PolkitBackendLocalAuthorityStoreTrace *store_trace;
+
+      store_trace = &g_array_index (trace->stores, PolkitBackendLocalAuthorityStoreTrace, n);
+      if (store_trace->load_time == 0 && store_trace->entries_scanned == 0)
+        continue;
+      g_string_append (str, " store=");
+      append_trace_value (str, store_trace->path);
+      g_string_append_printf (str, ",load_us=%" G_GINT64_FORMAT ",scanned=%u,matched=%u",
+                              store_trace->load_time, store_trace->entries_scanned,
+                              store_trace->entries_matched);
     }
-  g_list_free (priv->authorization_stores);
-  priv->authorization_stores = NULL;
 
-  g_debug ("Purged all local authorization stores");
+  fprintf (stderr, "%s: trace: %s\n", g_get_prgname (), str->str);
+  g_string_free (str, TRUE);
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
+/* Like polkit_unix_user_new_for_name(), but may be called in several
+   threads at once */
+static PolkitIdentity *
+unix_user_new_for_name (const gchar  *user_name,
+                        GError      **error)
+{
+  struct passwd pwd;
+  struct passwd *passwd;
+  gchar *buffer;
+  gsize size;
+  PolkitIdentity *ret;
+  int rc;
+
+  size = 1024;
+  buffer = g_malloc (size);
+  while ((rc = getpwnam_r (user_name, &pwd, buffer, size, &passwd)) == ERANGE)
+    {
+      size *= 2;
+      buffer = g_realloc (buffer, size);
+    }
+  if (rc != 0 || passwd == NULL)
+    {
+      g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                   "No UNIX user with name %s", user_name);
+      ret = NULL;
+    }
+  else
+    ret = polkit_unix_user_new (passwd->pw_uid);
+  g_free (buffer);
+
+  return ret;
+}
+
+/* Reports errors in the same format as the one-shot command line. */
+static gboolean
+evaluate_query (PolkitBackendLocalAuthority  *authority,
+                const gchar                  *user_name,
+                const gchar                  *local_string,
+                const gchar                  *active_string,
+                const gchar                  *action_id,
+                PolkitImplicitAuthorization  *out_result,
+                GError                      **error)
+{
+  PolkitIdentity *user_for_subject;
+  gboolean subject_is_local, subject_is_active;
+  GError *local_error;
+
+  local_error = NULL;
+  subject_is_local = parse_boolean (local_string, &local_error);
+  if (local_error != NULL)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Invalid boolean `%s': %s"), local_string, local_error->message);
+      g_error_free (local_error);
+      return FALSE;
+    }
+  subject_is_active = parse_boolean (active_string, &local_error);
+  if (local_error != NULL)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Invalid boolean `%s': %s"), active_string, local_error->message);
+      g_error_free (local_error);
+      return FALSE;
+    }
+
+  user_for_subject = unix_user_new_for_name (user_name, &local_error);
+  if (user_for_subject == NULL)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Invalid user `%s': %s"), user_name, local_error->message);
+      g_error_free (local_error);
+      return FALSE;
+    }
+
+  /* polkitlocalauthority used to be able to change details, but that is no
+     longer supported in the JS authority, and was not apparently used
+     anyway.  Not asking for them allows cached results to be used. */
+  if (opt_trace)
+    {
+      PolkitBackendLocalAuthorityTrace trace;
+
+      *out_result = polkit_backend_local_authority_check_authorization_traced
+        (authority, user_for_subject, subject_is_local, subject_is_active,
+         action_id, NULL, &trace);
+      print_trace (user_name, action_id, *out_result, &trace);
+      polkit_backend_local_authority_trace_clear (&trace);
+    }
+  else
+    *out_result = polkit_backend_local_authority_check_authorization_sync
+      (authority, user_for_subject, subject_is_local, subject_is_active,
+       action_id, NULL);
+
+  g_object_unref (user_for_subject);
+
+  return TRUE;
+}
+
+/* Queries read from a stream (batch mode and the daemon) are lines with the
+   four command line arguments separated by tabs. */
+static gboolean
+evaluate_query_line (PolkitBackendLocalAuthority  *authority,
+                     const gchar                  *line,
+                     PolkitImplicitAuthorization  *out_result,
+                     GError                      **error)
+{
+  gchar **fields;
+  gboolean ret;
+
+  fields = g_strsplit (line, "\t", 0);
+  if (g_strv_length (fields) != 4)
+    {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                   _("Unexpected number of fields"));
+      ret = FALSE;
+    }
+  else
+    ret = evaluate_query (authority, fields[0], fields[1], fields[2], fields[3],
+                          out_result, error);
+  g_strfreev (fields);
+
+  return ret;
+}
 
 static void
-add_one_authorization_store (PolkitBackendLocalAuthorityPrivate *priv,
-                             GFile                       *directory)
+append_statistic (const gchar *name,
+                  guint64      value,
+                  gpointer     user_data)
 {
-  PolkitBackendLocalAuthorizationStore *store;
+  GString *str = user_data;
 
-  store = polkit_backend_local_authorization_store_new (directory, ".pkla");
-  priv->authorization_stores = g_list_append (priv->authorization_stores, store);
+  g_string_append_printf (str, " %s=%" G_GUINT64_FORMAT, name, value);
 }
 
-static gint
-authorization_store_path_compare_func (GFile *file_a,
-                                       GFile *file_b)
+/* Returns the counters of @authority as space-separated NAME=VALUE pairs,
+   each preceded by a space */
+static gchar *
+format_statistics (PolkitBackendLocalAuthority *authority)
 {
-  const gchar *a;
-  const gchar *b;
+  GString *str;
 
-  a = g_object_get_data (G_OBJECT (file_a), "sort-key");
-  b = g_object_get_data (G_OBJECT (file_b), "sort-key");
+  str = g_string_new (NULL);
+  polkit_backend_local_authority_foreach_statistic (authority, append_statistic, str);
 
-  return g_strcmp0 (a, b);
+  return g_string_free (str, FALSE);
 }
 
+/* Logs the counters of @authority, or writes them to standard error with
+   --stats */
 static void
-add_all_authorization_stores (PolkitBackendLocalAuthorityPrivate *priv)
+report_statistics (PolkitBackendLocalAuthority *authority)
+{
+  gchar *statistics;
+
+  statistics = format_statistics (authority);
+  if (opt_stats)
+    fprintf (stderr, "%s: statistics:%s\n", g_get_prgname (), statistics);
+  else
+    g_debug ("Statistics:%s", statistics);
+  g_free (statistics);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* The metrics file is in the text format read by Prometheus, see
+   https://prometheus.io/docs/instrumenting/exposition_formats/, and can
+   be collected by the textfile collector of node_exporter. */
+
+typedef struct
+{
+  const gchar *statistic;
+  const gchar *metric;
+  const gchar *type;
+  const gchar *help;
+} MetricInfo;
+
+/* Counters of polkit_backend_local_authority_foreach_statistic(); those
+   ending in "_us" are exported in seconds */
+static const MetricInfo authority_metrics[] =
+  {
+    { "checks", "pkla_checks_total", "counter",
+      "Queries evaluated." },
+    { "result_cache_hits", "pkla_result_cache_hits_total", "counter",
+      "Queries answered from the result cache." },
+    { "result_cache_misses", "pkla_result_cache_misses_total", "counter",
+      "Queries not found in the result cache." },
+    { "result_cache_entries", "pkla_result_cache_entries", "gauge",
+      "Results in the result cache." },
+    { "result_cache_kept", "pkla_result_cache_kept_total", "counter",
+      "Results kept in the result cache because changed authorization entries do not match their action." },
+    { "result_cache_invalidated", "pkla_result_cache_invalidated_total", "counter",
+      "Results dropped from the result cache because authorization entries changed." },
+    { "decision_table_hits", "pkla_decision_table_hits_total", "counter",
+      "Queries answered from the decision table." },
+    { "decision_table_entries", "pkla_decision_table_entries", "gauge",
+      "Precomputed results in the decision table." },
+    { "decision_table_builds", "pkla_decision_table_builds_total", "counter",
+      "Times the decision table was computed." },
+    { "decision_table_build_time_us", "pkla_decision_table_build_seconds_total", "counter",
+      "Time spent computing the decision table." },
+    { "group_cache_hits", "pkla_group_cache_hits_total", "counter",
+      "Group lookups answered from the cache." },
+    { "group_cache_misses", "pkla_group_cache_misses_total", "counter",
+      "Group lookups done through NSS." },
+    { "group_cache_entries", "pkla_group_cache_entries", "gauge",
+      "Users whose groups are cached." },
+    { "group_lookup_time_us", "pkla_group_lookup_seconds_total", "counter",
+      "Time spent looking up groups." },
+    { "group_lookups_coalesced", "pkla_group_lookups_coalesced_total", "counter",
+      "Queries that waited for the group lookup of another query." },
+    { "group_lookup_timeouts", "pkla_group_lookup_timeouts_total", "counter",
+      "Queries that used expired groups because the lookup took too long." },
+    { "netgroup_cache_hits", "pkla_netgroup_cache_hits_total", "counter",
+      "Netgroup memberships answered from the cache." },
+    { "netgroup_cache_misses", "pkla_netgroup_cache_misses_total", "counter",
+      "Netgroup memberships looked up through NSS." },
+    { "netgroup_cache_entries", "pkla_netgroup_cache_entries", "gauge",
+      "Netgroup memberships in the cache." },
+    { "innetgr_calls", "pkla_innetgr_calls_total", "counter",
+      "Calls to innetgr()." },
+    { "innetgr_time_us", "pkla_innetgr_seconds_total", "counter",
+      "Time spent in innetgr()." },
+    { "entries_scanned", "pkla_entries_scanned_total", "counter",
+      "Authorization entries matched against the identities of a query." },
+    { "entries_matched", "pkla_entries_matched_total", "counter",
+      "Authorization entries that matched an identity of a query." },
+    { "shadowed_entries", "pkla_shadowed_entries", "gauge",
+      "Authorization entries left out of lookups because they are overridden." },
+  };
+
+/* Counters of polkit_backend_local_authority_foreach_store_statistic() */
+static const MetricInfo store_metrics[] =
+  {
+    { "files", "pkla_store_files", "gauge",
+      "Authorization files read from the directory." },
+    { "entries", "pkla_store_entries", "gauge",
+      "Authorization entries read from the directory." },
+    { "parse_errors", "pkla_store_parse_errors", "gauge",
+      "Authorization entries and files in the directory that could not be parsed." },
+    { "change_events", "pkla_store_change_events_total", "counter",
+      "Change notifications received for files in the directory." },
+    { "reloads", "pkla_store_reloads_total", "counter",
+      "Times changed files in the directory added, removed or changed entries." },
+    { "reload_time_us", "pkla_store_reload_seconds_total", "counter",
+      "Time spent reading changed files in the directory again." },
+    { "load_time_us", "pkla_store_load_seconds_total", "counter",
+      "Time spent listing, reading and indexing files in the directory." },
+  };
+
+static gint
+find_metric (const MetricInfo *infos,
+             guint             n_infos,
+             const gchar      *statistic)
 {
   guint n;
-  GList *directories;
-  GList *l;
 
-  directories = NULL;
+  for (n = 0; n < n_infos; n++)
+    {
+      if (strcmp (infos[n].statistic, statistic) == 0)
+        return n;
+    }
+
+  return -1;
+}
+
+static void
+append_metric_header (GString          *str,
+                      const MetricInfo *info)
+{
+  g_string_append_printf (str, "# HELP %s %s\n# TYPE %s %s\n",
+                          info->metric, info->help, info->metric, info->type);
+}
+
+static void
+append_metric_value (GString     *str,
+                     const gchar *statistic,
+                     guint64      value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (g_str_has_suffix (statistic, "_us"))
+    g_string_append (str, g_ascii_formatd (buf, sizeof (buf), "%.6f",
+                                           (gdouble) value / G_USEC_PER_SEC));
+  else
+    g_string_append_printf (str, "%" G_GUINT64_FORMAT, value);
+  g_string_append_c (str, '\n');
+}
+
+typedef struct
+{
+  guint64 values[G_N_ELEMENTS (authority_metrics)];
+  gboolean have_values[G_N_ELEMENTS (authority_metrics)];
+  /* One GString of samples per element of store_metrics */
+  GString *store_samples[G_N_ELEMENTS (store_metrics)];
+  GString *buckets;
+} MetricsData;
+
+static void
+collect_authority_metric (const gchar *name,
+                          guint64      value,
+                          gpointer     user_data)
+{
+  MetricsData *data = user_data;
+  gint n;
+
+  n = find_metric (authority_metrics, G_N_ELEMENTS (authority_metrics), name);
+  if (n < 0)
+    return;
+  data->values[n] = value;
+  data->have_values[n] = TRUE;
+}
 
-  for (n = 0; priv->authorization_store_paths && priv->authorization_store_paths[n]; n++)
+static void
+collect_store_metric (const gchar *directory,
+                      const gchar *name,
+                      guint64      value,
+                      gpointer     user_data)
+{
+  MetricsData *data = user_data;
+  GString *str;
+  const gchar *p;
+  gint n;
+
+  n = find_metric (store_metrics, G_N_ELEMENTS (store_metrics), name);
+  if (n < 0)
+    return;
+
+  str = data->store_samples[n];
+  g_string_append_printf (str, "%s{directory=\"", store_metrics[n].metric);
+  for (p = directory; *p != '\0'; p++)
     {
-      const gchar *toplevel_path;
-      GFile *toplevel_directory;
-      GFileEnumerator *directory_enumerator;
-      GFileInfo *file_info;
-      GError *error;
+      if (*p == '\\' || *p == '"')
+        g_string_append_c (str, '\\');
+      if (*p == '\n')
+        g_string_append (str, "\\n");
+      else
+        g_string_append_c (str, *p);
+    }
+  g_string_append (str, "\"} ");
+  append_metric_value (str, name, value);
+}
+
+static void
+collect_check_time_bucket (gint64   upper_bound,
+                           guint64  count,
+                           gpointer user_data)
+{
+  MetricsData *data = user_data;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append_printf (data->buckets, "pkla_check_duration_seconds_bucket{le=\"%s\"} %"
+                          G_GUINT64_FORMAT "\n",
+                          g_ascii_formatd (buf, sizeof (buf), "%g",
+                                           (gdouble) upper_bound / G_USEC_PER_SEC),
+                          count);
+}
+
+/* Returns the counters of @authority in the Prometheus text format */
+static gchar *
+format_metrics (PolkitBackendLocalAuthority *authority)
+{
+  MetricsData data;
+  GString *str;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  guint64 checks;
+  gint64 check_time;
+  guint n;
 
-      error = NULL;
+  memset (&data, 0, sizeof (data));
+  for (n = 0; n < G_N_ELEMENTS (store_metrics); n++)
+    data.store_samples[n] = g_string_new (NULL);
+  data.buckets = g_string_new (NULL);
 
-      toplevel_path = priv->authorization_store_paths[n];
-      toplevel_directory = g_file_new_for_path (toplevel_path);
-      directory_enumerator = g_file_enumerate_children (toplevel_directory,
-                                                        "standard::name,standard::type",
-                                                        G_FILE_QUERY_INFO_NONE,
-                                                        NULL,
-                                                        &error);
-      if (directory_enumerator == NULL)
+  polkit_backend_local_authority_foreach_statistic (authority, collect_authority_metric, &data);
+  polkit_backend_local_authority_foreach_store_statistic (authority, collect_store_metric, &data);
+  /* The buckets, count and sum of the histogram must be consistent */
+  polkit_backend_local_authority_get_check_time_histogram (authority, collect_check_time_bucket,
+                                                           &data, &checks, &check_time);
+
+  str = g_string_new (NULL);
+  for (n = 0; n < G_N_ELEMENTS (authority_metrics); n++)
+    {
+      if (!data.have_values[n])
+        continue;
+      append_metric_header (str, &authority_metrics[n]);
+      g_string_append_printf (str, "%s ", authority_metrics[n].metric);
+      append_metric_value (str, authority_metrics[n].statistic, data.values[n]);
+    }
+
+  g_string_append (str,
+                   "# HELP pkla_check_duration_seconds Time taken to evaluate a query.\n"
+                   "# TYPE pkla_check_duration_seconds histogram\n");
+  g_string_append (str, data.buckets->str);
+  g_string_append_printf (str,
+                          "pkla_check_duration_seconds_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n"
+                          "pkla_check_duration_seconds_sum %s\n"
+                          "pkla_check_duration_seconds_count %" G_GUINT64_FORMAT "\n",
+                          checks,
+                          g_ascii_formatd (buf, sizeof (buf), "%.6f",
+                                           (gdouble) check_time / G_USEC_PER_SEC),
+                          checks);
+
+  for (n = 0; n < G_N_ELEMENTS (store_metrics); n++)
+    {
+      if (data.store_samples[n]->len > 0)
         {
-          g_warning ("Error getting enumerator for %s: %s", toplevel_path, error->message);
-          g_error_free (error);
-          g_object_unref (toplevel_directory);
-          continue;
+          append_metric_header (str, &store_metrics[n]);
+          g_string_append (str, data.store_samples[n]->str);
         }
+      g_string_free (data.store_samples[n], TRUE);
+    }
+  g_string_free (data.buckets, TRUE);
 
-      while ((file_info = g_file_enumerator_next_file (directory_enumerator, NULL, &error)) != NULL)
-        {
-          /* only consider directories */
-          if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
-            {
-              const gchar *name;
-              GFile *directory;
-              gchar *sort_key;
+  return g_string_free (str, FALSE);
+}
 
-              name = g_file_info_get_name (file_info);
+/* ---------------------------------------------------------------------------------------------------- */
 
-              /* This makes entries in directories in /etc take precedence to entries in directories in /var */
-              sort_key = g_strdup_printf ("%s-%d", name, n);
+static int
+run_batch (PolkitBackendLocalAuthority *authority)
+{
+  GInputStream *stdin_stream;
+  GDataInputStream *input;
+  PolkitImplicitAuthorization result;
+  gchar *line;
+  guint line_number;
+  GError *error;
+  int ret;
 
-              directory = g_file_get_child (toplevel_directory, name);
-              g_object_set_data_full (G_OBJECT (directory), "sort-key", sort_key, g_free);
+  ret = 0;
 
-              directories = g_list_prepend (directories, directory);
-            }
-          g_object_unref (file_info);
-        }
-      if (error != NULL)
+  stdin_stream = g_unix_input_stream_new (STDIN_FILENO, FALSE);
+  input = g_data_input_stream_new (stdin_stream);
+  g_object_unref (stdin_stream);
+
+  error = NULL;
+  for (line_number = 1;
+       (line = g_data_input_stream_read_line (input, NULL, NULL, &error)) != NULL;
+       line_number++)
+    {
+      if (!evaluate_query_line (authority, line, &result, &error))
         {
-          g_warning ("Error enumerating files in %s: %s", toplevel_path, error->message);
+          fprintf (stderr, _("%s: line %u: %s\n"), g_get_prgname (),
+                   line_number, error->message);
           g_error_free (error);
-          g_object_unref (toplevel_directory);
-          g_object_unref (directory_enumerator);
-          continue;
+          error = NULL;
+          result = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+          ret = EXIT_FAILURE;
         }
-      g_object_unref (directory_enumerator);
-      g_object_unref (toplevel_directory);
+      g_free (line);
+
+      /* One output line per input line, even if there is no decision */
+      if (result != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+        printf ("%s\n", polkit_implicit_authorization_to_string (result));
+      else
+        printf ("\n");
+      fflush (stdout);
     }
+  if (error != NULL)
+    {
+      fprintf (stderr, _("%s: Error reading standard input: %s\n"),
+               g_get_prgname (), error->message);
+      g_error_free (error);
+      ret = EXIT_FAILURE;
+    }
+  g_object_unref (input);
+
+  report_statistics (authority);
+
+  return ret;
+}
 
-  /* Sort directories */
-  directories = g_list_sort (directories, (GCompareFunc) authorization_store_path_compare_func);
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Daemon protocol: each request is a query line as in batch mode.  Each
+   reply is a line starting with "OK", followed by a space and the decision
+   if one is configured, or with "ERROR " followed by a message.  The
+   request "STATS" is answered with "OK" followed by the NAME=VALUE pairs
+   of the counters of the daemon, each preceded by a space. */
+
+#define STATS_REQUEST "STATS"
 
-  /* And now add an authorization store for each one */
-  for (l = directories; l != NULL; l = l->next)
+static gchar *
+handle_request (PolkitBackendLocalAuthority *authority,
+                const gchar                 *line)
+{
+  gchar *reply;
+  gchar *statistics;
+  PolkitImplicitAuthorization result;
+  GError *error;
+
+  error = NULL;
+  if (strcmp (line, STATS_REQUEST) == 0)
     {
-      GFile *directory = G_FILE (l->data);
-      gchar *name;
+      statistics = format_statistics (authority);
+      reply = g_strdup_printf ("OK%s\n", statistics);
+      g_free (statistics);
+    }
+  else if (!evaluate_query_line (authority, line, &result, &error))
+    {
+      reply = g_strdup_printf ("ERROR %s\n", error->message);
+      g_error_free (error);
+    }
+  else if (result != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+    reply = g_strdup_printf ("OK %s\n", polkit_implicit_authorization_to_string (result));
+  else
+    reply = g_strdup ("OK\n");
+
+  return reply;
+}
 
-      name = g_file_get_path (directory);
-      g_debug ("Added `%s' as a local authorization store", name);
-      g_free (name);
+/* Serves one connection until the client goes away, in a thread of the
+   service; the authority handles changes of the files in the main loop */
+static gboolean
+on_run (GThreadedSocketService *service,
+        GSocketConnection      *connection,
+        GObject                *source_object,
+        gpointer                user_data)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (user_data);
+  GDataInputStream *input;
+  GOutputStream *output;
+  gchar *line;
+  gchar *reply;
+  GError *error;
 
-      add_one_authorization_store (priv, directory);
+  g_socket_set_timeout (g_socket_connection_get_socket (connection), SOCKET_TIMEOUT);
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+
+  error = NULL;
+  while ((line = g_data_input_stream_read_line (input, NULL, NULL, &error)) != NULL)
+    {
+      reply = handle_request (authority, line);
+      g_free (line);
+
+      if (!g_output_stream_write_all (output, reply, strlen (reply), NULL, NULL, &error))
+        {
+          g_free (reply);
+          break;
+        }
+      g_free (reply);
+    }
+
+  /* EOF, or the client went away */
+  if (error != NULL)
+    {
+      g_debug ("Error serving request: %s", error->message);
+      g_error_free (error);
     }
+  g_object_unref (input);
 
-  g_list_foreach (directories, (GFunc) g_object_unref, NULL);
-  g_list_free (directories);
+  return TRUE;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
+typedef struct
+{
+  PolkitBackendLocalAuthority *authority;
+  const gchar *path;
+} MetricsFile;
 
+/* Replaces the file atomically, so that collectors never see part of it */
 static void
-polkit_backend_local_authority_init (PolkitBackendLocalAuthorityPrivate *priv)
+write_metrics_file (MetricsFile *metrics_file)
 {
-  priv->authorization_store_paths = NULL;
+  gchar *metrics;
+  GError *error;
+
+  metrics = format_metrics (metrics_file->authority);
+  error = NULL;
+  if (!g_file_set_contents (metrics_file->path, metrics, -1, &error))
+    {
+      g_warning ("Error writing metrics to `%s': %s", metrics_file->path, error->message);
+      g_error_free (error);
+    }
+  g_free (metrics);
 }
 
-static void
-polkit_backend_local_authority_constructed (PolkitBackendLocalAuthorityPrivate *priv)
+static gboolean
+on_metrics_timeout (gpointer user_data)
 {
-  add_all_authorization_stores (priv);
+  write_metrics_file (user_data);
+  return TRUE;
 }
 
-static void
-polkit_backend_local_authority_finalize (PolkitBackendLocalAuthorityPrivate *priv)
+static gboolean
+on_termination_signal (gpointer user_data)
 {
-  purge_all_authorization_stores (priv);
+  GMainLoop *loop = user_data;
 
-  g_strfreev (priv->authorization_store_paths);
+  g_main_loop_quit (loop);
+  return FALSE;
 }
 
-static void
-polkit_backend_local_authority_set_auth_store_paths (PolkitBackendLocalAuthorityPrivate *priv, const char *paths)
+static GSocketConnection *
+connect_to_daemon (const gchar *path,
+                   GError     **error)
 {
-  g_strfreev (priv->authorization_store_paths);
-  priv->authorization_store_paths = g_strsplit (paths, ";", 0);
+  GSocketClient *client;
+  GSocketAddress *address;
+  GSocketConnection *connection;
+
+  client = g_socket_client_new ();
+  g_socket_client_set_timeout (client, SOCKET_TIMEOUT);
+  address = g_unix_socket_address_new (path);
+  connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, error);
+  g_object_unref (address);
+  g_object_unref (client);
+
+  return connection;
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
+static gboolean
+prepare_socket_path (const gchar *path)
+{
+  GSocketConnection *connection;
+  GStatBuf st;
 
-static void
-update_ret_from_authorization_store (PolkitBackendLocalAuthorityPrivate *priv,
-				     PolkitImplicitAuthorization *ret,
-				     PolkitIdentity *identity,
-				     gboolean subject_is_local,
-				     gboolean subject_is_active,
-				     const gchar *action_id,
-				     PolkitDetails *details)
-{
-  GList *l;
-
-  for (l = priv->authorization_stores; l != NULL; l = l->next)
-    {
-      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
-      PolkitImplicitAuthorization ret_any;
-      PolkitImplicitAuthorization ret_inactive;
-      PolkitImplicitAuthorization ret_active;
-
-      if (polkit_backend_local_authorization_store_lookup (store, identity,
-							   action_id, details,
-							   &ret_any,
-							   &ret_inactive,
-							   &ret_active))
-	{
-	  PolkitImplicitAuthorization relevant_ret;
-
-	  if (subject_is_local && subject_is_active)
-	    relevant_ret = ret_active;
-	  else if (subject_is_local)
-	    relevant_ret = ret_inactive;
-	  else
-	    relevant_ret = ret_any;
-	  if (relevant_ret != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
-	    *ret = relevant_ret;
-	}
+  if (g_lstat (path, &st) != 0)
+    return TRUE;
+
+  if (!S_ISSOCK (st.st_mode))
+    {
+      fprintf (stderr, _("%s: `%s' exists and is not a socket\n"),
+               g_get_prgname (), path);
+      return FALSE;
     }
+
+  connection = connect_to_daemon (path, NULL);
+  if (connection != NULL)
+    {
+      fprintf (stderr, _("%s: Another instance is already serving `%s'\n"),
+               g_get_prgname (), path);
+      g_object_unref (connection);
+      return FALSE;
+    }
+
+  /* A stale socket left behind by a daemon that did not exit cleanly */
+  g_unlink (path);
+  return TRUE;
 }
 
-static PolkitImplicitAuthorization
-polkit_backend_local_authority_check_authorization_sync (PolkitBackendLocalAuthorityPrivate *priv,
-                                                         PolkitIdentity                    *user_for_subject,
-                                                         gboolean                           subject_is_local,
-                                                         gboolean                           subject_is_active,
-                                                         const gchar                       *action_id,
-                                                         PolkitDetails                     *details)
+/* Whether @args can be sent as the fields of one request line */
+static gboolean
+arguments_fit_request (char * const *args,
+                       guint         n_args)
 {
-  PolkitImplicitAuthorization ret;
-  GList *groups;
-  GList *ll;
+  guint n;
 
-  ret = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+  for (n = 0; n < n_args; n++)
+    {
+      if (strpbrk (args[n], "\t\n") != NULL)
+        return FALSE;
+    }
 
-#if 0
-  g_debug ("local: checking `%s' for subject `%s' (user `%s')",
-           action_id,
-           polkit_subject_to_string (subject),
-           polkit_identity_to_string (user_for_subject));
-#endif
+  return TRUE;
+}
 
-  /* First check for default entries */
-  update_ret_from_authorization_store (priv, &ret, NULL,
-				       subject_is_local, subject_is_active,
-				       action_id, details);
+static int
+serve (const gchar *paths,
+       const gchar *path,
+       guint        threads,
+       guint        group_cache_ttl,
+       guint        group_lookup_timeout,
+       guint        coalesce_timeout,
+       guint        result_cache_size,
+       const gchar *metrics_path,
+       guint        metrics_interval)
+{
+  PolkitBackendLocalAuthority *authority;
+  GSocketService *service;
+  GSocketAddress *address;
+  GMainLoop *loop;
+  struct group *group;
+  MetricsFile metrics_file;
+  guint metrics_source_id;
+  mode_t old_umask;
+  GError *error;
+  gboolean ok;
+
+  if (!prepare_socket_path (path))
+    return EXIT_FAILURE;
+
+  authority = new_authority (paths);
+  g_object_set (authority,
+                "group-cache-ttl", group_cache_ttl,
+                "group-lookup-timeout", group_lookup_timeout,
+                "netgroup-cache-ttl", group_cache_ttl,
+                "coalesce-timeout", coalesce_timeout,
+                "result-cache-size", result_cache_size,
+                "eliminate-shadowed", TRUE,
+                "decision-table", opt_decision_table,
+                NULL);
+
+  service = g_threaded_socket_service_new (threads);
+  address = g_unix_socket_address_new (path);
+  error = NULL;
+  old_umask = umask (0117);
+  ok = g_socket_listener_add_address (G_SOCKET_LISTENER (service), address,
+                                      G_SOCKET_TYPE_STREAM,
+                                      G_SOCKET_PROTOCOL_DEFAULT,
+                                      NULL, NULL, &error);
+  umask (old_umask);
+  g_object_unref (address);
+  if (!ok)
+    {
+      fprintf (stderr, _("%s: Error listening on `%s': %s\n"),
+               g_get_prgname (), path, error->message);
+      g_error_free (error);
+      g_object_unref (service);
+      g_object_unref (authority);
+      return EXIT_FAILURE;
+    }
 
-  /* Then lookup for all groups the user belong to */
-  groups = get_groups_for_user (user_for_subject);
-  for (ll = groups; ll != NULL; ll = ll->next)
+  /* polkitd runs the rules, and thus our client, as POLKITD_GROUP */
+  group = getgrnam (POLKITD_GROUP);
+  if (group == NULL)
+    g_debug ("No group `%s', not changing group of `%s'", POLKITD_GROUP, path);
+  else if (chown (path, (uid_t) -1, group->gr_gid) != 0)
+    g_warning ("Error changing group of `%s': %s", path, g_strerror (errno));
+
+  g_signal_connect (service, "run", G_CALLBACK (on_run), authority);
+  g_socket_service_start (service);
+  g_debug ("Serving requests on `%s' in %u threads", path, threads);
+
+  metrics_file.authority = authority;
+  metrics_file.path = metrics_path;
+  metrics_source_id = 0;
+  if (metrics_path != NULL)
     {
-      PolkitIdentity *group = POLKIT_IDENTITY (ll->data);
+      write_metrics_file (&metrics_file);
+      metrics_source_id = g_timeout_add_seconds (metrics_interval, on_metrics_timeout,
+                                                 &metrics_file);
+    }
 
-      update_ret_from_authorization_store (priv, &ret, group,
-					   subject_is_local, subject_is_active,
-					   action_id, details);
+  loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGINT, on_termination_signal, loop);
+  g_unix_signal_add (SIGTERM, on_termination_signal, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  if (metrics_source_id != 0)
+    {
+      g_source_remove (metrics_source_id);
+      write_metrics_file (&metrics_file);
     }
-  g_list_foreach (groups, (GFunc) g_object_unref, NULL);
-  g_list_free (groups);
 
-  /* Then do it for the user */
-  update_ret_from_authorization_store (priv, &ret, user_for_subject,
-				       subject_is_local, subject_is_active,
-				       action_id, details);
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+  g_object_unref (service);
+  g_unlink (path);
 
-  return ret;
-}
+  report_statistics (authority);
+  g_object_unref (authority);
 
-/* ---------------------------------------------------------------------------------------------------- */
+  return 0;
+}
 
-static GList *
-get_groups_for_user (PolkitIdentity *user)
+/* Returns %FALSE if the daemon could not be reached; the caller should then
+   evaluate the query itself. */
+static gboolean
+query_daemon (const gchar  *path,
+              const gchar  *request,
+              gchar       **out_reply)
 {
-  uid_t uid;
-  struct passwd *passwd;
-  GList *result;
-  gid_t groups[512];
-  int num_groups = 512;
-  int n;
-
-  result = NULL;
+  GSocketConnection *connection;
+  GDataInputStream *input;
+  GOutputStream *output;
+  gchar *reply;
+  GError *error;
 
-  /* TODO: it would be, uhm, good to cache this information */
+  reply = NULL;
 
-  uid = polkit_unix_user_get_uid (POLKIT_UNIX_USER (user));
-  passwd = getpwuid (uid);
-  if (passwd == NULL)
+  error = NULL;
+  connection = connect_to_daemon (path, &error);
+  if (connection == NULL)
     {
-      g_warning ("No user with uid %d", uid);
-      goto out;
+      g_debug ("Not using daemon at `%s': %s", path, error->message);
+      g_error_free (error);
+      return FALSE;
     }
 
-  /* TODO: should resize etc etc etc */
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  if (!g_output_stream_write_all (output, request, strlen (request), NULL, NULL, &error))
+    goto out;
+  reply = g_data_input_stream_read_line (input, NULL, NULL, &error);
 
-  if (getgrouplist (passwd->pw_name,
-                    passwd->pw_gid,
-                    groups,
-                    &num_groups) < 0)
+ out:
+  if (error != NULL)
     {
-      g_warning ("Error looking up groups for uid %d: %s", uid, g_strerror (errno));
-      goto out;
+      g_debug ("Error talking to daemon at `%s': %s", path, error->message);
+      g_error_free (error);
     }
+  g_object_unref (input);
+  g_object_unref (connection);
 
-  for (n = 0; n < num_groups; n++)
-    result = g_list_prepend (result, polkit_unix_group_new (groups[n]));
-
- out:
-
-  return result;
+  if (reply == NULL)
+    return FALSE;
+  *out_reply = reply;
+  return TRUE;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static gboolean
-parse_boolean (const char *arg, GError **error)
+static void
+print_shadowed (const gchar *id,
+                const gchar *shadowed_by_id,
+                gpointer     user_data)
 {
-  if (strcmp (arg, "true") == 0)
-    return TRUE;
-  if (strcmp (arg, "false") == 0)
-    return FALSE;
-  g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
-	       _("Invalid boolean value"));
-  return FALSE;
+  printf ("%s: shadowed by %s\n", id, shadowed_by_id);
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
+
 static gchar *auth_paths; /* = NULL; */
+static gboolean opt_batch; /* = FALSE; */
+static gboolean opt_serve; /* = FALSE; */
+static gboolean opt_daemon_stats; /* = FALSE; */
+static gboolean opt_explain_shadowed; /* = FALSE; */
+static gint opt_group_cache_ttl = -1;
+static gint opt_group_lookup_timeout = -1;
+static gint opt_coalesce_timeout = -1;
+static gint opt_result_cache_size = -1;
+static gchar *socket_path; /* = NULL; */
+static gchar *opt_engine; /* = NULL; */
+static gchar *metrics_path; /* = NULL; */
+static gint opt_metrics_interval = -1;
+static gint opt_threads = -1;
 
 /* Use G_OPTION_ARG_FILENAME for all strings to avoid the conversion to
    UTF-8. */
@@ -356,6 +1007,63 @@ static const GOptionEntry opt_entries[] =
     { "paths", 'p', 0, G_OPTION_ARG_FILENAME, &auth_paths,
       N_("Use authorization 'top' directories in ;-separated PATH"), N_("PATH"),
     },
+    { "batch", 0, 0, G_OPTION_ARG_NONE, &opt_batch,
+      N_("Read queries from standard input, one per line"), NULL,
+    },
+    { "serve", 0, 0, G_OPTION_ARG_NONE, &opt_serve,
+      N_("Keep running and answer queries on a UNIX socket"), NULL,
+    },
+    { "snapshot", 0, 0, G_OPTION_ARG_FILENAME, &snapshot_path,
+      N_("Use snapshot PATH written by pkla-compile"), N_("PATH"),
+    },
+    { "socket", 0, 0, G_OPTION_ARG_FILENAME, &socket_path,
+      N_("Use daemon socket PATH"), N_("PATH"),
+    },
+    { "group-cache-ttl", 0, 0, G_OPTION_ARG_INT, &opt_group_cache_ttl,
+      N_("Cache group and netgroup memberships for SECONDS in batch and daemon mode"), N_("SECONDS"),
+    },
+    { "group-lookup-timeout", 0, 0, G_OPTION_ARG_INT, &opt_group_lookup_timeout,
+      N_("In daemon mode, wait MILLISECONDS for group lookups before using expired groups"),
+      N_("MILLISECONDS"),
+    },
+    { "coalesce-timeout", 0, 0, G_OPTION_ARG_INT, &opt_coalesce_timeout,
+      N_("In daemon mode, wait MILLISECONDS for further changes before reloading files"),
+      N_("MILLISECONDS"),
+    },
+    { "metrics-file", 0, 0, G_OPTION_ARG_FILENAME, &metrics_path,
+      N_("In daemon mode, write metrics for Prometheus to PATH"), N_("PATH"),
+    },
+    { "metrics-interval", 0, 0, G_OPTION_ARG_INT, &opt_metrics_interval,
+      N_("In daemon mode, update the metrics file every SECONDS"), N_("SECONDS"),
+    },
+    { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads,
+      N_("In daemon mode, serve up to NUMBER connections at the same time"), N_("NUMBER"),
+    },
+    { "load-threads", 0, 0, G_OPTION_ARG_INT, &opt_load_threads,
+      N_("Read authorization files in up to NUMBER threads"), N_("NUMBER"),
+    },
+    { "result-cache-size", 0, 0, G_OPTION_ARG_INT, &opt_result_cache_size,
+      N_("Remember up to NUMBER results in batch and daemon mode"), N_("NUMBER"),
+    },
+    { "engine", 0, 0, G_OPTION_ARG_STRING, &opt_engine,
+      N_("Evaluate authorization entries in \"forward\" or \"reverse\" (default) order"),
+      N_("ENGINE"),
+    },
+    { "decision-table", 0, 0, G_OPTION_ARG_NONE, &opt_decision_table,
+      N_("In batch and daemon mode, precompute the results of actions named in the files"), NULL,
+    },
+    { "daemon-stats", 0, 0, G_OPTION_ARG_NONE, &opt_daemon_stats,
+      N_("Print the counters of the running daemon"), NULL,
+    },
+    { "explain-shadowed", 0, 0, G_OPTION_ARG_NONE, &opt_explain_shadowed,
+      N_("List authorization entries that never change a result"), NULL,
+    },
+    { "trace", 0, 0, G_OPTION_ARG_NONE, &opt_trace,
+      N_("Write where the time of each query went to standard error"), NULL,
+    },
+    { "stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats,
+      N_("Write the counters to standard error when done"), NULL,
+    },
     { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
   };
 
@@ -364,11 +1072,14 @@ main (int argc, char *argv[])
 {
   GError *error;
   GOptionContext *opt_context;
-  PolkitBackendLocalAuthorityPrivate priv;
-  PolkitIdentity *user_for_subject = NULL;
-  gboolean subject_is_local, subject_is_active;
-  PolkitDetails *details;
+  PolkitBackendLocalAuthority *authority;
   PolkitImplicitAuthorization result;
+  gboolean use_daemon;
+  guint group_cache_ttl;
+  guint group_lookup_timeout;
+  guint coalesce_timeout;
+  guint result_cache_size;
+  int ret;
 
   g_type_init ();
 
@@ -388,7 +1099,93 @@ main (int argc, char *argv[])
       goto error;
     }
   g_option_context_free (opt_context);
-  if (argc != 5)
+  if ((opt_batch ? 1 : 0) + (opt_serve ? 1 : 0) + (opt_daemon_stats ? 1 : 0)
+      + (opt_explain_shadowed ? 1 : 0) > 1)
+    {
+      fprintf (stderr, _("%s: --batch, --serve, --daemon-stats and --explain-shadowed "
+			 "are mutually exclusive\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), g_get_prgname ());
+      goto error;
+    }
+  /* Clients using the default paths trust the daemon on the default
+     socket to use them as well */
+  if (opt_serve && socket_path == NULL && auth_paths != NULL
+      && strcmp (auth_paths, POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_PATHS) != 0)
+    {
+      fprintf (stderr, _("%s: --serve with non-default --paths requires --socket\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), g_get_prgname ());
+      goto error;
+    }
+  if (opt_group_cache_ttl < -1)
+    {
+      fprintf (stderr, _("%s: Invalid group cache TTL %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_group_cache_ttl, g_get_prgname ());
+      goto error;
+    }
+  if (opt_group_lookup_timeout < -1)
+    {
+      fprintf (stderr, _("%s: Invalid group lookup timeout %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_group_lookup_timeout, g_get_prgname ());
+      goto error;
+    }
+  if (opt_coalesce_timeout < -1)
+    {
+      fprintf (stderr, _("%s: Invalid coalesce timeout %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_coalesce_timeout, g_get_prgname ());
+      goto error;
+    }
+  if (opt_metrics_interval == 0 || opt_metrics_interval < -1)
+    {
+      fprintf (stderr, _("%s: Invalid metrics interval %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_metrics_interval, g_get_prgname ());
+      goto error;
+    }
+  if (opt_threads == 0 || opt_threads < -1)
+    {
+      fprintf (stderr, _("%s: Invalid number of threads %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_threads, g_get_prgname ());
+      goto error;
+    }
+  if (opt_load_threads < 0)
+    {
+      fprintf (stderr, _("%s: Invalid number of threads %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_load_threads, g_get_prgname ());
+      goto error;
+    }
+  if (opt_result_cache_size < -1)
+    {
+      fprintf (stderr, _("%s: Invalid result cache size %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_result_cache_size, g_get_prgname ());
+      goto error;
+    }
+  if (opt_engine != NULL)
+    {
+      if (strcmp (opt_engine, "forward") == 0)
+        reverse_evaluation = FALSE;
+      else if (strcmp (opt_engine, "reverse") != 0)
+        {
+          fprintf (stderr, _("%s: Invalid engine `%s'\n"
+                             "Run `%s --help' for more information.\n"),
+                   g_get_prgname (), opt_engine, g_get_prgname ());
+          g_free (opt_engine);
+          goto error;
+        }
+      g_free (opt_engine);
+    }
+  if (opt_result_cache_size >= 0)
+    result_cache_size = opt_result_cache_size;
+  else
+    result_cache_size = DEFAULT_RESULT_CACHE_SIZE;
+  if (argc != (opt_batch || opt_serve || opt_daemon_stats || opt_explain_shadowed ? 1 : 5))
     {
       fprintf (stderr, _("%s: unexpected number of arguments\n"
 			 "Run `%s --help' for more information.\n"),
@@ -396,64 +1193,178 @@ main (int argc, char *argv[])
       goto error;
     }
 
+  /* A daemon only knows about the default paths, unless told otherwise.
+     Traces and counters are only available when evaluating locally. */
+  use_daemon = (socket_path != NULL || auth_paths == NULL) && !opt_trace && !opt_stats;
+  if (socket_path == NULL)
+    socket_path = g_strdup (PACKAGE_LOCALSTATE_DIR "/run/pkla-check-authorization.socket");
   if (auth_paths == NULL)
-    auth_paths = g_strdup (PACKAGE_LOCALSTATE_DIR "/lib/polkit-1/localauthority;"
-			   PACKAGE_SYSCONF_DIR "/polkit-1/localauthority");
+    auth_paths = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_PATHS);
+  if (snapshot_path == NULL)
+    snapshot_path = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_SNAPSHOT);
   g_debug ("Using authorization directory paths `%s'", auth_paths);
 
-  memset (&priv, 0, sizeof (priv));
-  polkit_backend_local_authority_init (&priv);
-  /* "Local Authorization Store Paths",
-     "Semi-colon separated list of Authorization Store 'top' directories." */
-  polkit_backend_local_authority_set_auth_store_paths (&priv, auth_paths);
-  polkit_backend_local_authority_constructed (&priv);
+  if (opt_daemon_stats)
+    {
+      gchar *reply;
+      gchar **pairs;
+      guint n;
+
+      ret = EXIT_FAILURE;
+      if (!query_daemon (socket_path, STATS_REQUEST "\n", &reply))
+        fprintf (stderr, _("%s: Cannot reach the daemon at `%s'\n"),
+                 g_get_prgname (), socket_path);
+      else
+        {
+          if (strcmp (reply, "OK") != 0 && !g_str_has_prefix (reply, "OK "))
+            fprintf (stderr, _("%s: Unexpected reply from daemon\n"),
+                     g_get_prgname ());
+          else
+            {
+              pairs = g_strsplit (reply + 2, " ", 0);
+              for (n = 0; pairs[n] != NULL; n++)
+                {
+                  if (pairs[n][0] != '\0')
+                    printf ("%s\n", pairs[n]);
+                }
+              g_strfreev (pairs);
+              ret = 0;
+            }
+          g_free (reply);
+        }
+      g_free (auth_paths);
+      g_free (socket_path);
+      g_free (snapshot_path);
+      return ret;
+    }
 
-  user_for_subject = polkit_unix_user_new_for_name(argv[1], &error);
-  if (user_for_subject == NULL)
+  if (opt_explain_shadowed)
     {
-      fprintf (stderr, _("%s: Invalid user `%s': %s\n"), g_get_prgname(),
-	       argv[1], error->message);
-      g_error_free (error);
-      goto error_priv;
+      authority = new_authority (auth_paths);
+      polkit_backend_local_authority_foreach_shadowed (authority, print_shadowed, NULL);
+      g_object_unref (authority);
+      g_free (auth_paths);
+      g_free (socket_path);
+      g_free (snapshot_path);
+      return 0;
     }
-  subject_is_local = parse_boolean (argv[2], &error);
-  if (error != NULL)
+
+  if (opt_serve)
     {
-      fprintf (stderr, _("%s: Invalid boolean `%s': %s\n"), g_get_prgname(),
-	       argv[2], error->message);
-      g_error_free (error);
-      goto error_priv;
+      if (opt_group_cache_ttl >= 0)
+        group_cache_ttl = opt_group_cache_ttl;
+      else
+        group_cache_ttl = DEFAULT_GROUP_CACHE_TTL;
+      if (opt_group_lookup_timeout >= 0)
+        group_lookup_timeout = opt_group_lookup_timeout;
+      else
+        group_lookup_timeout = DEFAULT_GROUP_LOOKUP_TIMEOUT;
+      if (opt_coalesce_timeout >= 0)
+        coalesce_timeout = opt_coalesce_timeout;
+      else
+        coalesce_timeout = DEFAULT_COALESCE_TIMEOUT;
+      ret = serve (auth_paths, socket_path,
+                   opt_threads > 0 ? (guint) opt_threads : DEFAULT_THREADS,
+                   group_cache_ttl, group_lookup_timeout, coalesce_timeout,
+                   result_cache_size, metrics_path,
+                   opt_metrics_interval > 0 ? (guint) opt_metrics_interval
+                   : DEFAULT_METRICS_INTERVAL);
+      g_free (auth_paths);
+      g_free (socket_path);
+      g_free (snapshot_path);
+      g_free (metrics_path);
+      return ret;
     }
-  subject_is_active = parse_boolean(argv[3], &error);
-  if (error != NULL)
+
+  if (opt_batch)
     {
-      fprintf (stderr, _("%s: Invalid boolean `%s': %s\n"), g_get_prgname(),
-	       argv[3], error->message);
-      g_error_free (error);
-      goto error_priv;
+      authority = new_authority (auth_paths);
+      /* By default each user's groups are looked up only once per batch */
+      if (opt_group_cache_ttl >= 0)
+        group_cache_ttl = opt_group_cache_ttl;
+      else
+        group_cache_ttl = G_MAXUINT;
+      g_object_set (authority,
+                    "group-cache-ttl", group_cache_ttl,
+                    "netgroup-cache-ttl", group_cache_ttl,
+                    "result-cache-size", result_cache_size,
+                    "eliminate-shadowed", TRUE,
+                    "decision-table", opt_decision_table,
+                    NULL);
+      ret = run_batch (authority);
+      g_object_unref (authority);
+      g_free (auth_paths);
+      g_free (socket_path);
+      g_free (snapshot_path);
+      return ret;
     }
 
-  /* polkitlocalauthority used to be able to change details, but that is no
-     longer supported in the JS authority, and was not apparently used
-     anyway.  Just submit a dummy object. */
-  details = polkit_details_new ();
-  result = polkit_backend_local_authority_check_authorization_sync
-    (&priv, user_for_subject, subject_is_local, subject_is_active, argv[4],
-     details);
-  g_object_unref (details);
+  /* Arguments that would change the fields or lines of the request are
+     evaluated locally */
+  if (use_daemon && !arguments_fit_request (argv + 1, 4))
+    use_daemon = FALSE;
 
-  g_object_unref (user_for_subject);
-  polkit_backend_local_authority_finalize (&priv);
+  if (use_daemon)
+    {
+      gchar *request;
+      gchar *reply;
+      gboolean ok;
+
+      request = g_strdup_printf ("%s\t%s\t%s\t%s\n", argv[1], argv[2], argv[3], argv[4]);
+      ok = query_daemon (socket_path, request, &reply);
+      g_free (request);
+      if (ok)
+        {
+          ret = 0;
+          if (g_str_has_prefix (reply, "OK "))
+            printf ("%s\n", reply + 3);
+          else if (g_str_has_prefix (reply, "ERROR "))
+            {
+              fprintf (stderr, _("%s: %s\n"), g_get_prgname (), reply + 6);
+              ret = EXIT_FAILURE;
+            }
+          else if (strcmp (reply, "OK") != 0)
+            {
+              fprintf (stderr, _("%s: Unexpected reply from daemon\n"),
+                       g_get_prgname ());
+              ret = EXIT_FAILURE;
+            }
+          g_free (reply);
+          g_free (auth_paths);
+          g_free (socket_path);
+          g_free (snapshot_path);
+          return ret;
+        }
+    }
+
+  /* "Local Authorization Store Paths",
+     "Semi-colon separated list of Authorization Store 'top' directories." */
+  authority = new_authority (auth_paths);
+
+  if (!evaluate_query (authority, argv[1], argv[2], argv[3], argv[4],
+                       &result, &error))
+    {
+      fprintf (stderr, _("%s: %s\n"), g_get_prgname(), error->message);
+      g_error_free (error);
+      g_object_unref (authority);
+      goto error;
+    }
+
+  if (opt_stats)
+    report_statistics (authority);
+  g_object_unref (authority);
 
   if (result != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
     printf ("%s\n", polkit_implicit_authorization_to_string (result));
 
+  g_free (auth_paths);
+  g_free (socket_path);
+  g_free (snapshot_path);
   return 0;
 
- error_priv:
-  g_object_unref (user_for_subject);
-  polkit_backend_local_authority_finalize (&priv);
  error:
   g_free (auth_paths);
+  g_free (socket_path);
+  g_free (snapshot_path);
   return EXIT_FAILURE;
 }
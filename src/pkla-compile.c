@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <locale.h>
+#include <glib/gi18n.h>
+
+#include <polkit/polkit.h>
+#include "polkitbackendconfigsource.h"
+#include "polkitbackendlocalauthority.h"
+#include "polkitbackendsnapshot.h"
+
+/* Configuration files modified less than this many seconds before they were
+   read could be modified again without a change in the recorded state */
+#define CONFIG_SETTLE_SECONDS 2
+
+/* Reads the configuration files in @config_path, waiting for a few seconds
+   and reading them again if they were modified very recently */
+static GVariant *
+serialize_config (const gchar *config_path)
+{
+  GVariant *ret;
+  guint n;
+
+  ret = NULL;
+  for (n = 0; n < 2; n++)
+    {
+      PolkitBackendConfigSource *config_source;
+      GFile *config_directory;
+      GVariant *sources;
+      gint64 newest_mtime;
+      gint64 now;
+
+      if (ret != NULL)
+	g_variant_unref (ret);
+
+      config_directory = g_file_new_for_path (config_path);
+      config_source = polkit_backend_config_source_new (config_directory);
+      g_object_unref (config_directory);
+      ret = g_variant_ref_sink (polkit_backend_config_source_serialize (config_source));
+      g_object_unref (config_source);
+
+      sources = g_variant_get_child_value (ret, 1);
+      newest_mtime = polkit_backend_snapshot_sources_get_newest_mtime (sources);
+      g_variant_unref (sources);
+      now = g_get_real_time () / G_USEC_PER_SEC;
+      if (newest_mtime <= now - CONFIG_SETTLE_SECONDS)
+	break;
+
+      g_debug ("Configuration files were modified recently, reading them again");
+      /* Timestamps in the future are not worth waiting for */
+      g_usleep (MIN (newest_mtime + CONFIG_SETTLE_SECONDS + 1 - now,
+		     CONFIG_SETTLE_SECONDS + 1) * G_USEC_PER_SEC);
+    }
+
+  return ret;
+}
+
+static gchar *auth_paths; /* = NULL; */
+static gchar *config_path; /* = NULL; */
+static gchar *output_path; /* = NULL; */
+static gint opt_load_threads; /* = 0; */
+static gboolean opt_invalidate; /* = FALSE; */
+
+/* Use G_OPTION_ARG_FILENAME for all strings to avoid the conversion to
+   UTF-8. */
+static const GOptionEntry opt_entries[] =
+  {
+    { "paths", 'p', 0, G_OPTION_ARG_FILENAME, &auth_paths,
+      N_("Use authorization 'top' directories in ;-separated PATH"), N_("PATH"),
+    },
+    { "config-path", 'c', 0, G_OPTION_ARG_FILENAME, &config_path,
+      N_("Use configuration files in DIR"), N_("DIR"),
+    },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path,
+      N_("Write the snapshot to PATH"), N_("PATH"),
+    },
+    { "load-threads", 0, 0, G_OPTION_ARG_INT, &opt_load_threads,
+      N_("Read authorization files in up to NUMBER threads"), N_("NUMBER"),
+    },
+    { "invalidate", 0, 0, G_OPTION_ARG_NONE, &opt_invalidate,
+      N_("Only make the programs ignore the current snapshot"), NULL,
+    },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+  };
+
+int
+main (int argc, char *argv[])
+{
+  GError *error;
+  GOptionContext *opt_context;
+  guint64 generation;
+  int ret;
+
+  g_type_init ();
+
+  opt_context = g_option_context_new ("");
+  g_option_context_set_summary (opt_context,
+				N_("Writes a snapshot of pklocalauthority(8) "
+				   "authorization and configuration files."));
+  g_option_context_add_main_entries (opt_context, opt_entries, PACKAGE_NAME);
+  error = NULL;
+  if (!g_option_context_parse (opt_context, &argc, &argv, &error))
+    {
+      fprintf (stderr, _("%s: %s\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), error->message, g_get_prgname ());
+      g_error_free (error);
+      g_option_context_free (opt_context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (opt_context);
+  if (argc != 1)
+    {
+      fprintf (stderr, _("%s: unexpected argument\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+  if (opt_load_threads < 0)
+    {
+      fprintf (stderr, _("%s: Invalid number of threads %d\n"
+			 "Run `%s --help' for more information.\n"),
+	       g_get_prgname (), opt_load_threads, g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+
+  if (auth_paths == NULL)
+    auth_paths = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_PATHS);
+  if (config_path == NULL)
+    config_path = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_CONFIG_PATH);
+  if (output_path == NULL)
+    output_path = g_strdup (POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_SNAPSHOT);
+  g_debug ("Using authorization directory paths `%s'", auth_paths);
+
+  ret = 0;
+  /* Programs ignore the old snapshot while the files are read */
+  generation = polkit_backend_snapshot_invalidate (output_path, &error);
+  if (generation == 0)
+    {
+      fprintf (stderr, _("%s: Error invalidating `%s': %s\n"), g_get_prgname (),
+	       output_path, error->message);
+      g_error_free (error);
+      ret = EXIT_FAILURE;
+    }
+  else if (!opt_invalidate)
+    {
+      GVariantBuilder sections_builder;
+      PolkitBackendLocalAuthority *authority;
+      GVariant *value;
+
+      g_variant_builder_init (&sections_builder, G_VARIANT_TYPE ("a{sv}"));
+
+      authority = polkit_backend_local_authority_new (auth_paths);
+      g_object_set (authority, "load-threads", (guint) opt_load_threads, NULL);
+      value = polkit_backend_local_authority_serialize (authority);
+      g_variant_builder_add (&sections_builder, "{sv}",
+			     POLKIT_BACKEND_SNAPSHOT_SECTION_AUTHORITY, value);
+      g_variant_unref (value);
+      g_object_unref (authority);
+
+      /* Not every system has configuration files */
+      if (g_file_test (config_path, G_FILE_TEST_IS_DIR))
+	{
+	  g_debug ("Using config directory `%s'", config_path);
+	  value = serialize_config (config_path);
+	  g_variant_builder_add (&sections_builder, "{sv}",
+				 POLKIT_BACKEND_SNAPSHOT_SECTION_CONFIG, value);
+	  g_variant_unref (value);
+	}
+
+      if (!polkit_backend_snapshot_save_sections (output_path, generation,
+						  g_variant_builder_end (&sections_builder),
+						  &error))
+	{
+	  fprintf (stderr, _("%s: Error writing `%s': %s\n"), g_get_prgname (),
+		   output_path, error->message);
+	  g_error_free (error);
+	  ret = EXIT_FAILURE;
+	}
+    }
+
+  g_free (auth_paths);
+  g_free (config_path);
+  g_free (output_path);
+  return ret;
+}
@@ -23,6 +23,7 @@
 
 #include <polkit/polkit.h>
 #include "polkitbackendconfigsource.h"
+#include "polkitbackendsnapshot.h"
 
 /* <internal>
  * SECTION:polkitbackendconfigsource
@@ -32,6 +33,11 @@
  * The #PolkitBackendConfigSource class is a utility class to read
  * configuration data from a set of prioritized key-value files in a
  * given directory.
+ *
+ * The values of all files are merged into one index when the files are
+ * read, so that each lookup is a hash table lookup no matter how many
+ * files there are.  The index can be serialized, see
+ * polkit_backend_config_source_serialize().
  */
 
 struct _PolkitBackendConfigSourcePrivate
@@ -40,8 +46,23 @@ struct _PolkitBackendConfigSourcePrivate
 
   GFileMonitor *directory_monitor;
 
-  /* sorted according to priority, higher priority is first */
-  GList *key_files;
+  /* Milliseconds to collect change notifications for before handling them
+     all at once, 0 to handle each one immediately */
+  guint coalesce_timeout;
+  guint coalesce_source_id;
+  /* Monotonic time of the first pending notification, in microseconds */
+  gint64 coalesce_started;
+  guint pending_events;
+  guint64 change_events;
+  guint64 reloads;
+
+  /* The values of all files, with those of files of higher priority
+   replacing the others; NULL until read */
+  GKeyFile *values;
+
+  /* Snapshot source records of the directory and of each file, in the
+     order they were read */
+  GPtrArray *sources;
 
   gboolean has_data;
 };
@@ -50,8 +71,13 @@ enum
 {
   PROP_0,
   PROP_DIRECTORY,
+  PROP_COALESCE_TIMEOUT,
 };
 
+/* A burst of change notifications is handled at the latest after this many
+   coalescing timeouts */
+#define MAX_COALESCE_TIMEOUTS 10
+
 enum
 {
   CHANGED_SIGNAL,
@@ -74,6 +100,7 @@ polkit_backend_config_source_init (PolkitBackendConfigSource *source)
   source->priv = G_TYPE_INSTANCE_GET_PRIVATE (source,
                                               POLKIT_BACKEND_TYPE_CONFIG_SOURCE,
                                               PolkitBackendConfigSourcePrivate);
+  source->priv->sources = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
 }
 
 static void
@@ -87,8 +114,12 @@ polkit_backend_config_source_finalize (GObject *object)
   if (source->priv->directory_monitor != NULL)
     g_object_unref (source->priv->directory_monitor);
 
-  g_list_foreach (source->priv->key_files, (GFunc) g_key_file_free, NULL);
-  g_list_free (source->priv->key_files);
+  if (source->priv->coalesce_source_id != 0)
+    g_source_remove (source->priv->coalesce_source_id);
+
+  if (source->priv->values != NULL)
+    g_key_file_free (source->priv->values);
+  g_ptr_array_unref (source->priv->sources);
 
   if (G_OBJECT_CLASS (polkit_backend_config_source_parent_class)->finalize != NULL)
     G_OBJECT_CLASS (polkit_backend_config_source_parent_class)->finalize (object);
@@ -109,6 +140,10 @@ polkit_backend_config_source_get_property (GObject    *object,
       g_value_set_object (value, source->priv->directory);
       break;
 
+    case PROP_COALESCE_TIMEOUT:
+      g_value_set_uint (value, source->priv->coalesce_timeout);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -129,12 +164,67 @@ polkit_backend_config_source_set_property (GObject      *object,
       source->priv->directory = g_value_dup_object (value);
       break;
 
+    case PROP_COALESCE_TIMEOUT:
+      source->priv->coalesce_timeout = g_value_get_uint (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+/* Handles all change notifications received since the last call */
+static void
+handle_pending_changes (PolkitBackendConfigSource *source)
+{
+  g_debug ("Handled %u change notifications for configuration files",
+           source->priv->pending_events);
+
+  source->priv->reloads++;
+  source->priv->pending_events = 0;
+
+  /* now throw away all caches */
+  polkit_backend_config_source_purge (source);
+  g_signal_emit_by_name (source, "changed");
+}
+
+static gboolean
+on_coalesce_timeout (gpointer user_data)
+{
+  PolkitBackendConfigSource *source = POLKIT_BACKEND_CONFIG_SOURCE (user_data);
+
+  source->priv->coalesce_source_id = 0;
+  handle_pending_changes (source);
+
+  return FALSE;
+}
+
+/* Waits until no notification arrived for the coalescing timeout, or until
+   MAX_COALESCE_TIMEOUTS have passed since the first one */
+static void
+schedule_pending_changes (PolkitBackendConfigSource *source)
+{
+  PolkitBackendConfigSourcePrivate *priv = source->priv;
+  gint64 now;
+  gint64 deadline;
+  guint delay;
+
+  now = g_get_monotonic_time ();
+  if (priv->coalesce_source_id == 0)
+    priv->coalesce_started = now;
+  else
+    g_source_remove (priv->coalesce_source_id);
+
+  deadline = priv->coalesce_started
+    + (gint64) priv->coalesce_timeout * MAX_COALESCE_TIMEOUTS * (G_USEC_PER_SEC / 1000);
+  delay = priv->coalesce_timeout;
+  if (now + (gint64) delay * (G_USEC_PER_SEC / 1000) > deadline)
+    delay = deadline > now ? (deadline - now) / (G_USEC_PER_SEC / 1000) : 0;
+
+  priv->coalesce_source_id = g_timeout_add (delay, on_coalesce_timeout, source);
+}
+
 static void
 directory_monitor_changed (GFileMonitor     *monitor,
                            GFile            *file,
@@ -164,9 +254,12 @@ directory_monitor_changed (GFileMonitor     *monitor,
 
           //g_debug ("match");
 
-          /* now throw away all caches */
-          polkit_backend_config_source_purge (source);
-          g_signal_emit_by_name (source, "changed");
+          source->priv->pending_events++;
+          source->priv->change_events++;
+          if (source->priv->coalesce_timeout == 0)
+            handle_pending_changes (source);
+          else
+            schedule_pending_changes (source);
         }
 
       g_free (name);
@@ -235,6 +328,26 @@ polkit_backend_config_source_class_init (PolkitBackendConfigSourceClass *klass)
                                                         G_PARAM_STATIC_BLURB |
                                                         G_PARAM_STATIC_NICK));
 
+  /**
+   * PolkitBackendConfigSource:coalesce-timeout:
+   *
+   * Number of milliseconds to wait for further change notifications
+   * before dropping the configuration read so far, or 0 to drop it as
+   * soon as a file changes.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_COALESCE_TIMEOUT,
+                                   g_param_spec_uint ("coalesce-timeout",
+                                                      "Coalesce Timeout",
+                                                      "Milliseconds to collect change notifications for",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
   /**
    * PolkitBackendConfiguSource::changed:
    * @source: A #PolkitBackendConfigSource.
@@ -275,12 +388,37 @@ polkit_backend_config_source_new (GFile *directory)
   return source;
 }
 
+/**
+ * polkit_backend_config_source_get_reload_stats:
+ * @source: A #PolkitBackendConfigSource.
+ * @out_change_events: (allow-none): Return location for the number of
+ *     change notifications received for configuration files.
+ * @out_reloads: (allow-none): Return location for the number of times
+ *     these notifications were handled, see
+ *     #PolkitBackendConfigSource:coalesce-timeout.
+ *
+ * Gets statistics about the reloads of @source.
+ */
+void
+polkit_backend_config_source_get_reload_stats (PolkitBackendConfigSource *source,
+                                               guint64                   *out_change_events,
+                                               guint64                   *out_reloads)
+{
+  g_return_if_fail (POLKIT_BACKEND_IS_CONFIG_SOURCE (source));
+
+  if (out_change_events != NULL)
+    *out_change_events = source->priv->change_events;
+  if (out_reloads != NULL)
+    *out_reloads = source->priv->reloads;
+}
+
 static void
 polkit_backend_config_source_purge (PolkitBackendConfigSource *source)
 {
-  g_list_foreach (source->priv->key_files, (GFunc) g_key_file_free, NULL);
-  g_list_free (source->priv->key_files);
-  source->priv->key_files = NULL;
+  if (source->priv->values != NULL)
+    g_key_file_free (source->priv->values);
+  source->priv->values = NULL;
+  g_ptr_array_set_size (source->priv->sources, 0);
 
   source->priv->has_data = FALSE;
 }
@@ -301,6 +439,38 @@ compare_filename (GFile *a, GFile *b)
   return ret;
 }
 
+/* Adds the values of @key_file that are not in @values yet */
+static void
+merge_key_file (GKeyFile *values,
+                GKeyFile *key_file)
+{
+  gchar **groups;
+  guint n, m;
+
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (n = 0; groups[n] != NULL; n++)
+    {
+      gchar **keys;
+
+      keys = g_key_file_get_keys (key_file, groups[n], NULL, NULL);
+      for (m = 0; keys != NULL && keys[m] != NULL; m++)
+        {
+          gchar *value;
+
+          if (g_key_file_has_key (values, groups[n], keys[m], NULL))
+            continue;
+
+          /* Raw values, so that the getters parse them like before */
+          value = g_key_file_get_value (key_file, groups[n], keys[m], NULL);
+          if (value != NULL)
+            g_key_file_set_value (values, groups[n], keys[m], value);
+          g_free (value);
+        }
+      g_strfreev (keys);
+    }
+  g_strfreev (groups);
+}
+
 static void
 polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
 {
@@ -309,6 +479,7 @@ polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
   GError *error;
   GList *files;
   GList *l;
+  gchar *directory_path;
 
   files = NULL;
 
@@ -316,6 +487,12 @@ polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
     goto out;
 
   polkit_backend_config_source_purge (source);
+  source->priv->values = g_key_file_new ();
+
+  directory_path = g_file_get_path (source->priv->directory);
+  g_ptr_array_add (source->priv->sources,
+                   g_variant_ref_sink (polkit_backend_snapshot_source_new (directory_path)));
+  g_free (directory_path);
 
   error = NULL;
   enumerator = g_file_enumerate_children (source->priv->directory,
@@ -363,6 +540,8 @@ polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
       GKeyFile *key_file;
 
       filename = g_file_get_path (file);
+      g_ptr_array_add (source->priv->sources,
+                       g_variant_ref_sink (polkit_backend_snapshot_source_new (filename)));
 
       key_file = g_key_file_new ();
 
@@ -375,17 +554,16 @@ polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
           g_warning ("Error loading key-file %s: %s", filename, error->message);
           g_error_free (error);
           error = NULL;
-          g_key_file_free (key_file);
         }
       else
         {
-          source->priv->key_files = g_list_prepend (source->priv->key_files, key_file);
+          merge_key_file (source->priv->values, key_file);
         }
+      g_key_file_free (key_file);
 
       g_free (filename);
     }
 
-  source->priv->key_files = g_list_reverse (source->priv->key_files);
   source->priv->has_data = TRUE;
 
  out:
@@ -393,37 +571,164 @@ polkit_backend_config_source_ensure (PolkitBackendConfigSource *source)
   g_list_free (files);
 }
 
+/* Returns the merged values if they contain @key in @group */
 static GKeyFile *
 find_key_file (PolkitBackendConfigSource  *source,
                const gchar                *group,
                const gchar                *key,
                GError                    **error)
 {
-  GList *l;
   GKeyFile *ret;
 
   ret = NULL;
+  if (source->priv->values != NULL
+      && g_key_file_has_key (source->priv->values, group, key, NULL))
+    ret = source->priv->values;
+
+  if (ret == NULL)
+    g_set_error_literal (error,
+                         G_KEY_FILE_ERROR,
+                         G_KEY_FILE_ERROR_NOT_FOUND,
+                         "Group/Key combo not found in any config file");
+  return ret;
+}
+
+/**
+ * polkit_backend_config_source_get_sources:
+ * @source: A #PolkitBackendConfigSource.
+ *
+ * Reads the configuration files if necessary, and gets the state of the
+ * directory and of each file when it was read.  The values returned by
+ * @source stay valid while polkit_backend_snapshot_sources_are_fresh()
+ * returns %TRUE for the result.
+ *
+ * Returns: A floating #GVariant array of source file records, see
+ *     %POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING.
+ */
+GVariant *
+polkit_backend_config_source_get_sources (PolkitBackendConfigSource *source)
+{
+  g_return_val_if_fail (POLKIT_BACKEND_IS_CONFIG_SOURCE (source), NULL);
+
+  polkit_backend_config_source_ensure (source);
+
+  return g_variant_new_array (G_VARIANT_TYPE (POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING),
+                              (GVariant * const *) source->priv->sources->pdata,
+                              source->priv->sources->len);
+}
+
+/**
+ * polkit_backend_config_source_serialize:
+ * @source: A #PolkitBackendConfigSource.
+ *
+ * Reads the configuration files if necessary, and serializes the merged
+ * values together with the snapshot source records of the directory and
+ * the files they were read from.
+ *
+ * Returns: A floating #GVariant of type
+ *     %POLKIT_BACKEND_CONFIG_SOURCE_SERIALIZED_TYPE_STRING.
+ */
+GVariant *
+polkit_backend_config_source_serialize (PolkitBackendConfigSource *source)
+{
+  GVariantBuilder groups_builder;
+  gchar **groups;
+  gchar *path;
+  GVariant *ret;
+  guint n, m;
 
-  for (l = source->priv->key_files; l != NULL; l = l->next)
+  g_return_val_if_fail (POLKIT_BACKEND_IS_CONFIG_SOURCE (source), NULL);
+
+  polkit_backend_config_source_ensure (source);
+
+  g_variant_builder_init (&groups_builder, G_VARIANT_TYPE ("a{sa{ss}}"));
+  groups = g_key_file_get_groups (source->priv->values, NULL);
+  for (n = 0; groups[n] != NULL; n++)
     {
-      GKeyFile *key_file = l->data;
+      gchar **keys;
 
-      if (g_key_file_has_key (key_file, group, key, NULL))
+      g_variant_builder_open (&groups_builder, G_VARIANT_TYPE ("{sa{ss}}"));
+      g_variant_builder_add (&groups_builder, "s", groups[n]);
+      g_variant_builder_open (&groups_builder, G_VARIANT_TYPE ("a{ss}"));
+      keys = g_key_file_get_keys (source->priv->values, groups[n], NULL, NULL);
+      for (m = 0; keys != NULL && keys[m] != NULL; m++)
         {
-          ret = key_file;
-          goto out;
+          gchar *value;
+
+          value = g_key_file_get_value (source->priv->values, groups[n], keys[m], NULL);
+          g_variant_builder_add (&groups_builder, "{ss}", keys[m], value != NULL ? value : "");
+          g_free (value);
         }
+      g_strfreev (keys);
+      g_variant_builder_close (&groups_builder);
+      g_variant_builder_close (&groups_builder);
     }
+  g_strfreev (groups);
+
+  path = g_file_get_path (source->priv->directory);
+  ret = g_variant_new ("(s@a(sxutt)a{sa{ss}})",
+                       path,
+                       polkit_backend_config_source_get_sources (source),
+                       &groups_builder);
+  g_free (path);
 
- out:
-  if (ret == NULL)
-    g_set_error_literal (error,
-                         G_KEY_FILE_ERROR,
-                         G_KEY_FILE_ERROR_NOT_FOUND,
-                         "Group/Key combo not found in any config file");
   return ret;
 }
 
+/**
+ * polkit_backend_config_source_new_from_serialized:
+ * @value: A #GVariant returned by polkit_backend_config_source_serialize().
+ *
+ * Creates a new #PolkitBackendConfigSource object like
+ * polkit_backend_config_source_new(), but uses the values in @value
+ * instead of reading the directory.  The caller is responsible for
+ * checking that @value is still up to date, for example with
+ * polkit_backend_snapshot_sources_are_fresh() on the result of
+ * polkit_backend_config_source_get_sources().  Changes to the directory
+ * are handled as usual.
+ *
+ * Returns: A #PolkitBackendConfigSource. Free with g_object_unref().
+ **/
+PolkitBackendConfigSource *
+polkit_backend_config_source_new_from_serialized (GVariant *value)
+{
+  PolkitBackendConfigSource *source;
+  const gchar *path;
+  GFile *directory;
+  GVariantIter *sources_iter;
+  GVariantIter *groups_iter;
+  GVariantIter *keys_iter;
+  GVariant *record;
+  const gchar *group;
+
+  g_return_val_if_fail (g_variant_is_of_type (value, G_VARIANT_TYPE (POLKIT_BACKEND_CONFIG_SOURCE_SERIALIZED_TYPE_STRING)), NULL);
+
+  g_variant_get (value, "(&sa(sxutt)a{sa{ss}})", &path, &sources_iter, &groups_iter);
+  directory = g_file_new_for_path (path);
+  source = polkit_backend_config_source_new (directory);
+  g_object_unref (directory);
+
+  while ((record = g_variant_iter_next_value (sources_iter)) != NULL)
+    g_ptr_array_add (source->priv->sources, record);
+
+  source->priv->values = g_key_file_new ();
+  while (g_variant_iter_next (groups_iter, "{&sa{ss}}", &group, &keys_iter))
+    {
+      const gchar *key;
+      const gchar *val;
+
+      while (g_variant_iter_next (keys_iter, "{&s&s}", &key, &val))
+        g_key_file_set_value (source->priv->values, group, key, val);
+      g_variant_iter_free (keys_iter);
+    }
+  source->priv->has_data = TRUE;
+
+  g_variant_iter_free (groups_iter);
+  g_variant_iter_free (sources_iter);
+
+  return source;
+}
+
 /**
  * polkit_backend_config_source_get_integer:
  * @source: A PolkitBackendConfigSource.
@@ -27,6 +27,9 @@
 
 G_BEGIN_DECLS
 
+/* Directory, snapshot source records, merged raw values of each group */
+#define POLKIT_BACKEND_CONFIG_SOURCE_SERIALIZED_TYPE_STRING "(sa(sxutt)a{sa{ss}})"
+
 #define POLKIT_BACKEND_TYPE_CONFIG_SOURCE         (polkit_backend_config_source_get_type ())
 #define POLKIT_BACKEND_CONFIG_SOURCE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), POLKIT_BACKEND_TYPE_CONFIG_SOURCE, PolkitBackendConfigSource))
 #define POLKIT_BACKEND_CONFIG_SOURCE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), POLKIT_BACKEND_TYPE_CONFIG_SOURCE, PolkitBackendConfigSourceClass))
@@ -66,6 +69,12 @@ struct _PolkitBackendConfigSourceClass
 
 GType                      polkit_backend_config_source_get_type        (void) G_GNUC_CONST;
 PolkitBackendConfigSource *polkit_backend_config_source_new             (GFile                      *directory);
+void                       polkit_backend_config_source_get_reload_stats (PolkitBackendConfigSource *source,
+                                                                          guint64                   *out_change_events,
+                                                                          guint64                   *out_reloads);
+GVariant                  *polkit_backend_config_source_get_sources     (PolkitBackendConfigSource  *source);
+GVariant                  *polkit_backend_config_source_serialize       (PolkitBackendConfigSource  *source);
+PolkitBackendConfigSource *polkit_backend_config_source_new_from_serialized (GVariant               *value);
 gint                       polkit_backend_config_source_get_integer     (PolkitBackendConfigSource  *source,
                                                                          const gchar                *group,
                                                                          const gchar                *key,
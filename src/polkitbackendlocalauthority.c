@@ -0,0 +1,3253 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <string.h>
+
+#include <polkit/polkit.h>
+#include "polkitbackendlocalauthority.h"
+#include "polkitbackendlocalauthorizationstore.h"
+#include "polkitbackendnetgroupcache.h"
+#include "polkitbackendsnapshot.h"
+
+/* <internal>
+ * SECTION:polkitbackendlocalauthority
+ * @title: PolkitBackendLocalAuthority
+ * @short_description: Evaluates authorization files
+ *
+ * #PolkitBackendLocalAuthority answers authorization questions using
+ * the #PolkitBackendLocalAuthorizationStore instances found in a set
+ * of authorization store 'top' directories.
+ *
+ * Checks may run in several threads at once.  Each check uses the rules
+ * of all stores as they were when it started, see
+ * polkit_backend_local_authorization_store_get_rules().  Changes of the
+ * stores are handled in the thread that created the authority, and build
+ * new rules for the checks started afterwards, without waiting for the
+ * checks in progress.  Properties should also be set in that thread.
+ */
+
+/* Authorization store paths, snapshot source records for the 'top'
+   directories, serialized authorization stores */
+#define SNAPSHOT_TYPE_STRING                                            \
+  "(asa" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING                     \
+  "a" POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING ")"
+
+/* Initial number of entries in the getgrouplist() buffer */
+#define INITIAL_GID_BUFFER_SIZE 64
+
+/* Maximum number of threads running group lookups that checks may stop
+   waiting for */
+#define MAX_GROUP_LOOKUP_THREADS 8
+
+static GPtrArray *get_groups_for_user (PolkitBackendLocalAuthority *authority,
+                                       PolkitIdentity              *user,
+                                       gint64                      *out_expires_at);
+static void invalidate_cached_results (PolkitBackendLocalAuthority          *authority,
+                                       PolkitBackendLocalAuthorizationRules *changes);
+
+typedef struct _DecisionTable DecisionTable;
+
+/* The rules of all stores at one point in time, in order of precedence */
+typedef struct
+{
+  volatile gint ref_count;
+  guint n_rules;
+  PolkitBackendLocalAuthorizationRules **rules;
+  /* Set once by the decision table pool, with lock held, if enabled */
+  DecisionTable *decision_table;
+} RuleSet;
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Upper bounds of the check time histogram, in microseconds */
+static const gint64 check_time_bounds[] =
+  {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000
+  };
+
+#define N_CHECK_TIME_BUCKETS G_N_ELEMENTS (check_time_bounds)
+
+struct _PolkitBackendLocalAuthorityPrivate
+{
+  /* Held while the list of stores is changed or used, except by checks,
+     which only use the rule set.  May be held when taking lock, not the
+     other way round. */
+  GMutex *update_lock;
+  /* Held for the caches, counters and rule set, and the properties read by
+     checks */
+  GMutex *lock;
+
+  gchar **authorization_store_paths;
+  GList *authorization_stores;
+  GList *directory_monitors;
+
+  /* The rules checks use, NULL until the first check.  Replaced with both
+     locks held, so holding either is enough to read it. */
+  RuleSet *rule_set;
+
+  /* Snapshot source records for the 'top' directories */
+  GPtrArray *toplevel_sources;
+
+  /* Only set during construction */
+  GVariant *snapshot;
+
+  /* Seconds group memberships are cached for, 0 to disable the cache */
+  guint group_cache_ttl;
+  /* uid => GroupCacheEntry */
+  GHashTable *groups_by_uid;
+  /* Shared by all stores */
+  PolkitBackendNetgroupCache *netgroup_cache;
+
+  /* Monitors for nss_files, only created if a cache is enabled */
+  GList *nss_file_monitors;
+  guint64 group_cache_hits;
+  guint64 group_cache_misses;
+
+  /* Milliseconds a check waits for the groups of a user before using
+     expired ones, 0 to always wait */
+  guint group_lookup_timeout;
+  /* uid => GroupLookup, for lookups in progress */
+  GHashTable *group_lookups;
+  /* Broadcast with lock held whenever a lookup finishes */
+  GCond *group_lookup_cond;
+  /* Runs lookups that checks may stop waiting for, created on demand */
+  GThreadPool *group_lookup_pool;
+  /* Checks that waited for the lookup of another check */
+  guint64 group_lookups_coalesced;
+  /* Checks that used expired groups because the lookup took too long */
+  guint64 group_lookup_timeouts;
+
+  /* Initial size of getgrouplist() buffers, grown as needed; accessed
+     atomically */
+  volatile gint gid_buffer_size;
+  /* gid => PolkitUnixGroup */
+  GHashTable *unix_groups;
+
+  /* Applied to every authorization store */
+  guint coalesce_timeout;
+  /* Reload statistics of stores that have been purged */
+  guint64 store_change_events;
+  /* Times a rule set with different entries replaced the old one */
+  guint64 rule_set_reloads;
+
+  /* Maximum number of cached results, 0 to disable the cache */
+  guint result_cache_size;
+  /* ResultCacheEntry => itself */
+  GHashTable *results;
+  /* ResultCacheEntry objects, most recently used first */
+  GQueue *results_lru;
+  /* Incremented whenever cached results may have become wrong */
+  /* Checks record it together with the rule set they use */
+  guint64 result_generation;
+  guint64 result_cache_hits;
+  guint64 result_cache_misses;
+  /* Results kept and dropped when the stores changed */
+  guint64 result_cache_kept;
+  guint64 result_cache_invalidated;
+
+  /* Number of threads to read new stores in, 0 to let each store read its
+     files on its first lookup */
+  guint load_threads;
+  /* Whether stores have been added since they were last read in threads */
+  gboolean stores_need_load;
+
+  /* Whether shadowed authorization entries are left out of lookups */
+  gboolean eliminate_shadowed;
+  /* Whether that was done since the stores last changed */
+  gboolean shadowed_eliminated;
+  /* Number of entries left out */
+  guint n_shadowed;
+
+  /* Whether checks without details search backwards from the entries
+     taking precedence, see evaluate_reverse() */
+  gboolean reverse_evaluation;
+
+  /* Whether rule sets are tabulated for checks without details, see
+     decision_table_new() */
+  gboolean decision_table;
+  /* Builds the tables one at a time, created on demand */
+  GThreadPool *decision_table_pool;
+  guint64 decision_table_builds;
+  gint64 decision_table_build_time;
+  guint64 decision_table_hits;
+
+  /* Timing counters, in microseconds */
+  guint64 checks;
+  gint64 check_time;
+  gint64 groups_time;
+  /* Checks that took at most check_time_bounds[n] */
+  guint64 check_time_buckets[N_CHECK_TIME_BUCKETS];
+  /* Lookup statistics of stores that have been purged */
+  gint64 store_load_time;
+  guint64 store_entries_scanned;
+  guint64 store_entries_matched;
+};
+
+enum
+{
+  PROP_0,
+  PROP_AUTH_STORE_PATHS,
+  PROP_SNAPSHOT,
+  PROP_GROUP_CACHE_TTL,
+  PROP_GROUP_LOOKUP_TIMEOUT,
+  PROP_NETGROUP_CACHE_TTL,
+  PROP_COALESCE_TIMEOUT,
+  PROP_RESULT_CACHE_SIZE,
+  PROP_LOAD_THREADS,
+  PROP_ELIMINATE_SHADOWED,
+  PROP_REVERSE_EVALUATION,
+  PROP_DECISION_TABLE,
+};
+
+enum
+{
+  CHANGED_SIGNAL,
+  LAST_SIGNAL,
+};
+
+static guint signals[LAST_SIGNAL] = {0};
+
+/* Files whose changes invalidate the group and netgroup caches.  Other NSS
+   sources such as LDAP cannot be watched, which is what the cache TTLs are
+   for. */
+static const gchar *nss_files[] =
+  {
+    "/etc/passwd",
+    "/etc/group",
+    "/etc/netgroup",
+    NULL
+  };
+
+static void on_store_changed (PolkitBackendLocalAuthorizationStore *store,
+                              gpointer                              user_data);
+
+G_DEFINE_TYPE (PolkitBackendLocalAuthority, polkit_backend_local_authority, G_TYPE_OBJECT);
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Called with the update lock held, except when constructing or finalizing
+   the authority */
+static void
+purge_all_authorization_stores (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GList *l;
+
+  for (l = priv->authorization_stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+      guint64 change_events;
+      guint64 entries_scanned, entries_matched;
+      gint64 load_time;
+
+      polkit_backend_local_authorization_store_get_reload_stats (store, &change_events, NULL,
+                                                                 NULL);
+      priv->store_change_events += change_events;
+      polkit_backend_local_authorization_store_get_lookup_stats (store, &load_time,
+                                                                 &entries_scanned,
+                                                                 &entries_matched);
+      priv->store_load_time += load_time;
+      priv->store_entries_scanned += entries_scanned;
+      priv->store_entries_matched += entries_matched;
+
+      g_signal_handlers_disconnect_by_func (store,
+                                            G_CALLBACK (on_store_changed),
+                                            authority);
+      g_object_unref (store);
+    }
+  g_list_free (priv->authorization_stores);
+  priv->authorization_stores = NULL;
+  g_mutex_lock (priv->lock);
+  priv->result_generation++;
+  g_mutex_unlock (priv->lock);
+  priv->shadowed_eliminated = FALSE;
+  priv->n_shadowed = 0;
+
+  g_debug ("Purged all local authorization stores");
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+add_one_authorization_store (PolkitBackendLocalAuthority *authority,
+                             GFile                       *directory)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  PolkitBackendLocalAuthorizationStore *store;
+
+  store = polkit_backend_local_authorization_store_new (directory, ".pkla");
+  g_object_set (store, "coalesce-timeout", priv->coalesce_timeout, NULL);
+  priv->authorization_stores = g_list_append (priv->authorization_stores, store);
+  priv->stores_need_load = TRUE;
+  priv->shadowed_eliminated = FALSE;
+
+  g_signal_connect (store,
+                    "changed",
+                    G_CALLBACK (on_store_changed),
+                    authority);
+}
+
+static gint
+authorization_store_path_compare_func (GFile *file_a,
+                                       GFile *file_b)
+{
+  const gchar *a;
+  const gchar *b;
+
+  a = g_object_get_data (G_OBJECT (file_a), "sort-key");
+  b = g_object_get_data (G_OBJECT (file_b), "sort-key");
+
+  return g_strcmp0 (a, b);
+}
+
+static void
+add_all_authorization_stores (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  guint n;
+  GList *directories;
+  GList *l;
+
+  directories = NULL;
+
+  g_ptr_array_set_size (priv->toplevel_sources, 0);
+
+  for (n = 0; priv->authorization_store_paths && priv->authorization_store_paths[n]; n++)
+    {
+      const gchar *toplevel_path;
+      GFile *toplevel_directory;
+      GFileEnumerator *directory_enumerator;
+      GFileInfo *file_info;
+      GError *error;
+
+      error = NULL;
+
+      toplevel_path = priv->authorization_store_paths[n];
+      g_ptr_array_add (priv->toplevel_sources,
+                       g_variant_ref_sink (polkit_backend_snapshot_source_new (toplevel_path)));
+      toplevel_directory = g_file_new_for_path (toplevel_path);
+      directory_enumerator = g_file_enumerate_children (toplevel_directory,
+                                                        "standard::name,standard::type",
+                                                        G_FILE_QUERY_INFO_NONE,
+                                                        NULL,
+                                                        &error);
+      if (directory_enumerator == NULL)
+        {
+          g_warning ("Error getting enumerator for %s: %s", toplevel_path, error->message);
+          g_error_free (error);
+          g_object_unref (toplevel_directory);
+          continue;
+        }
+
+      while ((file_info = g_file_enumerator_next_file (directory_enumerator, NULL, &error)) != NULL)
+        {
+          /* only consider directories */
+          if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+            {
+              const gchar *name;
+              GFile *directory;
+              gchar *sort_key;
+
+              name = g_file_info_get_name (file_info);
+
+              /* This makes entries in directories in /etc take precedence to entries in directories in /var */
+              sort_key = g_strdup_printf ("%s-%d", name, n);
+
+              directory = g_file_get_child (toplevel_directory, name);
+              g_object_set_data_full (G_OBJECT (directory), "sort-key", sort_key, g_free);
+
+              directories = g_list_prepend (directories, directory);
+            }
+          g_object_unref (file_info);
+        }
+      if (error != NULL)
+        {
+          g_warning ("Error enumerating files in %s: %s", toplevel_path, error->message);
+          g_error_free (error);
+          g_object_unref (toplevel_directory);
+          g_object_unref (directory_enumerator);
+          continue;
+        }
+      g_object_unref (directory_enumerator);
+      g_object_unref (toplevel_directory);
+    }
+
+  /* Sort directories */
+  directories = g_list_sort (directories, (GCompareFunc) authorization_store_path_compare_func);
+
+  /* And now add an authorization store for each one */
+  for (l = directories; l != NULL; l = l->next)
+    {
+      GFile *directory = G_FILE (l->data);
+      gchar *name;
+
+      name = g_file_get_path (directory);
+      g_debug ("Added `%s' as a local authorization store", name);
+      g_free (name);
+
+      add_one_authorization_store (authority, directory);
+    }
+
+  g_list_foreach (directories, (GFunc) g_object_unref, NULL);
+  g_list_free (directories);
+}
+
+static void
+add_authorization_stores_from_snapshot (PolkitBackendLocalAuthority *authority,
+                                        GVariant                    *snapshot)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GVariant *toplevel_sources;
+  GVariant *stores;
+  GVariantIter iter;
+  GVariant *value;
+
+  g_variant_get (snapshot, "(@as@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING
+                 "@a" POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING ")",
+                 NULL, &toplevel_sources, &stores);
+
+  g_variant_iter_init (&iter, toplevel_sources);
+  while ((value = g_variant_iter_next_value (&iter)) != NULL)
+    g_ptr_array_add (priv->toplevel_sources, value);
+
+  g_variant_iter_init (&iter, stores);
+  while ((value = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      PolkitBackendLocalAuthorizationStore *store;
+      GVariant *sources;
+
+      /* Stores with changed files are read again, but their directories
+         are not listed again unless they changed too */
+      sources = g_variant_get_child_value (value, 1);
+      if (polkit_backend_snapshot_sources_are_fresh (sources))
+        store = polkit_backend_local_authorization_store_new_from_serialized (value, ".pkla");
+      else
+        {
+          store = polkit_backend_local_authorization_store_new_from_listing (value, ".pkla");
+          priv->stores_need_load = TRUE;
+        }
+      g_variant_unref (sources);
+      g_object_set (store, "coalesce-timeout", priv->coalesce_timeout, NULL);
+      priv->authorization_stores = g_list_append (priv->authorization_stores, store);
+      priv->shadowed_eliminated = FALSE;
+
+      g_signal_connect (store,
+                        "changed",
+                        G_CALLBACK (on_store_changed),
+                        authority);
+      g_variant_unref (value);
+    }
+
+  g_variant_unref (stores);
+  g_variant_unref (toplevel_sources);
+}
+
+/* Reads all stores added since the last call, if enabled with
+   #PolkitBackendLocalAuthority:load-threads.  Called with the update lock
+   held. */
+static void
+load_authorization_stores (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  if (priv->load_threads == 0 || !priv->stores_need_load)
+    return;
+
+  polkit_backend_local_authorization_store_load_all (priv->authorization_stores,
+                                                     priv->load_threads);
+  priv->stores_need_load = FALSE;
+}
+
+/* Leaves shadowed entries out of lookups, if enabled with
+   #PolkitBackendLocalAuthority:eliminate-shadowed.  Must be called again
+   whenever a store changed.  Called with the update lock held. */
+static void
+eliminate_shadowed_entries (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  if (!priv->eliminate_shadowed || priv->shadowed_eliminated)
+    return;
+
+  priv->n_shadowed = polkit_backend_local_authorization_store_eliminate_shadowed (priv->authorization_stores);
+  priv->shadowed_eliminated = TRUE;
+  g_debug ("Left %u shadowed authorization entries out of lookups", priv->n_shadowed);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Columns of a Decision, by kind of subject */
+enum
+{
+  DECISION_ANY,
+  DECISION_INACTIVE,
+  DECISION_ACTIVE,
+  N_DECISION_COLUMNS
+};
+
+/* The result of the entries of all stores for one identity string and
+   action, as evaluate_forward() would compute it for that identity alone */
+typedef struct
+{
+  PolkitImplicitAuthorization results[N_DECISION_COLUMNS];
+  /* The deciding entries, owned by the rule set */
+  const gchar *ids[N_DECISION_COLUMNS];
+} Decision;
+
+typedef struct
+{
+  /* Decision structures, the first one for "default" */
+  GArray *decisions;
+  /* identity string => index in decisions, for every identity the
+     entries for the action name */
+  GHashTable *identities;
+} ActionDecisions;
+
+/* The decisions for all actions entries name without wildcards and that
+   only name identities without wildcards or netgroups.  Not modified once
+   built; strings are owned by the rule set. */
+struct _DecisionTable
+{
+  /* action id => ActionDecisions */
+  GHashTable *actions;
+  guint n_decisions;
+};
+
+/* Returns the index of a new Decision without results */
+static guint
+action_decisions_add (ActionDecisions *decisions)
+{
+  Decision decision;
+  guint n;
+
+  for (n = 0; n < N_DECISION_COLUMNS; n++)
+    {
+      decision.results[n] = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+      decision.ids[n] = NULL;
+    }
+  g_array_append_val (decisions->decisions, decision);
+
+  return decisions->decisions->len - 1;
+}
+
+static ActionDecisions *
+action_decisions_new (void)
+{
+  ActionDecisions *decisions;
+
+  decisions = g_new0 (ActionDecisions, 1);
+  decisions->decisions = g_array_new (FALSE, FALSE, sizeof (Decision));
+  decisions->identities = g_hash_table_new (g_str_hash, g_str_equal);
+  action_decisions_add (decisions);
+
+  return decisions;
+}
+
+static void
+action_decisions_free (ActionDecisions *decisions)
+{
+  g_array_free (decisions->decisions, TRUE);
+  g_hash_table_unref (decisions->identities);
+  g_free (decisions);
+}
+
+/* Folds the last entry of a store matching @identity into its Decision;
+   called for each store in order of precedence */
+static void
+add_to_action_decisions (const gchar                                *identity,
+                         const PolkitBackendLocalAuthorizationMatch *match,
+                         gpointer                                    user_data)
+{
+  ActionDecisions *decisions = user_data;
+  PolkitImplicitAuthorization results[N_DECISION_COLUMNS];
+  Decision *decision;
+  guint index;
+  guint n;
+
+  if (identity == NULL)
+    index = 0;
+  else
+    {
+      index = GPOINTER_TO_UINT (g_hash_table_lookup (decisions->identities, identity));
+      if (index == 0)
+        {
+          index = action_decisions_add (decisions);
+          g_hash_table_insert (decisions->identities, (gpointer) identity,
+                               GUINT_TO_POINTER (index));
+        }
+    }
+
+  results[DECISION_ANY] = match->result_any;
+  results[DECISION_INACTIVE] = match->result_inactive;
+  results[DECISION_ACTIVE] = match->result_active;
+  decision = &g_array_index (decisions->decisions, Decision, index);
+  for (n = 0; n < N_DECISION_COLUMNS; n++)
+    {
+      if (results[n] != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+        {
+          decision->results[n] = results[n];
+          decision->ids[n] = match->id;
+        }
+    }
+}
+
+/* Tabulates the actions of @rule_set; this takes a while for large rule
+   sets, and is done in decision_table_pool */
+static DecisionTable *
+decision_table_new (RuleSet *rule_set)
+{
+  DecisionTable *table;
+  GHashTable *seen;
+  guint n, m, k;
+
+  table = g_new0 (DecisionTable, 1);
+  table->actions = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) action_decisions_free);
+  /* Actions already considered, including those that can not be
+     tabulated */
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (n = 0; n < rule_set->n_rules; n++)
+    {
+      GPtrArray *action_ids;
+
+      action_ids = polkit_backend_local_authorization_rules_get_literal_actions (rule_set->rules[n]);
+      for (m = 0; m < action_ids->len; m++)
+        {
+          const gchar *action_id = action_ids->pdata[m];
+          ActionDecisions *decisions;
+
+          if (g_hash_table_lookup_extended (seen, action_id, NULL, NULL))
+            continue;
+          g_hash_table_insert (seen, (gpointer) action_id, NULL);
+
+          /* Entries of other stores may match the action through patterns */
+          decisions = action_decisions_new ();
+          for (k = 0; k < rule_set->n_rules; k++)
+            {
+              if (!polkit_backend_local_authorization_rules_tabulate (rule_set->rules[k], action_id,
+                                                                      add_to_action_decisions,
+                                                                      decisions))
+                break;
+            }
+          if (k < rule_set->n_rules)
+            {
+              action_decisions_free (decisions);
+              continue;
+            }
+          table->n_decisions += decisions->decisions->len;
+          g_hash_table_insert (table->actions, (gpointer) action_id, decisions);
+        }
+      g_ptr_array_unref (action_ids);
+    }
+  g_hash_table_unref (seen);
+
+  return table;
+}
+
+static void
+decision_table_free (DecisionTable *table)
+{
+  g_hash_table_unref (table->actions);
+  g_free (table);
+}
+
+/* Finds the Decision for an identity of a check.  Returns %FALSE if
+   decisions exist for both keys of @keys, as the entries for each would
+   have to be merged in file order. */
+static gboolean
+action_decisions_lookup (ActionDecisions                *decisions,
+                         PolkitBackendLocalIdentityKeys *keys,
+                         const Decision                **out_decision)
+{
+  const gchar *name, *numeric;
+  guint index;
+
+  polkit_backend_local_identity_keys_get_strings (keys, &name, &numeric);
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (decisions->identities, name));
+  if (numeric != NULL)
+    {
+      guint numeric_index;
+
+      numeric_index = GPOINTER_TO_UINT (g_hash_table_lookup (decisions->identities, numeric));
+      if (index != 0 && numeric_index != 0)
+        return FALSE;
+      index = MAX (index, numeric_index);
+    }
+
+  *out_decision = index != 0 ? &g_array_index (decisions->decisions, Decision, index) : NULL;
+
+  return TRUE;
+}
+
+/* Gives the same result as evaluate_forward() without details by combining
+   the decisions for "default", @groups and @user_keys in that order.
+   Returns %FALSE if @action_id is not in @table or an identity can not be
+   looked up in it; the stores must be evaluated then. */
+static gboolean
+evaluate_decision_table (DecisionTable                  *table,
+                         GPtrArray                      *groups,
+                         PolkitBackendLocalIdentityKeys *user_keys,
+                         gboolean                        subject_is_local,
+                         gboolean                        subject_is_active,
+                         const gchar                    *action_id,
+                         PolkitImplicitAuthorization    *out_result,
+                         const gchar                   **out_deciding_id)
+{
+  ActionDecisions *decisions;
+  const Decision *decision;
+  PolkitImplicitAuthorization ret;
+  const gchar *deciding_id;
+  guint column;
+  guint n;
+
+  decisions = g_hash_table_lookup (table->actions, action_id);
+  if (decisions == NULL)
+    return FALSE;
+
+  if (subject_is_local && subject_is_active)
+    column = DECISION_ACTIVE;
+  else if (subject_is_local)
+    column = DECISION_INACTIVE;
+  else
+    column = DECISION_ANY;
+
+  decision = &g_array_index (decisions->decisions, Decision, 0);
+  ret = decision->results[column];
+  deciding_id = decision->ids[column];
+  for (n = 0; n <= groups->len; n++)
+    {
+      PolkitBackendLocalIdentityKeys *keys;
+
+      keys = n < groups->len ? g_ptr_array_index (groups, n) : user_keys;
+      if (!action_decisions_lookup (decisions, keys, &decision))
+        return FALSE;
+      if (decision != NULL && decision->results[column] != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+        {
+          ret = decision->results[column];
+          deciding_id = decision->ids[column];
+        }
+    }
+
+  *out_result = ret;
+  *out_deciding_id = deciding_id;
+
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static RuleSet *
+rule_set_new (GList *stores)
+{
+  RuleSet *set;
+  GList *l;
+  guint n;
+
+  set = g_new0 (RuleSet, 1);
+  set->ref_count = 1;
+  set->n_rules = g_list_length (stores);
+  set->rules = g_new (PolkitBackendLocalAuthorizationRules *, set->n_rules);
+  for (l = stores, n = 0; l != NULL; l = l->next, n++)
+    set->rules[n] = polkit_backend_local_authorization_store_get_rules (l->data);
+
+  return set;
+}
+
+static RuleSet *
+rule_set_ref (RuleSet *set)
+{
+  g_atomic_int_inc (&set->ref_count);
+  return set;
+}
+
+/* May be called in any thread, the set does not reference the stores */
+static void
+rule_set_unref (RuleSet *set)
+{
+  guint n;
+
+  if (!g_atomic_int_dec_and_test (&set->ref_count))
+    return;
+
+  if (set->decision_table != NULL)
+    decision_table_free (set->decision_table);
+  for (n = 0; n < set->n_rules; n++)
+    polkit_backend_local_authorization_rules_unref (set->rules[n]);
+  g_free (set->rules);
+  g_free (set);
+}
+
+/* Reads the stores as needed and takes their rules.  Called with the
+   update lock held. */
+static RuleSet *
+build_rule_set (PolkitBackendLocalAuthority *authority)
+{
+  load_authorization_stores (authority);
+  eliminate_shadowed_entries (authority);
+
+  return rule_set_new (authority->priv->authorization_stores);
+}
+
+/* Tabulates @set, unless it was replaced or tabulating was disabled
+   while it waited in decision_table_pool */
+static void
+run_decision_table_build_in_thread (gpointer data,
+                                    gpointer user_data)
+{
+  PolkitBackendLocalAuthority *authority = user_data;
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  RuleSet *set = data;
+  DecisionTable *table;
+  gboolean wanted;
+  gint64 start;
+
+  g_mutex_lock (priv->lock);
+  wanted = priv->decision_table && set == priv->rule_set && set->decision_table == NULL;
+  g_mutex_unlock (priv->lock);
+
+  if (wanted)
+    {
+      start = g_get_monotonic_time ();
+      table = decision_table_new (set);
+      g_mutex_lock (priv->lock);
+      set->decision_table = table;
+      priv->decision_table_builds++;
+      priv->decision_table_build_time += g_get_monotonic_time () - start;
+      g_mutex_unlock (priv->lock);
+      g_debug ("Tabulated %u actions with %u decisions",
+               g_hash_table_size (table->actions), table->n_decisions);
+    }
+
+  rule_set_unref (set);
+}
+
+/* Starts tabulating the current rule set in the background if enabled;
+   checks evaluate the stores until it is done.  Called with lock held. */
+static void
+queue_decision_table (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  if (!priv->decision_table || priv->rule_set == NULL || priv->rule_set->decision_table != NULL)
+    return;
+
+  if (priv->decision_table_pool == NULL)
+    priv->decision_table_pool = g_thread_pool_new (run_decision_table_build_in_thread, authority,
+                                                   1, FALSE, NULL);
+  if (priv->decision_table_pool != NULL)
+    g_thread_pool_push (priv->decision_table_pool, rule_set_ref (priv->rule_set), NULL);
+}
+
+/* Returns a reference to the rule set for a check, building it if this is
+   the first check, and the result generation that goes with it */
+static RuleSet *
+get_rule_set (PolkitBackendLocalAuthority *authority,
+              guint64                     *out_generation)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  RuleSet *ret;
+
+  g_mutex_lock (priv->lock);
+  ret = priv->rule_set != NULL ? rule_set_ref (priv->rule_set) : NULL;
+  *out_generation = priv->result_generation;
+  g_mutex_unlock (priv->lock);
+  if (ret != NULL)
+    return ret;
+
+  /* Other threads doing their first check wait for the set built here */
+  g_mutex_lock (priv->update_lock);
+  if (priv->rule_set == NULL)
+    {
+      RuleSet *set;
+
+      set = build_rule_set (authority);
+      g_mutex_lock (priv->lock);
+      priv->rule_set = set;
+      queue_decision_table (authority);
+      g_mutex_unlock (priv->lock);
+    }
+  g_mutex_lock (priv->lock);
+  ret = rule_set_ref (priv->rule_set);
+  *out_generation = priv->result_generation;
+  g_mutex_unlock (priv->lock);
+  g_mutex_unlock (priv->update_lock);
+
+  return ret;
+}
+
+/* Builds a new rule set after the stores changed, if there were checks
+   before, and makes cached results stale, except for the actions no
+   added, removed or changed entry matches.  Checks in progress keep using
+   the old set.  Called with the update lock held. */
+static void
+replace_rule_set (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  RuleSet *old_set;
+  RuleSet *new_set;
+  PolkitBackendLocalAuthorizationRules *changes;
+  PolkitBackendLocalAuthorizationDiff diff;
+
+  /* Only replaced with the update lock held */
+  old_set = priv->rule_set;
+  new_set = old_set != NULL ? build_rule_set (authority) : NULL;
+  changes = NULL;
+  if (new_set != NULL)
+    {
+      changes = polkit_backend_local_authorization_rules_diff (old_set->rules, old_set->n_rules,
+                                                               new_set->rules, new_set->n_rules,
+                                                               &diff);
+      if (changes != NULL)
+        g_debug ("Authorization entries changed: %u added, %u removed, %u modified",
+                 diff.n_added, diff.n_removed, diff.n_changed);
+      else
+        g_debug ("Authorization entries were reordered");
+      /* Stores only report changed entries, but a new list of stores may
+         have the same ones */
+      if (changes == NULL || diff.n_added + diff.n_removed + diff.n_changed > 0)
+        priv->rule_set_reloads++;
+    }
+
+  g_mutex_lock (priv->lock);
+  priv->rule_set = new_set;
+  priv->result_generation++;
+  invalidate_cached_results (authority, changes);
+  queue_decision_table (authority);
+  g_mutex_unlock (priv->lock);
+
+  if (changes != NULL)
+    polkit_backend_local_authorization_rules_unref (changes);
+
+  if (old_set != NULL)
+    rule_set_unref (old_set);
+}
+
+static void
+set_eliminate_shadowed (PolkitBackendLocalAuthority *authority,
+                        gboolean                     eliminate_shadowed)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  g_mutex_lock (priv->update_lock);
+  priv->eliminate_shadowed = eliminate_shadowed;
+  if (!eliminate_shadowed && priv->shadowed_eliminated)
+    {
+      polkit_backend_local_authorization_store_restore_shadowed (priv->authorization_stores);
+      priv->shadowed_eliminated = FALSE;
+      priv->n_shadowed = 0;
+    }
+  replace_rule_set (authority);
+  g_mutex_unlock (priv->update_lock);
+}
+
+static void
+set_load_threads (PolkitBackendLocalAuthority *authority,
+                  guint                        load_threads)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  g_mutex_lock (priv->update_lock);
+  priv->load_threads = load_threads;
+  g_mutex_unlock (priv->update_lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_store_changed (PolkitBackendLocalAuthorizationStore *store,
+                  gpointer                              user_data)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (user_data);
+
+  g_mutex_lock (authority->priv->update_lock);
+  /* Entries of the other stores may be shadowed differently now */
+  authority->priv->shadowed_eliminated = FALSE;
+  replace_rule_set (authority);
+  g_mutex_unlock (authority->priv->update_lock);
+
+  g_signal_emit_by_name (authority, "changed");
+}
+
+static void
+on_toplevel_authority_store_monitor_changed (GFileMonitor     *monitor,
+                                             GFile            *file,
+                                             GFile            *other_file,
+                                             GFileMonitorEvent event_type,
+                                             gpointer          user_data)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (user_data);
+
+  if (event_type != G_FILE_MONITOR_EVENT_CREATED &&
+      event_type != G_FILE_MONITOR_EVENT_DELETED)
+    return;
+
+  /* A sub-directory was added or removed; re-create the list of stores */
+  g_mutex_lock (authority->priv->update_lock);
+  purge_all_authorization_stores (authority);
+  add_all_authorization_stores (authority);
+  replace_rule_set (authority);
+  g_mutex_unlock (authority->priv->update_lock);
+
+  g_signal_emit_by_name (authority, "changed");
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  /* Array of PolkitBackendLocalIdentityKeys, not modified once created */
+  GPtrArray *groups;
+  /* Monotonic time, in microseconds */
+  gint64 expires_at;
+} GroupCacheEntry;
+
+static void
+group_cache_entry_free (GroupCacheEntry *entry)
+{
+  g_ptr_array_unref (entry->groups);
+  g_free (entry);
+}
+
+/* A lookup of the groups of a user through NSS, shared by all checks
+   needing them while it runs.  Only accessed with lock held. */
+typedef struct
+{
+  guint ref_count;
+  PolkitBackendLocalAuthority *authority;
+  PolkitIdentity *user;
+  /* Value of result_generation when the lookup started */
+  guint64 generation;
+  /* Monotonic time, in microseconds */
+  gint64 started_at;
+  /* Array of PolkitBackendLocalIdentityKeys, set when done */
+  GPtrArray *groups;
+} GroupLookup;
+
+static void
+group_lookup_unref (GroupLookup *lookup)
+{
+  if (--lookup->ref_count > 0)
+    return;
+
+  g_object_unref (lookup->user);
+  if (lookup->groups != NULL)
+    g_ptr_array_unref (lookup->groups);
+  g_free (lookup);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  uid_t uid;
+  gboolean subject_is_local;
+  gboolean subject_is_active;
+  gchar *action_id;
+
+  PolkitImplicitAuthorization result;
+  /* Value of result_generation when the check computing the result
+     started */
+  guint64 generation;
+  /* Monotonic time, in microseconds; when the group or netgroup
+     memberships the result depends on expire */
+  gint64 expires_at;
+  /* Link in results_lru */
+  GList *link;
+} ResultCacheEntry;
+
+static guint
+result_cache_entry_hash (gconstpointer key)
+{
+  const ResultCacheEntry *entry = key;
+  guint hash;
+
+  hash = g_str_hash (entry->action_id);
+  hash = hash * 31 + entry->uid;
+  hash = hash * 4 + (entry->subject_is_local ? 2 : 0) + (entry->subject_is_active ? 1 : 0);
+
+  return hash;
+}
+
+static gboolean
+result_cache_entry_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const ResultCacheEntry *entry_a = a;
+  const ResultCacheEntry *entry_b = b;
+
+  return entry_a->uid == entry_b->uid
+    && !entry_a->subject_is_local == !entry_b->subject_is_local
+    && !entry_a->subject_is_active == !entry_b->subject_is_active
+    && strcmp (entry_a->action_id, entry_b->action_id) == 0;
+}
+
+static void
+result_cache_entry_free (ResultCacheEntry *entry)
+{
+  g_free (entry->action_id);
+  g_free (entry);
+}
+
+/* The functions below are called with the lock held */
+
+static void
+remove_cached_result (PolkitBackendLocalAuthority *authority,
+                      ResultCacheEntry            *entry)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  g_queue_delete_link (priv->results_lru, entry->link);
+  /* Frees entry */
+  g_hash_table_remove (priv->results, entry);
+}
+
+/* Drops the least recently used results until at most @size are left */
+static void
+trim_cached_results (PolkitBackendLocalAuthority *authority,
+                     guint                        size)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  while (g_queue_get_length (priv->results_lru) > size)
+    remove_cached_result (authority, g_queue_peek_tail (priv->results_lru));
+}
+
+static gboolean
+lookup_cached_result (PolkitBackendLocalAuthority *authority,
+                      uid_t                        uid,
+                      gboolean                     subject_is_local,
+                      gboolean                     subject_is_active,
+                      const gchar                 *action_id,
+                      PolkitImplicitAuthorization *out_result)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  ResultCacheEntry key;
+  ResultCacheEntry *entry;
+
+  key.uid = uid;
+  key.subject_is_local = subject_is_local;
+  key.subject_is_active = subject_is_active;
+  key.action_id = (gchar *) action_id;
+  entry = g_hash_table_lookup (priv->results, &key);
+  if (entry == NULL)
+    goto miss;
+
+  if (entry->generation != priv->result_generation ||
+      g_get_monotonic_time () >= entry->expires_at)
+    {
+      remove_cached_result (authority, entry);
+      goto miss;
+    }
+
+  /* Move to the front of the LRU list */
+  g_queue_unlink (priv->results_lru, entry->link);
+  g_queue_push_head_link (priv->results_lru, entry->link);
+
+  priv->result_cache_hits++;
+  *out_result = entry->result;
+  return TRUE;
+
+ miss:
+  priv->result_cache_misses++;
+  return FALSE;
+}
+
+static void
+add_cached_result (PolkitBackendLocalAuthority *authority,
+                   uid_t                        uid,
+                   gboolean                     subject_is_local,
+                   gboolean                     subject_is_active,
+                   const gchar                 *action_id,
+                   PolkitImplicitAuthorization  result,
+                   guint64                      generation,
+                   gint64                       expires_at)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  ResultCacheEntry *entry;
+
+  /* The stores or memberships changed during the check */
+  if (generation != priv->result_generation || g_get_monotonic_time () >= expires_at)
+    return;
+
+  trim_cached_results (authority, priv->result_cache_size - 1);
+
+  entry = g_new0 (ResultCacheEntry, 1);
+  entry->uid = uid;
+  entry->subject_is_local = subject_is_local;
+  entry->subject_is_active = subject_is_active;
+  entry->action_id = g_strdup (action_id);
+  entry->result = result;
+  entry->generation = generation;
+  entry->expires_at = expires_at;
+  g_queue_push_head (priv->results_lru, entry);
+  entry->link = priv->results_lru->head;
+  g_hash_table_insert (priv->results, entry, entry);
+}
+
+/* Called after result_generation was incremented because the stores
+   changed.  Results for actions that no entry of @changes matches are
+   still right, and are kept; all are dropped if @changes is %NULL. */
+static void
+invalidate_cached_results (PolkitBackendLocalAuthority          *authority,
+                           PolkitBackendLocalAuthorizationRules *changes)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GHashTable *affected;
+  GList *l, *next;
+  guint n_kept, n_invalidated;
+
+  n_kept = 0;
+  n_invalidated = 0;
+  /* action id => whether it is affected; the keys are copies, as the
+     entries they were taken from may be freed */
+  affected = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (l = priv->results_lru->head; l != NULL; l = next)
+    {
+      ResultCacheEntry *entry = l->data;
+      gpointer value;
+
+      next = l->next;
+      /* Results already stale before are not made valid again */
+      if (changes != NULL && entry->generation == priv->result_generation - 1)
+        {
+          if (!g_hash_table_lookup_extended (affected, entry->action_id, NULL, &value))
+            {
+              value = GINT_TO_POINTER (polkit_backend_local_authorization_rules_has_action (changes,
+                                                                                            entry->action_id));
+              g_hash_table_insert (affected, g_strdup (entry->action_id), value);
+            }
+          if (!GPOINTER_TO_INT (value))
+            {
+              entry->generation = priv->result_generation;
+              n_kept++;
+              continue;
+            }
+        }
+      /* Frees entry */
+      remove_cached_result (authority, entry);
+      n_invalidated++;
+    }
+  g_hash_table_unref (affected);
+
+  priv->result_cache_kept += n_kept;
+  priv->result_cache_invalidated += n_invalidated;
+  if (n_kept + n_invalidated > 0)
+    g_debug ("Kept %u cached results, dropped %u", n_kept, n_invalidated);
+}
+
+static void
+set_result_cache_size (PolkitBackendLocalAuthority *authority,
+                       guint                        size)
+{
+  g_mutex_lock (authority->priv->lock);
+  trim_cached_results (authority, size);
+  authority->priv->result_cache_size = size;
+  g_mutex_unlock (authority->priv->lock);
+}
+
+static void
+on_nss_file_monitor_changed (GFileMonitor     *monitor,
+                             GFile            *file,
+                             GFile            *other_file,
+                             GFileMonitorEvent event_type,
+                             gpointer          user_data)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (user_data);
+
+  if (event_type == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+    return;
+
+  g_debug ("User, group or netgroup database changed, flushing caches");
+  polkit_backend_netgroup_cache_clear (authority->priv->netgroup_cache);
+  g_mutex_lock (authority->priv->lock);
+  g_hash_table_remove_all (authority->priv->groups_by_uid);
+  authority->priv->result_generation++;
+  g_mutex_unlock (authority->priv->lock);
+}
+
+static void
+add_nss_file_monitors (PolkitBackendLocalAuthority *authority)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  guint n;
+
+  for (n = 0; nss_files[n] != NULL; n++)
+    {
+      GFile *file;
+      GFileMonitor *monitor;
+      GError *error;
+
+      file = g_file_new_for_path (nss_files[n]);
+      error = NULL;
+      monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+      if (monitor == NULL)
+        {
+          g_warning ("Error creating file monitor for %s: %s", nss_files[n], error->message);
+          g_error_free (error);
+        }
+      else
+        {
+          g_signal_connect (monitor,
+                            "changed",
+                            G_CALLBACK (on_nss_file_monitor_changed),
+                            authority);
+          priv->nss_file_monitors = g_list_prepend (priv->nss_file_monitors, monitor);
+        }
+      g_object_unref (file);
+    }
+}
+
+static void
+set_group_cache_ttl (PolkitBackendLocalAuthority *authority,
+                     guint                        ttl)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  /* Entries were created with the old TTL */
+  g_mutex_lock (priv->lock);
+  g_hash_table_remove_all (priv->groups_by_uid);
+  priv->group_cache_ttl = ttl;
+  priv->result_generation++;
+  g_mutex_unlock (priv->lock);
+
+  if (ttl != 0 && priv->nss_file_monitors == NULL)
+    add_nss_file_monitors (authority);
+}
+
+static void
+set_group_lookup_timeout (PolkitBackendLocalAuthority *authority,
+                          guint                        timeout)
+{
+  g_mutex_lock (authority->priv->lock);
+  authority->priv->group_lookup_timeout = timeout;
+  g_mutex_unlock (authority->priv->lock);
+}
+
+static void
+set_netgroup_cache_ttl (PolkitBackendLocalAuthority *authority,
+                        guint                        ttl)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  polkit_backend_netgroup_cache_set_ttl (priv->netgroup_cache, ttl);
+  g_mutex_lock (priv->lock);
+  priv->result_generation++;
+  g_mutex_unlock (priv->lock);
+
+  if (ttl != 0 && priv->nss_file_monitors == NULL)
+    add_nss_file_monitors (authority);
+}
+
+static void
+set_coalesce_timeout (PolkitBackendLocalAuthority *authority,
+                      guint                        timeout)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GList *l;
+
+  g_mutex_lock (priv->update_lock);
+  priv->coalesce_timeout = timeout;
+  for (l = priv->authorization_stores; l != NULL; l = l->next)
+    g_object_set (l->data, "coalesce-timeout", timeout, NULL);
+  g_mutex_unlock (priv->update_lock);
+}
+
+static void
+set_reverse_evaluation (PolkitBackendLocalAuthority *authority,
+                        gboolean                     reverse_evaluation)
+{
+  g_mutex_lock (authority->priv->lock);
+  authority->priv->reverse_evaluation = reverse_evaluation;
+  g_mutex_unlock (authority->priv->lock);
+}
+
+static void
+set_decision_table (PolkitBackendLocalAuthority *authority,
+                    gboolean                     decision_table)
+{
+  g_mutex_lock (authority->priv->lock);
+  authority->priv->decision_table = decision_table;
+  queue_decision_table (authority);
+  g_mutex_unlock (authority->priv->lock);
+}
+
+static void
+polkit_backend_local_authority_init (PolkitBackendLocalAuthority *authority)
+{
+  authority->priv = G_TYPE_INSTANCE_GET_PRIVATE (authority,
+                                                 POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY,
+                                                 PolkitBackendLocalAuthorityPrivate);
+  authority->priv->update_lock = g_mutex_new ();
+  authority->priv->lock = g_mutex_new ();
+  authority->priv->toplevel_sources = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  authority->priv->groups_by_uid = g_hash_table_new_full (g_direct_hash,
+                                                          g_direct_equal,
+                                                          NULL,
+                                                          (GDestroyNotify) group_cache_entry_free);
+  authority->priv->group_lookups = g_hash_table_new (g_direct_hash, g_direct_equal);
+  authority->priv->group_lookup_cond = g_cond_new ();
+  authority->priv->netgroup_cache = polkit_backend_netgroup_cache_new (0);
+  authority->priv->gid_buffer_size = INITIAL_GID_BUFFER_SIZE;
+  authority->priv->results = g_hash_table_new_full (result_cache_entry_hash,
+                                                    result_cache_entry_equal,
+                                                    (GDestroyNotify) result_cache_entry_free,
+                                                    NULL);
+  authority->priv->results_lru = g_queue_new ();
+  authority->priv->unix_groups = g_hash_table_new_full (g_direct_hash,
+                                                        g_direct_equal,
+                                                        NULL,
+                                                        g_object_unref);
+}
+
+static void
+polkit_backend_local_authority_constructed (GObject *object)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (object);
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  guint n;
+
+  for (n = 0; priv->authorization_store_paths && priv->authorization_store_paths[n]; n++)
+    {
+      const gchar *toplevel_path;
+      GFile *toplevel_directory;
+      GFileMonitor *monitor;
+      GError *error;
+
+      toplevel_path = priv->authorization_store_paths[n];
+      toplevel_directory = g_file_new_for_path (toplevel_path);
+
+      error = NULL;
+      monitor = g_file_monitor_directory (toplevel_directory,
+                                          G_FILE_MONITOR_NONE,
+                                          NULL,
+                                          &error);
+      if (monitor == NULL)
+        {
+          g_warning ("Error creating directory monitor for %s: %s", toplevel_path, error->message);
+          g_error_free (error);
+        }
+      else
+        {
+          g_signal_connect (monitor,
+                            "changed",
+                            G_CALLBACK (on_toplevel_authority_store_monitor_changed),
+                            authority);
+          priv->directory_monitors = g_list_prepend (priv->directory_monitors, monitor);
+        }
+
+      g_object_unref (toplevel_directory);
+    }
+
+  if (priv->snapshot != NULL)
+    {
+      add_authorization_stores_from_snapshot (authority, priv->snapshot);
+      g_variant_unref (priv->snapshot);
+      priv->snapshot = NULL;
+    }
+  else
+    add_all_authorization_stores (authority);
+
+  if (G_OBJECT_CLASS (polkit_backend_local_authority_parent_class)->constructed != NULL)
+    G_OBJECT_CLASS (polkit_backend_local_authority_parent_class)->constructed (object);
+}
+
+static void
+polkit_backend_local_authority_finalize (GObject *object)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (object);
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+
+  g_list_foreach (priv->directory_monitors, (GFunc) g_object_unref, NULL);
+  g_list_free (priv->directory_monitors);
+
+  /* Rule sets waiting to be tabulated are dropped */
+  if (priv->decision_table_pool != NULL)
+    {
+      g_mutex_lock (priv->lock);
+      priv->decision_table = FALSE;
+      g_mutex_unlock (priv->lock);
+      g_thread_pool_free (priv->decision_table_pool, FALSE, TRUE);
+    }
+
+  purge_all_authorization_stores (authority);
+  if (priv->rule_set != NULL)
+    rule_set_unref (priv->rule_set);
+
+  g_ptr_array_unref (priv->toplevel_sources);
+  if (priv->snapshot != NULL)
+    g_variant_unref (priv->snapshot);
+
+  /* Lookups still running finish first; none can be started anymore */
+  if (priv->group_lookup_pool != NULL)
+    g_thread_pool_free (priv->group_lookup_pool, FALSE, TRUE);
+  g_hash_table_unref (priv->group_lookups);
+  g_cond_free (priv->group_lookup_cond);
+
+  g_list_foreach (priv->nss_file_monitors, (GFunc) g_object_unref, NULL);
+  g_list_free (priv->nss_file_monitors);
+  g_hash_table_unref (priv->groups_by_uid);
+  polkit_backend_netgroup_cache_free (priv->netgroup_cache);
+  g_hash_table_unref (priv->unix_groups);
+  g_queue_free (priv->results_lru);
+  g_hash_table_unref (priv->results);
+
+  g_strfreev (priv->authorization_store_paths);
+  g_mutex_free (priv->lock);
+  g_mutex_free (priv->update_lock);
+
+  if (G_OBJECT_CLASS (polkit_backend_local_authority_parent_class)->finalize != NULL)
+    G_OBJECT_CLASS (polkit_backend_local_authority_parent_class)->finalize (object);
+}
+
+static void
+polkit_backend_local_authority_set_auth_store_paths (PolkitBackendLocalAuthority *authority, const char *paths)
+{
+  g_strfreev (authority->priv->authorization_store_paths);
+  authority->priv->authorization_store_paths = g_strsplit (paths, ";", 0);
+}
+
+static void
+polkit_backend_local_authority_get_property (GObject    *object,
+                                             guint       prop_id,
+                                             GValue     *value,
+                                             GParamSpec *pspec)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (object);
+  gchar *paths;
+
+  switch (prop_id)
+    {
+    case PROP_AUTH_STORE_PATHS:
+      paths = authority->priv->authorization_store_paths != NULL
+        ? g_strjoinv (";", authority->priv->authorization_store_paths) : NULL;
+      g_value_set_string (value, paths);
+      g_free (paths);
+      break;
+
+    case PROP_GROUP_CACHE_TTL:
+      g_value_set_uint (value, authority->priv->group_cache_ttl);
+      break;
+
+    case PROP_NETGROUP_CACHE_TTL:
+      g_value_set_uint (value, polkit_backend_netgroup_cache_get_ttl (authority->priv->netgroup_cache));
+      break;
+
+    case PROP_COALESCE_TIMEOUT:
+      g_value_set_uint (value, authority->priv->coalesce_timeout);
+      break;
+
+    case PROP_RESULT_CACHE_SIZE:
+      g_value_set_uint (value, authority->priv->result_cache_size);
+      break;
+
+    case PROP_LOAD_THREADS:
+      g_value_set_uint (value, authority->priv->load_threads);
+      break;
+
+    case PROP_ELIMINATE_SHADOWED:
+      g_value_set_boolean (value, authority->priv->eliminate_shadowed);
+      break;
+
+    case PROP_REVERSE_EVALUATION:
+      g_value_set_boolean (value, authority->priv->reverse_evaluation);
+      break;
+
+    case PROP_DECISION_TABLE:
+      g_value_set_boolean (value, authority->priv->decision_table);
+      break;
+
+    case PROP_GROUP_LOOKUP_TIMEOUT:
+      g_value_set_uint (value, authority->priv->group_lookup_timeout);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+polkit_backend_local_authority_set_property (GObject      *object,
+                                             guint         prop_id,
+                                             const GValue *value,
+                                             GParamSpec   *pspec)
+{
+  PolkitBackendLocalAuthority *authority = POLKIT_BACKEND_LOCAL_AUTHORITY (object);
+
+  switch (prop_id)
+    {
+    case PROP_AUTH_STORE_PATHS:
+      polkit_backend_local_authority_set_auth_store_paths (authority, g_value_get_string (value));
+      break;
+
+    case PROP_SNAPSHOT:
+      authority->priv->snapshot = g_value_dup_variant (value);
+      break;
+
+    case PROP_GROUP_CACHE_TTL:
+      set_group_cache_ttl (authority, g_value_get_uint (value));
+      break;
+
+    case PROP_NETGROUP_CACHE_TTL:
+      set_netgroup_cache_ttl (authority, g_value_get_uint (value));
+      break;
+
+    case PROP_COALESCE_TIMEOUT:
+      set_coalesce_timeout (authority, g_value_get_uint (value));
+      break;
+
+    case PROP_RESULT_CACHE_SIZE:
+      set_result_cache_size (authority, g_value_get_uint (value));
+      break;
+
+    case PROP_LOAD_THREADS:
+      set_load_threads (authority, g_value_get_uint (value));
+      break;
+
+    case PROP_ELIMINATE_SHADOWED:
+      set_eliminate_shadowed (authority, g_value_get_boolean (value));
+      break;
+
+    case PROP_REVERSE_EVALUATION:
+      set_reverse_evaluation (authority, g_value_get_boolean (value));
+      break;
+
+    case PROP_DECISION_TABLE:
+      set_decision_table (authority, g_value_get_boolean (value));
+      break;
+
+    case PROP_GROUP_LOOKUP_TIMEOUT:
+      set_group_lookup_timeout (authority, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+polkit_backend_local_authority_class_init (PolkitBackendLocalAuthorityClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->get_property = polkit_backend_local_authority_get_property;
+  gobject_class->set_property = polkit_backend_local_authority_set_property;
+  gobject_class->constructed  = polkit_backend_local_authority_constructed;
+  gobject_class->finalize     = polkit_backend_local_authority_finalize;
+
+  g_type_class_add_private (klass, sizeof (PolkitBackendLocalAuthorityPrivate));
+
+  /**
+   * PolkitBackendLocalAuthority:auth-store-paths:
+   *
+   * Semi-colon separated list of Authorization Store 'top' directories.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_AUTH_STORE_PATHS,
+                                   g_param_spec_string ("auth-store-paths",
+                                                        "Local Authorization Store Paths",
+                                                        "Semi-colon separated list of Authorization Store 'top' directories.",
+                                                        NULL,
+                                                        G_PARAM_CONSTRUCT_ONLY |
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_NAME |
+                                                        G_PARAM_STATIC_BLURB |
+                                                        G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:snapshot:
+   *
+   * Serialized authorization stores to use instead of reading the
+   * 'top' directories, see polkit_backend_local_authority_new_from_snapshot().
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_SNAPSHOT,
+                                   g_param_spec_variant ("snapshot",
+                                                         "Snapshot",
+                                                         "Serialized authorization stores",
+                                                         G_VARIANT_TYPE (SNAPSHOT_TYPE_STRING),
+                                                         NULL,
+                                                         G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_WRITABLE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:group-cache-ttl:
+   *
+   * Number of seconds the groups of a user are remembered for, 0 to
+   * look them up for every check, or %G_MAXUINT to never expire them.
+   * The cache is also flushed when <filename>/etc/passwd</filename>
+   * or <filename>/etc/group</filename> change while a main loop is
+   * running; changes in other NSS sources are only noticed when the
+   * entries expire.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_GROUP_CACHE_TTL,
+                                   g_param_spec_uint ("group-cache-ttl",
+                                                      "Group Cache TTL",
+                                                      "Seconds the groups of a user are cached for",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:group-lookup-timeout:
+   *
+   * Number of milliseconds a check waits for the groups of a user to be
+   * looked up through NSS, if they are in the cache but have expired,
+   * before using the expired groups.  The lookup goes on, and its result
+   * is cached for later checks.  Checks for the same user while a lookup
+   * runs always wait for it instead of starting another one.  If 0, or
+   * if nothing is cached, checks wait until the lookup is done.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_GROUP_LOOKUP_TIMEOUT,
+                                   g_param_spec_uint ("group-lookup-timeout",
+                                                      "Group Lookup Timeout",
+                                                      "Milliseconds to wait for groups before using expired ones",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:netgroup-cache-ttl:
+   *
+   * Number of seconds the answers to netgroup membership queries for
+   * <literal>unix-netgroup:</literal> identities are remembered for, with
+   * the same special values as
+   * #PolkitBackendLocalAuthority:group-cache-ttl.  The cache is shared
+   * by all authorization stores and also flushed when
+   * <filename>/etc/netgroup</filename> changes.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_NETGROUP_CACHE_TTL,
+                                   g_param_spec_uint ("netgroup-cache-ttl",
+                                                      "Netgroup Cache TTL",
+                                                      "Seconds netgroup memberships are cached for",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:coalesce-timeout:
+   *
+   * Number of milliseconds each authorization store collects change
+   * notifications for before reloading the changed files, see
+   * #PolkitBackendLocalAuthorizationStore:coalesce-timeout.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_COALESCE_TIMEOUT,
+                                   g_param_spec_uint ("coalesce-timeout",
+                                                      "Coalesce Timeout",
+                                                      "Milliseconds to collect change notifications for",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:result-cache-size:
+   *
+   * Maximum number of results of
+   * polkit_backend_local_authority_check_authorization_sync() to
+   * remember, or 0 to evaluate every query.  The least recently used
+   * results are dropped first.  When an authorization store changes,
+   * the results for actions that added, removed or modified entries
+   * match are forgotten, and all results if entries were reordered.
+   * Each one is also forgotten when the group or netgroup memberships it
+   * was computed from expire; results are therefore not remembered if
+   * either of #PolkitBackendLocalAuthority:group-cache-ttl and
+   * #PolkitBackendLocalAuthority:netgroup-cache-ttl is 0.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_RESULT_CACHE_SIZE,
+                                   g_param_spec_uint ("result-cache-size",
+                                                      "Result Cache Size",
+                                                      "Maximum number of remembered results",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:load-threads:
+   *
+   * If non-zero, the authorization files of all stores that have not been
+   * read yet are read and parsed in up to this many threads before the
+   * first check or snapshot, see
+   * polkit_backend_local_authorization_store_load_all().  If 0, each
+   * store reads its files on its first lookup.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_LOAD_THREADS,
+                                   g_param_spec_uint ("load-threads",
+                                                      "Load Threads",
+                                                      "Number of threads to read authorization files in",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:eliminate-shadowed:
+   *
+   * Whether authorization entries that never change the result of a
+   * check, because later entries override them for every subject, are
+   * left out of lookups, see
+   * polkit_backend_local_authorization_store_eliminate_shadowed().  The
+   * analysis is done before the first check after any store changed.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_ELIMINATE_SHADOWED,
+                                   g_param_spec_boolean ("eliminate-shadowed",
+                                                         "Eliminate Shadowed",
+                                                         "Whether shadowed entries are left out of lookups",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:reverse-evaluation:
+   *
+   * Whether checks without details look for the deciding authorization
+   * entry starting with the user, then the groups, then the default
+   * entries, each from the last store and entry backwards, and stop as
+   * soon as the relevant result is known.  Entries that can not change
+   * the result, and often whole stores, are then not consulted.  The
+   * results are the same as when evaluating all entries in order, which
+   * is still done for checks with details, as those collect the return
+   * values of all matching entries.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_REVERSE_EVALUATION,
+                                   g_param_spec_boolean ("reverse-evaluation",
+                                                         "Reverse Evaluation",
+                                                         "Whether checks stop at the deciding entry",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority:decision-table:
+   *
+   * Whether the results of checks without details are precomputed, in a
+   * background thread after the stores were read or changed, for every
+   * action authorization entries name without wildcards, and for
+   * "default" and each group and user the entries name.  A check then
+   * combines the results for the identities of the subject instead of
+   * evaluating the stores.  Checks done before the table is ready, and
+   * those for actions only matched through wildcards or with entries for
+   * identity patterns or netgroups, evaluate the stores as usual.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_DECISION_TABLE,
+                                   g_param_spec_boolean ("decision-table",
+                                                         "Decision Table",
+                                                         "Whether results are precomputed for literal actions",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_STATIC_NICK));
+
+  /**
+   * PolkitBackendLocalAuthority::changed:
+   * @authority: A #PolkitBackendLocalAuthority.
+   *
+   * Emitted when authorization files in any of
+   * #PolkitBackendLocalAuthority:auth-store-paths change.
+   */
+  signals[CHANGED_SIGNAL] = g_signal_new ("changed",
+                                          POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY,
+                                          G_SIGNAL_RUN_LAST,
+                                          G_STRUCT_OFFSET (PolkitBackendLocalAuthorityClass, changed),
+                                          NULL,
+                                          NULL,
+                                          g_cclosure_marshal_VOID__VOID,
+                                          G_TYPE_NONE,
+                                          0);
+}
+
+/**
+ * polkit_backend_local_authority_new:
+ * @auth_store_paths: Semi-colon separated list of Authorization Store 'top' directories.
+ *
+ * Creates a new #PolkitBackendLocalAuthority that reads authorization
+ * stores from all sub-directories of @auth_store_paths. To watch for
+ * configuration changes, connect to the
+ * #PolkitBackendLocalAuthority::changed signal.
+ *
+ * Returns: A #PolkitBackendLocalAuthority. Free with g_object_unref().
+ **/
+PolkitBackendLocalAuthority *
+polkit_backend_local_authority_new (const gchar *auth_store_paths)
+{
+  PolkitBackendLocalAuthority *authority;
+
+  authority = POLKIT_BACKEND_LOCAL_AUTHORITY (g_object_new (POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY,
+                                                            "auth-store-paths", auth_store_paths,
+                                                            NULL));
+
+  return authority;
+}
+
+/**
+ * polkit_backend_local_authority_new_from_snapshot:
+ * @auth_store_paths: Semi-colon separated list of Authorization Store 'top' directories.
+ * @filename: A shared snapshot containing the result of
+ *     polkit_backend_local_authority_serialize().
+ * @error: Return location for error.
+ *
+ * Creates a new #PolkitBackendLocalAuthority like
+ * polkit_backend_local_authority_new(), using the authorization entries
+ * stored in @filename instead of reading all authorization files.  This
+ * fails if the snapshot was invalidated or created for different
+ * @auth_store_paths, or if authorization stores were added or removed
+ * since.  Stores whose files have changed are read again as usual.
+ *
+ * Returns: A #PolkitBackendLocalAuthority, or %NULL if @error is set.
+ *     Free with g_object_unref().
+ **/
+PolkitBackendLocalAuthority *
+polkit_backend_local_authority_new_from_snapshot (const gchar  *auth_store_paths,
+                                                  const gchar  *filename,
+                                                  GError      **error)
+{
+  PolkitBackendLocalAuthority *authority;
+  GVariant *snapshot;
+  GVariant *snapshot_paths_value;
+  gchar **paths;
+  const gchar **snapshot_paths;
+  gboolean fresh;
+  guint n;
+
+  snapshot = polkit_backend_snapshot_load_section (filename,
+                                                   POLKIT_BACKEND_SNAPSHOT_SECTION_AUTHORITY,
+                                                   G_VARIANT_TYPE (SNAPSHOT_TYPE_STRING),
+                                                   error);
+  if (snapshot == NULL)
+    return NULL;
+
+  paths = g_strsplit (auth_store_paths, ";", 0);
+  snapshot_paths_value = g_variant_get_child_value (snapshot, 0);
+  snapshot_paths = g_variant_get_strv (snapshot_paths_value, NULL);
+  fresh = g_strv_length (paths) == g_strv_length ((gchar **) snapshot_paths);
+  for (n = 0; fresh && paths[n] != NULL; n++)
+    fresh = strcmp (paths[n], snapshot_paths[n]) == 0;
+  g_free (snapshot_paths);
+  g_variant_unref (snapshot_paths_value);
+  g_strfreev (paths);
+
+  if (fresh)
+    {
+      GVariant *toplevel_sources;
+
+      g_variant_get_child (snapshot, 1, "@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING,
+                           &toplevel_sources);
+      fresh = polkit_backend_snapshot_sources_are_fresh (toplevel_sources);
+      g_variant_unref (toplevel_sources);
+    }
+
+  if (!fresh)
+    {
+      g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                   "Snapshot `%s' is out of date", filename);
+      g_variant_unref (snapshot);
+      return NULL;
+    }
+
+  authority = POLKIT_BACKEND_LOCAL_AUTHORITY (g_object_new (POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY,
+                                                            "auth-store-paths", auth_store_paths,
+                                                            "snapshot", snapshot,
+                                                            NULL));
+  g_variant_unref (snapshot);
+
+  return authority;
+}
+
+/* Sources modified less than this many seconds before they were read could
+   be modified again without a change in the recorded state.  This is
+   generous, to allow for coarse file system timestamps. */
+#define SNAPSHOT_SETTLE_SECONDS 2
+
+/* Called with the update lock held */
+static GVariant *
+serialize_authority (PolkitBackendLocalAuthority *authority,
+                     gint64                      *out_newest_mtime)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GVariantBuilder toplevel_sources_builder;
+  GVariantBuilder stores_builder;
+  const gchar * const empty_paths[] = { NULL };
+  GVariant *toplevel_sources;
+  gint64 newest_mtime;
+  GList *l;
+  guint n;
+
+  g_variant_builder_init (&toplevel_sources_builder,
+                          G_VARIANT_TYPE ("a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING));
+  for (n = 0; n < priv->toplevel_sources->len; n++)
+    g_variant_builder_add_value (&toplevel_sources_builder, priv->toplevel_sources->pdata[n]);
+  toplevel_sources = g_variant_builder_end (&toplevel_sources_builder);
+  newest_mtime = polkit_backend_snapshot_sources_get_newest_mtime (toplevel_sources);
+
+  load_authorization_stores (authority);
+  g_variant_builder_init (&stores_builder,
+                          G_VARIANT_TYPE ("a" POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING));
+  for (l = priv->authorization_stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+      GVariant *value;
+      GVariant *sources;
+
+      value = polkit_backend_local_authorization_store_serialize (store);
+      sources = g_variant_get_child_value (value, 1);
+      newest_mtime = MAX (newest_mtime,
+                          polkit_backend_snapshot_sources_get_newest_mtime (sources));
+      g_variant_unref (sources);
+
+      g_variant_builder_add_value (&stores_builder, value);
+    }
+
+  *out_newest_mtime = newest_mtime;
+
+  return g_variant_ref_sink (g_variant_new ("(^as@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING
+                                            "a" POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING ")",
+                                            priv->authorization_store_paths != NULL
+                                            ? (const gchar * const *) priv->authorization_store_paths
+                                            : empty_paths,
+                                            toplevel_sources,
+                                            &stores_builder));
+}
+
+/**
+ * polkit_backend_local_authority_serialize:
+ * @authority: A #PolkitBackendLocalAuthority.
+ *
+ * Reads all authorization files, and serializes their contents for the
+ * %POLKIT_BACKEND_SNAPSHOT_SECTION_AUTHORITY section of a shared snapshot,
+ * see polkit_backend_snapshot_save_sections() and
+ * polkit_backend_local_authority_new_from_snapshot().  If any of the
+ * files were modified very recently, this waits for a few seconds and
+ * reads them again, so that later modifications are reliably detected.
+ *
+ * Returns: A #GVariant. Free with g_variant_unref().
+ **/
+GVariant *
+polkit_backend_local_authority_serialize (PolkitBackendLocalAuthority *authority)
+{
+  GVariant *snapshot;
+  gint64 newest_mtime;
+  gint64 now;
+
+  g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority), NULL);
+
+  /* Checks go on meanwhile */
+  g_mutex_lock (authority->priv->update_lock);
+  snapshot = serialize_authority (authority, &newest_mtime);
+  now = g_get_real_time () / G_USEC_PER_SEC;
+  if (newest_mtime > now - SNAPSHOT_SETTLE_SECONDS)
+    {
+      g_debug ("Authorization files were modified recently, reading them again");
+      g_variant_unref (snapshot);
+      /* Timestamps in the future are not worth waiting for */
+      g_usleep (MIN (newest_mtime + SNAPSHOT_SETTLE_SECONDS + 1 - now,
+                     SNAPSHOT_SETTLE_SECONDS + 1) * G_USEC_PER_SEC);
+
+      purge_all_authorization_stores (authority);
+      add_all_authorization_stores (authority);
+      replace_rule_set (authority);
+      snapshot = serialize_authority (authority, &newest_mtime);
+    }
+  g_mutex_unlock (authority->priv->update_lock);
+
+  return snapshot;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static PolkitImplicitAuthorization
+get_relevant_result (const PolkitBackendLocalAuthorizationMatch *match,
+                     gboolean                                    subject_is_local,
+                     gboolean                                    subject_is_active)
+{
+  if (subject_is_local && subject_is_active)
+    return match->result_active;
+  else if (subject_is_local)
+    return match->result_inactive;
+  else
+    return match->result_any;
+}
+
+/* Matches each store once for all @identities, in order of precedence.
+   Sets @out_deciding_id to the id of the entry the result was taken from. */
+static PolkitImplicitAuthorization
+evaluate_forward (RuleSet                       *rule_set,
+                  PolkitBackendLocalIdentitySet *identities,
+                  gboolean                       subject_is_local,
+                  gboolean                       subject_is_active,
+                  const gchar                   *action_id,
+                  PolkitDetails                 *details,
+                  const gchar                  **out_deciding_id)
+{
+  PolkitImplicitAuthorization ret;
+  PolkitBackendLocalAuthorizationMatch *matches;
+  guint n_identities;
+  guint n_stores;
+  guint n, m;
+
+  ret = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+
+  n_identities = polkit_backend_local_identity_set_get_size (identities);
+  n_stores = rule_set->n_rules;
+  matches = g_new (PolkitBackendLocalAuthorizationMatch, n_stores * n_identities);
+  for (n = 0; n < n_stores; n++)
+    polkit_backend_local_authorization_rules_lookup_identities (rule_set->rules[n], identities,
+                                                                action_id, details,
+                                                                matches + n * n_identities);
+
+  /* Later identities and later stores take precedence */
+  for (m = 0; m < n_identities; m++)
+    {
+      for (n = 0; n < n_stores; n++)
+        {
+          const PolkitBackendLocalAuthorizationMatch *match = &matches[n * n_identities + m];
+          PolkitImplicitAuthorization relevant_ret;
+
+          if (!match->matched)
+            continue;
+          relevant_ret = get_relevant_result (match, subject_is_local, subject_is_active);
+          if (relevant_ret != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+            {
+              ret = relevant_ret;
+              *out_deciding_id = match->id;
+            }
+        }
+    }
+
+  g_free (matches);
+
+  return ret;
+}
+
+/* Gives the same result as evaluate_forward() without details, by taking
+   the first relevant result in reverse order of precedence: the last
+   identity first, and for each one the last store first.  Within a store,
+   the last matching entry decides even if its relevant result is unknown,
+   so that earlier entries of the store are not consulted for that
+   identity.  Stores are only matched when they are reached. */
+static PolkitImplicitAuthorization
+evaluate_reverse (RuleSet                       *rule_set,
+                  PolkitBackendLocalIdentitySet *identities,
+                  gboolean                       subject_is_local,
+                  gboolean                       subject_is_active,
+                  const gchar                   *action_id,
+                  const gchar                  **out_deciding_id)
+{
+  PolkitImplicitAuthorization ret;
+  PolkitBackendLocalAuthorizationReverseLookup **lookups;
+  guint n_identities;
+  guint n_stores;
+  guint n, m;
+
+  ret = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+
+  n_identities = polkit_backend_local_identity_set_get_size (identities);
+  n_stores = rule_set->n_rules;
+  lookups = g_new0 (PolkitBackendLocalAuthorizationReverseLookup *, n_stores);
+
+  for (m = n_identities; m > 0; m--)
+    {
+      for (n = n_stores; n > 0; n--)
+        {
+          const PolkitBackendLocalAuthorizationMatch *match;
+
+          if (lookups[n - 1] == NULL)
+            lookups[n - 1] = polkit_backend_local_authorization_reverse_lookup_new (rule_set->rules[n - 1],
+                                                                                    identities,
+                                                                                    action_id);
+          match = polkit_backend_local_authorization_reverse_lookup_get (lookups[n - 1], m - 1);
+          if (!match->matched)
+            continue;
+          ret = get_relevant_result (match, subject_is_local, subject_is_active);
+          if (ret != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+            {
+              *out_deciding_id = match->id;
+              goto out;
+            }
+        }
+    }
+
+ out:
+  for (n = 0; n < n_stores; n++)
+    {
+      if (lookups[n] != NULL)
+        polkit_backend_local_authorization_reverse_lookup_free (lookups[n]);
+    }
+  g_free (lookups);
+
+  return ret;
+}
+
+/* Evaluates the rules of all stores in @rule_set; sets @out_expires_at to
+   the time the group and netgroup memberships used expire, and
+   @out_deciding_id to the id of the entry the result was taken from, which
+   is owned by @rule_set */
+static PolkitImplicitAuthorization
+evaluate_authorization (PolkitBackendLocalAuthority *authority,
+                        RuleSet                     *rule_set,
+                        PolkitIdentity              *user_for_subject,
+                        gboolean                     subject_is_local,
+                        gboolean                     subject_is_active,
+                        const gchar                 *action_id,
+                        PolkitDetails               *details,
+                        gint64                      *out_expires_at,
+                        const gchar                **out_deciding_id)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  PolkitImplicitAuthorization ret;
+  PolkitBackendLocalIdentitySet *identities;
+  PolkitBackendLocalIdentityKeys *user_keys;
+  GPtrArray *groups;
+  gboolean reverse_evaluation;
+  DecisionTable *table;
+  gboolean tabulated;
+  gint64 start;
+  gint64 groups_time;
+  guint n;
+
+  *out_deciding_id = NULL;
+
+  /* Default entries come first, then all groups the user belongs to, then
+     the user.  The keys of the groups are computed when looking up the
+     groups, only those of the user are computed for each check. */
+  identities = polkit_backend_local_identity_set_new ();
+  polkit_backend_local_identity_set_set_netgroup_cache (identities, priv->netgroup_cache);
+  polkit_backend_local_identity_set_add_keys (identities, NULL);
+  start = g_get_monotonic_time ();
+  groups = get_groups_for_user (authority, user_for_subject, out_expires_at);
+  groups_time = g_get_monotonic_time () - start;
+  g_mutex_lock (priv->lock);
+  priv->groups_time += groups_time;
+  reverse_evaluation = priv->reverse_evaluation;
+  table = priv->decision_table ? rule_set->decision_table : NULL;
+  g_mutex_unlock (priv->lock);
+  for (n = 0; n < groups->len; n++)
+    polkit_backend_local_identity_set_add_keys (identities, g_ptr_array_index (groups, n));
+  user_keys = polkit_backend_local_identity_keys_new (user_for_subject);
+  polkit_backend_local_identity_set_add_keys (identities, user_keys);
+
+  tabulated = details == NULL && table != NULL
+    && evaluate_decision_table (table, groups, user_keys, subject_is_local, subject_is_active,
+                                action_id, &ret, out_deciding_id);
+  if (tabulated)
+    {
+      g_mutex_lock (priv->lock);
+      priv->decision_table_hits++;
+      g_mutex_unlock (priv->lock);
+    }
+  else if (reverse_evaluation && details == NULL)
+    ret = evaluate_reverse (rule_set, identities, subject_is_local, subject_is_active,
+                            action_id, out_deciding_id);
+  else
+    ret = evaluate_forward (rule_set, identities, subject_is_local, subject_is_active,
+                            action_id, details, out_deciding_id);
+
+  /* Netgroup memberships are looked up while matching; the result is only
+     valid for as long as the answers it was based on */
+  *out_expires_at = MIN (*out_expires_at,
+                         polkit_backend_local_identity_set_get_netgroups_expire_at (identities));
+
+  polkit_backend_local_identity_set_free (identities);
+  polkit_backend_local_identity_keys_free (user_keys);
+  g_ptr_array_unref (groups);
+
+  return ret;
+}
+
+/* Counters compared before and after a traced check.  They also count the
+   work of checks running in other threads meanwhile. */
+typedef struct
+{
+  gint64 groups_time;
+  guint64 innetgr_calls;
+  gint64 innetgr_time;
+  /* PolkitBackendLocalAuthorityStoreTrace, with the totals of each store */
+  GArray *stores;
+} TraceCounters;
+
+static void
+get_trace_counters (PolkitBackendLocalAuthority *authority,
+                    TraceCounters               *counters)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GList *l;
+
+  g_mutex_lock (priv->lock);
+  counters->groups_time = priv->groups_time;
+  g_mutex_unlock (priv->lock);
+  polkit_backend_netgroup_cache_get_innetgr_stats (priv->netgroup_cache,
+                                                   &counters->innetgr_calls,
+                                                   &counters->innetgr_time);
+  counters->stores = g_array_new (FALSE, TRUE, sizeof (PolkitBackendLocalAuthorityStoreTrace));
+  g_mutex_lock (priv->update_lock);
+  for (l = priv->authorization_stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorityStoreTrace store_trace;
+      guint64 entries_scanned, entries_matched;
+
+      polkit_backend_local_authorization_store_get_lookup_stats (l->data,
+                                                                 &store_trace.load_time,
+                                                                 &entries_scanned,
+                                                                 &entries_matched);
+      store_trace.path = NULL;
+      store_trace.entries_scanned = entries_scanned;
+      store_trace.entries_matched = entries_matched;
+      g_array_append_val (counters->stores, store_trace);
+    }
+  g_mutex_unlock (priv->update_lock);
+}
+
+/* Sets the fields of @trace to the differences since @before, which is
+   freed.  Stores added since are left out. */
+static void
+set_trace (PolkitBackendLocalAuthority      *authority,
+           TraceCounters                    *before,
+           PolkitBackendLocalAuthorityTrace *trace)
+{
+  TraceCounters after;
+  GList *l;
+  guint n;
+
+  get_trace_counters (authority, &after);
+  trace->groups_time = after.groups_time - before->groups_time;
+  trace->innetgr_calls = after.innetgr_calls - before->innetgr_calls;
+  trace->innetgr_time = after.innetgr_time - before->innetgr_time;
+
+  trace->stores = g_array_new (FALSE, TRUE, sizeof (PolkitBackendLocalAuthorityStoreTrace));
+  g_mutex_lock (authority->priv->update_lock);
+  for (l = authority->priv->authorization_stores, n = 0;
+       l != NULL && n < after.stores->len;
+       l = l->next, n++)
+    {
+      PolkitBackendLocalAuthorityStoreTrace *store_after;
+      PolkitBackendLocalAuthorityStoreTrace store_trace;
+      GFile *directory;
+
+      store_after = &g_array_index (after.stores, PolkitBackendLocalAuthorityStoreTrace, n);
+      store_trace = *store_after;
+      if (n < before->stores->len)
+        {
+          PolkitBackendLocalAuthorityStoreTrace *store_before;
+
+          store_before = &g_array_index (before->stores, PolkitBackendLocalAuthorityStoreTrace, n);
+          store_trace.load_time -= store_before->load_time;
+          store_trace.entries_scanned -= store_before->entries_scanned;
+          store_trace.entries_matched -= store_before->entries_matched;
+        }
+      g_object_get (l->data, "directory", &directory, NULL);
+      store_trace.path = g_file_get_path (directory);
+      g_object_unref (directory);
+      g_array_append_val (trace->stores, store_trace);
+
+      trace->load_time += store_trace.load_time;
+      trace->entries_scanned += store_trace.entries_scanned;
+      trace->entries_matched += store_trace.entries_matched;
+    }
+  g_mutex_unlock (authority->priv->update_lock);
+
+  trace->match_time = MAX (trace->total_time - trace->groups_time - trace->load_time
+                           - trace->innetgr_time, 0);
+
+  g_array_free (after.stores, TRUE);
+  g_array_free (before->stores, TRUE);
+}
+
+/**
+ * polkit_backend_local_authority_check_authorization_sync:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @user_for_subject: The #PolkitUnixUser asking for authorization.
+ * @subject_is_local: Whether the subject is in a local session.
+ * @subject_is_active: Whether the subject is in an active session.
+ * @action_id: The action id to check for.
+ * @details: (allow-none): Details for @action_id, or %NULL.
+ *
+ * Evaluates the authorization entries in all stores for @user_for_subject.
+ * Return values of matching entries are added to @details.  If @details
+ * is %NULL, the result may be taken from the cache described at
+ * #PolkitBackendLocalAuthority:result-cache-size.
+ *
+ * Returns: The configured authorization decision, or
+ *     %POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN if none applies.
+ */
+PolkitImplicitAuthorization
+polkit_backend_local_authority_check_authorization_sync (PolkitBackendLocalAuthority *authority,
+                                                         PolkitIdentity              *user_for_subject,
+                                                         gboolean                     subject_is_local,
+                                                         gboolean                     subject_is_active,
+                                                         const gchar                 *action_id,
+                                                         PolkitDetails               *details)
+{
+  return polkit_backend_local_authority_check_authorization_traced (authority,
+                                                                    user_for_subject,
+                                                                    subject_is_local,
+                                                                    subject_is_active,
+                                                                    action_id,
+                                                                    details,
+                                                                    NULL);
+}
+
+typedef struct
+{
+  PolkitIdentity *user_for_subject;
+  gboolean subject_is_local;
+  gboolean subject_is_active;
+  gchar *action_id;
+  PolkitDetails *details;
+  PolkitImplicitAuthorization result;
+} CheckAuthorizationData;
+
+static void
+check_authorization_data_free (CheckAuthorizationData *data)
+{
+  g_object_unref (data->user_for_subject);
+  g_free (data->action_id);
+  if (data->details != NULL)
+    g_object_unref (data->details);
+  g_free (data);
+}
+
+static void
+check_authorization_in_thread (GSimpleAsyncResult *simple,
+                               GObject            *object,
+                               GCancellable       *cancellable)
+{
+  CheckAuthorizationData *data;
+  GError *error = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      g_simple_async_result_take_error (simple, error);
+      return;
+    }
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  data->result = polkit_backend_local_authority_check_authorization_sync (POLKIT_BACKEND_LOCAL_AUTHORITY (object),
+                                                                          data->user_for_subject,
+                                                                          data->subject_is_local,
+                                                                          data->subject_is_active,
+                                                                          data->action_id,
+                                                                          data->details);
+}
+
+/**
+ * polkit_backend_local_authority_check_authorization:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @user_for_subject: The #PolkitUnixUser asking for authorization.
+ * @subject_is_local: Whether the subject is in a local session.
+ * @subject_is_active: Whether the subject is in an active session.
+ * @action_id: The action id to check for.
+ * @details: (allow-none): Details for @action_id, or %NULL.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the check is done.
+ * @user_data: The data to pass to @callback.
+ *
+ * Asynchronously does the same as
+ * polkit_backend_local_authority_check_authorization_sync() in a worker
+ * thread, so that a main loop is not blocked while the groups of the user
+ * are looked up.  @details must not be used until the check is done.
+ * Cancelling only has an effect before the check has started.
+ *
+ * @callback is invoked in the thread-default main context of the thread
+ * calling this function; call
+ * polkit_backend_local_authority_check_authorization_finish() in it to get
+ * the result.
+ */
+void
+polkit_backend_local_authority_check_authorization (PolkitBackendLocalAuthority *authority,
+                                                    PolkitIdentity              *user_for_subject,
+                                                    gboolean                     subject_is_local,
+                                                    gboolean                     subject_is_active,
+                                                    const gchar                 *action_id,
+                                                    PolkitDetails               *details,
+                                                    GCancellable                *cancellable,
+                                                    GAsyncReadyCallback          callback,
+                                                    gpointer                     user_data)
+{
+  GSimpleAsyncResult *simple;
+  CheckAuthorizationData *data;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority));
+  g_return_if_fail (POLKIT_IS_UNIX_USER (user_for_subject));
+  g_return_if_fail (action_id != NULL);
+  g_return_if_fail (details == NULL || POLKIT_IS_DETAILS (details));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  data = g_new0 (CheckAuthorizationData, 1);
+  data->user_for_subject = g_object_ref (user_for_subject);
+  data->subject_is_local = subject_is_local;
+  data->subject_is_active = subject_is_active;
+  data->action_id = g_strdup (action_id);
+  data->details = details != NULL ? g_object_ref (details) : NULL;
+  data->result = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+
+  simple = g_simple_async_result_new (G_OBJECT (authority),
+                                      callback,
+                                      user_data,
+                                      polkit_backend_local_authority_check_authorization);
+  g_simple_async_result_set_op_res_gpointer (simple, data,
+                                             (GDestroyNotify) check_authorization_data_free);
+  g_simple_async_result_run_in_thread (simple, check_authorization_in_thread,
+                                       G_PRIORITY_DEFAULT, cancellable);
+  g_object_unref (simple);
+}
+
+/**
+ * polkit_backend_local_authority_check_authorization_finish:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @res: A #GAsyncResult obtained from the #GAsyncReadyCallback passed to
+ *     polkit_backend_local_authority_check_authorization().
+ * @error: (allow-none): Return location for error or %NULL.
+ *
+ * Finishes a check started with
+ * polkit_backend_local_authority_check_authorization().
+ *
+ * Returns: The configured authorization decision, or
+ *     %POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN if none applies or @error
+ *     is set because the check was cancelled.
+ */
+PolkitImplicitAuthorization
+polkit_backend_local_authority_check_authorization_finish (PolkitBackendLocalAuthority  *authority,
+                                                           GAsyncResult                 *res,
+                                                           GError                      **error)
+{
+  GSimpleAsyncResult *simple;
+  CheckAuthorizationData *data;
+
+  g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority), POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+  g_return_val_if_fail (g_simple_async_result_is_valid (res,
+                                                        G_OBJECT (authority),
+                                                        polkit_backend_local_authority_check_authorization),
+                        POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+  g_return_val_if_fail (error == NULL || *error == NULL, POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+
+  simple = G_SIMPLE_ASYNC_RESULT (res);
+  if (g_simple_async_result_propagate_error (simple, error))
+    return POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+
+  data = g_simple_async_result_get_op_res_gpointer (simple);
+  return data->result;
+}
+
+/**
+ * polkit_backend_local_authority_check_authorization_traced:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @user_for_subject: The #PolkitUnixUser asking for authorization.
+ * @subject_is_local: Whether the subject is in a local session.
+ * @subject_is_active: Whether the subject is in an active session.
+ * @action_id: The action id to check for.
+ * @details: (allow-none): Details for @action_id, or %NULL.
+ * @out_trace: (allow-none): Return location for where the time of the
+ *     check went.  Free with polkit_backend_local_authority_trace_clear().
+ *
+ * Does the same as
+ * polkit_backend_local_authority_check_authorization_sync(), and also
+ * reports the time spent in each phase and store, and the entry that
+ * decided the result.  The totals over all checks are reported by
+ * polkit_backend_local_authority_foreach_statistic() whether traced or
+ * not.  Work done by checks running in other threads at the same time
+ * is included in the trace.
+ *
+ * Returns: The configured authorization decision, or
+ *     %POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN if none applies.
+ */
+PolkitImplicitAuthorization
+polkit_backend_local_authority_check_authorization_traced (PolkitBackendLocalAuthority      *authority,
+                                                           PolkitIdentity                   *user_for_subject,
+                                                           gboolean                          subject_is_local,
+                                                           gboolean                          subject_is_active,
+                                                           const gchar                      *action_id,
+                                                           PolkitDetails                    *details,
+                                                           PolkitBackendLocalAuthorityTrace *out_trace)
+{
+  PolkitBackendLocalAuthorityPrivate *priv;
+  PolkitImplicitAuthorization ret;
+  TraceCounters before;
+  RuleSet *rule_set;
+  const gchar *deciding_id;
+  gboolean use_cache;
+  gboolean cached;
+  uid_t uid;
+  guint64 generation;
+  gint64 expires_at;
+  gint64 start;
+  gint64 duration;
+  guint n;
+
+  g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority), POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+  g_return_val_if_fail (details == NULL || POLKIT_IS_DETAILS (details), POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+
+  priv = authority->priv;
+
+  start = g_get_monotonic_time ();
+  if (out_trace != NULL)
+    {
+      memset (out_trace, 0, sizeof (*out_trace));
+      get_trace_counters (authority, &before);
+    }
+
+  uid = polkit_unix_user_get_uid (POLKIT_UNIX_USER (user_for_subject));
+  deciding_id = NULL;
+  rule_set = NULL;
+
+  g_mutex_lock (priv->lock);
+  /* Cached results do not include return values for @details */
+  use_cache = priv->result_cache_size != 0 && details == NULL;
+  cached = use_cache &&
+    lookup_cached_result (authority, uid, subject_is_local, subject_is_active,
+                          action_id, &ret);
+  g_mutex_unlock (priv->lock);
+  if (!cached)
+    {
+      rule_set = get_rule_set (authority, &generation);
+      ret = evaluate_authorization (authority, rule_set, user_for_subject, subject_is_local,
+                                    subject_is_active, action_id, details, &expires_at,
+                                    &deciding_id);
+
+      if (use_cache)
+        {
+          g_mutex_lock (priv->lock);
+          add_cached_result (authority, uid, subject_is_local, subject_is_active,
+                             action_id, ret, generation, expires_at);
+          g_mutex_unlock (priv->lock);
+        }
+    }
+
+  duration = g_get_monotonic_time () - start;
+  g_mutex_lock (priv->lock);
+  priv->checks++;
+  priv->check_time += duration;
+  for (n = 0; n < N_CHECK_TIME_BUCKETS; n++)
+    {
+      if (duration <= check_time_bounds[n])
+        {
+          priv->check_time_buckets[n]++;
+          break;
+        }
+    }
+  g_mutex_unlock (priv->lock);
+
+  if (out_trace != NULL)
+    {
+      out_trace->cached = cached;
+      out_trace->total_time = duration;
+      out_trace->deciding_id = g_strdup (deciding_id);
+      set_trace (authority, &before, out_trace);
+    }
+  if (rule_set != NULL)
+    rule_set_unref (rule_set);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authority_trace_clear:
+ * @trace: A #PolkitBackendLocalAuthorityTrace.
+ *
+ * Frees the data of @trace set by
+ * polkit_backend_local_authority_check_authorization_traced().
+ */
+void
+polkit_backend_local_authority_trace_clear (PolkitBackendLocalAuthorityTrace *trace)
+{
+  guint n;
+
+  g_return_if_fail (trace != NULL);
+
+  if (trace->stores != NULL)
+    {
+      for (n = 0; n < trace->stores->len; n++)
+        g_free (g_array_index (trace->stores, PolkitBackendLocalAuthorityStoreTrace, n).path);
+      g_array_free (trace->stores, TRUE);
+    }
+  g_free (trace->deciding_id);
+  memset (trace, 0, sizeof (*trace));
+}
+
+/**
+ * polkit_backend_local_authority_foreach_statistic:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @func: Function to call for each counter.
+ * @user_data: User data to pass to @func.
+ *
+ * Calls @func with the name and current value of each of the counters
+ * kept by @authority, in a fixed order.
+ */
+void
+polkit_backend_local_authority_foreach_statistic (PolkitBackendLocalAuthority             *authority,
+                                                  PolkitBackendLocalAuthorityStatisticFunc func,
+                                                  gpointer                                 user_data)
+{
+  PolkitBackendLocalAuthorityPrivate *priv;
+  guint64 hits, misses;
+  guint entries;
+  guint64 change_events, reloads;
+  guint64 entries_scanned, entries_matched;
+  guint64 innetgr_calls;
+  gint64 load_time, innetgr_time;
+  guint64 group_cache_hits, group_cache_misses, group_cache_entries;
+  guint64 group_lookups_coalesced, group_lookup_timeouts;
+  guint64 result_cache_hits, result_cache_misses, result_cache_entries;
+  guint64 result_cache_kept, result_cache_invalidated;
+  guint64 decision_table_builds, decision_table_hits, decision_table_entries;
+  gint64 decision_table_build_time;
+  guint64 checks;
+  gint64 check_time, groups_time;
+  guint n_shadowed;
+  GList *l;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority));
+  g_return_if_fail (func != NULL);
+
+  priv = authority->priv;
+
+  /* Taken first, so that @func is called without locks held */
+  g_mutex_lock (priv->update_lock);
+  change_events = priv->store_change_events;
+  reloads = priv->rule_set_reloads;
+  load_time = priv->store_load_time;
+  entries_scanned = priv->store_entries_scanned;
+  entries_matched = priv->store_entries_matched;
+  for (l = priv->authorization_stores; l != NULL; l = l->next)
+    {
+      guint64 store_change_events;
+      guint64 store_entries_scanned, store_entries_matched;
+      gint64 store_load_time;
+
+      polkit_backend_local_authorization_store_get_reload_stats (l->data,
+                                                                 &store_change_events,
+                                                                 NULL, NULL);
+      change_events += store_change_events;
+      polkit_backend_local_authorization_store_get_lookup_stats (l->data,
+                                                                 &store_load_time,
+                                                                 &store_entries_scanned,
+                                                                 &store_entries_matched);
+      load_time += store_load_time;
+      entries_scanned += store_entries_scanned;
+      entries_matched += store_entries_matched;
+    }
+  n_shadowed = priv->n_shadowed;
+  g_mutex_unlock (priv->update_lock);
+
+  g_mutex_lock (priv->lock);
+  group_cache_hits = priv->group_cache_hits;
+  group_cache_misses = priv->group_cache_misses;
+  group_cache_entries = g_hash_table_size (priv->groups_by_uid);
+  group_lookups_coalesced = priv->group_lookups_coalesced;
+  group_lookup_timeouts = priv->group_lookup_timeouts;
+  result_cache_hits = priv->result_cache_hits;
+  result_cache_misses = priv->result_cache_misses;
+  result_cache_entries = g_hash_table_size (priv->results);
+  result_cache_kept = priv->result_cache_kept;
+  result_cache_invalidated = priv->result_cache_invalidated;
+  decision_table_builds = priv->decision_table_builds;
+  decision_table_build_time = priv->decision_table_build_time;
+  decision_table_hits = priv->decision_table_hits;
+  if (priv->rule_set != NULL && priv->rule_set->decision_table != NULL)
+    decision_table_entries = priv->rule_set->decision_table->n_decisions;
+  else
+    decision_table_entries = 0;
+  checks = priv->checks;
+  check_time = priv->check_time;
+  groups_time = priv->groups_time;
+  g_mutex_unlock (priv->lock);
+
+  func ("group_cache_hits", group_cache_hits, user_data);
+  func ("group_cache_misses", group_cache_misses, user_data);
+  func ("group_cache_entries", group_cache_entries, user_data);
+  func ("group_lookups_coalesced", group_lookups_coalesced, user_data);
+  func ("group_lookup_timeouts", group_lookup_timeouts, user_data);
+
+  polkit_backend_netgroup_cache_get_stats (priv->netgroup_cache, &hits, &misses, &entries);
+  func ("netgroup_cache_hits", hits, user_data);
+  func ("netgroup_cache_misses", misses, user_data);
+  func ("netgroup_cache_entries", entries, user_data);
+
+  func ("store_change_events", change_events, user_data);
+  func ("store_reloads", reloads, user_data);
+
+  func ("result_cache_hits", result_cache_hits, user_data);
+  func ("result_cache_misses", result_cache_misses, user_data);
+  func ("result_cache_entries", result_cache_entries, user_data);
+  func ("result_cache_kept", result_cache_kept, user_data);
+  func ("result_cache_invalidated", result_cache_invalidated, user_data);
+
+  func ("decision_table_hits", decision_table_hits, user_data);
+  func ("decision_table_entries", decision_table_entries, user_data);
+  func ("decision_table_builds", decision_table_builds, user_data);
+  func ("decision_table_build_time_us", decision_table_build_time, user_data);
+
+  func ("shadowed_entries", n_shadowed, user_data);
+
+  func ("checks", checks, user_data);
+  func ("check_time_us", check_time, user_data);
+  func ("group_lookup_time_us", groups_time, user_data);
+  func ("store_load_time_us", load_time, user_data);
+  polkit_backend_netgroup_cache_get_innetgr_stats (priv->netgroup_cache, &innetgr_calls,
+                                                   &innetgr_time);
+  func ("innetgr_calls", innetgr_calls, user_data);
+  func ("innetgr_time_us", innetgr_time, user_data);
+  func ("entries_scanned", entries_scanned, user_data);
+  func ("entries_matched", entries_matched, user_data);
+}
+
+/**
+ * polkit_backend_local_authority_get_check_time_histogram:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @func: Function to call for each bucket.
+ * @user_data: User data to pass to @func.
+ * @out_checks: Return location for the number of all checks.
+ * @out_check_time: Return location for the microseconds spent on them.
+ *
+ * Calls @func with increasing upper bounds, in microseconds, and the
+ * number of checks that took at most that long.  Checks that took
+ * longer than the last bound are only included in @out_checks.  All
+ * values are copied at the same time, so no bucket exceeds @out_checks
+ * even while checks are running.
+ */
+void
+polkit_backend_local_authority_get_check_time_histogram (PolkitBackendLocalAuthority          *authority,
+                                                         PolkitBackendLocalAuthorityBucketFunc func,
+                                                         gpointer                              user_data,
+                                                         guint64                              *out_checks,
+                                                         gint64                               *out_check_time)
+{
+  guint64 buckets[N_CHECK_TIME_BUCKETS];
+  guint64 count;
+  guint n;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority));
+  g_return_if_fail (func != NULL);
+  g_return_if_fail (out_checks != NULL);
+  g_return_if_fail (out_check_time != NULL);
+
+  g_mutex_lock (authority->priv->lock);
+  memcpy (buckets, authority->priv->check_time_buckets, sizeof (buckets));
+  *out_checks = authority->priv->checks;
+  *out_check_time = authority->priv->check_time;
+  g_mutex_unlock (authority->priv->lock);
+
+  count = 0;
+  for (n = 0; n < N_CHECK_TIME_BUCKETS; n++)
+    {
+      count += buckets[n];
+      func (check_time_bounds[n], count, user_data);
+    }
+}
+
+/**
+ * polkit_backend_local_authority_foreach_store_statistic:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @func: Function to call for each counter.
+ * @user_data: User data to pass to @func.
+ *
+ * Calls @func with the directory, name and current value of each of the
+ * counters kept for the authorization stores of @authority, store by
+ * store in order of precedence.  Stores that have not been read yet
+ * report no files.  The counters start again from zero when the set of
+ * stores changes.  The set of stores can not change while @func is
+ * called, so it must not change properties of @authority.
+ */
+void
+polkit_backend_local_authority_foreach_store_statistic (PolkitBackendLocalAuthority                  *authority,
+                                                        PolkitBackendLocalAuthorityStoreStatisticFunc func,
+                                                        gpointer                                      user_data)
+{
+  GList *l;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority));
+  g_return_if_fail (func != NULL);
+
+  g_mutex_lock (authority->priv->update_lock);
+  for (l = authority->priv->authorization_stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorizationStore *store = l->data;
+      GFile *directory;
+      gchar *path;
+      guint n_files, n_entries, n_errors;
+      guint64 change_events, reloads;
+      gint64 reload_time, load_time;
+
+      g_object_get (store, "directory", &directory, NULL);
+      path = g_file_get_path (directory);
+      g_object_unref (directory);
+
+      polkit_backend_local_authorization_store_get_content_stats (store, &n_files, &n_entries,
+                                                                  &n_errors);
+      polkit_backend_local_authorization_store_get_reload_stats (store, &change_events, &reloads,
+                                                                 &reload_time);
+      polkit_backend_local_authorization_store_get_lookup_stats (store, &load_time, NULL, NULL);
+      func (path, "files", n_files, user_data);
+      func (path, "entries", n_entries, user_data);
+      func (path, "parse_errors", n_errors, user_data);
+      func (path, "change_events", change_events, user_data);
+      func (path, "reloads", reloads, user_data);
+      func (path, "reload_time_us", reload_time, user_data);
+      func (path, "load_time_us", load_time, user_data);
+
+      g_free (path);
+    }
+  g_mutex_unlock (authority->priv->update_lock);
+}
+
+/**
+ * polkit_backend_local_authority_foreach_shadowed:
+ * @authority: A #PolkitBackendLocalAuthority.
+ * @func: Function to call for each shadowed entry.
+ * @user_data: User data to pass to @func.
+ *
+ * Reads all authorization stores and calls @func with the id of each
+ * authorization entry that never changes the result of a check, and the
+ * id of a later entry that overrides it, in order of precedence.  This
+ * does not depend on #PolkitBackendLocalAuthority:eliminate-shadowed.
+ * As for polkit_backend_local_authority_foreach_store_statistic(), @func
+ * must not change properties of @authority.
+ */
+void
+polkit_backend_local_authority_foreach_shadowed (PolkitBackendLocalAuthority            *authority,
+                                                 PolkitBackendLocalAuthorityShadowedFunc func,
+                                                 gpointer                                user_data)
+{
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORITY (authority));
+  g_return_if_fail (func != NULL);
+
+  g_mutex_lock (authority->priv->update_lock);
+  load_authorization_stores (authority);
+  polkit_backend_local_authorization_store_foreach_shadowed (authority->priv->authorization_stores,
+                                                             func, user_data);
+  g_mutex_unlock (authority->priv->update_lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Returns a reference to the shared #PolkitUnixGroup for @gid */
+static PolkitIdentity *
+get_unix_group (PolkitBackendLocalAuthority *authority,
+                gid_t                        gid)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  PolkitIdentity *group;
+
+  g_mutex_lock (priv->lock);
+  group = g_hash_table_lookup (priv->unix_groups, GINT_TO_POINTER (gid));
+  if (group == NULL)
+    {
+      group = polkit_unix_group_new (gid);
+      g_hash_table_insert (priv->unix_groups, GINT_TO_POINTER (gid), group);
+    }
+  g_object_ref (group);
+  g_mutex_unlock (priv->lock);
+
+  return group;
+}
+
+/* Called without the lock held, the lookups may take long */
+static GPtrArray *
+lookup_groups_for_user (PolkitBackendLocalAuthority *authority,
+                        PolkitIdentity              *user)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  uid_t uid;
+  struct passwd pwd;
+  struct passwd *passwd;
+  gchar *buffer;
+  gsize buffer_size;
+  gid_t *gids;
+  gint gids_size;
+  GPtrArray *result;
+  int num_groups;
+  int rc;
+  int n;
+
+  num_groups = 0;
+  gids = NULL;
+
+  uid = polkit_unix_user_get_uid (POLKIT_UNIX_USER (user));
+  buffer_size = 1024;
+  buffer = g_malloc (buffer_size);
+  while ((rc = getpwuid_r (uid, &pwd, buffer, buffer_size, &passwd)) == ERANGE)
+    {
+      buffer_size *= 2;
+      buffer = g_realloc (buffer, buffer_size);
+    }
+  if (rc != 0 || passwd == NULL)
+    {
+      g_warning ("No user with uid %d", uid);
+      goto out;
+    }
+
+  gids_size = g_atomic_int_get (&priv->gid_buffer_size);
+  gids = g_new (gid_t, gids_size);
+  while (TRUE)
+    {
+      num_groups = gids_size;
+      if (getgrouplist (passwd->pw_name,
+                        passwd->pw_gid,
+                        gids,
+                        &num_groups) >= 0)
+        break;
+
+      /* If the buffer is too small, num_groups is set to the size needed.
+         Retry, because group membership may change in the meantime. */
+      if (num_groups <= gids_size)
+        {
+          g_warning ("Error looking up groups for uid %d: %s", uid, g_strerror (errno));
+          num_groups = 0;
+          goto out;
+        }
+      gids_size = num_groups;
+      gids = g_renew (gid_t, gids, gids_size);
+      /* Later lookups start with a buffer of this size */
+      g_atomic_int_set (&priv->gid_buffer_size, gids_size);
+    }
+
+ out:
+  result = g_ptr_array_new_full (num_groups, (GDestroyNotify) polkit_backend_local_identity_keys_free);
+  /* In reverse getgrouplist() order, which later groups have always been
+     evaluated in */
+  for (n = num_groups - 1; n >= 0; n--)
+    {
+      PolkitIdentity *group;
+
+      group = get_unix_group (authority, gids[n]);
+      g_ptr_array_add (result, polkit_backend_local_identity_keys_new (group));
+      g_object_unref (group);
+    }
+  g_free (gids);
+  g_free (buffer);
+
+  return result;
+}
+
+/* Looks up the groups for @lookup, caches them and wakes up the checks
+   waiting for them.  Called without the lock held, in the thread of the
+   check that started the lookup or in group_lookup_pool. */
+static void
+run_group_lookup (GroupLookup *lookup)
+{
+  PolkitBackendLocalAuthority *authority = lookup->authority;
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GPtrArray *groups;
+  gpointer key;
+  guint ttl;
+
+  groups = lookup_groups_for_user (authority, lookup->user);
+  key = GINT_TO_POINTER (polkit_unix_user_get_uid (POLKIT_UNIX_USER (lookup->user)));
+
+  g_mutex_lock (priv->lock);
+  lookup->groups = groups;
+  if (g_hash_table_lookup (priv->group_lookups, key) == lookup)
+    g_hash_table_remove (priv->group_lookups, key);
+
+  /* Not cached if the TTL or the group database changed meanwhile */
+  ttl = priv->group_cache_ttl;
+  if (ttl != 0 && priv->result_generation == lookup->generation)
+    {
+      GroupCacheEntry *entry;
+
+      entry = g_new0 (GroupCacheEntry, 1);
+      entry->groups = g_ptr_array_ref (groups);
+      entry->expires_at = lookup->started_at + (gint64) ttl * G_USEC_PER_SEC;
+      g_hash_table_insert (priv->groups_by_uid, key, entry);
+    }
+
+  g_cond_broadcast (priv->group_lookup_cond);
+  group_lookup_unref (lookup);
+  g_mutex_unlock (priv->lock);
+}
+
+static void
+run_group_lookup_in_thread (gpointer data,
+                            gpointer user_data)
+{
+  run_group_lookup (data);
+}
+
+/* Returns a reference to an array of PolkitBackendLocalIdentityKeys for the
+   groups of @user, which must not be modified.  Checks that miss the cache
+   for the same user at the same time share one lookup; see
+   #PolkitBackendLocalAuthority:group-lookup-timeout for when the expired
+   groups are used instead. */
+static GPtrArray *
+get_groups_for_user (PolkitBackendLocalAuthority *authority,
+                     PolkitIdentity              *user,
+                     gint64                      *out_expires_at)
+{
+  PolkitBackendLocalAuthorityPrivate *priv = authority->priv;
+  GroupCacheEntry *entry;
+  GroupLookup *lookup;
+  GPtrArray *groups;
+  gpointer key;
+  gboolean run_here;
+  GTimeVal deadline;
+  guint timeout;
+  guint ttl;
+  gint64 now;
+
+  key = GINT_TO_POINTER (polkit_unix_user_get_uid (POLKIT_UNIX_USER (user)));
+
+  g_mutex_lock (priv->lock);
+  ttl = priv->group_cache_ttl;
+  now = g_get_monotonic_time ();
+  entry = NULL;
+  if (ttl != 0)
+    {
+      entry = g_hash_table_lookup (priv->groups_by_uid, key);
+      if (entry != NULL &&
+          (ttl == G_MAXUINT || now < entry->expires_at))
+        {
+          priv->group_cache_hits++;
+          *out_expires_at = ttl == G_MAXUINT ? G_MAXINT64 : entry->expires_at;
+          groups = g_ptr_array_ref (entry->groups);
+          g_mutex_unlock (priv->lock);
+          return groups;
+        }
+      priv->group_cache_misses++;
+    }
+
+  /* Lookups started before the group database changed are not joined */
+  run_here = FALSE;
+  lookup = g_hash_table_lookup (priv->group_lookups, key);
+  if (lookup != NULL && lookup->generation == priv->result_generation)
+    {
+      lookup->ref_count++;
+      priv->group_lookups_coalesced++;
+    }
+  else
+    {
+      /* One reference for running it, one for waiting for it */
+      lookup = g_new0 (GroupLookup, 1);
+      lookup->ref_count = 2;
+      lookup->authority = authority;
+      lookup->user = g_object_ref (user);
+      lookup->generation = priv->result_generation;
+      lookup->started_at = now;
+      g_hash_table_insert (priv->group_lookups, key, lookup);
+
+      /* Only worth running in another thread if there is something to use
+         when it takes too long */
+      run_here = TRUE;
+      if (entry != NULL && priv->group_lookup_timeout != 0)
+        {
+          if (priv->group_lookup_pool == NULL)
+            priv->group_lookup_pool = g_thread_pool_new (run_group_lookup_in_thread, NULL,
+                                                         MAX_GROUP_LOOKUP_THREADS, FALSE,
+                                                         NULL);
+          if (priv->group_lookup_pool != NULL)
+            {
+              g_thread_pool_push (priv->group_lookup_pool, lookup, NULL);
+              run_here = FALSE;
+            }
+        }
+    }
+
+  if (run_here)
+    {
+      g_mutex_unlock (priv->lock);
+      run_group_lookup (lookup);
+      g_mutex_lock (priv->lock);
+    }
+
+  timeout = priv->group_lookup_timeout;
+  g_get_current_time (&deadline);
+  g_time_val_add (&deadline, (glong) MIN ((gint64) timeout * 1000, G_MAXLONG));
+  while (lookup->groups == NULL)
+    {
+      if (timeout == 0)
+        {
+          g_cond_wait (priv->group_lookup_cond, priv->lock);
+          continue;
+        }
+      if (g_cond_timed_wait (priv->group_lookup_cond, priv->lock, &deadline))
+        continue;
+
+      /* Looked up again, the entry may have been replaced meanwhile */
+      entry = g_hash_table_lookup (priv->groups_by_uid, key);
+      if (entry != NULL)
+        {
+          priv->group_lookup_timeouts++;
+          /* Results computed from these are not worth caching */
+          *out_expires_at = now;
+          groups = g_ptr_array_ref (entry->groups);
+          group_lookup_unref (lookup);
+          g_mutex_unlock (priv->lock);
+          return groups;
+        }
+      /* Nothing to use instead */
+      timeout = 0;
+    }
+
+  if (ttl == 0)
+    *out_expires_at = now;
+  else if (ttl == G_MAXUINT)
+    *out_expires_at = G_MAXINT64;
+  else
+    *out_expires_at = lookup->started_at + (gint64) ttl * G_USEC_PER_SEC;
+  groups = g_ptr_array_ref (lookup->groups);
+  group_lookup_unref (lookup);
+  g_mutex_unlock (priv->lock);
+
+  return groups;
+}
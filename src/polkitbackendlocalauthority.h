@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#ifndef __POLKIT_BACKEND_LOCAL_AUTHORITY_H
+#define __POLKIT_BACKEND_LOCAL_AUTHORITY_H
+
+#include <glib-object.h>
+#include <gio/gio.h>
+#include <polkit/polkit.h>
+
+G_BEGIN_DECLS
+
+/* Defaults for the programs, which define PACKAGE_LOCALSTATE_DIR and
+   PACKAGE_SYSCONF_DIR */
+#define POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_PATHS                    \
+  PACKAGE_LOCALSTATE_DIR "/lib/polkit-1/localauthority;"               \
+  PACKAGE_SYSCONF_DIR "/polkit-1/localauthority"
+#define POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_SNAPSHOT                 \
+  PACKAGE_LOCALSTATE_DIR "/cache/polkit-1/localauthority.snapshot"
+#define POLKIT_BACKEND_LOCAL_AUTHORITY_DEFAULT_CONFIG_PATH              \
+  PACKAGE_SYSCONF_DIR "/polkit-1/localauthority.conf.d"
+
+#define POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY         (polkit_backend_local_authority_get_type ())
+#define POLKIT_BACKEND_LOCAL_AUTHORITY(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY, PolkitBackendLocalAuthority))
+#define POLKIT_BACKEND_LOCAL_AUTHORITY_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY, PolkitBackendLocalAuthorityClass))
+#define POLKIT_BACKEND_LOCAL_AUTHORITY_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY,PolkitBackendLocalAuthorityClass))
+#define POLKIT_BACKEND_IS_LOCAL_AUTHORITY(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY))
+#define POLKIT_BACKEND_IS_LOCAL_AUTHORITY_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), POLKIT_BACKEND_TYPE_LOCAL_AUTHORITY))
+
+typedef struct _PolkitBackendLocalAuthority         PolkitBackendLocalAuthority;
+typedef struct _PolkitBackendLocalAuthorityClass    PolkitBackendLocalAuthorityClass;
+typedef struct _PolkitBackendLocalAuthorityPrivate  PolkitBackendLocalAuthorityPrivate;
+
+/* Called with the name and value of a counter */
+typedef void (*PolkitBackendLocalAuthorityStatisticFunc) (const gchar *name,
+                                                          guint64      value,
+                                                          gpointer     user_data);
+
+/* Called with the upper bound of a histogram bucket, in microseconds, and
+   the number of values up to it */
+typedef void (*PolkitBackendLocalAuthorityBucketFunc) (gint64   upper_bound,
+                                                       guint64  count,
+                                                       gpointer user_data);
+
+/* Called with the directory of an authorization store, and the name and
+   value of one of its counters */
+typedef void (*PolkitBackendLocalAuthorityStoreStatisticFunc) (const gchar *directory,
+                                                               const gchar *name,
+                                                               guint64      value,
+                                                               gpointer     user_data);
+
+/* Called with the id of an authorization entry, and the id of a later entry
+   that overrides it */
+typedef void (*PolkitBackendLocalAuthorityShadowedFunc) (const gchar *id,
+                                                         const gchar *shadowed_by_id,
+                                                         gpointer     user_data);
+
+/**
+ * PolkitBackendLocalAuthorityStoreTrace:
+ * @path: The directory of the store.
+ * @load_time: Microseconds spent reading the store.
+ * @entries_scanned: Number of entries for the action matched against the
+ *     identities.
+ * @entries_matched: Number of those that matched an identity.
+ *
+ * The work done in one store for a check.
+ */
+typedef struct
+{
+  gchar *path;
+  gint64 load_time;
+  guint entries_scanned;
+  guint entries_matched;
+} PolkitBackendLocalAuthorityStoreTrace;
+
+/**
+ * PolkitBackendLocalAuthorityTrace:
+ * @cached: Whether the result was remembered; no other work is done then.
+ * @total_time: Microseconds the check took.
+ * @groups_time: Microseconds spent looking up the groups of the user.
+ * @load_time: Microseconds spent reading authorization stores.
+ * @innetgr_time: Microseconds spent in innetgr() calls.
+ * @match_time: Microseconds spent matching entries and otherwise
+ *     evaluating the stores, excluding @load_time and @innetgr_time.
+ * @innetgr_calls: Number of innetgr() calls.
+ * @entries_scanned: Number of entries for the action, in all stores,
+ *     matched against the identities.
+ * @entries_matched: Number of those that matched an identity.
+ * @deciding_id: The id of the entry the result was taken from,
+ *     <literal>filename::group</literal>, or %NULL.
+ * @stores: (element-type PolkitBackendLocalAuthorityStoreTrace): The work
+ *     done in each store, in order of precedence.
+ *
+ * Where the time of a check went, see
+ * polkit_backend_local_authority_check_authorization_traced().
+ */
+typedef struct
+{
+  gboolean cached;
+  gint64 total_time;
+  gint64 groups_time;
+  gint64 load_time;
+  gint64 innetgr_time;
+  gint64 match_time;
+  guint innetgr_calls;
+  guint entries_scanned;
+  guint entries_matched;
+  gchar *deciding_id;
+  GArray *stores;
+} PolkitBackendLocalAuthorityTrace;
+
+struct _PolkitBackendLocalAuthority
+{
+  GObject parent_instance;
+  PolkitBackendLocalAuthorityPrivate *priv;
+};
+
+struct _PolkitBackendLocalAuthorityClass
+{
+  /*< public >*/
+  GObjectClass parent_class;
+
+  /* Signals */
+  void (*changed)  (PolkitBackendLocalAuthority *authority);
+
+  /*< private >*/
+  /* Padding for future expansion */
+  void (*_polkit_reserved1) (void);
+  void (*_polkit_reserved2) (void);
+  void (*_polkit_reserved3) (void);
+  void (*_polkit_reserved4) (void);
+  void (*_polkit_reserved5) (void);
+  void (*_polkit_reserved6) (void);
+  void (*_polkit_reserved7) (void);
+  void (*_polkit_reserved8) (void);
+};
+
+GType                        polkit_backend_local_authority_get_type                 (void) G_GNUC_CONST;
+PolkitBackendLocalAuthority *polkit_backend_local_authority_new                      (const gchar                 *auth_store_paths);
+PolkitBackendLocalAuthority *polkit_backend_local_authority_new_from_snapshot        (const gchar                 *auth_store_paths,
+                                                                                      const gchar                 *filename,
+                                                                                      GError                     **error);
+GVariant                    *polkit_backend_local_authority_serialize                (PolkitBackendLocalAuthority *authority);
+PolkitImplicitAuthorization  polkit_backend_local_authority_check_authorization_sync (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitIdentity              *user_for_subject,
+                                                                                      gboolean                     subject_is_local,
+                                                                                      gboolean                     subject_is_active,
+                                                                                      const gchar                 *action_id,
+                                                                                      PolkitDetails               *details);
+void                         polkit_backend_local_authority_check_authorization      (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitIdentity              *user_for_subject,
+                                                                                      gboolean                     subject_is_local,
+                                                                                      gboolean                     subject_is_active,
+                                                                                      const gchar                 *action_id,
+                                                                                      PolkitDetails               *details,
+                                                                                      GCancellable                *cancellable,
+                                                                                      GAsyncReadyCallback          callback,
+                                                                                      gpointer                     user_data);
+PolkitImplicitAuthorization  polkit_backend_local_authority_check_authorization_finish (PolkitBackendLocalAuthority  *authority,
+                                                                                        GAsyncResult                 *res,
+                                                                                        GError                      **error);
+PolkitImplicitAuthorization  polkit_backend_local_authority_check_authorization_traced (PolkitBackendLocalAuthority    *authority,
+                                                                                        PolkitIdentity                 *user_for_subject,
+                                                                                        gboolean                        subject_is_local,
+                                                                                        gboolean                        subject_is_active,
+                                                                                        const gchar                    *action_id,
+                                                                                        PolkitDetails                  *details,
+                                                                                        PolkitBackendLocalAuthorityTrace *out_trace);
+void                         polkit_backend_local_authority_trace_clear              (PolkitBackendLocalAuthorityTrace *trace);
+void                         polkit_backend_local_authority_foreach_statistic        (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitBackendLocalAuthorityStatisticFunc func,
+                                                                                      gpointer                     user_data);
+void                         polkit_backend_local_authority_get_check_time_histogram (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitBackendLocalAuthorityBucketFunc func,
+                                                                                      gpointer                     user_data,
+                                                                                      guint64                     *out_checks,
+                                                                                      gint64                      *out_check_time);
+void                         polkit_backend_local_authority_foreach_store_statistic  (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitBackendLocalAuthorityStoreStatisticFunc func,
+                                                                                      gpointer                     user_data);
+void                         polkit_backend_local_authority_foreach_shadowed         (PolkitBackendLocalAuthority *authority,
+                                                                                      PolkitBackendLocalAuthorityShadowedFunc func,
+                                                                                      gpointer                     user_data);
+
+G_END_DECLS
+
+#endif /* __POLKIT_BACKEND_LOCAL_AUTHORITY_H */
@@ -21,10 +21,15 @@
 
 #include "config.h"
 
-#include <netdb.h>
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
 #include <string.h>
 #include <polkit/polkit.h>
 #include "polkitbackendlocalauthorizationstore.h"
+#include "polkitbackendnetgroupcache.h"
+#include "polkitbackendpklaparser.h"
+#include "polkitbackendsnapshot.h"
 
 /* <internal>
  * SECTION:polkitbackendlocalauthorizationstore
@@ -33,8 +38,159 @@
  *
  * #PolkitBackendLocalAuthorizationStore is a utility class to watch
  * and read authorization files from a directory.
+ *
+ * Lookups are done in a #PolkitBackendLocalAuthorizationRules, an
+ * immutable snapshot of the entries of the store taken with
+ * polkit_backend_local_authorization_store_get_rules().  Reloads build new
+ * rules and replace the current ones, while lookups in progress keep
+ * using the rules they started with, so lookups may run in several
+ * threads without waiting for reloads or for each other.
  */
 
+/* How a Pattern is matched; only patterns with '?' or with '*' anywhere
+   but at the start or the end need a GPatternSpec */
+typedef enum
+{
+  PATTERN_EXACT,     /* "text" */
+  PATTERN_PREFIX,    /* "text*" */
+  PATTERN_SUFFIX,    /* "*text" */
+  PATTERN_CONTAINS,  /* "*text*" */
+  PATTERN_GLOB,
+} PatternKind;
+
+typedef struct
+{
+  PatternKind kind;
+  /* Not owned, the pattern without the leading and trailing '*', except
+     for PATTERN_GLOB */
+  const gchar *text;
+  gsize length;
+  /* Only for PATTERN_GLOB */
+  GPatternSpec *spec;
+} Pattern;
+
+/* Classifies @string, which must outlive @pattern */
+static void
+pattern_init (Pattern     *pattern,
+              const gchar *string)
+{
+  gsize length;
+  gboolean leading, trailing;
+  const gchar *wildcard;
+
+  length = strlen (string);
+  leading = length > 0 && string[0] == '*';
+  trailing = length > 1 && string[length - 1] == '*';
+
+  pattern->text = string + (leading ? 1 : 0);
+  pattern->length = length - (leading ? 1 : 0) - (trailing ? 1 : 0);
+  pattern->spec = NULL;
+
+  wildcard = strpbrk (pattern->text, "*?");
+  if (wildcard != NULL && wildcard < pattern->text + pattern->length)
+    {
+      pattern->kind = PATTERN_GLOB;
+      pattern->text = string;
+      pattern->length = length;
+      pattern->spec = g_pattern_spec_new (string);
+    }
+  else if (leading && trailing)
+    pattern->kind = PATTERN_CONTAINS;
+  else if (leading)
+    pattern->kind = PATTERN_SUFFIX;
+  else if (trailing)
+    pattern->kind = PATTERN_PREFIX;
+  else
+    pattern->kind = PATTERN_EXACT;
+}
+
+static void
+pattern_clear (Pattern *pattern)
+{
+  if (pattern->spec != NULL)
+    g_pattern_spec_free (pattern->spec);
+}
+
+/* Finds @needle of @needle_length bytes in @haystack */
+static gboolean
+contains_substring (const gchar *haystack,
+                    gsize        haystack_length,
+                    const gchar *needle,
+                    gsize        needle_length)
+{
+  const gchar *p;
+  const gchar *last;
+
+  if (needle_length == 0)
+    return TRUE;
+  if (haystack_length < needle_length)
+    return FALSE;
+
+  last = haystack + haystack_length - needle_length;
+  for (p = haystack; p <= last; p++)
+    {
+      p = memchr (p, needle[0], last - p + 1);
+      if (p == NULL)
+        return FALSE;
+      if (memcmp (p, needle, needle_length) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+pattern_match (const Pattern *pattern,
+               const gchar   *string)
+{
+  gsize length;
+
+  switch (pattern->kind)
+    {
+    case PATTERN_EXACT:
+      return strcmp (string, pattern->text) == 0;
+
+    case PATTERN_PREFIX:
+      return strncmp (string, pattern->text, pattern->length) == 0;
+
+    case PATTERN_SUFFIX:
+      length = strlen (string);
+      return length >= pattern->length
+        && memcmp (string + length - pattern->length, pattern->text, pattern->length) == 0;
+
+    case PATTERN_CONTAINS:
+      return contains_substring (string, strlen (string), pattern->text, pattern->length);
+
+    case PATTERN_GLOB:
+    default:
+      return g_pattern_match_string (pattern->spec, string);
+    }
+}
+
+/* A node in the trie of "prefix*" Action patterns.  All nodes of the trie
+   are in one array, the root first, and refer to each other by index. */
+typedef struct
+{
+  gchar c;
+  /* Indices of the first child and of the next sibling, 0 if none */
+  guint children;
+  guint next;
+
+  /* RuleEntry structures with a pattern ending at this node, or NULL */
+  GPtrArray *entries;
+} ActionPrefixNode;
+
+typedef struct _RuleEntry RuleEntry;
+
+/* An Action pattern that is neither literal nor a prefix */
+typedef struct
+{
+  Pattern pattern;
+  RuleEntry *entry;
+} ActionGlob;
+
+typedef struct _LookupCounters LookupCounters;
+
 struct _PolkitBackendLocalAuthorizationStorePrivate
 {
   GFile *directory;
@@ -42,10 +198,45 @@ struct _PolkitBackendLocalAuthorizationStorePrivate
 
   GFileMonitor *directory_monitor;
 
-  /* List of LocalAuthorization objects */
-  GList *authorizations;
+  /* Held while reading or changing the fields below, except the ones only
+     used by change notifications, and the shadowed flags of the files.
+     Lookups do not take it. */
+  GMutex *lock;
+
+  /* Milliseconds to collect change notifications for before handling them
+     all at once, 0 to handle each one immediately */
+  guint coalesce_timeout;
+  guint coalesce_source_id;
+  /* Monotonic time of the first pending notification, in microseconds */
+  gint64 coalesce_started;
+  /* basename => NULL, for the files with pending notifications */
+  GHashTable *pending_files;
+  guint pending_events;
+  guint64 change_events;
+  guint64 reloads;
+  /* Microseconds spent handling the notifications */
+  gint64 reload_time;
+
+  /* Snapshot source record for the directory */
+  GVariant *directory_source;
+
+  /* Snapshot source record for the directory when it was last listed, and
+     the basenames found then, see get_authorization_files() */
+  GVariant *listing_source;
+  GPtrArray *listing;
+
+  /* LocalAuthorizationFile objects, sorted by basename */
+  GPtrArray *files;
+
+  /* The rules for the current files, NULL until they have been read;
+     protected by the published_rules lock, see set_rules() */
+  PolkitBackendLocalAuthorizationRules *rules;
 
   gboolean has_data;
+
+  /* See polkit_backend_local_authorization_store_get_lookup_stats() */
+  gint64 load_time;
+  LookupCounters *counters;
 };
 
 enum
@@ -53,8 +244,13 @@ enum
   PROP_0,
   PROP_DIRECTORY,
   PROP_EXTENSION,
+  PROP_COALESCE_TIMEOUT,
 };
 
+/* A burst of change notifications is handled at the latest after this many
+   coalescing timeouts */
+#define MAX_COALESCE_TIMEOUTS 10
+
 enum
 {
   CHANGED_SIGNAL,
@@ -63,180 +259,344 @@ enum
 
 static guint signals[LAST_SIGNAL] = {0};
 
+/* Protects the rules field of all stores, only held to replace the rules
+   or take a reference */
+G_LOCK_DEFINE_STATIC (published_rules);
+
 static void polkit_backend_local_authorization_store_purge (PolkitBackendLocalAuthorizationStore *store);
 
 static void polkit_backend_local_authorization_store_ensure (PolkitBackendLocalAuthorizationStore *store);
 
+static gboolean reload_file (PolkitBackendLocalAuthorizationStore *store,
+                             const gchar                          *basename);
+
 G_DEFINE_TYPE (PolkitBackendLocalAuthorizationStore, polkit_backend_local_authorization_store, G_TYPE_OBJECT);
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* A range of elements in one of the arrays of a LocalAuthorizationFile */
 typedef struct
 {
-  gchar *id;
+  guint start;
+  guint length;
+} LocalAuthorizationRange;
+
+typedef struct _LocalAuthorizationFile LocalAuthorizationFile;
+
+typedef struct _LocalAuthorization
+{
+  /* The file the ranges below refer to */
+  LocalAuthorizationFile *file;
+
+  /* In file->chunk */
+  const gchar *id;
 
-  /* Identities with glob support; NULL entries mean "default identity" */
-  GList *identity_specs;
+  /* The configured strings, to be able to serialize the authorization;
+     in file->strings */
+  LocalAuthorizationRange identity_strings;
+  LocalAuthorizationRange action_strings;
 
-  /* Netgroup identity strings, which can not support glob syntax */
-  GList *netgroup_identities;
+  /* Whether "default" is one of the identities */
+  gboolean matches_default;
 
-  GList *action_specs;
+  /* Identities without wildcards in file->strings, and those with glob
+     support in file->identity_patterns */
+  LocalAuthorizationRange literal_identities;
+  LocalAuthorizationRange identity_patterns;
+
+  /* Netgroup names in file->strings, which can not support glob syntax */
+  LocalAuthorizationRange netgroup_identities;
 
   PolkitImplicitAuthorization result_any;
   PolkitImplicitAuthorization result_inactive;
   PolkitImplicitAuthorization result_active;
 
-  GHashTable *return_value;
+  /* Alternating keys and values in file->strings, without duplicate keys */
+  LocalAuthorizationRange return_value;
+
+  /* Left out of the rules built from now on, see
+     polkit_backend_local_authorization_store_eliminate_shadowed() */
+  gboolean shadowed;
 } LocalAuthorization;
 
+/* The authorization entries read from one file, compiled into flat arrays
+   which are not modified once the file has been read, except for the
+   shadowed flags.  Shared by the store and the rules built from it. */
+struct _LocalAuthorizationFile
+{
+  volatile gint ref_count;
+
+  /* In chunk */
+  const gchar *basename;
+
+  /* Snapshot source record of the file, taken before it was read */
+  GVariant *source;
+
+  /* LocalAuthorization structures in file order */
+  GArray *authorizations;
+
+  /* Holds all strings of the authorization entries, each one only once,
+     except netgroup names and ReturnValue keys, which repeat across files
+     and are interned with g_intern_string() */
+  GStringChunk *chunk;
+  /* Strings in chunk */
+  GPtrArray *strings;
+  /* Pattern structures for strings in chunk */
+  GArray *identity_patterns;
+
+  /* Number of groups that could not be parsed, or 1 if the file could not
+     be read at all */
+  guint n_errors;
+};
+
+#define LOCAL_AUTHORIZATION_FILE_STRINGS(file, range) \
+  ((const gchar * const *) (file)->strings->pdata + (range).start)
+
+/* Sinks @source */
+static LocalAuthorizationFile *
+local_authorization_file_new (const gchar *basename,
+                              GVariant    *source)
+{
+  LocalAuthorizationFile *file;
+
+  file = g_new0 (LocalAuthorizationFile, 1);
+  file->ref_count = 1;
+  file->chunk = g_string_chunk_new (1024);
+  file->basename = g_string_chunk_insert_const (file->chunk, basename);
+  file->source = g_variant_ref_sink (source);
+  file->authorizations = g_array_new (FALSE, FALSE, sizeof (LocalAuthorization));
+  file->strings = g_ptr_array_new ();
+  file->identity_patterns = g_array_new (FALSE, FALSE, sizeof (Pattern));
+
+  return file;
+}
+
+static LocalAuthorizationFile *
+local_authorization_file_ref (LocalAuthorizationFile *file)
+{
+  g_atomic_int_inc (&file->ref_count);
+  return file;
+}
+
 static void
-free_pattern_if_nonnull (gpointer pattern, gpointer user_data)
+local_authorization_file_unref (LocalAuthorizationFile *file)
+{
+  guint n;
+
+  if (!g_atomic_int_dec_and_test (&file->ref_count))
+    return;
+
+  for (n = 0; n < file->identity_patterns->len; n++)
+    pattern_clear (&g_array_index (file->identity_patterns, Pattern, n));
+
+  g_variant_unref (file->source);
+  g_array_free (file->authorizations, TRUE);
+  g_string_chunk_free (file->chunk);
+  g_ptr_array_unref (file->strings);
+  g_array_free (file->identity_patterns, TRUE);
+  g_free (file);
+}
+
+static LocalAuthorization *
+local_authorization_file_get (LocalAuthorizationFile *file,
+                              guint                   index)
 {
-  (void)user_data;
-  if (pattern != NULL)
-    g_pattern_spec_free (pattern);
+  return &g_array_index (file->authorizations, LocalAuthorization, index);
 }
 
+/* Starts a range at the end of file->strings */
 static void
-local_authorization_free (LocalAuthorization *authorization)
+begin_range (LocalAuthorizationFile  *file,
+             LocalAuthorizationRange *range)
 {
-  g_free (authorization->id);
-  g_list_foreach (authorization->identity_specs, free_pattern_if_nonnull, NULL);
-  g_list_free (authorization->identity_specs);
-  g_list_free_full (authorization->netgroup_identities, g_free);
-  g_list_foreach (authorization->action_specs, (GFunc) g_pattern_spec_free, NULL);
-  g_list_free (authorization->action_specs);
-  if (authorization->return_value != NULL)
-    g_hash_table_unref (authorization->return_value);
-  g_free (authorization);
+  range->start = file->strings->len;
+  range->length = 0;
 }
 
+static void
+add_to_range (LocalAuthorizationFile  *file,
+              LocalAuthorizationRange *range,
+              const gchar             *string)
+{
+  g_ptr_array_add (file->strings, g_string_chunk_insert_const (file->chunk, string));
+  range->length++;
+}
 
-static LocalAuthorization *
-local_authorization_new (GKeyFile      *key_file,
-                         const gchar   *filename,
-                         const gchar   *group,
-                         GError       **error)
+static void
+add_interned_to_range (LocalAuthorizationFile  *file,
+                       LocalAuthorizationRange *range,
+                       const gchar             *string)
+{
+  g_ptr_array_add (file->strings, (gpointer) g_intern_string (string));
+  range->length++;
+}
+
+static void
+add_strings_to_range (LocalAuthorizationFile  *file,
+                      LocalAuthorizationRange *range,
+                      const gchar * const     *strings)
 {
-  LocalAuthorization *authorization;
-  gchar **identity_strings;
-  gchar **action_strings;
-  gchar *result_any_string;
-  gchar *result_inactive_string;
-  gchar *result_active_string;
-  gchar **return_value_strings;
   guint n;
 
-  identity_strings = NULL;
-  action_strings = NULL;
-  result_any_string = NULL;
-  result_inactive_string = NULL;
-  result_active_string = NULL;
-  return_value_strings = NULL;
+  begin_range (file, range);
+  for (n = 0; strings[n] != NULL; n++)
+    add_to_range (file, range, strings[n]);
+}
 
-  authorization = g_new0 (LocalAuthorization, 1);
+/* Appends an authorization entry to @file.  @return_value contains
+   alternating keys and values, later values for the same key replace
+   earlier ones. */
+static void
+local_authorization_file_add (LocalAuthorizationFile      *file,
+                              const gchar                 *id,
+                              const gchar * const         *identity_strings,
+                              const gchar * const         *action_strings,
+                              PolkitImplicitAuthorization  result_any,
+                              PolkitImplicitAuthorization  result_inactive,
+                              PolkitImplicitAuthorization  result_active,
+                              const gchar * const         *return_value,
+                              guint                        return_value_length)
+{
+  LocalAuthorization authorization;
+  guint n, m;
 
-  identity_strings = g_key_file_get_string_list (key_file,
-                                                 group,
-                                                 "Identity",
-                                                 NULL,
-                                                 error);
-  if (identity_strings == NULL)
-    {
-      local_authorization_free (authorization);
-      authorization = NULL;
-      goto out;
-    }
+  memset (&authorization, 0, sizeof authorization);
+  authorization.file = file;
+  authorization.id = g_string_chunk_insert_const (file->chunk, id);
+
+  add_strings_to_range (file, &authorization.identity_strings, identity_strings);
+  add_strings_to_range (file, &authorization.action_strings, action_strings);
+
+  /* Each kind of identity is collected in a separate pass, so that the
+     ranges are contiguous */
+  begin_range (file, &authorization.literal_identities);
   for (n = 0; identity_strings[n] != NULL; n++)
     {
       /* "default" is a special case that doesn't match PolkitIdentity syntax */
       if (strcmp (identity_strings[n], "default") == 0)
-        authorization->identity_specs = g_list_prepend (authorization->identity_specs,
-                                                        NULL);
-      /* Put netgroup entries in a seperate list from other identities who support glob syntax */
-      else if (g_str_has_prefix (identity_strings[n], "unix-netgroup:"))
-        authorization->netgroup_identities = g_list_prepend (authorization->netgroup_identities,
-                                                             g_strdup (identity_strings[n] + sizeof "unix-netgroup:" - 1));
-      else
-        authorization->identity_specs = g_list_prepend (authorization->identity_specs,
-                                                        g_pattern_spec_new (identity_strings[n]));
+        authorization.matches_default = TRUE;
+      else if (!g_str_has_prefix (identity_strings[n], "unix-netgroup:")
+               && strpbrk (identity_strings[n], "*?") == NULL)
+        add_to_range (file, &authorization.literal_identities, identity_strings[n]);
     }
 
-  action_strings = g_key_file_get_string_list (key_file,
-                                                 group,
-                                                 "Action",
-                                                 NULL,
-                                                 error);
-  if (action_strings == NULL)
+  /* Put netgroup entries in a seperate list from other identities who
+     support glob syntax */
+  begin_range (file, &authorization.netgroup_identities);
+  for (n = 0; identity_strings[n] != NULL; n++)
     {
-      local_authorization_free (authorization);
-      authorization = NULL;
-      goto out;
+      if (g_str_has_prefix (identity_strings[n], "unix-netgroup:"))
+        add_interned_to_range (file, &authorization.netgroup_identities,
+                               identity_strings[n] + sizeof "unix-netgroup:" - 1);
+    }
+
+  authorization.identity_patterns.start = file->identity_patterns->len;
+  for (n = 0; identity_strings[n] != NULL; n++)
+    {
+      if (strcmp (identity_strings[n], "default") != 0
+          && !g_str_has_prefix (identity_strings[n], "unix-netgroup:")
+          && strpbrk (identity_strings[n], "*?") != NULL)
+        {
+          Pattern pattern;
+
+          pattern_init (&pattern, g_string_chunk_insert_const (file->chunk, identity_strings[n]));
+          g_array_append_val (file->identity_patterns, pattern);
+          authorization.identity_patterns.length++;
+        }
     }
-  for (n = 0; action_strings[n] != NULL; n++)
+
+  authorization.result_any = result_any;
+  authorization.result_inactive = result_inactive;
+  authorization.result_active = result_active;
+
+  begin_range (file, &authorization.return_value);
+  for (n = 0; n + 1 < return_value_length; n += 2)
     {
-      authorization->action_specs = g_list_prepend (authorization->action_specs,
-                                                    g_pattern_spec_new (action_strings[n]));
+      const gchar **pairs;
+
+      pairs = (const gchar **) file->strings->pdata + authorization.return_value.start;
+      for (m = 0; m < authorization.return_value.length; m += 2)
+        {
+          if (strcmp (pairs[m], return_value[n]) == 0)
+            break;
+        }
+      if (m < authorization.return_value.length)
+        pairs[m + 1] = g_string_chunk_insert_const (file->chunk, return_value[n + 1]);
+      else
+        {
+          add_interned_to_range (file, &authorization.return_value, return_value[n]);
+          add_to_range (file, &authorization.return_value, return_value[n + 1]);
+        }
     }
 
-  authorization->result_any = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
-  authorization->result_inactive = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
-  authorization->result_active = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+  g_array_append_val (file->authorizations, authorization);
+}
+
+/* Appends the authorization entry in @group of @filename, with the values of
+   its keys as returned by GKeyFile, to @file.  The ReturnValue strings are
+   modified. */
+static gboolean
+local_authorization_file_add_from_strings (LocalAuthorizationFile  *file,
+                                           const gchar             *filename,
+                                           const gchar             *group,
+                                           gchar                  **identity_strings,
+                                           gchar                  **action_strings,
+                                           const gchar             *result_any_string,
+                                           const gchar             *result_inactive_string,
+                                           const gchar             *result_active_string,
+                                           gchar                  **return_value_strings,
+                                           GError                 **error)
+{
+  gboolean ret;
+  PolkitImplicitAuthorization result_any;
+  PolkitImplicitAuthorization result_inactive;
+  PolkitImplicitAuthorization result_active;
+  GPtrArray *return_value;
+  gchar *id;
+  guint n;
+
+  ret = FALSE;
+  return_value = NULL;
+
+  result_any = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+  result_inactive = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+  result_active = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
 
-  result_any_string = g_key_file_get_string (key_file,
-                                             group,
-                                             "ResultAny",
-                                             NULL);
   if (result_any_string != NULL)
     {
       if (!polkit_implicit_authorization_from_string (result_any_string,
-                                                      &authorization->result_any))
+                                                      &result_any))
         {
           g_set_error (error,
                        POLKIT_ERROR,
                        POLKIT_ERROR_FAILED,
                        "Cannot parse ResultAny string `%s'", result_any_string);
-          local_authorization_free (authorization);
-          authorization = NULL;
           goto out;
         }
     }
 
-  result_inactive_string = g_key_file_get_string (key_file,
-                                                  group,
-                                                  "ResultInactive",
-                                                  NULL);
   if (result_inactive_string != NULL)
     {
       if (!polkit_implicit_authorization_from_string (result_inactive_string,
-                                                      &authorization->result_inactive))
+                                                      &result_inactive))
         {
           g_set_error (error,
                        POLKIT_ERROR,
                        POLKIT_ERROR_FAILED,
                        "Cannot parse ResultInactive string `%s'", result_inactive_string);
-          local_authorization_free (authorization);
-          authorization = NULL;
           goto out;
         }
     }
 
-  result_active_string = g_key_file_get_string (key_file,
-                                                group,
-                                                "ResultActive",
-                                                NULL);
   if (result_active_string != NULL)
     {
       if (!polkit_implicit_authorization_from_string (result_active_string,
-                                                      &authorization->result_active))
+                                                      &result_active))
         {
           g_set_error (error,
                        POLKIT_ERROR,
                        POLKIT_ERROR_FAILED,
                        "Cannot parse ResultActive string `%s'", result_active_string);
-          local_authorization_free (authorization);
-          authorization = NULL;
           goto out;
         }
     }
@@ -247,16 +607,9 @@ local_authorization_new (GKeyFile      *key_file,
                        POLKIT_ERROR,
                        POLKIT_ERROR_FAILED,
                        "Must have at least one of ResultAny, ResultInactive and ResultActive");
-          local_authorization_free (authorization);
-          authorization = NULL;
           goto out;
     }
 
-  return_value_strings = g_key_file_get_string_list (key_file,
-                                                     group,
-                                                     "ReturnValue",
-                                                     NULL,
-                                                     NULL);
   if (return_value_strings != NULL)
     {
       for (n = 0; return_value_strings[n] != NULL; n++)
@@ -277,18 +630,100 @@ local_authorization_new (GKeyFile      *key_file,
           key = return_value_strings[n];
           value = p + 1;
 
-          if (authorization->return_value == NULL)
-            {
-              authorization->return_value = g_hash_table_new_full (g_str_hash,
-                                                                   g_str_equal,
-                                                                   g_free,
-                                                                   g_free);
-            }
-          g_hash_table_insert (authorization->return_value, g_strdup (key), g_strdup (value));
+          if (return_value == NULL)
+            return_value = g_ptr_array_new ();
+          g_ptr_array_add (return_value, (gpointer) key);
+          g_ptr_array_add (return_value, (gpointer) value);
         }
     }
 
-  authorization->id = g_strdup_printf ("%s::%s", filename, group);
+  id = g_strdup_printf ("%s::%s", filename, group);
+  local_authorization_file_add (file,
+                                id,
+                                (const gchar * const *) identity_strings,
+                                (const gchar * const *) action_strings,
+                                result_any,
+                                result_inactive,
+                                result_active,
+                                return_value != NULL ? (const gchar * const *) return_value->pdata : NULL,
+                                return_value != NULL ? return_value->len : 0);
+  g_free (id);
+  ret = TRUE;
+
+ out:
+  if (return_value != NULL)
+    g_ptr_array_unref (return_value);
+  return ret;
+}
+
+/* Appends the authorization entry in @group of @key_file to @file */
+static gboolean
+local_authorization_file_add_from_key_file (LocalAuthorizationFile  *file,
+                                            GKeyFile                *key_file,
+                                            const gchar             *filename,
+                                            const gchar             *group,
+                                            GError                 **error)
+{
+  gboolean ret;
+  gchar **identity_strings;
+  gchar **action_strings;
+  gchar *result_any_string;
+  gchar *result_inactive_string;
+  gchar *result_active_string;
+  gchar **return_value_strings;
+
+  ret = FALSE;
+  identity_strings = NULL;
+  action_strings = NULL;
+  result_any_string = NULL;
+  result_inactive_string = NULL;
+  result_active_string = NULL;
+  return_value_strings = NULL;
+
+  identity_strings = g_key_file_get_string_list (key_file,
+                                                 group,
+                                                 "Identity",
+                                                 NULL,
+                                                 error);
+  if (identity_strings == NULL)
+    goto out;
+
+  action_strings = g_key_file_get_string_list (key_file,
+                                                 group,
+                                                 "Action",
+                                                 NULL,
+                                                 error);
+  if (action_strings == NULL)
+    goto out;
+
+  result_any_string = g_key_file_get_string (key_file,
+                                             group,
+                                             "ResultAny",
+                                             NULL);
+  result_inactive_string = g_key_file_get_string (key_file,
+                                                  group,
+                                                  "ResultInactive",
+                                                  NULL);
+  result_active_string = g_key_file_get_string (key_file,
+                                                group,
+                                                "ResultActive",
+                                                NULL);
+  return_value_strings = g_key_file_get_string_list (key_file,
+                                                     group,
+                                                     "ReturnValue",
+                                                     NULL,
+                                                     NULL);
+
+  ret = local_authorization_file_add_from_strings (file,
+                                                   filename,
+                                                   group,
+                                                   identity_strings,
+                                                   action_strings,
+                                                   result_any_string,
+                                                   result_inactive_string,
+                                                   result_active_string,
+                                                   return_value_strings,
+                                                   error);
 
  out:
   g_strfreev (identity_strings);
@@ -297,37 +732,465 @@ local_authorization_new (GKeyFile      *key_file,
   g_free (result_inactive_string);
   g_free (result_active_string);
   g_strfreev (return_value_strings);
-  return authorization;
+  return ret;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static void
-polkit_backend_local_authorization_store_init (PolkitBackendLocalAuthorizationStore *store)
+/* An authorization entry of a PolkitBackendLocalAuthorizationRules.  The
+   entries are in a single array in file order, so that sorting pointers to
+   them restores file order. */
+struct _RuleEntry
 {
-  store->priv = G_TYPE_INSTANCE_GET_PRIVATE (store,
-                                             POLKIT_BACKEND_TYPE_LOCAL_AUTHORIZATION_STORE,
-                                             PolkitBackendLocalAuthorizationStorePrivate);
-}
+  LocalAuthorization *authorization;
+};
 
-static void
-polkit_backend_local_authorization_store_finalize (GObject *object)
+/* The lookup counters of a store, shared with its rules so that lookups can
+   still count after the store changed.  Protected by the lookup_counters
+   lock. */
+struct _LookupCounters
 {
-  PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (object);
+  volatile gint ref_count;
+  guint64 entries_scanned;
+  guint64 entries_matched;
+};
 
-  if (store->priv->directory != NULL)
-    g_object_unref (store->priv->directory);
-  g_free (store->priv->extension);
+G_LOCK_DEFINE_STATIC (lookup_counters);
 
-  if (store->priv->directory_monitor != NULL)
-    g_object_unref (store->priv->directory_monitor);
+struct _PolkitBackendLocalAuthorizationRules
+{
+  volatile gint ref_count;
 
-  g_list_foreach (store->priv->authorizations, (GFunc) local_authorization_free, NULL);
-  g_list_free (store->priv->authorizations);
+  /* LocalAuthorizationFile objects the entries are in, referenced */
+  GPtrArray *files;
 
-  if (G_OBJECT_CLASS (polkit_backend_local_authorization_store_parent_class)->finalize != NULL)
-    G_OBJECT_CLASS (polkit_backend_local_authorization_store_parent_class)->finalize (object);
-}
+  /* The entries that are not shadowed, in file order */
+  RuleEntry *entries;
+  guint n_entries;
+
+  /* Index of the entries by their Action patterns.  Each list of entries is
+     in file order. */
+  GHashTable *literal_actions;    /* action id => GPtrArray of RuleEntry */
+  GArray *prefix_actions;         /* ActionPrefixNode */
+  GArray *glob_actions;           /* ActionGlob */
+
+  LookupCounters *counters;
+};
+
+static LookupCounters *
+lookup_counters_ref (LookupCounters *counters)
+{
+  g_atomic_int_inc (&counters->ref_count);
+  return counters;
+}
+
+static void
+lookup_counters_unref (LookupCounters *counters)
+{
+  if (g_atomic_int_dec_and_test (&counters->ref_count))
+    g_free (counters);
+}
+
+static void
+lookup_counters_add (LookupCounters *counters,
+                     guint           entries_scanned,
+                     guint           entries_matched)
+{
+  G_LOCK (lookup_counters);
+  counters->entries_scanned += entries_scanned;
+  counters->entries_matched += entries_matched;
+  G_UNLOCK (lookup_counters);
+}
+
+#define ACTION_PREFIX_NODE(rules, index) \
+  (&g_array_index ((rules)->prefix_actions, ActionPrefixNode, (index)))
+
+/* Returns the index of the child of the node at @index for @c, or 0 */
+static guint
+action_prefix_node_get_child (PolkitBackendLocalAuthorizationRules *rules,
+                              guint                                 index,
+                              gchar                                 c)
+{
+  guint child;
+
+  for (child = ACTION_PREFIX_NODE (rules, index)->children;
+       child != 0;
+       child = ACTION_PREFIX_NODE (rules, child)->next)
+    {
+      if (ACTION_PREFIX_NODE (rules, child)->c == c)
+        break;
+    }
+
+  return child;
+}
+
+static void
+index_action (PolkitBackendLocalAuthorizationRules *rules,
+              RuleEntry                            *entry,
+              const gchar                          *action)
+{
+  const gchar *wildcard;
+  GPtrArray *entries;
+
+  wildcard = strpbrk (action, "*?");
+  if (wildcard == NULL)
+    {
+      entries = g_hash_table_lookup (rules->literal_actions, action);
+      if (entries == NULL)
+        {
+          entries = g_ptr_array_new ();
+          /* @action is in the chunk of the file of the entry */
+          g_hash_table_insert (rules->literal_actions, (gpointer) action, entries);
+        }
+    }
+  else if (*wildcard == '*' && wildcard[1] == '\0')
+    {
+      ActionPrefixNode *node;
+      const gchar *p;
+      guint index;
+
+      index = 0;
+      for (p = action; p != wildcard; p++)
+        {
+          guint child;
+
+          child = action_prefix_node_get_child (rules, index, *p);
+          if (child == 0)
+            {
+              ActionPrefixNode new_node;
+
+              new_node.c = *p;
+              new_node.children = 0;
+              new_node.next = ACTION_PREFIX_NODE (rules, index)->children;
+              new_node.entries = NULL;
+              child = rules->prefix_actions->len;
+              g_array_append_val (rules->prefix_actions, new_node);
+              ACTION_PREFIX_NODE (rules, index)->children = child;
+            }
+          index = child;
+        }
+      node = ACTION_PREFIX_NODE (rules, index);
+      if (node->entries == NULL)
+        node->entries = g_ptr_array_new ();
+      entries = node->entries;
+    }
+  else
+    {
+      ActionGlob glob;
+
+      /* @action is in the chunk of the file of the entry */
+      pattern_init (&glob.pattern, action);
+      glob.entry = entry;
+      g_array_append_val (rules->glob_actions, glob);
+      return;
+    }
+
+  /* An entry may have several patterns with the same key */
+  if (entries->len == 0 || entries->pdata[entries->len - 1] != entry)
+    g_ptr_array_add (entries, entry);
+}
+
+/* Indexes @authorizations, LocalAuthorization structures from @files in
+   the order lookups consider them, by sorting their Action patterns into
+   a hash table of literal action ids, a trie of patterns with a single
+   trailing '*', and a list of all other patterns */
+static PolkitBackendLocalAuthorizationRules *
+rules_new_for_entries (GPtrArray      *files,
+                       GPtrArray      *authorizations,
+                       LookupCounters *counters)
+{
+  PolkitBackendLocalAuthorizationRules *rules;
+  guint n, k;
+
+  rules = g_new0 (PolkitBackendLocalAuthorizationRules, 1);
+  rules->ref_count = 1;
+  rules->files = g_ptr_array_new_with_free_func ((GDestroyNotify) local_authorization_file_unref);
+  rules->literal_actions = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) g_ptr_array_unref);
+  rules->prefix_actions = g_array_new (FALSE, TRUE, sizeof (ActionPrefixNode));
+  g_array_set_size (rules->prefix_actions, 1);
+  rules->glob_actions = g_array_new (FALSE, FALSE, sizeof (ActionGlob));
+  rules->counters = lookup_counters_ref (counters);
+
+  for (n = 0; n < files->len; n++)
+    g_ptr_array_add (rules->files, local_authorization_file_ref (files->pdata[n]));
+
+  /* Not resized from here on, the index points into it */
+  rules->entries = g_new (RuleEntry, authorizations->len);
+  for (n = 0; n < authorizations->len; n++)
+    {
+      LocalAuthorization *authorization = authorizations->pdata[n];
+      const gchar * const *action_strings;
+      RuleEntry *entry;
+
+      entry = &rules->entries[rules->n_entries++];
+      entry->authorization = authorization;
+      action_strings = LOCAL_AUTHORIZATION_FILE_STRINGS (authorization->file,
+                                                         authorization->action_strings);
+      for (k = 0; k < authorization->action_strings.length; k++)
+        index_action (rules, entry, action_strings[k]);
+    }
+
+  return rules;
+}
+
+/* Collects the entries of @files that are not shadowed and indexes them.
+   The files are only read, so they can still be used by earlier rules. */
+static PolkitBackendLocalAuthorizationRules *
+rules_new (GPtrArray      *files,
+           LookupCounters *counters)
+{
+  PolkitBackendLocalAuthorizationRules *rules;
+  GPtrArray *authorizations;
+  guint n_entries;
+  guint n, m;
+
+  n_entries = 0;
+  for (n = 0; n < files->len; n++)
+    n_entries += ((LocalAuthorizationFile *) files->pdata[n])->authorizations->len;
+
+  authorizations = g_ptr_array_sized_new (n_entries);
+  for (n = 0; n < files->len; n++)
+    {
+      LocalAuthorizationFile *file = files->pdata[n];
+
+      for (m = 0; m < file->authorizations->len; m++)
+        {
+          LocalAuthorization *authorization = local_authorization_file_get (file, m);
+
+          if (!authorization->shadowed)
+            g_ptr_array_add (authorizations, authorization);
+        }
+    }
+  rules = rules_new_for_entries (files, authorizations, counters);
+  g_ptr_array_unref (authorizations);
+
+  return rules;
+}
+
+/**
+ * polkit_backend_local_authorization_rules_ref:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ *
+ * Increases the reference count of @rules.  This may be done in any
+ * thread.
+ *
+ * Returns: @rules.
+ */
+PolkitBackendLocalAuthorizationRules *
+polkit_backend_local_authorization_rules_ref (PolkitBackendLocalAuthorizationRules *rules)
+{
+  g_return_val_if_fail (rules != NULL, NULL);
+
+  g_atomic_int_inc (&rules->ref_count);
+  return rules;
+}
+
+/**
+ * polkit_backend_local_authorization_rules_unref:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ *
+ * Decreases the reference count of @rules, freeing it when it drops to
+ * zero.  This may be done in any thread.
+ */
+void
+polkit_backend_local_authorization_rules_unref (PolkitBackendLocalAuthorizationRules *rules)
+{
+  guint n;
+
+  g_return_if_fail (rules != NULL);
+
+  if (!g_atomic_int_dec_and_test (&rules->ref_count))
+    return;
+
+  /* The patterns of the index are in the chunks of the files */
+  g_hash_table_unref (rules->literal_actions);
+  for (n = 0; n < rules->prefix_actions->len; n++)
+    {
+      ActionPrefixNode *node = ACTION_PREFIX_NODE (rules, n);
+
+      if (node->entries != NULL)
+        g_ptr_array_unref (node->entries);
+    }
+  g_array_free (rules->prefix_actions, TRUE);
+  for (n = 0; n < rules->glob_actions->len; n++)
+    pattern_clear (&g_array_index (rules->glob_actions, ActionGlob, n).pattern);
+  g_array_free (rules->glob_actions, TRUE);
+  g_free (rules->entries);
+  g_ptr_array_unref (rules->files);
+  lookup_counters_unref (rules->counters);
+  g_free (rules);
+}
+
+/* Returns %TRUE if any entry was marked as shadowed */
+static gboolean
+clear_shadowed (PolkitBackendLocalAuthorizationStore *store)
+{
+  gboolean ret;
+  guint n, m;
+
+  ret = FALSE;
+  for (n = 0; n < store->priv->files->len; n++)
+    {
+      LocalAuthorizationFile *file = store->priv->files->pdata[n];
+
+      for (m = 0; m < file->authorizations->len; m++)
+        {
+          LocalAuthorization *authorization = local_authorization_file_get (file, m);
+
+          if (authorization->shadowed)
+            {
+              authorization->shadowed = FALSE;
+              ret = TRUE;
+            }
+        }
+    }
+
+  return ret;
+}
+
+static void
+add_candidates (GPtrArray *candidates,
+                GPtrArray *entries)
+{
+  guint n;
+
+  if (entries == NULL)
+    return;
+  for (n = 0; n < entries->len; n++)
+    g_ptr_array_add (candidates, entries->pdata[n]);
+}
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  const RuleEntry *entry_a = *(RuleEntry * const *) a;
+  const RuleEntry *entry_b = *(RuleEntry * const *) b;
+
+  if (entry_a < entry_b)
+    return -1;
+  return entry_a > entry_b;
+}
+
+/* Returns the RuleEntry structures matching @action_id in file order,
+   without duplicates */
+static GPtrArray *
+get_entries_for_action (PolkitBackendLocalAuthorizationRules *rules,
+                        const gchar                          *action_id)
+{
+  GPtrArray *candidates;
+  const gchar *p;
+  guint index;
+  guint n, m;
+
+  candidates = g_ptr_array_new ();
+
+  add_candidates (candidates, g_hash_table_lookup (rules->literal_actions, action_id));
+
+  index = 0;
+  add_candidates (candidates, ACTION_PREFIX_NODE (rules, index)->entries);
+  for (p = action_id; *p != '\0'; p++)
+    {
+      index = action_prefix_node_get_child (rules, index, *p);
+      if (index == 0)
+        break;
+      add_candidates (candidates, ACTION_PREFIX_NODE (rules, index)->entries);
+    }
+
+  for (n = 0; n < rules->glob_actions->len; n++)
+    {
+      ActionGlob *glob = &g_array_index (rules->glob_actions, ActionGlob, n);
+
+      if (pattern_match (&glob->pattern, action_id))
+        g_ptr_array_add (candidates, glob->entry);
+    }
+
+  g_ptr_array_sort (candidates, compare_entries);
+  for (n = 0, m = 0; n < candidates->len; n++)
+    {
+      if (m == 0 || candidates->pdata[m - 1] != candidates->pdata[n])
+        candidates->pdata[m++] = candidates->pdata[n];
+    }
+  g_ptr_array_set_size (candidates, m);
+
+  return candidates;
+}
+
+/* Replaces the rules used by lookups in @store with @rules, which may be
+   %NULL, taking ownership of it */
+static void
+set_rules (PolkitBackendLocalAuthorizationStore *store,
+           PolkitBackendLocalAuthorizationRules *rules)
+{
+  PolkitBackendLocalAuthorizationRules *old_rules;
+
+  G_LOCK (published_rules);
+  old_rules = store->priv->rules;
+  store->priv->rules = rules;
+  G_UNLOCK (published_rules);
+
+  if (old_rules != NULL)
+    polkit_backend_local_authorization_rules_unref (old_rules);
+}
+
+/* Builds the rules for the current files of @store and starts using them.
+   Called with the lock held. */
+static void
+update_rules (PolkitBackendLocalAuthorizationStore *store)
+{
+  set_rules (store, rules_new (store->priv->files, store->priv->counters));
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+polkit_backend_local_authorization_store_init (PolkitBackendLocalAuthorizationStore *store)
+{
+  store->priv = G_TYPE_INSTANCE_GET_PRIVATE (store,
+                                             POLKIT_BACKEND_TYPE_LOCAL_AUTHORIZATION_STORE,
+                                             PolkitBackendLocalAuthorizationStorePrivate);
+  store->priv->lock = g_mutex_new ();
+  store->priv->files = g_ptr_array_new_with_free_func ((GDestroyNotify) local_authorization_file_unref);
+  store->priv->pending_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  store->priv->counters = g_new0 (LookupCounters, 1);
+  store->priv->counters->ref_count = 1;
+}
+
+static void
+polkit_backend_local_authorization_store_finalize (GObject *object)
+{
+  PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (object);
+
+  if (store->priv->directory != NULL)
+    g_object_unref (store->priv->directory);
+  g_free (store->priv->extension);
+
+  if (store->priv->directory_monitor != NULL)
+    g_object_unref (store->priv->directory_monitor);
+
+  if (store->priv->coalesce_source_id != 0)
+    g_source_remove (store->priv->coalesce_source_id);
+  g_hash_table_unref (store->priv->pending_files);
+
+  if (store->priv->directory_source != NULL)
+    g_variant_unref (store->priv->directory_source);
+  if (store->priv->listing_source != NULL)
+    g_variant_unref (store->priv->listing_source);
+  if (store->priv->listing != NULL)
+    g_ptr_array_unref (store->priv->listing);
+  g_ptr_array_unref (store->priv->files);
+
+  if (store->priv->rules != NULL)
+    polkit_backend_local_authorization_rules_unref (store->priv->rules);
+  lookup_counters_unref (store->priv->counters);
+  g_mutex_free (store->priv->lock);
+
+  if (G_OBJECT_CLASS (polkit_backend_local_authorization_store_parent_class)->finalize != NULL)
+    G_OBJECT_CLASS (polkit_backend_local_authorization_store_parent_class)->finalize (object);
+}
 
 
 static void
@@ -348,6 +1211,10 @@ polkit_backend_local_authorization_store_get_property (GObject    *object,
       g_value_set_string (value, store->priv->extension);
       break;
 
+    case PROP_COALESCE_TIMEOUT:
+      g_value_set_uint (value, store->priv->coalesce_timeout);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -372,12 +1239,131 @@ polkit_backend_local_authorization_store_set_property (GObject      *object,
       store->priv->extension = g_value_dup_string (value);
       break;
 
+    case PROP_COALESCE_TIMEOUT:
+      store->priv->coalesce_timeout = g_value_get_uint (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
     }
 }
 
+/* Handles all change notifications received since the last call */
+static void
+handle_pending_changes (PolkitBackendLocalAuthorizationStore *store)
+{
+  PolkitBackendLocalAuthorizationStorePrivate *priv = store->priv;
+  GHashTableIter iter;
+  const gchar *name;
+  gboolean changed;
+  gchar *path;
+
+  g_mutex_lock (priv->lock);
+
+  /* If nothing was read yet, there is nothing to update */
+  changed = !priv->has_data;
+  if (priv->has_data)
+    {
+      PolkitBackendLocalAuthorizationRules *old_rules;
+      gboolean reloaded;
+      gint64 start;
+      gint64 duration;
+
+      old_rules = priv->rules;
+      if (old_rules != NULL)
+        polkit_backend_local_authorization_rules_ref (old_rules);
+      reloaded = FALSE;
+      start = g_get_monotonic_time ();
+      g_hash_table_iter_init (&iter, priv->pending_files);
+      while (g_hash_table_iter_next (&iter, (gpointer *) &name, NULL))
+        {
+          if (reload_file (store, name))
+            reloaded = TRUE;
+        }
+      /* Editors often write a file several times, or write it again
+         unchanged; only count a reload if entries were added, removed or
+         changed */
+      if (reloaded)
+        {
+          PolkitBackendLocalAuthorizationRules *diff_rules;
+          PolkitBackendLocalAuthorizationDiff diff;
+
+          diff_rules = polkit_backend_local_authorization_rules_diff (&old_rules,
+                                                                      old_rules != NULL ? 1 : 0,
+                                                                      &priv->rules,
+                                                                      priv->rules != NULL ? 1 : 0,
+                                                                      &diff);
+          if (diff_rules != NULL)
+            {
+              if (diff.n_added + diff.n_removed + diff.n_changed == 0)
+                reloaded = FALSE;
+              polkit_backend_local_authorization_rules_unref (diff_rules);
+            }
+        }
+      if (old_rules != NULL)
+        polkit_backend_local_authorization_rules_unref (old_rules);
+      duration = g_get_monotonic_time () - start;
+      priv->load_time += duration;
+      priv->reload_time += duration;
+      if (reloaded)
+        {
+          priv->reloads++;
+          changed = TRUE;
+        }
+    }
+
+  path = g_file_get_path (priv->directory);
+  g_debug ("Handled %u change notifications for %u files in `%s'",
+           priv->pending_events, g_hash_table_size (priv->pending_files), path);
+  g_free (path);
+
+  priv->pending_events = 0;
+  g_hash_table_remove_all (priv->pending_files);
+
+  g_mutex_unlock (priv->lock);
+
+  /* Handlers may look up entries again */
+  if (changed)
+    g_signal_emit_by_name (store, "changed");
+}
+
+static gboolean
+on_coalesce_timeout (gpointer user_data)
+{
+  PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (user_data);
+
+  store->priv->coalesce_source_id = 0;
+  handle_pending_changes (store);
+
+  return FALSE;
+}
+
+/* Waits until no notification arrived for the coalescing timeout, or until
+   MAX_COALESCE_TIMEOUTS have passed since the first one */
+static void
+schedule_pending_changes (PolkitBackendLocalAuthorizationStore *store)
+{
+  PolkitBackendLocalAuthorizationStorePrivate *priv = store->priv;
+  gint64 now;
+  gint64 deadline;
+  guint delay;
+
+  now = g_get_monotonic_time ();
+  if (priv->coalesce_source_id == 0)
+    priv->coalesce_started = now;
+  else
+    g_source_remove (priv->coalesce_source_id);
+
+  deadline = priv->coalesce_started
+    + (gint64) priv->coalesce_timeout * MAX_COALESCE_TIMEOUTS * (G_USEC_PER_SEC / 1000);
+  delay = priv->coalesce_timeout;
+  if (now + (gint64) delay * (G_USEC_PER_SEC / 1000) > deadline)
+    delay = deadline > now ? (deadline - now) / (G_USEC_PER_SEC / 1000) : 0;
+
+  priv->coalesce_source_id = g_timeout_add (delay, on_coalesce_timeout, store);
+}
+
 static void
 directory_monitor_changed (GFileMonitor     *monitor,
                            GFile            *file,
@@ -407,9 +1393,16 @@ directory_monitor_changed (GFileMonitor     *monitor,
 
           //g_debug ("match");
 
-          /* now throw away all caches */
-          polkit_backend_local_authorization_store_purge (store);
-          g_signal_emit_by_name (store, "changed");
+          /* Only re-read the files that changed */
+          g_hash_table_insert (store->priv->pending_files, g_strdup (name), NULL);
+          store->priv->pending_events++;
+          g_mutex_lock (store->priv->lock);
+          store->priv->change_events++;
+          g_mutex_unlock (store->priv->lock);
+          if (store->priv->coalesce_timeout == 0)
+            handle_pending_changes (store);
+          else
+            schedule_pending_changes (store);
         }
 
       g_free (name);
@@ -495,6 +1488,26 @@ polkit_backend_local_authorization_store_class_init (PolkitBackendLocalAuthoriza
                                                         G_PARAM_STATIC_BLURB |
                                                         G_PARAM_STATIC_NICK));
 
+  /**
+   * PolkitBackendLocalAuthorizationStore:coalesce-timeout:
+   *
+   * Number of milliseconds to wait for further change notifications
+   * before re-reading changed files, or 0 to re-read each file as soon
+   * as it changes.  Until then, lookups use the previous contents.
+   */
+  g_object_class_install_property (gobject_class,
+                                   PROP_COALESCE_TIMEOUT,
+                                   g_param_spec_uint ("coalesce-timeout",
+                                                      "Coalesce Timeout",
+                                                      "Milliseconds to collect change notifications for",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_NAME |
+                                                      G_PARAM_STATIC_BLURB |
+                                                      G_PARAM_STATIC_NICK));
+
   /**
    * PolkitBackendConfiguStore::changed:
    * @store: A #PolkitBackendLocalAuthorizationStore.
@@ -571,134 +1584,2022 @@ polkit_backend_local_authorization_store_purge (PolkitBackendLocalAuthorizationS
   g_debug ("Dropping all .pkla caches for directory `%s'", path);
   g_free (path);
 
-  g_list_foreach (store->priv->authorizations, (GFunc) local_authorization_free, NULL);
-  g_list_free (store->priv->authorizations);
-  store->priv->authorizations = NULL;
+  g_ptr_array_set_size (store->priv->files, 0);
+  if (store->priv->directory_source != NULL)
+    {
+      g_variant_unref (store->priv->directory_source);
+      store->priv->directory_source = NULL;
+    }
+
+  set_rules (store, NULL);
 
   store->priv->has_data = FALSE;
 }
 
+static gchar *
+get_file_path (PolkitBackendLocalAuthorizationStore *store,
+               const gchar                          *basename)
+{
+  GFile *file;
+  gchar *path;
+
+  file = g_file_get_child (store->priv->directory, basename);
+  path = g_file_get_path (file);
+  g_object_unref (file);
+
+  return path;
+}
+
 static void
-polkit_backend_local_authorization_store_ensure (PolkitBackendLocalAuthorizationStore *store)
+update_directory_source (PolkitBackendLocalAuthorizationStore *store)
 {
-  GFileEnumerator *enumerator;
-  GFileInfo *file_info;
-  GError *error;
-  GList *files;
-  GList *l;
+  gchar *path;
 
-  files = NULL;
+  if (store->priv->directory_source != NULL)
+    g_variant_unref (store->priv->directory_source);
+  path = g_file_get_path (store->priv->directory);
+  store->priv->directory_source = g_variant_ref_sink (polkit_backend_snapshot_source_new (path));
+  g_free (path);
+}
 
-  if (store->priv->has_data)
-    goto out;
+typedef struct
+{
+  LocalAuthorizationFile *file;
+  const gchar *filename;
+} ParsedGroupData;
 
-  polkit_backend_local_authorization_store_purge (store);
+static void
+add_parsed_group (PolkitBackendPklaGroup *group,
+                  gpointer                user_data)
+{
+  ParsedGroupData *data = user_data;
+  GError *error;
 
   error = NULL;
-  enumerator = g_file_enumerate_children (store->priv->directory,
-                                          "standard::name",
-                                          G_FILE_QUERY_INFO_NONE,
-                                          NULL,
-                                          &error);
-  if (enumerator == NULL)
+  if (!local_authorization_file_add_from_strings (data->file,
+                                                  data->filename,
+                                                  group->name,
+                                                  group->identity_strings,
+                                                  group->action_strings,
+                                                  group->result_any,
+                                                  group->result_inactive,
+                                                  group->result_active,
+                                                  group->return_value_strings,
+                                                  &error))
     {
-      gchar *dir_name;
-      dir_name = g_file_get_uri (store->priv->directory);
-      g_warning ("Error enumerating files in %s: %s", dir_name, error->message);
-      g_free (dir_name);
+      g_warning ("Error parsing group `%s' in file `%s': %s",
+                 group->name,
+                 data->filename,
+                 error->message);
       g_error_free (error);
-      goto out;
+      data->file->n_errors++;
     }
+}
 
-  while ((file_info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
-    {
-      const gchar *name;
+/* Reads the authorization entries from the file @basename, which was in the
+   state recorded in @source just before.  Sinks @source. */
+static LocalAuthorizationFile *
+load_authorization_file (PolkitBackendLocalAuthorizationStore *store,
+                         const gchar                          *basename,
+                         GVariant                             *source)
+{
+  LocalAuthorizationFile *file;
+  gchar *filename;
+  GMappedFile *mapped_file;
+  GKeyFile *key_file;
+  GError *error;
 
-      name = g_file_info_get_name (file_info);
+  file = local_authorization_file_new (basename, source);
+  if (!polkit_backend_snapshot_source_exists (file->source))
+    return file;
 
-      /* only consider files with the appropriate extension */
-      if (g_str_has_suffix (name, store->priv->extension) && name[0] != '.')
-        files = g_list_prepend (files, g_file_get_child (store->priv->directory, name));
+  filename = get_file_path (store, basename);
 
-      g_object_unref (file_info);
-    }
-  g_object_unref (enumerator);
+  /* Most files can be parsed without GKeyFile; the others, including any
+     that cannot be mapped, are read as before to get the same errors */
+  mapped_file = g_mapped_file_new (filename, FALSE, NULL);
+  if (mapped_file != NULL)
+    {
+      ParsedGroupData data;
+      gboolean parsed;
+
+      data.file = file;
+      data.filename = filename;
+      parsed = polkit_backend_pkla_parse (g_mapped_file_get_contents (mapped_file),
+                                          g_mapped_file_get_length (mapped_file),
+                                          add_parsed_group,
+                                          &data);
+      g_mapped_file_unref (mapped_file);
+      if (parsed)
+        {
+          g_free (filename);
+          return file;
+        }
+    }
+
+  key_file = g_key_file_new ();
+
+  error = NULL;
+  if (!g_key_file_load_from_file (key_file,
+                                  filename,
+                                  G_KEY_FILE_NONE,
+                                  &error))
+    {
+      g_warning ("Error loading key-file %s: %s", filename, error->message);
+      g_error_free (error);
+      file->n_errors = 1;
+    }
+  else
+    {
+      gchar **groups;
+      guint n;
+
+      groups = g_key_file_get_groups (key_file, NULL);
+      for (n = 0; groups[n] != NULL; n++)
+        {
+          error = NULL;
+          if (!local_authorization_file_add_from_key_file (file, key_file, filename,
+                                                           groups[n], &error))
+            {
+              g_warning ("Error parsing group `%s' in file `%s': %s",
+                         groups[n],
+                         filename,
+                         error->message);
+              g_error_free (error);
+              file->n_errors++;
+            }
+        }
+      g_strfreev (groups);
+    }
+
+  g_key_file_free (key_file);
+  g_free (filename);
+
+  return file;
+}
+
+/* Returns the position of @basename in store->priv->files, or the position
+   to insert it at to keep the order of compare_basename() */
+static guint
+find_file (PolkitBackendLocalAuthorizationStore *store,
+           const gchar                          *basename,
+           gboolean                             *out_found)
+{
+  GPtrArray *files = store->priv->files;
+  guint low, high;
+
+  low = 0;
+  high = files->len;
+  while (low < high)
+    {
+      guint middle;
+      gint cmp;
+
+      middle = low + (high - low) / 2;
+      cmp = g_strcmp0 (((LocalAuthorizationFile *) files->pdata[middle])->basename, basename);
+      if (cmp == 0)
+        {
+          *out_found = TRUE;
+          return middle;
+        }
+      if (cmp < 0)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+  *out_found = FALSE;
+  return low;
+}
+
+/* Re-reads the file @basename after a change notification, splicing its
+   entries into the store.  Returns %FALSE if the file is unchanged since it
+   was read. */
+static gboolean
+reload_file (PolkitBackendLocalAuthorizationStore *store,
+             const gchar                          *basename)
+{
+  GPtrArray *files = store->priv->files;
+  LocalAuthorizationFile *file;
+  GVariant *source;
+  gchar *filename;
+  gboolean found;
+  gboolean exists;
+  guint pos;
+
+  pos = find_file (store, basename, &found);
+
+  filename = get_file_path (store, basename);
+  source = g_variant_ref_sink (polkit_backend_snapshot_source_new (filename));
+  exists = polkit_backend_snapshot_source_exists (source);
+  if (found
+      ? g_variant_equal (((LocalAuthorizationFile *) files->pdata[pos])->source, source)
+      : !exists)
+    {
+      g_variant_unref (source);
+      g_free (filename);
+      return FALSE;
+    }
+
+  g_debug ("Reloading `%s'", filename);
+  g_free (filename);
+
+  if (!exists)
+    g_ptr_array_remove_index (files, pos);
+  else
+    {
+      file = load_authorization_file (store, basename, source);
+      if (found)
+        {
+          local_authorization_file_unref (files->pdata[pos]);
+          files->pdata[pos] = file;
+        }
+      else
+        {
+          g_ptr_array_add (files, NULL);
+          memmove (files->pdata + pos + 1, files->pdata + pos,
+                   (files->len - 1 - pos) * sizeof (gpointer));
+          files->pdata[pos] = file;
+        }
+    }
+  g_variant_unref (source);
+
+  update_directory_source (store);
+  /* Entries of other files may no longer be shadowed by those of this one */
+  clear_shadowed (store);
+  update_rules (store);
+
+  return TRUE;
+}
+
+/* Lists the basenames of the authorization files, in the order they are
+   evaluated in, or returns NULL on error */
+static GPtrArray *
+list_authorization_files (PolkitBackendLocalAuthorizationStore *store)
+{
+  GFileEnumerator *enumerator;
+  GFileInfo *file_info;
+  GError *error;
+  GList *files;
+  GList *l;
+  GPtrArray *ret;
+
+  files = NULL;
+  ret = NULL;
+
+  error = NULL;
+  enumerator = g_file_enumerate_children (store->priv->directory,
+                                          "standard::name",
+                                          G_FILE_QUERY_INFO_NONE,
+                                          NULL,
+                                          &error);
+  if (enumerator == NULL)
+    {
+      gchar *dir_name;
+      dir_name = g_file_get_uri (store->priv->directory);
+      g_warning ("Error enumerating files in %s: %s", dir_name, error->message);
+      g_free (dir_name);
+      g_error_free (error);
+      goto out;
+    }
+
+  while ((file_info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL)
+    {
+      const gchar *name;
+
+      name = g_file_info_get_name (file_info);
+
+      /* only consider files with the appropriate extension */
+      if (g_str_has_suffix (name, store->priv->extension) && name[0] != '.')
+        files = g_list_prepend (files, g_file_get_child (store->priv->directory, name));
+
+      g_object_unref (file_info);
+    }
+  g_object_unref (enumerator);
   if (error != NULL)
     {
-      g_warning ("Error enumerating files: %s", error->message);
-      g_error_free (error);
-      goto out;
+      g_warning ("Error enumerating files: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  /* Warning: This ordering is undocumented and must not be relied upon; use
+     the documented ordering of subdirectories instead.  It's here only to help
+     users who rely on a tested but ambiguous configuration while using a
+     single release of polkit.  The basename ordering may change without
+     notice. */
+  files = g_list_sort (files, compare_basename);
+
+  ret = g_ptr_array_new_with_free_func (g_free);
+  for (l = files; l != NULL; l = l->next)
+    g_ptr_array_add (ret, g_file_get_basename (G_FILE (l->data)));
+
+ out:
+  g_list_foreach (files, (GFunc) g_object_unref, NULL);
+  g_list_free (files);
+  return ret;
+}
+
+/* Directories modified less than this many seconds before they were listed
+   could change again without a change in their snapshot source record */
+#define LISTING_SETTLE_SECONDS 2
+
+/* Updates the directory source record and returns the basenames like
+   list_authorization_files().  The directory is only listed if its record
+   differs from the one of the last listing, so an unchanged directory costs
+   a single stat(); the files themselves are still read. */
+static GPtrArray *
+get_authorization_files (PolkitBackendLocalAuthorizationStore *store)
+{
+  PolkitBackendLocalAuthorizationStorePrivate *priv = store->priv;
+  GPtrArray *basenames;
+  gint64 mtime;
+
+  update_directory_source (store);
+
+  if (priv->listing != NULL)
+    {
+      if (g_variant_equal (priv->listing_source, priv->directory_source))
+        return g_ptr_array_ref (priv->listing);
+
+      g_variant_unref (priv->listing_source);
+      priv->listing_source = NULL;
+      g_ptr_array_unref (priv->listing);
+      priv->listing = NULL;
+    }
+
+  basenames = list_authorization_files (store);
+  if (basenames == NULL)
+    return NULL;
+
+  /* The record was taken before listing, so a change in between is noticed
+     next time unless it happened within the timestamp granularity */
+  g_variant_get (priv->directory_source, "(&sxutt)", NULL, &mtime, NULL, NULL, NULL);
+  if (mtime != -1 && mtime <= g_get_real_time () / G_USEC_PER_SEC - LISTING_SETTLE_SECONDS)
+    {
+      priv->listing_source = g_variant_ref (priv->directory_source);
+      priv->listing = g_ptr_array_ref (basenames);
+    }
+
+  return basenames;
+}
+
+/* Reads the files if that has not happened yet.  Called with the lock
+   held. */
+static void
+polkit_backend_local_authorization_store_ensure (PolkitBackendLocalAuthorizationStore *store)
+{
+  GPtrArray *basenames;
+  gint64 start;
+  guint n;
+
+  if (store->priv->has_data)
+    return;
+
+  start = g_get_monotonic_time ();
+  polkit_backend_local_authorization_store_purge (store);
+
+  basenames = get_authorization_files (store);
+  if (basenames == NULL)
+    goto out;
+
+  for (n = 0; n < basenames->len; n++)
+    {
+      const gchar *basename = basenames->pdata[n];
+      gchar *filename;
+
+      filename = get_file_path (store, basename);
+      g_ptr_array_add (store->priv->files,
+                       load_authorization_file (store, basename,
+                                                polkit_backend_snapshot_source_new (filename)));
+      g_free (filename);
+    }
+  g_ptr_array_unref (basenames);
+
+  update_rules (store);
+
+  store->priv->has_data = TRUE;
+
+ out:
+  store->priv->load_time += g_get_monotonic_time () - start;
+}
+
+/* Functions working on several stores lock all of them, always in list
+   order so that they can not deadlock */
+static void
+lock_stores (GList *stores)
+{
+  GList *l;
+
+  for (l = stores; l != NULL; l = l->next)
+    g_mutex_lock (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data)->priv->lock);
+}
+
+static void
+unlock_stores (GList *stores)
+{
+  GList *l;
+
+  for (l = stores; l != NULL; l = l->next)
+    g_mutex_unlock (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data)->priv->lock);
+}
+
+/* A file to be read by load_file_in_thread() */
+typedef struct
+{
+  PolkitBackendLocalAuthorizationStore *store;
+  const gchar *basename;
+
+  /* Set by the thread */
+  LocalAuthorizationFile *file;
+  gint64 load_time;
+} LoadFileJob;
+
+static void
+load_file_in_thread (gpointer data,
+                     gpointer user_data)
+{
+  LoadFileJob *job = data;
+  gchar *filename;
+  gint64 start;
+
+  /* Only reads the directory and extension of the store, which do not
+     change */
+  start = g_get_monotonic_time ();
+  filename = get_file_path (job->store, job->basename);
+  job->file = load_authorization_file (job->store, job->basename,
+                                       polkit_backend_snapshot_source_new (filename));
+  g_free (filename);
+  job->load_time = g_get_monotonic_time () - start;
+}
+
+/**
+ * polkit_backend_local_authorization_store_load_all:
+ * @stores: (element-type PolkitBackendLocalAuthorizationStore): Stores to
+ *     read.
+ * @max_threads: Maximum number of files to read at the same time.
+ *
+ * Reads the authorization files of all @stores that have not been read
+ * yet, which would otherwise happen on the first lookup in each store.
+ * The directories are listed in turn, or not at all if unchanged since
+ * they were last listed, but all files are read and parsed in up to
+ * @max_threads threads.  The result is the same as reading them
+ * one after another.  The time reported by
+ * polkit_backend_local_authorization_store_get_lookup_stats() includes
+ * the time each file took to read, not the overall duration.  Lookups
+ * in rules taken before are not held up.
+ */
+void
+polkit_backend_local_authorization_store_load_all (GList *stores,
+                                                   guint  max_threads)
+{
+  GPtrArray *basenames_by_store;
+  GArray *jobs;
+  GThreadPool *pool;
+  GError *error;
+  GList *l;
+  guint n, m;
+
+  g_return_if_fail (max_threads > 0);
+
+  lock_stores (stores);
+
+  basenames_by_store = g_ptr_array_new ();
+  jobs = g_array_new (FALSE, FALSE, sizeof (LoadFileJob));
+  for (l = stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+      GPtrArray *basenames;
+
+      basenames = NULL;
+      if (!store->priv->has_data)
+        {
+          gint64 start;
+
+          start = g_get_monotonic_time ();
+          polkit_backend_local_authorization_store_purge (store);
+          basenames = get_authorization_files (store);
+          store->priv->load_time += g_get_monotonic_time () - start;
+        }
+      g_ptr_array_add (basenames_by_store, basenames);
+      if (basenames == NULL)
+        continue;
+
+      for (n = 0; n < basenames->len; n++)
+        {
+          LoadFileJob job;
+
+          job.store = store;
+          job.basename = basenames->pdata[n];
+          job.file = NULL;
+          job.load_time = 0;
+          g_array_append_val (jobs, job);
+        }
+    }
+
+  /* The jobs array is not resized from here on */
+  error = NULL;
+  pool = g_thread_pool_new (load_file_in_thread, NULL, max_threads, FALSE, &error);
+  if (pool == NULL)
+    {
+      g_warning ("Error creating threads for reading authorization files: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      for (n = 0; n < jobs->len; n++)
+        g_thread_pool_push (pool, &g_array_index (jobs, LoadFileJob, n), NULL);
+      /* Waits for all jobs */
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+
+  /* Merge in directory order, then basename order */
+  m = 0;
+  for (l = stores, n = 0; l != NULL; l = l->next, n++)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+      GPtrArray *basenames = basenames_by_store->pdata[n];
+      gint64 start;
+      guint k;
+
+      if (basenames == NULL)
+        continue;
+
+      for (k = 0; k < basenames->len; k++, m++)
+        {
+          LoadFileJob *job = &g_array_index (jobs, LoadFileJob, m);
+
+          /* Read here if no thread could be started */
+          if (job->file == NULL)
+            load_file_in_thread (job, NULL);
+          g_ptr_array_add (store->priv->files, job->file);
+          store->priv->load_time += job->load_time;
+        }
+      g_ptr_array_unref (basenames);
+
+      start = g_get_monotonic_time ();
+      update_rules (store);
+      store->priv->has_data = TRUE;
+      store->priv->load_time += g_get_monotonic_time () - start;
+    }
+
+  g_array_free (jobs, TRUE);
+  g_ptr_array_free (basenames_by_store, TRUE);
+
+  unlock_stores (stores);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* An authorization entry of the stores passed to find_shadowed() */
+typedef struct
+{
+  LocalAuthorization *authorization;
+  guint store;
+} ShadowCandidate;
+
+/* Checks whether all strings in @range_a of @file_a are in @range_b of
+   @file_b */
+static gboolean
+range_contains_all (LocalAuthorizationFile  *file_b,
+                    LocalAuthorizationRange  range_b,
+                    LocalAuthorizationFile  *file_a,
+                    LocalAuthorizationRange  range_a)
+{
+  const gchar * const *strings_a = LOCAL_AUTHORIZATION_FILE_STRINGS (file_a, range_a);
+  const gchar * const *strings_b = LOCAL_AUTHORIZATION_FILE_STRINGS (file_b, range_b);
+  guint n, m;
+
+  for (n = 0; n < range_a.length; n++)
+    {
+      for (m = 0; m < range_b.length; m++)
+        {
+          if (strcmp (strings_a[n], strings_b[m]) == 0)
+            break;
+        }
+      if (m == range_b.length)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Checks whether @b matches every identity and action @a matches */
+static gboolean
+authorization_covers (const LocalAuthorization *b,
+                      const LocalAuthorization *a)
+{
+  const gchar * const *action_strings;
+  guint n;
+
+  if (!range_contains_all (b->file, b->identity_strings, a->file, a->identity_strings))
+    return FALSE;
+
+  action_strings = LOCAL_AUTHORIZATION_FILE_STRINGS (b->file, b->action_strings);
+  for (n = 0; n < b->action_strings.length; n++)
+    {
+      if (strcmp (action_strings[n], "*") == 0)
+        return TRUE;
+    }
+
+  return range_contains_all (b->file, b->action_strings, a->file, a->action_strings);
+}
+
+static gboolean
+authorization_has_all_results (const LocalAuthorization *authorization)
+{
+  return authorization->result_any != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN
+    && authorization->result_inactive != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN
+    && authorization->result_active != POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+}
+
+/* Finds the entries of @stores, in order of precedence, that never change
+   the result of a lookup.  An entry A is shadowed by a later entry B that
+   matches all identities and actions A matches, if
+
+    - B is in the same store, where the last matching entry wins, or
+    - B is in a later store, sets all three results, and all entries after
+      B in its store set all three results, so that whatever entry of that
+      store matches last overrides A for any subject.
+
+   Entries with return values are kept, since those are added to the
+   details for every matching entry.  As B is itself either kept or
+   shadowed by an entry that also shadows A, all shadowed entries can be
+   left out together.  Calls @func, if not %NULL, for each, and marks them
+   if @mark is %TRUE.  Called with all @stores locked. */
+static guint
+find_shadowed (GList                                      *stores,
+               gboolean                                    mark,
+               PolkitBackendLocalAuthorizationShadowedFunc func,
+               gpointer                                    user_data)
+{
+  GArray *candidates;
+  GArray *complete_from;
+  GHashTable *by_identity;
+  GList *l;
+  guint ret;
+  guint n, m, k;
+
+  candidates = g_array_new (FALSE, FALSE, sizeof (ShadowCandidate));
+  /* For each store, the candidate index from which on all of its entries
+     set all three results */
+  complete_from = g_array_new (FALSE, FALSE, sizeof (guint));
+  /* identity string => GArray of candidate indexes, in order */
+  by_identity = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify) g_array_unref);
+
+  for (l = stores, n = 0; l != NULL; l = l->next, n++)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+      guint store_complete_from;
+
+      polkit_backend_local_authorization_store_ensure (store);
+
+      store_complete_from = candidates->len;
+      for (m = 0; m < store->priv->files->len; m++)
+        {
+          LocalAuthorizationFile *file = store->priv->files->pdata[m];
+
+          for (k = 0; k < file->authorizations->len; k++)
+            {
+              ShadowCandidate candidate;
+              const gchar * const *identity_strings;
+              guint i;
+
+              candidate.authorization = local_authorization_file_get (file, k);
+              candidate.store = n;
+              if (!authorization_has_all_results (candidate.authorization))
+                store_complete_from = candidates->len + 1;
+
+              identity_strings = LOCAL_AUTHORIZATION_FILE_STRINGS (file, candidate.authorization->identity_strings);
+              for (i = 0; i < candidate.authorization->identity_strings.length; i++)
+                {
+                  GArray *indexes;
+
+                  indexes = g_hash_table_lookup (by_identity, identity_strings[i]);
+                  if (indexes == NULL)
+                    {
+                      indexes = g_array_new (FALSE, FALSE, sizeof (guint));
+                      g_hash_table_insert (by_identity, (gpointer) identity_strings[i], indexes);
+                    }
+                  /* Identities listed twice are only recorded once */
+                  if (indexes->len == 0
+                      || g_array_index (indexes, guint, indexes->len - 1) != candidates->len)
+                    g_array_append_val (indexes, candidates->len);
+                }
+
+              g_array_append_val (candidates, candidate);
+            }
+        }
+      g_array_append_val (complete_from, store_complete_from);
+    }
+
+  ret = 0;
+  for (n = 0; n < candidates->len; n++)
+    {
+      ShadowCandidate *a = &g_array_index (candidates, ShadowCandidate, n);
+      const gchar * const *identity_strings;
+      GArray *indexes;
+
+      if (a->authorization->return_value.length != 0
+          || a->authorization->identity_strings.length == 0)
+        continue;
+
+      /* Any entry that covers A has each of its identities, so only the
+         entries with the least common one need to be checked */
+      identity_strings = LOCAL_AUTHORIZATION_FILE_STRINGS (a->authorization->file,
+                                                           a->authorization->identity_strings);
+      indexes = NULL;
+      for (m = 0; m < a->authorization->identity_strings.length; m++)
+        {
+          GArray *identity_indexes = g_hash_table_lookup (by_identity, identity_strings[m]);
+
+          if (indexes == NULL || identity_indexes->len < indexes->len)
+            indexes = identity_indexes;
+        }
+
+      for (m = 0; m < indexes->len; m++)
+        {
+          guint index = g_array_index (indexes, guint, m);
+          ShadowCandidate *b;
+
+          if (index <= n)
+            continue;
+          b = &g_array_index (candidates, ShadowCandidate, index);
+          if (b->store != a->store && index < g_array_index (complete_from, guint, b->store))
+            continue;
+          if (!authorization_covers (b->authorization, a->authorization))
+            continue;
+
+          ret++;
+          if (mark)
+            a->authorization->shadowed = TRUE;
+          if (func != NULL)
+            func (a->authorization->id, b->authorization->id, user_data);
+          break;
+        }
+    }
+
+  g_hash_table_unref (by_identity);
+  g_array_free (complete_from, TRUE);
+  g_array_free (candidates, TRUE);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_store_eliminate_shadowed:
+ * @stores: (element-type PolkitBackendLocalAuthorizationStore): All stores
+ *     of an authority, in order of precedence.
+ *
+ * Leaves the authorization entries of @stores that are overridden by later
+ * entries for all subjects out of lookups, which don't change their
+ * results.  Entries are compared by their configured identity and action
+ * strings.  This must be done again after any of @stores changed, and is
+ * undone for a store when one of its files is read again.  Only rules
+ * taken afterwards are affected.
+ *
+ * Returns: The number of entries left out.
+ */
+guint
+polkit_backend_local_authorization_store_eliminate_shadowed (GList *stores)
+{
+  GList *l;
+  guint ret;
+
+  lock_stores (stores);
+
+  for (l = stores; l != NULL; l = l->next)
+    clear_shadowed (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data));
+
+  ret = find_shadowed (stores, TRUE, NULL, NULL);
+
+  for (l = stores; l != NULL; l = l->next)
+    update_rules (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data));
+
+  unlock_stores (stores);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_store_restore_shadowed:
+ * @stores: (element-type PolkitBackendLocalAuthorizationStore): Stores
+ *     passed to polkit_backend_local_authorization_store_eliminate_shadowed().
+ *
+ * Uses all authorization entries of @stores in lookups again.
+ */
+void
+polkit_backend_local_authorization_store_restore_shadowed (GList *stores)
+{
+  GList *l;
+
+  for (l = stores; l != NULL; l = l->next)
+    {
+      PolkitBackendLocalAuthorizationStore *store = POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE (l->data);
+
+      g_mutex_lock (store->priv->lock);
+      if (clear_shadowed (store))
+        update_rules (store);
+      g_mutex_unlock (store->priv->lock);
+    }
+}
+
+/**
+ * polkit_backend_local_authorization_store_foreach_shadowed:
+ * @stores: (element-type PolkitBackendLocalAuthorizationStore): All stores
+ *     of an authority, in order of precedence.
+ * @func: Function to call for each shadowed entry.
+ * @user_data: User data to pass to @func.
+ *
+ * Calls @func with the id of each entry that
+ * polkit_backend_local_authorization_store_eliminate_shadowed() would
+ * leave out, and the id of a later entry that overrides it, in order of
+ * precedence.  Nothing is left out of lookups.
+ */
+void
+polkit_backend_local_authorization_store_foreach_shadowed (GList                                      *stores,
+                                                           PolkitBackendLocalAuthorizationShadowedFunc func,
+                                                           gpointer                                    user_data)
+{
+  g_return_if_fail (func != NULL);
+
+  lock_stores (stores);
+  find_shadowed (stores, FALSE, func, user_data);
+  unlock_stores (stores);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+struct _PolkitBackendLocalIdentityKeys
+{
+  PolkitIdentity *identity;
+
+  /* KEY_NAME: e.g. "unix-group:users", KEY_NUMERIC: e.g. "unix-group:100",
+     NULL if the same as the name form or the identity has no number */
+  gchar *keys[2];
+
+  /* For matching netgroups, if the identity is a user */
+  gchar *user_name;
+};
+
+enum
+{
+  KEY_NAME,
+  KEY_NUMERIC,
+};
+
+/* A key of an entry in an identity set, index * 2 + key kind + 1, or 0 for
+   none */
+#define IDENTITY_SET_LINK(index, kind) ((index) * 2 + (kind) + 1)
+#define IDENTITY_SET_LINK_INDEX(link)  (((link) - 1) / 2)
+#define IDENTITY_SET_LINK_KIND(link)   (((link) - 1) % 2)
+
+typedef struct
+{
+  /* NULL for "default" */
+  PolkitBackendLocalIdentityKeys *keys;
+
+  /* For each key kind, the next key with the same string */
+  guint next_same[2];
+} IdentitySetEntry;
+
+struct _PolkitBackendLocalIdentitySet
+{
+  GArray *entries;
+
+  /* key string => link to the first key with that string */
+  GHashTable *first_key;
+
+  /* Keys created by polkit_backend_local_identity_set_add() */
+  GPtrArray *owned_keys;
+
+  /* Not owned, may be NULL */
+  PolkitBackendNetgroupCache *netgroup_cache;
+
+  /* Monotonic time the netgroup answers used for lookups expire */
+  gint64 netgroups_expire_at;
+};
+
+/* Returns the name of the user with @uid, or %NULL.  Unlike getpwuid(),
+   as used by polkit_identity_to_string(), this may be called in several
+   threads at once. */
+static gchar *
+lookup_user_name (uid_t uid)
+{
+  struct passwd pwd;
+  struct passwd *result;
+  gchar *buffer;
+  gsize size;
+  gchar *ret;
+  gint rc;
+
+  size = 1024;
+  buffer = g_malloc (size);
+  while ((rc = getpwuid_r (uid, &pwd, buffer, size, &result)) == ERANGE)
+    {
+      size *= 2;
+      buffer = g_realloc (buffer, size);
+    }
+  ret = rc == 0 && result != NULL ? g_strdup (pwd.pw_name) : NULL;
+  g_free (buffer);
+
+  return ret;
+}
+
+/* Returns the name of the group with @gid, or %NULL, like
+   lookup_user_name() */
+static gchar *
+lookup_group_name (gid_t gid)
+{
+  struct group grp;
+  struct group *result;
+  gchar *buffer;
+  gsize size;
+  gchar *ret;
+  gint rc;
+
+  size = 1024;
+  buffer = g_malloc (size);
+  while ((rc = getgrgid_r (gid, &grp, buffer, size, &result)) == ERANGE)
+    {
+      size *= 2;
+      buffer = g_realloc (buffer, size);
+    }
+  ret = rc == 0 && result != NULL ? g_strdup (grp.gr_name) : NULL;
+  g_free (buffer);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_identity_keys_new:
+ * @identity: An identity.
+ *
+ * Computes the strings authorization entries are matched against for
+ * @identity: the usual name form, and for UNIX users and groups also the
+ * numeric form, e.g. <literal>unix-user:500</literal>.  Reusing the
+ * result avoids looking up the names again for each check.  This may be
+ * called in several threads at once.
+ *
+ * Returns: A #PolkitBackendLocalIdentityKeys.  Free with
+ *     polkit_backend_local_identity_keys_free().
+ */
+PolkitBackendLocalIdentityKeys *
+polkit_backend_local_identity_keys_new (PolkitIdentity *identity)
+{
+  PolkitBackendLocalIdentityKeys *keys;
+
+  g_return_val_if_fail (POLKIT_IS_IDENTITY (identity), NULL);
+
+  keys = g_new0 (PolkitBackendLocalIdentityKeys, 1);
+  keys->identity = g_object_ref (identity);
+  if (POLKIT_IS_UNIX_USER (identity))
+    {
+      gint uid = polkit_unix_user_get_uid (POLKIT_UNIX_USER (identity));
+
+      keys->user_name = lookup_user_name (uid);
+      keys->keys[KEY_NUMERIC] = g_strdup_printf ("unix-user:%d", uid);
+      if (keys->user_name != NULL)
+        keys->keys[KEY_NAME] = g_strdup_printf ("unix-user:%s", keys->user_name);
+      else
+        keys->keys[KEY_NAME] = g_strdup (keys->keys[KEY_NUMERIC]);
+    }
+  else if (POLKIT_IS_UNIX_GROUP (identity))
+    {
+      gint gid = polkit_unix_group_get_gid (POLKIT_UNIX_GROUP (identity));
+      gchar *group_name;
+
+      group_name = lookup_group_name (gid);
+      keys->keys[KEY_NUMERIC] = g_strdup_printf ("unix-group:%d", gid);
+      if (group_name != NULL)
+        keys->keys[KEY_NAME] = g_strdup_printf ("unix-group:%s", group_name);
+      else
+        keys->keys[KEY_NAME] = g_strdup (keys->keys[KEY_NUMERIC]);
+      g_free (group_name);
+    }
+  else
+    keys->keys[KEY_NAME] = polkit_identity_to_string (identity);
+
+  /* Identities without a name are already in the numeric form */
+  if (g_strcmp0 (keys->keys[KEY_NAME], keys->keys[KEY_NUMERIC]) == 0)
+    {
+      g_free (keys->keys[KEY_NUMERIC]);
+      keys->keys[KEY_NUMERIC] = NULL;
+    }
+
+  return keys;
+}
+
+/**
+ * polkit_backend_local_identity_keys_free:
+ * @keys: A #PolkitBackendLocalIdentityKeys.
+ *
+ * Frees @keys.
+ */
+void
+polkit_backend_local_identity_keys_free (PolkitBackendLocalIdentityKeys *keys)
+{
+  g_object_unref (keys->identity);
+  g_free (keys->keys[KEY_NAME]);
+  g_free (keys->keys[KEY_NUMERIC]);
+  g_free (keys->user_name);
+  g_free (keys);
+}
+
+/**
+ * polkit_backend_local_identity_keys_get_identity:
+ * @keys: A #PolkitBackendLocalIdentityKeys.
+ *
+ * Gets the identity @keys were computed for.
+ *
+ * Returns: (transfer none): A #PolkitIdentity owned by @keys.
+ */
+PolkitIdentity *
+polkit_backend_local_identity_keys_get_identity (PolkitBackendLocalIdentityKeys *keys)
+{
+  return keys->identity;
+}
+
+/**
+ * polkit_backend_local_identity_keys_get_strings:
+ * @keys: A #PolkitBackendLocalIdentityKeys.
+ * @out_name: Return location for the name form.
+ * @out_numeric: Return location for the numeric form, or %NULL if there
+ *     is none.
+ *
+ * Gets the strings authorization entries without wildcards are compared
+ * with, owned by @keys.
+ */
+void
+polkit_backend_local_identity_keys_get_strings (PolkitBackendLocalIdentityKeys  *keys,
+                                                const gchar                    **out_name,
+                                                const gchar                    **out_numeric)
+{
+  *out_name = keys->keys[KEY_NAME];
+  *out_numeric = keys->keys[KEY_NUMERIC];
+}
+
+/**
+ * polkit_backend_local_identity_set_new:
+ *
+ * Creates an empty ordered set of identities for
+ * polkit_backend_local_authorization_store_lookup_identities().
+ *
+ * Returns: A #PolkitBackendLocalIdentitySet.  Free with
+ *     polkit_backend_local_identity_set_free().
+ */
+PolkitBackendLocalIdentitySet *
+polkit_backend_local_identity_set_new (void)
+{
+  PolkitBackendLocalIdentitySet *set;
+
+  set = g_new (PolkitBackendLocalIdentitySet, 1);
+  set->entries = g_array_new (FALSE, FALSE, sizeof (IdentitySetEntry));
+  set->first_key = g_hash_table_new (g_str_hash, g_str_equal);
+  set->owned_keys = NULL;
+  set->netgroup_cache = NULL;
+  set->netgroups_expire_at = G_MAXINT64;
+
+  return set;
+}
+
+/**
+ * polkit_backend_local_identity_set_free:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ *
+ * Frees @set.
+ */
+void
+polkit_backend_local_identity_set_free (PolkitBackendLocalIdentitySet *set)
+{
+  g_array_free (set->entries, TRUE);
+  g_hash_table_unref (set->first_key);
+  if (set->owned_keys != NULL)
+    g_ptr_array_unref (set->owned_keys);
+  g_free (set);
+}
+
+/**
+ * polkit_backend_local_identity_set_add:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ * @identity: An identity, or %NULL for "default".
+ *
+ * Appends @identity to @set.  The same identity may be added more than
+ * once.
+ *
+ * Returns: The index of @identity in @set.
+ */
+guint
+polkit_backend_local_identity_set_add (PolkitBackendLocalIdentitySet *set,
+                                       PolkitIdentity                *identity)
+{
+  PolkitBackendLocalIdentityKeys *keys;
+
+  g_return_val_if_fail (identity == NULL || POLKIT_IS_IDENTITY (identity), 0);
+
+  keys = NULL;
+  if (identity != NULL)
+    {
+      keys = polkit_backend_local_identity_keys_new (identity);
+      if (set->owned_keys == NULL)
+        set->owned_keys = g_ptr_array_new_with_free_func ((GDestroyNotify) polkit_backend_local_identity_keys_free);
+      g_ptr_array_add (set->owned_keys, keys);
+    }
+
+  return polkit_backend_local_identity_set_add_keys (set, keys);
+}
+
+/**
+ * polkit_backend_local_identity_set_add_keys:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ * @keys: (allow-none): Keys of an identity that outlive @set, or %NULL
+ *     for "default".
+ *
+ * Appends the identity of @keys to @set, like
+ * polkit_backend_local_identity_set_add(), without computing its keys
+ * again.
+ *
+ * Returns: The index of the identity in @set.
+ */
+guint
+polkit_backend_local_identity_set_add_keys (PolkitBackendLocalIdentitySet  *set,
+                                            PolkitBackendLocalIdentityKeys *keys)
+{
+  IdentitySetEntry entry;
+  guint index;
+  guint kind;
+
+  index = set->entries->len;
+  entry.keys = keys;
+  entry.next_same[KEY_NAME] = 0;
+  entry.next_same[KEY_NUMERIC] = 0;
+  g_array_append_val (set->entries, entry);
+
+  for (kind = KEY_NAME; keys != NULL && kind <= KEY_NUMERIC; kind++)
+    {
+      gpointer first;
+      guint link;
+
+      if (keys->keys[kind] == NULL)
+        continue;
+
+      /* Keys with the same string are linked in order */
+      if (!g_hash_table_lookup_extended (set->first_key, keys->keys[kind], NULL, &first))
+        {
+          g_hash_table_insert (set->first_key, keys->keys[kind],
+                               GUINT_TO_POINTER (IDENTITY_SET_LINK (index, kind)));
+          continue;
+        }
+      link = GPOINTER_TO_UINT (first);
+      for (;;)
+        {
+          IdentitySetEntry *same = &g_array_index (set->entries, IdentitySetEntry,
+                                                   IDENTITY_SET_LINK_INDEX (link));
+          guint *next = &same->next_same[IDENTITY_SET_LINK_KIND (link)];
+
+          if (*next == 0)
+            {
+              *next = IDENTITY_SET_LINK (index, kind);
+              break;
+            }
+          link = *next;
+        }
+    }
+
+  return index;
+}
+
+/**
+ * polkit_backend_local_identity_set_get_size:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ *
+ * Gets the number of identities added to @set.
+ *
+ * Returns: The number of identities.
+ */
+guint
+polkit_backend_local_identity_set_get_size (PolkitBackendLocalIdentitySet *set)
+{
+  return set->entries->len;
+}
+
+/**
+ * polkit_backend_local_identity_set_set_netgroup_cache:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ * @cache: (allow-none): A #PolkitBackendNetgroupCache that outlives @set,
+ *     or %NULL.
+ *
+ * Makes lookups for @set answer unix-netgroup: identities using @cache
+ * instead of calling innetgr() directly.
+ */
+void
+polkit_backend_local_identity_set_set_netgroup_cache (PolkitBackendLocalIdentitySet *set,
+                                                      PolkitBackendNetgroupCache    *cache)
+{
+  set->netgroup_cache = cache;
+}
+
+/**
+ * polkit_backend_local_identity_set_get_netgroups_expire_at:
+ * @set: A #PolkitBackendLocalIdentitySet.
+ *
+ * Gets the time the earliest of the netgroup answers used by lookups for
+ * @set so far expires, so that results based on them can be remembered
+ * for as long as the answers are.
+ *
+ * Returns: A monotonic time in microseconds, or %G_MAXINT64 if no
+ *     netgroup answer was used or none expires.
+ */
+gint64
+polkit_backend_local_identity_set_get_netgroups_expire_at (PolkitBackendLocalIdentitySet *set)
+{
+  return set->netgroups_expire_at;
+}
+
+static gboolean
+identity_set_netgroup_contains_user (PolkitBackendLocalIdentitySet *set,
+                                     const gchar                   *netgroup,
+                                     const gchar                   *user_name)
+{
+  gboolean ret;
+  gint64 expires_at;
+
+  if (set->netgroup_cache != NULL)
+    ret = polkit_backend_netgroup_cache_contains_user (set->netgroup_cache, netgroup, user_name,
+                                                       &expires_at);
+  else
+    {
+      /* Not remembered at all */
+      ret = polkit_backend_netgroup_contains_user (netgroup, user_name);
+      expires_at = g_get_monotonic_time ();
+    }
+  set->netgroups_expire_at = MIN (set->netgroups_expire_at, expires_at);
+
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+insert_return_value (PolkitDetails      *details,
+                     LocalAuthorization *authorization)
+{
+  const gchar * const *pairs;
+  guint n;
+
+  pairs = LOCAL_AUTHORIZATION_FILE_STRINGS (authorization->file, authorization->return_value);
+  for (n = 0; n < authorization->return_value.length; n += 2)
+    polkit_details_insert (details, pairs[n], pairs[n + 1]);
+}
+
+/* Marks the entries of @identities matched by @authorization by setting
+   @matched_by[entry] to @serial. */
+static void
+match_identities (LocalAuthorization            *authorization,
+                  PolkitBackendLocalIdentitySet *identities,
+                  guint                         *matched_by,
+                  guint                          serial)
+{
+  LocalAuthorizationFile *file = authorization->file;
+  GArray *entries = identities->entries;
+  const gchar * const *strings;
+  guint n, m;
+
+  if (authorization->matches_default)
+    {
+      for (n = 0; n < entries->len; n++)
+        {
+          if (g_array_index (entries, IdentitySetEntry, n).keys == NULL)
+            matched_by[n] = serial;
+        }
+    }
+
+  strings = LOCAL_AUTHORIZATION_FILE_STRINGS (file, authorization->literal_identities);
+  for (n = 0; n < authorization->literal_identities.length; n++)
+    {
+      gpointer first;
+      guint link;
+
+      if (!g_hash_table_lookup_extended (identities->first_key, strings[n], NULL, &first))
+        continue;
+      link = GPOINTER_TO_UINT (first);
+      do
+        {
+          m = IDENTITY_SET_LINK_INDEX (link);
+          matched_by[m] = serial;
+          link = g_array_index (entries, IdentitySetEntry, m).next_same[IDENTITY_SET_LINK_KIND (link)];
+        }
+      while (link != 0);
+    }
+
+  /* Only names are matched against globs; a numeric ID only matches an
+     entry naming exactly that ID, which was looked up above */
+  for (m = 0; m < authorization->identity_patterns.length; m++)
+    {
+      const Pattern *pattern = &g_array_index (file->identity_patterns, Pattern,
+                                               authorization->identity_patterns.start + m);
+
+      for (n = 0; n < entries->len; n++)
+        {
+          IdentitySetEntry *entry = &g_array_index (entries, IdentitySetEntry, n);
+
+          if (entry->keys == NULL || matched_by[n] == serial)
+            continue;
+          if (pattern_match (pattern, entry->keys->keys[KEY_NAME]))
+            matched_by[n] = serial;
+        }
+    }
+
+  /* if no identity specs matched and identity is a user, match against netgroups */
+  if (authorization->netgroup_identities.length == 0)
+    return;
+  strings = LOCAL_AUTHORIZATION_FILE_STRINGS (file, authorization->netgroup_identities);
+  for (n = 0; n < entries->len; n++)
+    {
+      IdentitySetEntry *entry = &g_array_index (entries, IdentitySetEntry, n);
+
+      if (entry->keys == NULL || entry->keys->user_name == NULL || matched_by[n] == serial)
+        continue;
+      for (m = 0; m < authorization->netgroup_identities.length; m++)
+        {
+          if (identity_set_netgroup_contains_user (identities, strings[m],
+                                                   entry->keys->user_name))
+            {
+              matched_by[n] = serial;
+              break;
+            }
+        }
+    }
+}
+
+/**
+ * polkit_backend_local_authorization_store_get_rules:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ *
+ * Gets the authorization entries currently used by @store, reading them
+ * first if needed.  The result does not change when @store does, so it
+ * can be used for lookups in other threads while @store reloads files in
+ * the thread it was created in.
+ *
+ * This may be called in any thread.
+ *
+ * Returns: A #PolkitBackendLocalAuthorizationRules.  Free with
+ *     polkit_backend_local_authorization_rules_unref().
+ */
+PolkitBackendLocalAuthorizationRules *
+polkit_backend_local_authorization_store_get_rules (PolkitBackendLocalAuthorizationStore *store)
+{
+  PolkitBackendLocalAuthorizationRules *ret;
+  GPtrArray *no_files;
+
+  g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store), NULL);
+
+  G_LOCK (published_rules);
+  ret = store->priv->rules;
+  if (ret != NULL)
+    polkit_backend_local_authorization_rules_ref (ret);
+  G_UNLOCK (published_rules);
+  if (ret != NULL)
+    return ret;
+
+  g_mutex_lock (store->priv->lock);
+  polkit_backend_local_authorization_store_ensure (store);
+  G_LOCK (published_rules);
+  ret = store->priv->rules;
+  if (ret != NULL)
+    polkit_backend_local_authorization_rules_ref (ret);
+  G_UNLOCK (published_rules);
+  g_mutex_unlock (store->priv->lock);
+  if (ret != NULL)
+    return ret;
+
+  /* The directory could not be listed; this is tried again next time */
+  no_files = g_ptr_array_new ();
+  ret = rules_new (no_files, store->priv->counters);
+  g_ptr_array_unref (no_files);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_rules_lookup_identities:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ * @identities: The identities to check for.
+ * @action_id: The action id to check for.
+ * @details: Details for @action.
+ * @out_matches: Return location for an array with one element for each
+ *     identity in @identities.
+ *
+ * Does the same as calling polkit_backend_local_authorization_store_lookup()
+ * for each identity in @identities in turn, storing the results in the
+ * corresponding element of @out_matches, but matches each authorization
+ * entry against @action_id only once.
+ *
+ * This may be called in several threads at once for the same @rules, but
+ * not for the same @identities if it uses a #PolkitBackendNetgroupCache
+ * that is not shared.
+ */
+void
+polkit_backend_local_authorization_rules_lookup_identities (PolkitBackendLocalAuthorizationRules *rules,
+                                                            PolkitBackendLocalIdentitySet        *identities,
+                                                            const gchar                          *action_id,
+                                                            PolkitDetails                        *details,
+                                                            PolkitBackendLocalAuthorizationMatch *out_matches)
+{
+  GPtrArray *entries;
+  GPtrArray **return_values;
+  guint *matched_by;
+  guint n_identities;
+  guint n_matched;
+  guint n, m;
+
+  g_return_if_fail (rules != NULL);
+  g_return_if_fail (identities != NULL);
+  g_return_if_fail (action_id != NULL);
+  g_return_if_fail (details == NULL || POLKIT_IS_DETAILS (details));
+  g_return_if_fail (out_matches != NULL);
+
+  n_identities = identities->entries->len;
+  for (m = 0; m < n_identities; m++)
+    out_matches[m].matched = FALSE;
+
+  /* first match the action */
+  entries = get_entries_for_action (rules, action_id);
+  if (entries->len == 0)
+    goto out;
+
+  /* then the identities; entries are marked with 1 + the index of the
+     last authorization that matched them */
+  matched_by = g_new0 (guint, n_identities);
+  return_values = NULL;
+  n_matched = 0;
+  for (n = 0; n < entries->len; n++)
+    {
+      LocalAuthorization *authorization = ((RuleEntry *) entries->pdata[n])->authorization;
+      gboolean matched;
+
+      match_identities (authorization, identities, matched_by, n + 1);
+
+      matched = FALSE;
+      for (m = 0; m < n_identities; m++)
+        {
+          if (matched_by[m] != n + 1)
+            continue;
+
+          /* Yay, a match! However, keep going since subsequent authorization entries may modify the result */
+          matched = TRUE;
+          out_matches[m].matched = TRUE;
+          out_matches[m].id = authorization->id;
+          out_matches[m].result_any = authorization->result_any;
+          out_matches[m].result_inactive = authorization->result_inactive;
+          out_matches[m].result_active = authorization->result_active;
+
+          /* Return values are added to details in the order of the
+             identities, as by separate lookups */
+          if (details != NULL && authorization->return_value.length != 0)
+            {
+              if (return_values == NULL)
+                return_values = g_new0 (GPtrArray *, n_identities);
+              if (return_values[m] == NULL)
+                return_values[m] = g_ptr_array_new ();
+              g_ptr_array_add (return_values[m], authorization);
+            }
+        }
+      if (matched)
+        n_matched++;
+    }
+  lookup_counters_add (rules->counters, entries->len, n_matched);
+  g_free (matched_by);
+
+  if (return_values != NULL)
+    {
+      for (m = 0; m < n_identities; m++)
+        {
+          if (return_values[m] == NULL)
+            continue;
+          for (n = 0; n < return_values[m]->len; n++)
+            insert_return_value (details, return_values[m]->pdata[n]);
+          g_ptr_array_unref (return_values[m]);
+        }
+      g_free (return_values);
+    }
+
+ out:
+  g_ptr_array_unref (entries);
+}
+
+/**
+ * polkit_backend_local_authorization_store_lookup_identities:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ * @identities: The identities to check for.
+ * @action_id: The action id to check for.
+ * @details: Details for @action.
+ * @out_matches: Return location for an array with one element for each
+ *     identity in @identities.
+ *
+ * Like polkit_backend_local_authorization_rules_lookup_identities() for
+ * the current rules of @store.  The ids in @out_matches are only valid
+ * until @store changes.
+ */
+void
+polkit_backend_local_authorization_store_lookup_identities (PolkitBackendLocalAuthorizationStore *store,
+                                                            PolkitBackendLocalIdentitySet        *identities,
+                                                            const gchar                          *action_id,
+                                                            PolkitDetails                        *details,
+                                                            PolkitBackendLocalAuthorizationMatch *out_matches)
+{
+  PolkitBackendLocalAuthorizationRules *rules;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store));
+
+  rules = polkit_backend_local_authorization_store_get_rules (store);
+  polkit_backend_local_authorization_rules_lookup_identities (rules, identities, action_id,
+                                                              details, out_matches);
+  polkit_backend_local_authorization_rules_unref (rules);
+}
+
+struct _PolkitBackendLocalAuthorizationReverseLookup
+{
+  PolkitBackendLocalAuthorizationRules *rules;
+  PolkitBackendLocalIdentitySet *identities;
+
+  /* RuleEntry structures matching the action, in file order */
+  GPtrArray *entries;
+  /* Entries from this index on have been matched */
+  guint position;
+
+  /* As in polkit_backend_local_authorization_rules_lookup_identities() */
+  guint *matched_by;
+  /* Whether the last entry matching each identity has been found */
+  gboolean *found;
+  PolkitBackendLocalAuthorizationMatch *matches;
+
+  /* Added to the lookup counters when done */
+  guint entries_scanned;
+  guint entries_matched;
+};
+
+/**
+ * polkit_backend_local_authorization_reverse_lookup_new:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ * @identities: The identities to check for, which must not be modified
+ *     or freed before the result.
+ * @action_id: The action id to check for.
+ *
+ * Prepares a lookup of @identities in @rules like
+ * polkit_backend_local_authorization_rules_lookup_identities(), that
+ * matches the entries from the last one backwards, and only as far as
+ * needed for the identities asked for with
+ * polkit_backend_local_authorization_reverse_lookup_get().  Return values
+ * are not collected.
+ *
+ * Returns: A #PolkitBackendLocalAuthorizationReverseLookup.  Free with
+ *     polkit_backend_local_authorization_reverse_lookup_free().
+ */
+PolkitBackendLocalAuthorizationReverseLookup *
+polkit_backend_local_authorization_reverse_lookup_new (PolkitBackendLocalAuthorizationRules *rules,
+                                                       PolkitBackendLocalIdentitySet        *identities,
+                                                       const gchar                          *action_id)
+{
+  PolkitBackendLocalAuthorizationReverseLookup *lookup;
+  guint n_identities;
+
+  g_return_val_if_fail (rules != NULL, NULL);
+  g_return_val_if_fail (identities != NULL, NULL);
+  g_return_val_if_fail (action_id != NULL, NULL);
+
+  n_identities = identities->entries->len;
+  lookup = g_new0 (PolkitBackendLocalAuthorizationReverseLookup, 1);
+  lookup->rules = polkit_backend_local_authorization_rules_ref (rules);
+  lookup->identities = identities;
+  lookup->entries = get_entries_for_action (rules, action_id);
+  lookup->position = lookup->entries->len;
+  lookup->matched_by = g_new0 (guint, n_identities);
+  lookup->found = g_new0 (gboolean, n_identities);
+  lookup->matches = g_new0 (PolkitBackendLocalAuthorizationMatch, n_identities);
+
+  return lookup;
+}
+
+/**
+ * polkit_backend_local_authorization_reverse_lookup_get:
+ * @lookup: A #PolkitBackendLocalAuthorizationReverseLookup.
+ * @identity_index: The index of an identity in the set passed to
+ *     polkit_backend_local_authorization_reverse_lookup_new().
+ *
+ * Matches entries of the rules, continuing backwards from where the
+ * previous call stopped, until the last entry matching the identity has
+ * been found.  The last entries of other identities found on the way are
+ * remembered.
+ *
+ * Returns: The result for the identity, owned by @lookup.
+ */
+const PolkitBackendLocalAuthorizationMatch *
+polkit_backend_local_authorization_reverse_lookup_get (PolkitBackendLocalAuthorizationReverseLookup *lookup,
+                                                       guint                                          identity_index)
+{
+  guint n_identities;
+  guint m;
+
+  g_return_val_if_fail (lookup != NULL, NULL);
+  g_return_val_if_fail (identity_index < lookup->identities->entries->len, NULL);
+
+  n_identities = lookup->identities->entries->len;
+  while (!lookup->found[identity_index] && lookup->position > 0)
+    {
+      LocalAuthorization *authorization;
+      gboolean matched;
+
+      lookup->position--;
+      authorization = ((RuleEntry *) lookup->entries->pdata[lookup->position])->authorization;
+      match_identities (authorization, lookup->identities, lookup->matched_by,
+                        lookup->position + 1);
+      lookup->entries_scanned++;
+
+      matched = FALSE;
+      for (m = 0; m < n_identities; m++)
+        {
+          if (lookup->matched_by[m] != lookup->position + 1)
+            continue;
+          matched = TRUE;
+          if (lookup->found[m])
+            continue;
+
+          /* Earlier entries can not change the result */
+          lookup->found[m] = TRUE;
+          lookup->matches[m].matched = TRUE;
+          lookup->matches[m].id = authorization->id;
+          lookup->matches[m].result_any = authorization->result_any;
+          lookup->matches[m].result_inactive = authorization->result_inactive;
+          lookup->matches[m].result_active = authorization->result_active;
+        }
+      if (matched)
+        lookup->entries_matched++;
     }
 
-  /* Warning: This ordering is undocumented and must not be relied upon; use
-     the documented ordering of subdirectories instead.  It's here only to help
-     users who rely on a tested but ambiguous configuration while using a
-     single release of polkit.  The basename ordering may change without
-     notice. */
-  files = g_list_sort (files, compare_basename);
+  /* If all entries have been matched, matches[identity_index].matched
+     is still FALSE */
+  return &lookup->matches[identity_index];
+}
 
-  for (l = files; l != NULL; l = l->next)
+/**
+ * polkit_backend_local_authorization_reverse_lookup_free:
+ * @lookup: A #PolkitBackendLocalAuthorizationReverseLookup.
+ *
+ * Frees @lookup.
+ */
+void
+polkit_backend_local_authorization_reverse_lookup_free (PolkitBackendLocalAuthorizationReverseLookup *lookup)
+{
+  lookup_counters_add (lookup->rules->counters, lookup->entries_scanned, lookup->entries_matched);
+  g_free (lookup->matches);
+  g_free (lookup->found);
+  g_free (lookup->matched_by);
+  g_ptr_array_unref (lookup->entries);
+  polkit_backend_local_authorization_rules_unref (lookup->rules);
+  g_free (lookup);
+}
+
+static void
+tabulate_entry (const gchar                                 *identity,
+                LocalAuthorization                          *authorization,
+                PolkitBackendLocalAuthorizationTabulateFunc  func,
+                gpointer                                     user_data)
+{
+  PolkitBackendLocalAuthorizationMatch match;
+
+  match.matched = TRUE;
+  match.id = authorization->id;
+  match.result_any = authorization->result_any;
+  match.result_inactive = authorization->result_inactive;
+  match.result_active = authorization->result_active;
+  func (identity, &match, user_data);
+}
+
+/**
+ * polkit_backend_local_authorization_rules_get_literal_actions:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ *
+ * Gets the action ids that authorization entries in @rules name without
+ * wildcards, in no particular order.
+ *
+ * Returns: A #GPtrArray of strings owned by @rules.  Free with
+ *     g_ptr_array_unref().
+ */
+GPtrArray *
+polkit_backend_local_authorization_rules_get_literal_actions (PolkitBackendLocalAuthorizationRules *rules)
+{
+  GPtrArray *ret;
+  GHashTableIter iter;
+  gpointer action_id;
+
+  g_return_val_if_fail (rules != NULL, NULL);
+
+  ret = g_ptr_array_sized_new (g_hash_table_size (rules->literal_actions));
+  g_hash_table_iter_init (&iter, rules->literal_actions);
+  while (g_hash_table_iter_next (&iter, &action_id, NULL))
+    g_ptr_array_add (ret, action_id);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_rules_tabulate:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ * @action_id: The action id to tabulate.
+ * @func: Function to call for each identity.
+ * @user_data: User data to pass to @func.
+ *
+ * Computes what polkit_backend_local_authorization_rules_lookup_identities()
+ * would return for @action_id, without details, for each identity the
+ * entries matching @action_id name, without matching any identities.
+ * @func is called with %NULL for "default" and with the identity string
+ * otherwise, owned by @rules, and the last matching entry.  An identity
+ * with several keys matches what each of its keys matches, which @func
+ * is not told about.
+ *
+ * Nothing is tabulated if any of the entries matching @action_id has an
+ * identity with wildcards or a netgroup, as those can only be matched
+ * against a subject.
+ *
+ * This may be called in several threads at once.
+ *
+ * Returns: %TRUE if @func was called for all identities, %FALSE if the
+ *     entries for @action_id can not be tabulated.
+ */
+gboolean
+polkit_backend_local_authorization_rules_tabulate (PolkitBackendLocalAuthorizationRules        *rules,
+                                                   const gchar                                 *action_id,
+                                                   PolkitBackendLocalAuthorizationTabulateFunc  func,
+                                                   gpointer                                     user_data)
+{
+  GPtrArray *entries;
+  GHashTable *last_entries;
+  LocalAuthorization *default_entry;
+  GHashTableIter iter;
+  gpointer identity, authorization;
+  gboolean ret;
+  guint n, m;
+
+  g_return_val_if_fail (rules != NULL, FALSE);
+  g_return_val_if_fail (action_id != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  ret = FALSE;
+  entries = get_entries_for_action (rules, action_id);
+  /* identity string => last LocalAuthorization naming it */
+  last_entries = g_hash_table_new (g_str_hash, g_str_equal);
+  default_entry = NULL;
+  for (n = 0; n < entries->len; n++)
     {
-      GFile *file = G_FILE (l->data);
-      gchar *filename;
-      GKeyFile *key_file;
+      LocalAuthorization *entry = ((RuleEntry *) entries->pdata[n])->authorization;
+      const gchar * const *strings;
+
+      if (entry->identity_patterns.length != 0 || entry->netgroup_identities.length != 0)
+        goto out;
+      if (entry->matches_default)
+        default_entry = entry;
+      strings = LOCAL_AUTHORIZATION_FILE_STRINGS (entry->file, entry->literal_identities);
+      for (m = 0; m < entry->literal_identities.length; m++)
+        g_hash_table_insert (last_entries, (gpointer) strings[m], entry);
+    }
+
+  if (default_entry != NULL)
+    tabulate_entry (NULL, default_entry, func, user_data);
+  g_hash_table_iter_init (&iter, last_entries);
+  while (g_hash_table_iter_next (&iter, &identity, &authorization))
+    tabulate_entry (identity, authorization, func, user_data);
+
+  ret = TRUE;
+
+ out:
+  g_hash_table_unref (last_entries);
+  g_ptr_array_unref (entries);
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_rules_has_action:
+ * @rules: A #PolkitBackendLocalAuthorizationRules.
+ * @action_id: An action id.
+ *
+ * Checks whether any authorization entry in @rules matches @action_id.
+ *
+ * Returns: %TRUE if an entry matches @action_id.
+ */
+gboolean
+polkit_backend_local_authorization_rules_has_action (PolkitBackendLocalAuthorizationRules *rules,
+                                                     const gchar                          *action_id)
+{
+  GPtrArray *entries;
+  gboolean ret;
+
+  g_return_val_if_fail (rules != NULL, FALSE);
+  g_return_val_if_fail (action_id != NULL, FALSE);
+
+  entries = get_entries_for_action (rules, action_id);
+  ret = entries->len != 0;
+  g_ptr_array_unref (entries);
+
+  return ret;
+}
+
+static gboolean
+local_authorization_strings_equal (const LocalAuthorization      *a,
+                                   const LocalAuthorizationRange *range_a,
+                                   const LocalAuthorization      *b,
+                                   const LocalAuthorizationRange *range_b)
+{
+  const gchar * const *strings_a;
+  const gchar * const *strings_b;
+  guint n;
+
+  if (range_a->length != range_b->length)
+    return FALSE;
 
-      filename = g_file_get_path (file);
+  strings_a = LOCAL_AUTHORIZATION_FILE_STRINGS (a->file, *range_a);
+  strings_b = LOCAL_AUTHORIZATION_FILE_STRINGS (b->file, *range_b);
+  for (n = 0; n < range_a->length; n++)
+    {
+      if (strcmp (strings_a[n], strings_b[n]) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
 
-      key_file = g_key_file_new ();
+/* Whether @a and @b, with the same id, give the same results.  Entries of
+   files that were not read again are the same structure. */
+static gboolean
+local_authorization_equal (const LocalAuthorization *a,
+                           const LocalAuthorization *b)
+{
+  if (a == b)
+    return TRUE;
+
+  return a->result_any == b->result_any
+    && a->result_inactive == b->result_inactive
+    && a->result_active == b->result_active
+    && local_authorization_strings_equal (a, &a->identity_strings, b, &b->identity_strings)
+    && local_authorization_strings_equal (a, &a->action_strings, b, &b->action_strings)
+    && local_authorization_strings_equal (a, &a->return_value, b, &b->return_value);
+}
+
+/* Returns the entries of @rules, in order of precedence, and adds them to
+   @by_id */
+static GPtrArray *
+collect_entries_by_id (PolkitBackendLocalAuthorizationRules **rules,
+                       guint                                  n_rules,
+                       GHashTable                            *by_id)
+{
+  GPtrArray *ret;
+  guint n, m;
 
-      error = NULL;
-      if (!g_key_file_load_from_file (key_file,
-                                      filename,
-                                      G_KEY_FILE_NONE,
-                                      &error))
+  ret = g_ptr_array_new ();
+  for (n = 0; n < n_rules; n++)
+    {
+      for (m = 0; m < rules[n]->n_entries; m++)
         {
-          g_warning ("Error loading key-file %s: %s", filename, error->message);
-          g_error_free (error);
-          error = NULL;
-          g_key_file_free (key_file);
+          LocalAuthorization *authorization = rules[n]->entries[m].authorization;
+
+          g_ptr_array_add (ret, authorization);
+          g_hash_table_insert (by_id, (gpointer) authorization->id, authorization);
         }
-      else
-        {
-          gchar **groups;
-          guint n;
+    }
 
-          groups = g_key_file_get_groups (key_file, NULL);
-          for (n = 0; groups[n] != NULL; n++)
-            {
-              LocalAuthorization *authorization;
+  return ret;
+}
 
-              error = NULL;
-              authorization = local_authorization_new (key_file, filename, groups[n], &error);
-              if (authorization == NULL)
-                {
-                  g_warning ("Error parsing group `%s' in file `%s': %s",
-                             groups[n],
-                             filename,
-                             error->message);
-                  g_error_free (error);
-                }
-              else
-                {
-                  store->priv->authorizations = g_list_prepend (store->priv->authorizations,
-                                                                authorization);
-                }
-            }
-          g_strfreev (groups);
+static void
+add_changed_entry (GPtrArray          *changed,
+                   GHashTable         *files,
+                   LocalAuthorization *authorization)
+{
+  g_ptr_array_add (changed, authorization);
+  g_hash_table_insert (files, authorization->file, NULL);
+}
+
+/**
+ * polkit_backend_local_authorization_rules_diff:
+ * @old_rules: The rules of all stores before a change, in order of precedence.
+ * @n_old_rules: The number of elements in @old_rules.
+ * @new_rules: The rules of all stores after the change, in order of precedence.
+ * @n_new_rules: The number of elements in @new_rules.
+ * @out_diff: Return location for the number of entries that changed.
+ *
+ * Compares the authorization entries of @old_rules and @new_rules by
+ * their ids, <literal>filename::group</literal>.  Entries of files that
+ * were not read again are recognized without comparing their contents.
+ *
+ * Only checks for actions that entries of the result match can be
+ * decided differently by @new_rules, see
+ * polkit_backend_local_authorization_rules_has_action().  If entries in
+ * both were reordered, for instance because the order of the stores
+ * changed, any check can.
+ *
+ * Returns: A #PolkitBackendLocalAuthorizationRules with the entries that
+ *     were added or removed, and both versions of those that changed, or
+ *     %NULL if entries were reordered.  Free with
+ *     polkit_backend_local_authorization_rules_unref().
+ */
+PolkitBackendLocalAuthorizationRules *
+polkit_backend_local_authorization_rules_diff (PolkitBackendLocalAuthorizationRules **old_rules,
+                                               guint                                  n_old_rules,
+                                               PolkitBackendLocalAuthorizationRules **new_rules,
+                                               guint                                  n_new_rules,
+                                               PolkitBackendLocalAuthorizationDiff   *out_diff)
+{
+  PolkitBackendLocalAuthorizationRules *ret;
+  GHashTable *old_by_id, *new_by_id;
+  GPtrArray *old_entries, *new_entries;
+  GPtrArray *old_common, *new_common;
+  GPtrArray *changed;
+  GHashTable *changed_files;
+  GPtrArray *files;
+  GHashTableIter iter;
+  gpointer file;
+  LookupCounters *counters;
+  guint n;
+
+  g_return_val_if_fail (old_rules != NULL || n_old_rules == 0, NULL);
+  g_return_val_if_fail (new_rules != NULL || n_new_rules == 0, NULL);
+  g_return_val_if_fail (out_diff != NULL, NULL);
+
+  ret = NULL;
+  memset (out_diff, 0, sizeof (*out_diff));
+  old_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+  new_by_id = g_hash_table_new (g_str_hash, g_str_equal);
+  old_entries = collect_entries_by_id (old_rules, n_old_rules, old_by_id);
+  new_entries = collect_entries_by_id (new_rules, n_new_rules, new_by_id);
+
+  /* Entries in both, in their order in each */
+  old_common = g_ptr_array_new ();
+  new_common = g_ptr_array_new ();
+  changed = g_ptr_array_new ();
+  changed_files = g_hash_table_new (g_direct_hash, g_direct_equal);
+  for (n = 0; n < old_entries->len; n++)
+    {
+      LocalAuthorization *old_entry = old_entries->pdata[n];
+      LocalAuthorization *new_entry;
 
-          g_key_file_free (key_file);
+      new_entry = g_hash_table_lookup (new_by_id, old_entry->id);
+      if (new_entry == NULL)
+        {
+          out_diff->n_removed++;
+          add_changed_entry (changed, changed_files, old_entry);
+          continue;
         }
+      g_ptr_array_add (old_common, old_entry);
+      if (!local_authorization_equal (old_entry, new_entry))
+        {
+          out_diff->n_changed++;
+          add_changed_entry (changed, changed_files, old_entry);
+          add_changed_entry (changed, changed_files, new_entry);
+        }
+    }
+  for (n = 0; n < new_entries->len; n++)
+    {
+      LocalAuthorization *new_entry = new_entries->pdata[n];
 
-      g_free (filename);
+      if (g_hash_table_lookup (old_by_id, new_entry->id) == NULL)
+        {
+          out_diff->n_added++;
+          add_changed_entry (changed, changed_files, new_entry);
+        }
+      else
+        g_ptr_array_add (new_common, new_entry);
     }
 
-  store->priv->authorizations = g_list_reverse (store->priv->authorizations);
+  for (n = 0; n < old_common->len; n++)
+    {
+      const LocalAuthorization *old_entry = old_common->pdata[n];
+      const LocalAuthorization *new_entry = new_common->pdata[n];
 
-  store->priv->has_data = TRUE;
+      if (strcmp (old_entry->id, new_entry->id) != 0)
+        goto out;
+    }
+
+  files = g_ptr_array_sized_new (g_hash_table_size (changed_files));
+  g_hash_table_iter_init (&iter, changed_files);
+  while (g_hash_table_iter_next (&iter, &file, NULL))
+    g_ptr_array_add (files, file);
+  counters = g_new0 (LookupCounters, 1);
+  counters->ref_count = 1;
+  ret = rules_new_for_entries (files, changed, counters);
+  lookup_counters_unref (counters);
+  g_ptr_array_unref (files);
 
  out:
-  g_list_foreach (files, (GFunc) g_object_unref, NULL);
-  g_list_free (files);
+  g_hash_table_unref (changed_files);
+  g_ptr_array_unref (changed);
+  g_ptr_array_unref (new_common);
+  g_ptr_array_unref (old_common);
+  g_ptr_array_unref (new_entries);
+  g_ptr_array_unref (old_entries);
+  g_hash_table_unref (new_by_id);
+  g_hash_table_unref (old_by_id);
+  return ret;
 }
 
 /**
@@ -727,9 +3628,8 @@ polkit_backend_local_authorization_store_lookup (PolkitBackendLocalAuthorization
                                                  PolkitImplicitAuthorization          *out_result_inactive,
                                                  PolkitImplicitAuthorization          *out_result_active)
 {
-  GList *l, *ll;
-  gboolean ret;
-  gchar *identity_string;
+  PolkitBackendLocalIdentitySet *identities;
+  PolkitBackendLocalAuthorizationMatch match;
 
   g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store), FALSE);
   g_return_val_if_fail (identity == NULL || POLKIT_IS_IDENTITY (identity), FALSE);
@@ -739,92 +3639,379 @@ polkit_backend_local_authorization_store_lookup (PolkitBackendLocalAuthorization
   g_return_val_if_fail (out_result_inactive != NULL, FALSE);
   g_return_val_if_fail (out_result_active != NULL, FALSE);
 
-  ret = FALSE;
-  identity_string = NULL;
+  identities = polkit_backend_local_identity_set_new ();
+  polkit_backend_local_identity_set_add (identities, identity);
+  polkit_backend_local_authorization_store_lookup_identities (store, identities, action_id,
+                                                              details, &match);
+  polkit_backend_local_identity_set_free (identities);
+
+  if (!match.matched)
+    return FALSE;
+
+  *out_result_any = match.result_any;
+  *out_result_inactive = match.result_inactive;
+  *out_result_active = match.result_active;
+
+  return TRUE;
+}
+
+/**
+ * polkit_backend_local_authorization_store_get_reload_stats:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ * @out_change_events: (allow-none): Return location for the number of
+ *     change notifications received for authorization files.
+ * @out_reloads: (allow-none): Return location for the number of times
+ *     these notifications changed the authorization entries of @store, see
+ *     #PolkitBackendLocalAuthorizationStore:coalesce-timeout.
+ * @out_reload_time: (allow-none): Return location for the number of
+ *     microseconds spent reading files again while handling them.
+ *
+ * Gets statistics about the reloads of @store.
+ */
+void
+polkit_backend_local_authorization_store_get_reload_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                           guint64                              *out_change_events,
+                                                           guint64                              *out_reloads,
+                                                           gint64                               *out_reload_time)
+{
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store));
+
+  g_mutex_lock (store->priv->lock);
+  if (out_change_events != NULL)
+    *out_change_events = store->priv->change_events;
+  if (out_reloads != NULL)
+    *out_reloads = store->priv->reloads;
+  if (out_reload_time != NULL)
+    *out_reload_time = store->priv->reload_time;
+  g_mutex_unlock (store->priv->lock);
+}
+
+/**
+ * polkit_backend_local_authorization_store_get_content_stats:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ * @out_n_files: (allow-none): Return location for the number of
+ *     authorization files.
+ * @out_n_entries: (allow-none): Return location for the number of
+ *     authorization entries in them.
+ * @out_n_errors: (allow-none): Return location for the number of groups
+ *     in them that could not be parsed, counting files that could not be
+ *     read as one.
+ *
+ * Gets the size of the authorization entries currently held by @store,
+ * without reading them if that has not happened yet.  Errors are only
+ * known for files that were read; files taken from a snapshot count as
+ * having none.
+ */
+void
+polkit_backend_local_authorization_store_get_content_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                            guint                                *out_n_files,
+                                                            guint                                *out_n_entries,
+                                                            guint                                *out_n_errors)
+{
+  guint n_files, n_entries, n_errors;
+  guint n;
+
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store));
+
+  n_files = 0;
+  n_entries = 0;
+  n_errors = 0;
+  g_mutex_lock (store->priv->lock);
+  if (store->priv->has_data)
+    {
+      for (n = 0; n < store->priv->files->len; n++)
+        {
+          LocalAuthorizationFile *file = store->priv->files->pdata[n];
+
+          if (!polkit_backend_snapshot_source_exists (file->source))
+            continue;
+          n_files++;
+          n_entries += file->authorizations->len;
+          n_errors += file->n_errors;
+        }
+    }
+  g_mutex_unlock (store->priv->lock);
+
+  if (out_n_files != NULL)
+    *out_n_files = n_files;
+  if (out_n_entries != NULL)
+    *out_n_entries = n_entries;
+  if (out_n_errors != NULL)
+    *out_n_errors = n_errors;
+}
+
+/**
+ * polkit_backend_local_authorization_store_get_lookup_stats:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ * @out_load_time: (allow-none): Return location for the number of
+ *     microseconds spent listing, reading and indexing authorization
+ *     files, including reloads.
+ * @out_entries_scanned: (allow-none): Return location for the number of
+ *     authorization entries matching the action of a lookup that were
+ *     matched against its identities.
+ * @out_entries_matched: (allow-none): Return location for the number of
+ *     those entries that matched at least one identity.
+ *
+ * Gets counters of the work done by lookups in @store since it was
+ * created, to find out where the time of a check goes by comparing
+ * them before and after.
+ */
+void
+polkit_backend_local_authorization_store_get_lookup_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                           gint64                               *out_load_time,
+                                                           guint64                              *out_entries_scanned,
+                                                           guint64                              *out_entries_matched)
+{
+  g_return_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store));
+
+  if (out_load_time != NULL)
+    {
+      g_mutex_lock (store->priv->lock);
+      *out_load_time = store->priv->load_time;
+      g_mutex_unlock (store->priv->lock);
+    }
+
+  G_LOCK (lookup_counters);
+  if (out_entries_scanned != NULL)
+    *out_entries_scanned = store->priv->counters->entries_scanned;
+  if (out_entries_matched != NULL)
+    *out_entries_matched = store->priv->counters->entries_matched;
+  G_UNLOCK (lookup_counters);
+}
+
+/**
+ * polkit_backend_local_authorization_store_serialize:
+ * @store: A #PolkitBackendLocalAuthorizationStore.
+ *
+ * Serializes all authorization entries in @store, together with the
+ * snapshot source records of the files they were read from.
+ *
+ * Returns: A floating #GVariant of type
+ *     %POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING.
+ */
+GVariant *
+polkit_backend_local_authorization_store_serialize (PolkitBackendLocalAuthorizationStore *store)
+{
+  GVariantBuilder sources_builder;
+  GVariantBuilder files_builder;
+  gchar *path;
+  GVariant *ret;
+  guint n, m;
+
+  g_return_val_if_fail (POLKIT_BACKEND_IS_LOCAL_AUTHORIZATION_STORE (store), NULL);
 
+  g_mutex_lock (store->priv->lock);
   polkit_backend_local_authorization_store_ensure (store);
 
-  for (l = store->priv->authorizations; l != NULL; l = l->next)
+  /* The directory, followed by each file */
+  g_variant_builder_init (&sources_builder,
+                          G_VARIANT_TYPE ("a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING));
+  g_variant_builder_add_value (&sources_builder, store->priv->directory_source);
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("aa(sasasiiia{ss})"));
+  for (n = 0; n < store->priv->files->len; n++)
     {
-      LocalAuthorization *authorization = l->data;
+      LocalAuthorizationFile *file = store->priv->files->pdata[n];
+
+      g_variant_builder_add_value (&sources_builder, file->source);
 
-      /* first match the action */
-      for (ll = authorization->action_specs; ll != NULL; ll = ll->next)
+      g_variant_builder_open (&files_builder, G_VARIANT_TYPE ("a(sasasiiia{ss})"));
+      for (m = 0; m < file->authorizations->len; m++)
         {
-          if (g_pattern_match_string ((GPatternSpec *) ll->data, action_id))
-            break;
+          LocalAuthorization *authorization = local_authorization_file_get (file, m);
+          GVariantBuilder return_value_builder;
+          const gchar * const *pairs;
+          guint k;
+
+          g_variant_builder_init (&return_value_builder, G_VARIANT_TYPE ("a{ss}"));
+          pairs = LOCAL_AUTHORIZATION_FILE_STRINGS (file, authorization->return_value);
+          for (k = 0; k < authorization->return_value.length; k += 2)
+            g_variant_builder_add (&return_value_builder, "{ss}", pairs[k], pairs[k + 1]);
+
+          g_variant_builder_add (&files_builder, "(s@as@asiiia{ss})",
+                                 authorization->id,
+                                 g_variant_new_strv (LOCAL_AUTHORIZATION_FILE_STRINGS (file, authorization->identity_strings),
+                                                     authorization->identity_strings.length),
+                                 g_variant_new_strv (LOCAL_AUTHORIZATION_FILE_STRINGS (file, authorization->action_strings),
+                                                     authorization->action_strings.length),
+                                 (gint32) authorization->result_any,
+                                 (gint32) authorization->result_inactive,
+                                 (gint32) authorization->result_active,
+                                 &return_value_builder);
         }
-      if (ll == NULL)
-        continue;
+      g_variant_builder_close (&files_builder);
+    }
+  g_mutex_unlock (store->priv->lock);
 
-      if (identity == NULL)
-	{
-	  for (ll = authorization->identity_specs; ll != NULL; ll = ll->next)
-	    {
-	      if (ll->data == NULL)
-		break;
-	    }
-	}
-      else
-	{
-	  /* then match the identity against identity specs */
-	  if (identity_string == NULL)
-	    identity_string = polkit_identity_to_string (identity);
-	  for (ll = authorization->identity_specs; ll != NULL; ll = ll->next)
-	    {
-	      if (ll->data != NULL
-		  && g_pattern_match_string ((GPatternSpec *) ll->data, identity_string))
-		break;
-	    }
-
-	  /* if no identity specs matched and identity is a user, match against netgroups */
-	  if (ll == NULL && POLKIT_IS_UNIX_USER (identity))
-	    {
-	      PolkitUnixUser *user_identity = POLKIT_UNIX_USER (identity);
-	      const gchar *user_name = polkit_unix_user_get_name (user_identity);
-	      if (!user_name)
-		continue;
-
-	      for (ll = authorization->netgroup_identities; ll != NULL; ll = ll->next)
-		{
-		  if (innetgr ((const gchar *) ll->data, NULL, user_name, NULL))
-		    break;
-		}
-	    }
-	}
-
-      if (ll == NULL)
-        continue;
+  path = g_file_get_path (store->priv->directory);
+  ret = g_variant_new (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING,
+                       path, &sources_builder, &files_builder);
+  g_free (path);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_local_authorization_store_new_from_serialized:
+ * @value: A #GVariant returned by polkit_backend_local_authorization_store_serialize().
+ * @extension: The extension of files to consider e.g. <quote>.pkla</quote>.
+ *
+ * Creates a new #PolkitBackendLocalAuthorizationStore object like
+ * polkit_backend_local_authorization_store_new(), but uses the
+ * authorization entries in @value instead of reading the directory.
+ * The caller is responsible for checking that @value is still up to
+ * date.  Changes to the directory are handled as usual.
+ *
+ * Returns: A #PolkitBackendLocalAuthorizationStore. Free with
+ * g_object_unref().
+ **/
+PolkitBackendLocalAuthorizationStore *
+polkit_backend_local_authorization_store_new_from_serialized (GVariant    *value,
+                                                              const gchar *extension)
+{
+  PolkitBackendLocalAuthorizationStore *store;
+  const gchar *path;
+  GFile *directory;
+  GVariant *sources;
+  GVariantIter files_iter;
+  GVariant *authorizations;
+  guint n;
+
+  g_return_val_if_fail (g_variant_is_of_type (value, G_VARIANT_TYPE (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING)), NULL);
+
+  g_variant_get (value, "(&s@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING "@aa(sasasiiia{ss}))",
+                 &path, &sources, &authorizations);
+
+  directory = g_file_new_for_path (path);
+  store = polkit_backend_local_authorization_store_new (directory, extension);
+  g_object_unref (directory);
 
-      /* Yay, a match! However, keep going since subsequent authorization entries may modify the result */
-      *out_result_any = authorization->result_any;
-      *out_result_inactive = authorization->result_inactive;
-      *out_result_active = authorization->result_active;
-      ret = TRUE;
+  if (g_variant_n_children (sources) > 0)
+    store->priv->directory_source = g_variant_get_child_value (sources, 0);
+  else
+    update_directory_source (store);
 
-      if (details != NULL && authorization->return_value != NULL)
+  /* Each file has the source record following that of the directory */
+  g_variant_iter_init (&files_iter, authorizations);
+  for (n = 1; n < g_variant_n_children (sources); n++)
+    {
+      LocalAuthorizationFile *file;
+      GVariant *source;
+      const gchar *file_path;
+      gchar *basename;
+      GVariantIter *authorizations_iter;
+      const gchar *id;
+      const gchar **identity_strings;
+      const gchar **action_strings;
+      gint32 result_any;
+      gint32 result_inactive;
+      gint32 result_active;
+      GVariantIter *return_value_iter;
+      GPtrArray *return_value;
+
+      if (!g_variant_iter_next (&files_iter, "a(sasasiiia{ss})", &authorizations_iter))
+        break;
+
+      source = g_variant_get_child_value (sources, n);
+      g_variant_get (source, "(&sxutt)", &file_path, NULL, NULL, NULL, NULL);
+      basename = g_path_get_basename (file_path);
+      file = local_authorization_file_new (basename, source);
+      g_free (basename);
+      g_variant_unref (source);
+
+      /* The strings are copied into the file, so they can be borrowed
+         from @value */
+      return_value = g_ptr_array_new ();
+      while (g_variant_iter_next (authorizations_iter, "(&s^a&s^a&siiia{ss})", &id,
+                                  &identity_strings, &action_strings,
+                                  &result_any, &result_inactive, &result_active,
+                                  &return_value_iter))
         {
-          GHashTableIter iter;
           const gchar *key;
-          const gchar *value;
+          const gchar *val;
 
-          g_hash_table_iter_init (&iter, authorization->return_value);
-          while (g_hash_table_iter_next (&iter, (gpointer *) &key, (gpointer *) &value))
+          g_ptr_array_set_size (return_value, 0);
+          while (g_variant_iter_next (return_value_iter, "{&s&s}", &key, &val))
             {
-              polkit_details_insert (details, key, value);
+              g_ptr_array_add (return_value, (gpointer) key);
+              g_ptr_array_add (return_value, (gpointer) val);
             }
+          g_variant_iter_free (return_value_iter);
+
+          local_authorization_file_add (file,
+                                        id,
+                                        identity_strings,
+                                        action_strings,
+                                        result_any,
+                                        result_inactive,
+                                        result_active,
+                                        (const gchar * const *) return_value->pdata,
+                                        return_value->len);
+          g_free (identity_strings);
+          g_free (action_strings);
         }
+      g_ptr_array_unref (return_value);
+      g_variant_iter_free (authorizations_iter);
 
-#if 0
-      g_debug ("authorization with id `%s' matched action_id `%s' for identity `%s'",
-               authorization->id,
-               action_id,
-               identity != NULL
-	       ? polkit_identity_to_string (identity) : "default");
-#endif
+      g_ptr_array_add (store->priv->files, file);
     }
+  g_variant_unref (authorizations);
+  g_variant_unref (sources);
 
-  g_free (identity_string);
+  update_rules (store);
 
-  return ret;
+  store->priv->has_data = TRUE;
+
+  return store;
+}
+
+/**
+ * polkit_backend_local_authorization_store_new_from_listing:
+ * @value: A #GVariant returned by polkit_backend_local_authorization_store_serialize().
+ * @extension: The extension of files to consider e.g. <quote>.pkla</quote>.
+ *
+ * Creates a new #PolkitBackendLocalAuthorizationStore object like
+ * polkit_backend_local_authorization_store_new(), for use when @value is
+ * out of date.  The authorization entries in @value are not used, and all
+ * files are read again on first use, but the directory is only listed if
+ * it changed since @value was serialized.
+ *
+ * Returns: A #PolkitBackendLocalAuthorizationStore. Free with
+ * g_object_unref().
+ **/
+PolkitBackendLocalAuthorizationStore *
+polkit_backend_local_authorization_store_new_from_listing (GVariant    *value,
+                                                           const gchar *extension)
+{
+  PolkitBackendLocalAuthorizationStore *store;
+  const gchar *path;
+  GFile *directory;
+  GVariant *sources;
+  guint n;
+
+  g_return_val_if_fail (g_variant_is_of_type (value, G_VARIANT_TYPE (POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING)), NULL);
+
+  g_variant_get (value, "(&s@a" POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING "@aa(sasasiiia{ss}))",
+                 &path, &sources, NULL);
+
+  directory = g_file_new_for_path (path);
+  store = polkit_backend_local_authorization_store_new (directory, extension);
+  g_object_unref (directory);
+
+  /* The directory, followed by each file it contained */
+  if (g_variant_n_children (sources) > 0)
+    {
+      store->priv->listing_source = g_variant_get_child_value (sources, 0);
+      store->priv->listing = g_ptr_array_new_with_free_func (g_free);
+      for (n = 1; n < g_variant_n_children (sources); n++)
+        {
+          const gchar *file_path;
+
+          g_variant_get_child (sources, n, "(&sxutt)", &file_path, NULL, NULL, NULL, NULL);
+          g_ptr_array_add (store->priv->listing, g_path_get_basename (file_path));
+        }
+    }
+  g_variant_unref (sources);
+
+  return store;
 }
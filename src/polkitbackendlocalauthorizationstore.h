@@ -24,9 +24,14 @@
 
 #include <glib-object.h>
 #include <gio/gio.h>
+#include "polkitbackendnetgroupcache.h"
 
 G_BEGIN_DECLS
 
+/* Directory, snapshot source records of the directory and of each file,
+   authorization entries of each file */
+#define POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_SERIALIZED_TYPE_STRING "(sa(sxutt)aa(sasasiiia{ss}))"
+
 #define POLKIT_BACKEND_TYPE_LOCAL_AUTHORIZATION_STORE         (polkit_backend_local_authorization_store_get_type ())
 #define POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), POLKIT_BACKEND_TYPE_LOCAL_AUTHORIZATION_STORE, PolkitBackendLocalAuthorizationStore))
 #define POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), POLKIT_BACKEND_TYPE_LOCAL_AUTHORIZATION_STORE, PolkitBackendLocalAuthorizationStoreClass))
@@ -37,6 +42,59 @@ G_BEGIN_DECLS
 typedef struct _PolkitBackendLocalAuthorizationStore         PolkitBackendLocalAuthorizationStore;
 typedef struct _PolkitBackendLocalAuthorizationStoreClass    PolkitBackendLocalAuthorizationStoreClass;
 typedef struct _PolkitBackendLocalAuthorizationStorePrivate  PolkitBackendLocalAuthorizationStorePrivate;
+typedef struct _PolkitBackendLocalIdentitySet                PolkitBackendLocalIdentitySet;
+typedef struct _PolkitBackendLocalIdentityKeys               PolkitBackendLocalIdentityKeys;
+typedef struct _PolkitBackendLocalAuthorizationReverseLookup PolkitBackendLocalAuthorizationReverseLookup;
+typedef struct _PolkitBackendLocalAuthorizationRules         PolkitBackendLocalAuthorizationRules;
+
+/**
+ * PolkitBackendLocalAuthorizationMatch:
+ * @matched: Whether an authorization entry matched.
+ * @result_any: The result for any subjects, if @matched.
+ * @result_inactive: The result for subjects in local inactive sessions, if @matched.
+ * @result_active: The result for subjects in local active sessions, if @matched.
+ * @id: The id of the deciding authorization entry, <literal>filename::group</literal>,
+ *     if @matched.  Owned by the rules it was looked up in.
+ *
+ * The result of looking up one identity in a store.
+ */
+typedef struct
+{
+  gboolean matched;
+  const gchar *id;
+  PolkitImplicitAuthorization result_any;
+  PolkitImplicitAuthorization result_inactive;
+  PolkitImplicitAuthorization result_active;
+} PolkitBackendLocalAuthorizationMatch;
+
+/**
+ * PolkitBackendLocalAuthorizationDiff:
+ * @n_added: The number of authorization entries added.
+ * @n_removed: The number of authorization entries removed.
+ * @n_changed: The number of authorization entries with the same id and
+ *     different contents.
+ *
+ * How the authorization entries of all stores changed, see
+ * polkit_backend_local_authorization_rules_diff().
+ */
+typedef struct
+{
+  guint n_added;
+  guint n_removed;
+  guint n_changed;
+} PolkitBackendLocalAuthorizationDiff;
+
+/* Called with the id of an authorization entry, and the id of a later entry
+   that overrides it */
+typedef void (*PolkitBackendLocalAuthorizationShadowedFunc) (const gchar *id,
+                                                             const gchar *shadowed_by_id,
+                                                             gpointer     user_data);
+
+/* Called with an identity string, or NULL for "default", and the last entry
+   matching it */
+typedef void (*PolkitBackendLocalAuthorizationTabulateFunc) (const gchar                                *identity,
+                                                             const PolkitBackendLocalAuthorizationMatch *match,
+                                                             gpointer                                    user_data);
 
 struct _PolkitBackendLocalAuthorizationStore
 {
@@ -75,6 +133,86 @@ gboolean  polkit_backend_local_authorization_store_lookup   (PolkitBackendLocalA
                                                              PolkitImplicitAuthorization          *out_result_inactive,
                                                              PolkitImplicitAuthorization          *out_result_active);
 
+PolkitBackendLocalIdentityKeys *polkit_backend_local_identity_keys_new          (PolkitIdentity                 *identity);
+void                            polkit_backend_local_identity_keys_free         (PolkitBackendLocalIdentityKeys *keys);
+PolkitIdentity                 *polkit_backend_local_identity_keys_get_identity (PolkitBackendLocalIdentityKeys *keys);
+void                            polkit_backend_local_identity_keys_get_strings  (PolkitBackendLocalIdentityKeys  *keys,
+                                                                                 const gchar                    **out_name,
+                                                                                 const gchar                    **out_numeric);
+
+PolkitBackendLocalIdentitySet *polkit_backend_local_identity_set_new      (void);
+void                           polkit_backend_local_identity_set_free     (PolkitBackendLocalIdentitySet *set);
+guint                          polkit_backend_local_identity_set_add      (PolkitBackendLocalIdentitySet *set,
+                                                                           PolkitIdentity                *identity);
+guint                          polkit_backend_local_identity_set_add_keys (PolkitBackendLocalIdentitySet  *set,
+                                                                           PolkitBackendLocalIdentityKeys *keys);
+guint                          polkit_backend_local_identity_set_get_size (PolkitBackendLocalIdentitySet *set);
+void                           polkit_backend_local_identity_set_set_netgroup_cache (PolkitBackendLocalIdentitySet *set,
+                                                                                     PolkitBackendNetgroupCache    *cache);
+gint64                         polkit_backend_local_identity_set_get_netgroups_expire_at (PolkitBackendLocalIdentitySet *set);
+
+void      polkit_backend_local_authorization_store_load_all          (GList                                *stores,
+                                                                      guint                                 max_threads);
+
+guint     polkit_backend_local_authorization_store_eliminate_shadowed (GList                                      *stores);
+void      polkit_backend_local_authorization_store_restore_shadowed   (GList                                      *stores);
+void      polkit_backend_local_authorization_store_foreach_shadowed   (GList                                      *stores,
+                                                                       PolkitBackendLocalAuthorizationShadowedFunc func,
+                                                                       gpointer                                    user_data);
+
+void      polkit_backend_local_authorization_store_lookup_identities (PolkitBackendLocalAuthorizationStore *store,
+                                                                      PolkitBackendLocalIdentitySet        *identities,
+                                                                      const gchar                          *action_id,
+                                                                      PolkitDetails                        *details,
+                                                                      PolkitBackendLocalAuthorizationMatch *out_matches);
+
+PolkitBackendLocalAuthorizationRules *polkit_backend_local_authorization_store_get_rules          (PolkitBackendLocalAuthorizationStore *store);
+PolkitBackendLocalAuthorizationRules *polkit_backend_local_authorization_rules_ref                (PolkitBackendLocalAuthorizationRules *rules);
+void                                  polkit_backend_local_authorization_rules_unref              (PolkitBackendLocalAuthorizationRules *rules);
+void                                  polkit_backend_local_authorization_rules_lookup_identities (PolkitBackendLocalAuthorizationRules *rules,
+                                                                                                  PolkitBackendLocalIdentitySet        *identities,
+                                                                                                  const gchar                          *action_id,
+                                                                                                  PolkitDetails                        *details,
+                                                                                                  PolkitBackendLocalAuthorizationMatch *out_matches);
+GPtrArray                            *polkit_backend_local_authorization_rules_get_literal_actions (PolkitBackendLocalAuthorizationRules *rules);
+gboolean                              polkit_backend_local_authorization_rules_tabulate            (PolkitBackendLocalAuthorizationRules        *rules,
+                                                                                                    const gchar                                 *action_id,
+                                                                                                    PolkitBackendLocalAuthorizationTabulateFunc  func,
+                                                                                                    gpointer                                     user_data);
+gboolean                              polkit_backend_local_authorization_rules_has_action          (PolkitBackendLocalAuthorizationRules *rules,
+                                                                                                    const gchar                          *action_id);
+PolkitBackendLocalAuthorizationRules *polkit_backend_local_authorization_rules_diff                (PolkitBackendLocalAuthorizationRules **old_rules,
+                                                                                                    guint                                  n_old_rules,
+                                                                                                    PolkitBackendLocalAuthorizationRules **new_rules,
+                                                                                                    guint                                  n_new_rules,
+                                                                                                    PolkitBackendLocalAuthorizationDiff   *out_diff);
+
+PolkitBackendLocalAuthorizationReverseLookup *polkit_backend_local_authorization_reverse_lookup_new  (PolkitBackendLocalAuthorizationRules         *rules,
+                                                                                                      PolkitBackendLocalIdentitySet                *identities,
+                                                                                                      const gchar                                  *action_id);
+const PolkitBackendLocalAuthorizationMatch   *polkit_backend_local_authorization_reverse_lookup_get  (PolkitBackendLocalAuthorizationReverseLookup *lookup,
+                                                                                                      guint                                         identity_index);
+void                                          polkit_backend_local_authorization_reverse_lookup_free (PolkitBackendLocalAuthorizationReverseLookup *lookup);
+
+void      polkit_backend_local_authorization_store_get_reload_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                                     guint64                              *out_change_events,
+                                                                     guint64                              *out_reloads,
+                                                                     gint64                               *out_reload_time);
+void      polkit_backend_local_authorization_store_get_lookup_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                                     gint64                               *out_load_time,
+                                                                     guint64                              *out_entries_scanned,
+                                                                     guint64                              *out_entries_matched);
+void      polkit_backend_local_authorization_store_get_content_stats (PolkitBackendLocalAuthorizationStore *store,
+                                                                      guint                                *out_n_files,
+                                                                      guint                                *out_n_entries,
+                                                                      guint                                *out_n_errors);
+
+GVariant                             *polkit_backend_local_authorization_store_serialize           (PolkitBackendLocalAuthorizationStore *store);
+PolkitBackendLocalAuthorizationStore *polkit_backend_local_authorization_store_new_from_serialized (GVariant                             *value,
+                                                                                                    const gchar                          *extension);
+PolkitBackendLocalAuthorizationStore *polkit_backend_local_authorization_store_new_from_listing    (GVariant                             *value,
+                                                                                                    const gchar                          *extension);
+
 G_END_DECLS
 
 #endif /* __POLKIT_BACKEND_LOCAL_AUTHORIZATION_STORE_H */
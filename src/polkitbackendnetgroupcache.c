@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#include "config.h"
+#include <netdb.h>
+#include <polkit/polkit.h>
+#include "polkitbackendnetgroupcache.h"
+
+/* <internal>
+ * SECTION:polkitbackendnetgroupcache
+ * @title: Netgroup Cache
+ * @short_description: Remembers netgroup membership of users
+ *
+ * With NIS or LDAP, each innetgr() call may be a network round trip.
+ * A #PolkitBackendNetgroupCache remembers the answers for a configurable
+ * number of seconds, and is shared by all authorization stores of an
+ * authority.  It may be used in several threads at once.
+ */
+
+struct _PolkitBackendNetgroupCache
+{
+  /* Held for all fields below, but not during innetgr() calls */
+  GMutex *lock;
+
+  /* Seconds answers are remembered for, 0 to disable the cache, G_MAXUINT
+     to never expire them */
+  guint ttl;
+
+  /* user name => (netgroup => NetgroupCacheEntry) */
+  GHashTable *users;
+  guint n_entries;
+  /* Increased whenever the answers are forgotten */
+  guint generation;
+
+  guint64 hits;
+  guint64 misses;
+
+  /* Including calls while the cache is disabled */
+  guint64 innetgr_calls;
+  gint64 innetgr_time;
+};
+
+typedef struct
+{
+  gboolean is_member;
+  /* Monotonic time, in microseconds */
+  gint64 expires_at;
+} NetgroupCacheEntry;
+
+/* innetgr() keeps its state in static variables in GNU libc */
+G_LOCK_DEFINE_STATIC (innetgr);
+
+/**
+ * polkit_backend_netgroup_contains_user:
+ * @netgroup: Name of a netgroup.
+ * @user_name: Name of a user.
+ *
+ * Calls innetgr() for @user_name and @netgroup, one thread at a time, as
+ * it is not safe to call it in several threads at once.
+ *
+ * Returns: %TRUE if @user_name is a member of @netgroup.
+ */
+gboolean
+polkit_backend_netgroup_contains_user (const gchar *netgroup,
+                                       const gchar *user_name)
+{
+  gboolean ret;
+
+  G_LOCK (innetgr);
+  ret = innetgr (netgroup, NULL, user_name, NULL) != 0;
+  G_UNLOCK (innetgr);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_netgroup_cache_new:
+ * @ttl: Number of seconds to remember answers for, 0 to not remember them
+ *     at all, or %G_MAXUINT to never expire them.
+ *
+ * Creates a new cache of netgroup membership.
+ *
+ * Returns: A #PolkitBackendNetgroupCache.  Free with
+ *     polkit_backend_netgroup_cache_free().
+ */
+PolkitBackendNetgroupCache *
+polkit_backend_netgroup_cache_new (guint ttl)
+{
+  PolkitBackendNetgroupCache *cache;
+
+  cache = g_new0 (PolkitBackendNetgroupCache, 1);
+  cache->lock = g_mutex_new ();
+  cache->ttl = ttl;
+  cache->users = g_hash_table_new_full (g_str_hash,
+                                        g_str_equal,
+                                        g_free,
+                                        (GDestroyNotify) g_hash_table_unref);
+
+  return cache;
+}
+
+/**
+ * polkit_backend_netgroup_cache_free:
+ * @cache: A #PolkitBackendNetgroupCache.
+ *
+ * Frees @cache.
+ */
+void
+polkit_backend_netgroup_cache_free (PolkitBackendNetgroupCache *cache)
+{
+  g_hash_table_unref (cache->users);
+  g_mutex_free (cache->lock);
+  g_free (cache);
+}
+
+/**
+ * polkit_backend_netgroup_cache_get_ttl:
+ * @cache: A #PolkitBackendNetgroupCache.
+ *
+ * Gets the number of seconds answers are remembered for.
+ *
+ * Returns: The TTL passed to polkit_backend_netgroup_cache_new() or
+ *     polkit_backend_netgroup_cache_set_ttl().
+ */
+guint
+polkit_backend_netgroup_cache_get_ttl (PolkitBackendNetgroupCache *cache)
+{
+  guint ret;
+
+  g_mutex_lock (cache->lock);
+  ret = cache->ttl;
+  g_mutex_unlock (cache->lock);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_netgroup_cache_set_ttl:
+ * @cache: A #PolkitBackendNetgroupCache.
+ * @ttl: Number of seconds to remember answers for, as for
+ *     polkit_backend_netgroup_cache_new().
+ *
+ * Changes the TTL of @cache, forgetting all answers remembered so far.
+ */
+void
+polkit_backend_netgroup_cache_set_ttl (PolkitBackendNetgroupCache *cache,
+                                       guint                       ttl)
+{
+  g_mutex_lock (cache->lock);
+  g_hash_table_remove_all (cache->users);
+  cache->n_entries = 0;
+  cache->generation++;
+  cache->ttl = ttl;
+  g_mutex_unlock (cache->lock);
+}
+
+/**
+ * polkit_backend_netgroup_cache_clear:
+ * @cache: A #PolkitBackendNetgroupCache.
+ *
+ * Forgets all answers remembered so far, e.g. because the netgroup
+ * database has changed.
+ */
+void
+polkit_backend_netgroup_cache_clear (PolkitBackendNetgroupCache *cache)
+{
+  g_mutex_lock (cache->lock);
+  g_hash_table_remove_all (cache->users);
+  cache->n_entries = 0;
+  cache->generation++;
+  g_mutex_unlock (cache->lock);
+}
+
+/* Called without the lock held */
+static gboolean
+call_innetgr (PolkitBackendNetgroupCache *cache,
+              const gchar                *netgroup,
+              const gchar                *user_name)
+{
+  gint64 start;
+  gint64 time;
+  gboolean ret;
+
+  start = g_get_monotonic_time ();
+  ret = polkit_backend_netgroup_contains_user (netgroup, user_name);
+  time = g_get_monotonic_time () - start;
+
+  g_mutex_lock (cache->lock);
+  cache->innetgr_time += time;
+  cache->innetgr_calls++;
+  g_mutex_unlock (cache->lock);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_netgroup_cache_contains_user:
+ * @cache: A #PolkitBackendNetgroupCache.
+ * @netgroup: Name of a netgroup.
+ * @user_name: Name of a user.
+ * @out_expires_at: (allow-none): Return location for the monotonic time,
+ *     in microseconds, the answer expires at, or %G_MAXINT64 if never.
+ *
+ * Checks whether @user_name is a member of @netgroup, as innetgr() does,
+ * using a remembered answer if there is one that has not expired.
+ *
+ * Returns: %TRUE if @user_name is a member of @netgroup.
+ */
+gboolean
+polkit_backend_netgroup_cache_contains_user (PolkitBackendNetgroupCache *cache,
+                                             const gchar                *netgroup,
+                                             const gchar                *user_name,
+                                             gint64                     *out_expires_at)
+{
+  GHashTable *netgroups;
+  NetgroupCacheEntry *entry;
+  gboolean is_member;
+  guint generation;
+  guint ttl;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+  g_mutex_lock (cache->lock);
+  ttl = cache->ttl;
+  if (ttl == 0)
+    {
+      g_mutex_unlock (cache->lock);
+      if (out_expires_at != NULL)
+        *out_expires_at = now;
+      return call_innetgr (cache, netgroup, user_name);
+    }
+
+  netgroups = g_hash_table_lookup (cache->users, user_name);
+  entry = netgroups != NULL ? g_hash_table_lookup (netgroups, netgroup) : NULL;
+  if (entry != NULL && (ttl == G_MAXUINT || now < entry->expires_at))
+    {
+      cache->hits++;
+      is_member = entry->is_member;
+      g_mutex_unlock (cache->lock);
+      if (out_expires_at != NULL)
+        *out_expires_at = ttl == G_MAXUINT ? G_MAXINT64 : entry->expires_at;
+      return is_member;
+    }
+  cache->misses++;
+  generation = cache->generation;
+  g_mutex_unlock (cache->lock);
+
+  /* Other threads may ask for the same answer meanwhile; the last one to
+     get it stores it */
+  is_member = call_innetgr (cache, netgroup, user_name);
+
+  g_mutex_lock (cache->lock);
+  /* Not remembered if the answers were forgotten meanwhile */
+  if (cache->generation == generation)
+    {
+      netgroups = g_hash_table_lookup (cache->users, user_name);
+      if (netgroups == NULL)
+        {
+          netgroups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+          g_hash_table_insert (cache->users, g_strdup (user_name), netgroups);
+        }
+      entry = g_hash_table_lookup (netgroups, netgroup);
+      if (entry == NULL)
+        {
+          entry = g_new (NetgroupCacheEntry, 1);
+          g_hash_table_insert (netgroups, g_strdup (netgroup), entry);
+          cache->n_entries++;
+        }
+      entry->is_member = is_member;
+      entry->expires_at = now + (gint64) ttl * G_USEC_PER_SEC;
+    }
+  g_mutex_unlock (cache->lock);
+
+  if (out_expires_at != NULL)
+    *out_expires_at = ttl == G_MAXUINT ? G_MAXINT64 : now + (gint64) ttl * G_USEC_PER_SEC;
+  return is_member;
+}
+
+/**
+ * polkit_backend_netgroup_cache_get_stats:
+ * @cache: A #PolkitBackendNetgroupCache.
+ * @out_hits: (allow-none): Return location for the number of answers
+ *     that were remembered.
+ * @out_misses: (allow-none): Return location for the number of answers
+ *     that required innetgr() calls, while the cache was enabled.
+ * @out_entries: (allow-none): Return location for the number of answers
+ *     currently remembered.
+ *
+ * Gets statistics about the use of @cache.
+ */
+void
+polkit_backend_netgroup_cache_get_stats (PolkitBackendNetgroupCache *cache,
+                                         guint64                    *out_hits,
+                                         guint64                    *out_misses,
+                                         guint                      *out_entries)
+{
+  g_mutex_lock (cache->lock);
+  if (out_hits != NULL)
+    *out_hits = cache->hits;
+  if (out_misses != NULL)
+    *out_misses = cache->misses;
+  if (out_entries != NULL)
+    *out_entries = cache->n_entries;
+  g_mutex_unlock (cache->lock);
+}
+
+/**
+ * polkit_backend_netgroup_cache_get_innetgr_stats:
+ * @cache: A #PolkitBackendNetgroupCache.
+ * @out_calls: (allow-none): Return location for the number of innetgr()
+ *     calls, whether the cache was enabled or not.
+ * @out_time: (allow-none): Return location for the number of
+ *     microseconds spent in these calls.
+ *
+ * Gets statistics about the innetgr() calls made by @cache.
+ */
+void
+polkit_backend_netgroup_cache_get_innetgr_stats (PolkitBackendNetgroupCache *cache,
+                                                 guint64                    *out_calls,
+                                                 gint64                     *out_time)
+{
+  g_mutex_lock (cache->lock);
+  if (out_calls != NULL)
+    *out_calls = cache->innetgr_calls;
+  if (out_time != NULL)
+    *out_time = cache->innetgr_time;
+  g_mutex_unlock (cache->lock);
+}
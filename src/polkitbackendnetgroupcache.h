@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#ifndef __POLKIT_BACKEND_NETGROUP_CACHE_H
+#define __POLKIT_BACKEND_NETGROUP_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PolkitBackendNetgroupCache PolkitBackendNetgroupCache;
+
+PolkitBackendNetgroupCache *polkit_backend_netgroup_cache_new           (guint                       ttl);
+void                        polkit_backend_netgroup_cache_free          (PolkitBackendNetgroupCache *cache);
+guint                       polkit_backend_netgroup_cache_get_ttl       (PolkitBackendNetgroupCache *cache);
+void                        polkit_backend_netgroup_cache_set_ttl       (PolkitBackendNetgroupCache *cache,
+                                                                         guint                       ttl);
+void                        polkit_backend_netgroup_cache_clear         (PolkitBackendNetgroupCache *cache);
+gboolean                    polkit_backend_netgroup_cache_contains_user (PolkitBackendNetgroupCache *cache,
+                                                                         const gchar                *netgroup,
+                                                                         const gchar                *user_name,
+                                                                         gint64                     *out_expires_at);
+void                        polkit_backend_netgroup_cache_get_stats     (PolkitBackendNetgroupCache *cache,
+                                                                         guint64                    *out_hits,
+                                                                         guint64                    *out_misses,
+                                                                         guint                      *out_entries);
+void                        polkit_backend_netgroup_cache_get_innetgr_stats (PolkitBackendNetgroupCache *cache,
+                                                                             guint64                    *out_calls,
+                                                                             gint64                     *out_time);
+
+gboolean                    polkit_backend_netgroup_contains_user       (const gchar                *netgroup,
+                                                                         const gchar                *user_name);
+
+G_END_DECLS
+
+#endif /* __POLKIT_BACKEND_NETGROUP_CACHE_H */
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#include "config.h"
+#include <string.h>
+#include "polkitbackendpklaparser.h"
+
+/* <internal>
+ * SECTION:polkitbackendpklaparser
+ * @title: Authorization File Parser
+ * @short_description: Reads .pkla files without GKeyFile
+ *
+ * GKeyFile keeps a copy of every group, key and value of a file, which
+ * are then copied out again one key at a time.  polkit_backend_pkla_parse()
+ * instead makes one pass over the file contents, usually a mapped file,
+ * and only copies the values of the keys used in authorization entries.
+ *
+ * Only the subset of the key file format that authorization files use in
+ * practice is handled.  Anything else, such as escape sequences, trailing
+ * whitespace, locale suffixes or malformed lines, and groups without
+ * Identity or Action keys, makes the parser give up, so that the caller
+ * can use GKeyFile and report the same errors as before.
+ */
+
+enum
+{
+  KEY_IDENTITY,
+  KEY_ACTION,
+  KEY_RESULT_ANY,
+  KEY_RESULT_INACTIVE,
+  KEY_RESULT_ACTIVE,
+  KEY_RETURN_VALUE,
+  N_KEYS
+};
+
+static const gchar * const key_names[N_KEYS] =
+{
+  "Identity",
+  "Action",
+  "ResultAny",
+  "ResultInactive",
+  "ResultActive",
+  "ReturnValue",
+};
+
+/* A part of the parsed data, start is NULL if missing */
+typedef struct
+{
+  const gchar *start;
+  gsize length;
+} Span;
+
+typedef struct
+{
+  Span name;
+  Span values[N_KEYS];
+} Group;
+
+/* Returns the key at @start, which has @length bytes, or -1 for other keys */
+static gint
+lookup_key (const gchar *start,
+            gsize        length)
+{
+  guint n;
+
+  for (n = 0; n < N_KEYS; n++)
+    {
+      if (strlen (key_names[n]) == length && memcmp (key_names[n], start, length) == 0)
+        return n;
+    }
+
+  return -1;
+}
+
+/* Checks a group line like g_key_file_line_is_group() and
+   g_key_file_is_group_name() would */
+static gboolean
+parse_group_line (const gchar *line,
+                  const gchar *line_end,
+                  Span        *out_name)
+{
+  const gchar *p;
+
+  for (p = line + 1; p < line_end && *p != ']'; p++)
+    {
+      if (*p == '[' || g_ascii_iscntrl (*p))
+        return FALSE;
+    }
+  if (p == line_end || p == line + 1)
+    return FALSE;
+
+  out_name->start = line + 1;
+  out_name->length = p - (line + 1);
+
+  /* Whitespace after the ] is accepted */
+  for (p++; p < line_end; p++)
+    {
+      if (*p != ' ' && *p != '\t')
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Parses a key-value line like g_key_file_parse_key_value_pair() would, and
+   records the value if the key is used in authorization entries */
+static gboolean
+parse_key_value_line (const gchar *line,
+                      const gchar *line_end,
+                      Group       *group)
+{
+  const gchar *equals;
+  const gchar *key_end;
+  const gchar *value;
+  const gchar *p;
+  gint key;
+
+  equals = memchr (line, '=', line_end - line);
+  if (equals == NULL || equals == line)
+    return FALSE;
+
+  key_end = equals;
+  while (key_end > line && g_ascii_isspace (key_end[-1]))
+    key_end--;
+  for (p = line; p < key_end; p++)
+    {
+      /* Locale suffixes are left to GKeyFile */
+      if (*p == '[' || *p == ']')
+        return FALSE;
+    }
+
+  value = equals + 1;
+  while (value < line_end && g_ascii_isspace (*value))
+    value++;
+
+  /* GKeyFile checks the encoding given in the first group */
+  if ((gsize) (key_end - line) == strlen ("Encoding")
+      && memcmp (line, "Encoding", key_end - line) == 0)
+    return FALSE;
+
+  key = lookup_key (line, key_end - line);
+  if (key < 0)
+    return TRUE;
+
+  /* Values with escape sequences or trailing whitespace are left to
+     GKeyFile */
+  if (memchr (value, '\\', line_end - value) != NULL
+      || (value < line_end && g_ascii_isspace (line_end[-1])))
+    return FALSE;
+
+  /* Later values replace earlier ones, like in GKeyFile */
+  group->values[key].start = value;
+  group->values[key].length = line_end - value;
+
+  return TRUE;
+}
+
+/* The values of all groups are copied to @chunk, instead of allocating each
+   one separately */
+static gchar *
+dup_value (GStringChunk *chunk,
+           const Span   *span)
+{
+  if (span->start == NULL)
+    return NULL;
+
+  return g_string_chunk_insert_len (chunk, span->start, span->length);
+}
+
+/* Splits @span like g_key_file_get_string_list() would: an empty last
+   element is dropped.  The result is in @list, which is reused. */
+static gchar **
+split_value (GStringChunk *chunk,
+             GPtrArray    *list,
+             const Span   *span)
+{
+  const gchar *p;
+  const gchar *end;
+  const gchar *separator;
+
+  if (span->start == NULL)
+    return NULL;
+
+  g_ptr_array_set_size (list, 0);
+  p = span->start;
+  end = span->start + span->length;
+  while (p < end)
+    {
+      separator = memchr (p, ';', end - p);
+      if (separator == NULL)
+        separator = end;
+
+      g_ptr_array_add (list, g_string_chunk_insert_len (chunk, p, separator - p));
+      p = separator + 1;
+    }
+  g_ptr_array_add (list, NULL);
+
+  return (gchar **) list->pdata;
+}
+
+/**
+ * polkit_backend_pkla_parse:
+ * @data: The contents of an authorization file.
+ * @length: The length of @data.
+ * @func: Function to call for each group.
+ * @user_data: Data to pass to @func.
+ *
+ * Parses an authorization file in one pass over @data, which need not be
+ * nul-terminated, and calls @func for each group in the order of the
+ * file, with the values g_key_file_get_string() and
+ * g_key_file_get_string_list() would return.
+ *
+ * Nothing is reported if the file uses features of the key file format
+ * that are not handled, or if a group lacks an Identity or Action key;
+ * the caller should read it with GKeyFile instead.
+ *
+ * Returns: %TRUE if @func was called for all groups, %FALSE if @data
+ *     must be parsed with GKeyFile.
+ */
+gboolean
+polkit_backend_pkla_parse (const gchar                *data,
+                           gsize                       length,
+                           PolkitBackendPklaGroupFunc  func,
+                           gpointer                    user_data)
+{
+  const gchar *end;
+  const gchar *p;
+  GArray *groups;
+  GHashTable *group_names;
+  GStringChunk *chunk;
+  GPtrArray *lists[3];
+  gboolean ret;
+  guint n;
+
+  ret = FALSE;
+  groups = g_array_new (FALSE, TRUE, sizeof (Group));
+  group_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  chunk = NULL;
+
+  /* GKeyFile rejects values that are not UTF-8 when they are read */
+  if (length > 0
+      && (memchr (data, '\0', length) != NULL || !g_utf8_validate (data, length, NULL)))
+    goto out;
+
+  end = data + length;
+  for (p = data; p < end; )
+    {
+      const gchar *line;
+      const gchar *line_end;
+      const gchar *next;
+
+      line_end = memchr (p, '\n', end - p);
+      if (line_end == NULL)
+        line_end = end;
+      next = line_end < end ? line_end + 1 : end;
+      if (line_end > p && line_end[-1] == '\r')
+        line_end--;
+
+      line = p;
+      while (line < line_end && g_ascii_isspace (*line))
+        line++;
+      p = next;
+
+      if (line == line_end || *line == '#')
+        continue;
+
+      if (*line == '[')
+        {
+          Group group;
+          gchar *name;
+
+          memset (&group, 0, sizeof (group));
+          if (!parse_group_line (line, line_end, &group.name))
+            goto out;
+
+          /* GKeyFile merges groups with the same name */
+          name = g_strndup (group.name.start, group.name.length);
+          if (g_hash_table_lookup_extended (group_names, name, NULL, NULL))
+            {
+              g_free (name);
+              goto out;
+            }
+          g_hash_table_insert (group_names, name, NULL);
+          g_array_append_val (groups, group);
+        }
+      else if (groups->len == 0
+               || !parse_key_value_line (line, line_end,
+                                         &g_array_index (groups, Group, groups->len - 1)))
+        goto out;
+    }
+
+  for (n = 0; n < groups->len; n++)
+    {
+      Group *group = &g_array_index (groups, Group, n);
+
+      if (group->values[KEY_IDENTITY].start == NULL || group->values[KEY_ACTION].start == NULL)
+        goto out;
+    }
+
+  /* Usually one block holds all values */
+  chunk = g_string_chunk_new (MAX (length + length / 8, 1024));
+  for (n = 0; n < G_N_ELEMENTS (lists); n++)
+    lists[n] = g_ptr_array_new ();
+  for (n = 0; n < groups->len; n++)
+    {
+      Group *group = &g_array_index (groups, Group, n);
+      PolkitBackendPklaGroup parsed;
+
+      parsed.name = dup_value (chunk, &group->name);
+      parsed.identity_strings = split_value (chunk, lists[0], &group->values[KEY_IDENTITY]);
+      parsed.action_strings = split_value (chunk, lists[1], &group->values[KEY_ACTION]);
+      parsed.result_any = dup_value (chunk, &group->values[KEY_RESULT_ANY]);
+      parsed.result_inactive = dup_value (chunk, &group->values[KEY_RESULT_INACTIVE]);
+      parsed.result_active = dup_value (chunk, &group->values[KEY_RESULT_ACTIVE]);
+      parsed.return_value_strings = split_value (chunk, lists[2], &group->values[KEY_RETURN_VALUE]);
+
+      func (&parsed, user_data);
+    }
+
+  ret = TRUE;
+
+ out:
+  if (chunk != NULL)
+    {
+      for (n = 0; n < G_N_ELEMENTS (lists); n++)
+        g_ptr_array_unref (lists[n]);
+      g_string_chunk_free (chunk);
+    }
+  g_hash_table_unref (group_names);
+  g_array_free (groups, TRUE);
+  return ret;
+}
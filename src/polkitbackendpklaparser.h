@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#ifndef __POLKIT_BACKEND_PKLA_PARSER_H
+#define __POLKIT_BACKEND_PKLA_PARSER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * PolkitBackendPklaGroup:
+ * @name: The group name.
+ * @identity_strings: The Identity list.
+ * @action_strings: The Action list.
+ * @result_any: The ResultAny value, or %NULL.
+ * @result_inactive: The ResultInactive value, or %NULL.
+ * @result_active: The ResultActive value, or %NULL.
+ * @return_value_strings: The ReturnValue list, or %NULL.
+ *
+ * The keys of an authorization entry, as g_key_file_get_string() and
+ * g_key_file_get_string_list() would return them.  All strings and lists
+ * belong to the parser and must not be used after the callback returns;
+ * the callback may modify the strings.
+ */
+typedef struct
+{
+  gchar  *name;
+  gchar **identity_strings;
+  gchar **action_strings;
+  gchar  *result_any;
+  gchar  *result_inactive;
+  gchar  *result_active;
+  gchar **return_value_strings;
+} PolkitBackendPklaGroup;
+
+typedef void (*PolkitBackendPklaGroupFunc) (PolkitBackendPklaGroup *group,
+                                            gpointer                user_data);
+
+gboolean polkit_backend_pkla_parse (const gchar                *data,
+                                    gsize                       length,
+                                    PolkitBackendPklaGroupFunc  func,
+                                    gpointer                    user_data);
+
+G_END_DECLS
+
+#endif /* __POLKIT_BACKEND_PKLA_PARSER_H */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#include "config.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <polkit/polkit.h>
+#include "polkitbackendsnapshot.h"
+
+/* <internal>
+ * SECTION:polkitbackendsnapshot
+ * @title: Snapshots
+ * @short_description: Precompiled configuration files
+ *
+ * A snapshot is a serialized #GVariant, read using a memory mapping,
+ * together with a list of the source files it was created from.  It
+ * is only valid as long as none of the source files have changed.
+ *
+ * The snapshot written by pkla-compile is shared by all programs: it
+ * contains named sections, see polkit_backend_snapshot_save_sections(),
+ * and a generation number.  The generation must match the one in a
+ * stamp file next to the snapshot, so that polkit_backend_snapshot_invalidate()
+ * makes all programs ignore the snapshot until it is written again.
+ */
+
+#define SNAPSHOT_MAGIC "pkla-snapshot"
+
+/* Increment whenever the format of any snapshot payload changes */
+#define SNAPSHOT_VERSION 3
+
+/* The payload of a shared snapshot: the generation and the sections */
+#define SHARED_TYPE_STRING "(ta{sv})"
+
+/**
+ * polkit_backend_snapshot_source_new:
+ * @path: A file or directory.
+ *
+ * Records the current state of @path, which may also not exist.  Files
+ * should be recorded before they are read, and directories before they
+ * are enumerated.
+ *
+ * Returns: A floating #GVariant of type
+ *     %POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING.
+ */
+GVariant *
+polkit_backend_snapshot_source_new (const gchar *path)
+{
+  struct stat st;
+
+  if (g_stat (path, &st) != 0)
+    return g_variant_new (POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING,
+                          path, (gint64) -1, 0, (guint64) 0, (guint64) 0);
+
+  return g_variant_new (POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING,
+                        path, (gint64) st.st_mtime, (guint32) st.st_mtim.tv_nsec,
+                        (guint64) st.st_size, (guint64) st.st_ino);
+}
+
+/**
+ * polkit_backend_snapshot_source_exists:
+ * @source: A source file record.
+ *
+ * Checks whether the file existed when @source was recorded.
+ *
+ * Returns: %FALSE if the file did not exist.
+ */
+gboolean
+polkit_backend_snapshot_source_exists (GVariant *source)
+{
+  gint64 mtime;
+
+  g_variant_get (source, "(&sxutt)", NULL, &mtime, NULL, NULL, NULL);
+
+  return mtime != -1;
+}
+
+static gboolean
+source_is_fresh (GVariant *source)
+{
+  const gchar *path;
+  gint64 mtime;
+  guint32 mtime_nsec;
+  guint64 size;
+  guint64 inode;
+  struct stat st;
+
+  g_variant_get (source, "(&sxutt)", &path, &mtime, &mtime_nsec, &size, &inode);
+  if (g_stat (path, &st) != 0)
+    return mtime == -1;
+
+  return (mtime == (gint64) st.st_mtime
+          && mtime_nsec == (guint32) st.st_mtim.tv_nsec
+          && size == (guint64) st.st_size
+          && inode == (guint64) st.st_ino);
+}
+
+/**
+ * polkit_backend_snapshot_sources_are_fresh:
+ * @sources: A #GVariant array of source file records.
+ *
+ * Checks whether all of @sources are still in the recorded state.
+ *
+ * Returns: %TRUE if none of @sources have changed.
+ */
+gboolean
+polkit_backend_snapshot_sources_are_fresh (GVariant *sources)
+{
+  GVariantIter iter;
+  GVariant *source;
+
+  g_variant_iter_init (&iter, sources);
+  while ((source = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      gboolean fresh;
+
+      fresh = source_is_fresh (source);
+      g_variant_unref (source);
+      if (!fresh)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * polkit_backend_snapshot_sources_get_newest_mtime:
+ * @sources: A #GVariant array of source file records.
+ *
+ * Finds the most recent modification time of existing @sources.
+ *
+ * Returns: The modification time in seconds since the epoch, or -1 if
+ *     none of @sources exist.
+ */
+gint64
+polkit_backend_snapshot_sources_get_newest_mtime (GVariant *sources)
+{
+  GVariantIter iter;
+  gint64 mtime;
+  gint64 ret;
+
+  ret = -1;
+  g_variant_iter_init (&iter, sources);
+  while (g_variant_iter_next (&iter, "(&sxutt)", NULL, &mtime, NULL, NULL, NULL))
+    ret = MAX (ret, mtime);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_snapshot_save:
+ * @filename: The file to write.
+ * @payload: The snapshot contents.
+ * @error: Return location for error.
+ *
+ * Atomically replaces @filename with a snapshot containing @payload.
+ *
+ * Returns: %TRUE on success, %FALSE if @error is set.
+ */
+gboolean
+polkit_backend_snapshot_save (const gchar  *filename,
+                              GVariant     *payload,
+                              GError      **error)
+{
+  GVariant *value;
+  gboolean ret;
+
+  value = g_variant_ref_sink (g_variant_new ("(suv)", SNAPSHOT_MAGIC,
+                                             (guint32) SNAPSHOT_VERSION,
+                                             payload));
+  ret = g_file_set_contents (filename, g_variant_get_data (value),
+                             g_variant_get_size (value), error);
+  g_variant_unref (value);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_snapshot_load:
+ * @filename: The file to read.
+ * @payload_type: The expected type of the snapshot contents.
+ * @error: Return location for error.
+ *
+ * Maps the snapshot in @filename into memory.  Checking whether the
+ * sources of the snapshot are unchanged is up to the caller.
+ *
+ * Returns: The snapshot contents, or %NULL if @error is set.  Free with
+ *     g_variant_unref().
+ */
+GVariant *
+polkit_backend_snapshot_load (const gchar         *filename,
+                              const GVariantType  *payload_type,
+                              GError             **error)
+{
+  GMappedFile *mapped_file;
+  GVariant *value;
+  const gchar *magic;
+  guint32 version;
+  GVariant *payload;
+
+  mapped_file = g_mapped_file_new (filename, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+  if (g_mapped_file_get_length (mapped_file) == 0)
+    {
+      g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                   "Snapshot `%s' is empty", filename);
+      g_mapped_file_unref (mapped_file);
+      return NULL;
+    }
+
+  /* The variant keeps the file mapped for as long as it is used */
+  value = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE ("(suv)"),
+                                                       g_mapped_file_get_contents (mapped_file),
+                                                       g_mapped_file_get_length (mapped_file),
+                                                       FALSE,
+                                                       (GDestroyNotify) g_mapped_file_unref,
+                                                       mapped_file));
+  g_variant_get (value, "(&suv)", &magic, &version, &payload);
+  if (strcmp (magic, SNAPSHOT_MAGIC) != 0 || version != SNAPSHOT_VERSION
+      || !g_variant_is_of_type (payload, payload_type))
+    {
+      g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                   "Snapshot `%s' has an unsupported format", filename);
+      g_variant_unref (payload);
+      payload = NULL;
+    }
+  g_variant_unref (value);
+
+  return payload;
+}
+
+/* Returns the name of the stamp file of the shared snapshot @filename */
+static gchar *
+get_stamp_filename (const gchar *filename)
+{
+  return g_strconcat (filename, ".stamp", NULL);
+}
+
+/* Returns the generation in @stamp_filename, or 0 if it can not be read */
+static guint64
+read_generation (const gchar *stamp_filename)
+{
+  gchar *contents;
+  gchar *end;
+  guint64 ret;
+
+  if (!g_file_get_contents (stamp_filename, &contents, NULL, NULL))
+    return 0;
+
+  ret = g_ascii_strtoull (contents, &end, 10);
+  if (end == contents || (*end != '\0' && *end != '\n'))
+    ret = 0;
+  g_free (contents);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_snapshot_invalidate:
+ * @filename: The shared snapshot.
+ * @error: Return location for error.
+ *
+ * Atomically stores a new generation in the stamp file of @filename, so
+ * that polkit_backend_snapshot_load_section() ignores the snapshot until
+ * it is written again with the returned generation.  Call this before
+ * reading the files the new snapshot is created from.
+ *
+ * The generation is random instead of incremented, so that concurrent
+ * callers do not need to lock the stamp file: a snapshot is only used if
+ * its generation was stored last.
+ *
+ * Returns: The new generation, or 0 if @error is set.
+ */
+guint64
+polkit_backend_snapshot_invalidate (const gchar  *filename,
+                                    GError      **error)
+{
+  gchar *stamp_filename;
+  gchar *contents;
+  guint64 old_generation;
+  guint64 ret;
+
+  stamp_filename = get_stamp_filename (filename);
+  old_generation = read_generation (stamp_filename);
+  do
+    ret = ((guint64) g_random_int () << 32) | g_random_int ();
+  while (ret == 0 || ret == old_generation);
+
+  contents = g_strdup_printf ("%" G_GUINT64_FORMAT "\n", ret);
+  if (!g_file_set_contents (stamp_filename, contents, -1, error))
+    ret = 0;
+  g_free (contents);
+  g_free (stamp_filename);
+
+  return ret;
+}
+
+/**
+ * polkit_backend_snapshot_save_sections:
+ * @filename: The shared snapshot to write.
+ * @generation: A generation returned by polkit_backend_snapshot_invalidate().
+ * @sections: A #GVariant dictionary of sections, keyed by name.
+ * @error: Return location for error.
+ *
+ * Atomically replaces @filename with a shared snapshot containing
+ * @sections, for example %POLKIT_BACKEND_SNAPSHOT_SECTION_AUTHORITY and
+ * %POLKIT_BACKEND_SNAPSHOT_SECTION_CONFIG.
+ *
+ * Returns: %TRUE on success, %FALSE if @error is set.
+ */
+gboolean
+polkit_backend_snapshot_save_sections (const gchar  *filename,
+                                       guint64       generation,
+                                       GVariant     *sections,
+                                       GError      **error)
+{
+  g_return_val_if_fail (g_variant_is_of_type (sections, G_VARIANT_TYPE ("a{sv}")), FALSE);
+
+  return polkit_backend_snapshot_save (filename,
+                                       g_variant_new ("(t@a{sv})", generation, sections),
+                                       error);
+}
+
+/**
+ * polkit_backend_snapshot_load_section:
+ * @filename: The shared snapshot to read.
+ * @name: The name of the section.
+ * @section_type: The expected type of the section.
+ * @error: Return location for error.
+ *
+ * Maps the shared snapshot in @filename into memory, like
+ * polkit_backend_snapshot_load(), and looks up section @name.  This fails
+ * if the snapshot was invalidated by polkit_backend_snapshot_invalidate()
+ * after it was written.  Checking whether the sources of the section are
+ * unchanged is still up to the caller.
+ *
+ * Returns: The section, or %NULL if @error is set.  Free with
+ *     g_variant_unref().
+ */
+GVariant *
+polkit_backend_snapshot_load_section (const gchar         *filename,
+                                      const gchar         *name,
+                                      const GVariantType  *section_type,
+                                      GError             **error)
+{
+  GVariant *payload;
+  GVariant *sections;
+  GVariant *ret;
+  gchar *stamp_filename;
+  guint64 generation;
+
+  payload = polkit_backend_snapshot_load (filename, G_VARIANT_TYPE (SHARED_TYPE_STRING), error);
+  if (payload == NULL)
+    return NULL;
+
+  ret = NULL;
+  g_variant_get (payload, "(t@a{sv})", &generation, &sections);
+  stamp_filename = get_stamp_filename (filename);
+  if (generation != read_generation (stamp_filename))
+    g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                 "Snapshot `%s' was invalidated", filename);
+  else
+    {
+      ret = g_variant_lookup_value (sections, name, section_type);
+      if (ret == NULL)
+        g_set_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED,
+                     "Snapshot `%s' has no usable %s section", filename, name);
+    }
+  g_free (stamp_filename);
+  g_variant_unref (sections);
+  g_variant_unref (payload);
+
+  return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: David Zeuthen <davidz@redhat.com>
+ */
+
+#ifndef __POLKIT_BACKEND_SNAPSHOT_H
+#define __POLKIT_BACKEND_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A source file record: path, mtime seconds, mtime nanoseconds, size, inode */
+#define POLKIT_BACKEND_SNAPSHOT_SOURCE_TYPE_STRING "(sxutt)"
+
+/* Sections of the shared snapshot */
+#define POLKIT_BACKEND_SNAPSHOT_SECTION_AUTHORITY "authority"
+#define POLKIT_BACKEND_SNAPSHOT_SECTION_CONFIG "config"
+
+GVariant *polkit_backend_snapshot_source_new        (const gchar         *path);
+gboolean  polkit_backend_snapshot_source_exists     (GVariant            *source);
+gboolean  polkit_backend_snapshot_sources_are_fresh (GVariant            *sources);
+gint64    polkit_backend_snapshot_sources_get_newest_mtime (GVariant       *sources);
+
+gboolean  polkit_backend_snapshot_save              (const gchar         *filename,
+                                                     GVariant            *payload,
+                                                     GError             **error);
+GVariant *polkit_backend_snapshot_load              (const gchar         *filename,
+                                                     const GVariantType  *payload_type,
+                                                     GError             **error);
+
+guint64   polkit_backend_snapshot_invalidate        (const gchar         *filename,
+                                                     GError             **error);
+gboolean  polkit_backend_snapshot_save_sections     (const gchar         *filename,
+                                                     guint64              generation,
+                                                     GVariant            *sections,
+                                                     GError             **error);
+GVariant *polkit_backend_snapshot_load_section      (const gchar         *filename,
+                                                     const gchar         *name,
+                                                     const GVariantType  *section_type,
+                                                     GError             **error);
+
+G_END_DECLS
+
+#endif /* __POLKIT_BACKEND_SNAPSHOT_H */
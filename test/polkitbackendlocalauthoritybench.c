@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2011 Google Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Measures reading a synthetic set of authorization stores, and checks for
+   users in 1 to --max-groups groups.  Not run by "make check"; build it
+   with "make bench" and run it by hand under mocklibc, which reads the users, groups and netgroups this
+   program generates:
+
+     test/mocklibc/bin/mocklibc test/polkitbackendlocalauthoritybench
+
+   With the GNU C library, all calls of malloc() and its family in the
+   process are counted; GSlice allocates in larger chunks, so set
+   G_SLICE=always-malloc to count each of its blocks. */
+
+#include "config.h"
+#include <glib.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <polkit/polkit.h>
+
+#include "../src/polkitbackendlocalauthority.h"
+#include "../src/polkitbackendlocalauthorizationstore.h"
+
+#define FIRST_UID 1000
+#define FIRST_GID 2000
+#define N_ACTIONS_PER_PRODUCT 10
+#define N_NETGROUPS 100
+
+static gint opt_stores = 4;
+static gint opt_files = 10;
+static gint opt_groups = 100;
+static gint opt_products = 100;
+static gint opt_prefix_percent = 20;
+static gint opt_glob_percent = 5;
+static gint opt_netgroup_percent = 5;
+static gint opt_max_groups = 1000;
+static gint opt_iterations = 5;
+static gint opt_lookups = 1000;
+static gint opt_load_threads = 1;
+static gint opt_group_cache_ttl = 0;
+static gint opt_result_cache_size = 0;
+static gboolean opt_reverse = FALSE;
+static gint opt_seed = 1;
+
+/* g_mem_set_vtable() is ignored by current GLib, so allocations are
+   counted by replacing malloc() and its family for the whole process,
+   which glibc allows by exporting its implementations under other names */
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *mem, size_t size);
+extern void __libc_free (void *mem);
+
+/* Calls of the malloc() family that allocated or freed a block */
+static volatile gint n_allocations;
+static volatile gint n_frees;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  g_atomic_int_inc (&n_allocations);
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *mem,
+         size_t  size)
+{
+  if (mem == NULL)
+    g_atomic_int_inc (&n_allocations);
+  return __libc_realloc (mem, size);
+}
+
+void
+free (void *mem)
+{
+  if (mem != NULL)
+    g_atomic_int_inc (&n_frees);
+  __libc_free (mem);
+}
+#endif
+
+/* Returns the resident set size of the process in KiB, or 0 if unknown */
+static guint64
+get_rss (void)
+{
+  gchar *contents;
+  guint64 ret;
+  gchar *p;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  ret = 0;
+  p = strchr (contents, ' ');
+  if (p != NULL)
+    ret = g_ascii_strtoull (p + 1, NULL, 10) * sysconf (_SC_PAGESIZE) / 1024;
+  g_free (contents);
+
+  return ret;
+}
+
+static const GOptionEntry opt_entries[] =
+  {
+    { "stores", 0, 0, G_OPTION_ARG_INT, &opt_stores,
+      "Number of authorization stores", "N" },
+    { "files", 0, 0, G_OPTION_ARG_INT, &opt_files,
+      "Number of files in each store", "N" },
+    { "groups", 0, 0, G_OPTION_ARG_INT, &opt_groups,
+      "Number of authorization entries in each file", "N" },
+    { "products", 0, 0, G_OPTION_ARG_INT, &opt_products,
+      "Number of action prefixes used in entries", "N" },
+    { "prefix-percent", 0, 0, G_OPTION_ARG_INT, &opt_prefix_percent,
+      "Percentage of prefix patterns in Action", "PERCENT" },
+    { "glob-percent", 0, 0, G_OPTION_ARG_INT, &opt_glob_percent,
+      "Percentage of other patterns in Action", "PERCENT" },
+    { "netgroup-percent", 0, 0, G_OPTION_ARG_INT, &opt_netgroup_percent,
+      "Percentage of netgroups in Identity", "PERCENT" },
+    { "max-groups", 0, 0, G_OPTION_ARG_INT, &opt_max_groups,
+      "Number of groups of the user in most groups", "N" },
+    { "iterations", 0, 0, G_OPTION_ARG_INT, &opt_iterations,
+      "Number of times all stores are read", "N" },
+    { "lookups", 0, 0, G_OPTION_ARG_INT, &opt_lookups,
+      "Number of checks for each user", "N" },
+    { "load-threads", 0, 0, G_OPTION_ARG_INT, &opt_load_threads,
+      "Number of threads to read files in", "N" },
+    { "group-cache-ttl", 0, 0, G_OPTION_ARG_INT, &opt_group_cache_ttl,
+      "Seconds groups of a user are cached for", "SECONDS" },
+    { "result-cache-size", 0, 0, G_OPTION_ARG_INT, &opt_result_cache_size,
+      "Maximum number of remembered results", "N" },
+    { "reverse", 0, 0, G_OPTION_ARG_NONE, &opt_reverse,
+      "Stop checks at the deciding entry", NULL },
+    { "seed", 0, 0, G_OPTION_ARG_INT, &opt_seed,
+      "Seed of the generated rules and queries", "N" },
+    { NULL, '\0', 0, 0, NULL, NULL, NULL }
+  };
+
+/* The generated files, removed in reverse order */
+static GPtrArray *created_files;
+
+/* Numbers of groups of the generated users */
+static GArray *user_group_counts;
+
+static void
+write_file (const gchar *filename,
+            const gchar *contents)
+{
+  GError *error = NULL;
+
+  if (!g_file_set_contents (filename, contents, -1, &error))
+    g_error ("Error writing %s: %s", filename, error->message);
+  g_ptr_array_add (created_files, g_strdup (filename));
+}
+
+static void
+make_directory (const gchar *path)
+{
+  if (g_mkdir (path, 0700) != 0)
+    g_error ("Error creating %s: %s", path, g_strerror (errno));
+  g_ptr_array_add (created_files, g_strdup (path));
+}
+
+/* Writes the passwd, group and netgroup files for mocklibc: one user for
+   each power of 10 up to --max-groups groups, and for --max-groups.
+   Returns %FALSE if they are not used by the C library. */
+static gboolean
+make_accounts (const gchar *directory)
+{
+  GString *str;
+  gchar *filename;
+  guint count;
+  guint n, m;
+
+  user_group_counts = g_array_new (FALSE, FALSE, sizeof (guint));
+  for (count = 1; count < (guint) opt_max_groups; count *= 10)
+    g_array_append_val (user_group_counts, count);
+  count = opt_max_groups;
+  g_array_append_val (user_group_counts, count);
+
+  str = g_string_new ("root:x:0:0:root:/root:/bin/bash\n");
+  for (n = 0; n < user_group_counts->len; n++)
+    g_string_append_printf (str, "bench%u:x:%u:%u::/:/bin/sh\n", n, FIRST_UID + n, FIRST_GID);
+  filename = g_build_filename (directory, "passwd", NULL);
+  write_file (filename, str->str);
+  g_setenv ("MOCK_PASSWD", filename, TRUE);
+  g_free (filename);
+
+  g_string_assign (str, "root:x:0:\n");
+  for (m = 0; m < (guint) opt_max_groups; m++)
+    {
+      gboolean first = TRUE;
+
+      g_string_append_printf (str, "group%u:x:%u:", m, FIRST_GID + m);
+      for (n = 0; n < user_group_counts->len; n++)
+        {
+          if (m < g_array_index (user_group_counts, guint, n))
+            {
+              g_string_append_printf (str, first ? "bench%u" : ",bench%u", n);
+              first = FALSE;
+            }
+        }
+      g_string_append_c (str, '\n');
+    }
+  filename = g_build_filename (directory, "group", NULL);
+  write_file (filename, str->str);
+  g_setenv ("MOCK_GROUP", filename, TRUE);
+  g_free (filename);
+
+  g_string_truncate (str, 0);
+  for (m = 0; m < N_NETGROUPS; m++)
+    g_string_append_printf (str, "net%u (-,bench%u,)\n", m, m % user_group_counts->len);
+  filename = g_build_filename (directory, "netgroup", NULL);
+  write_file (filename, str->str);
+  g_setenv ("MOCK_NETGROUP", filename, TRUE);
+  g_free (filename);
+
+  g_string_free (str, TRUE);
+
+  return getpwnam ("bench0") != NULL;
+}
+
+static void
+append_identity (GString *str,
+                 GRand   *rand)
+{
+  gint r;
+
+  r = g_rand_int_range (rand, 0, 100);
+  if (r < opt_netgroup_percent)
+    g_string_append_printf (str, "unix-netgroup:net%u",
+                            g_rand_int_range (rand, 0, N_NETGROUPS));
+  else if (r % 2 == 0)
+    g_string_append_printf (str, "unix-user:bench%u",
+                            g_rand_int_range (rand, 0, user_group_counts->len));
+  else
+    g_string_append_printf (str, "unix-group:group%u",
+                            g_rand_int_range (rand, 0, opt_max_groups));
+}
+
+static void
+append_action (GString *str,
+               GRand   *rand)
+{
+  gint r;
+
+  r = g_rand_int_range (rand, 0, 100);
+  if (r < opt_glob_percent)
+    g_string_append_printf (str, "com.example.*.action%u",
+                            g_rand_int_range (rand, 0, N_ACTIONS_PER_PRODUCT));
+  else if (r < opt_glob_percent + opt_prefix_percent)
+    g_string_append_printf (str, "com.example.product%u.*",
+                            g_rand_int_range (rand, 0, opt_products));
+  else
+    g_string_append_printf (str, "com.example.product%u.action%u",
+                            g_rand_int_range (rand, 0, opt_products),
+                            g_rand_int_range (rand, 0, N_ACTIONS_PER_PRODUCT));
+}
+
+/* Returns the contents of a file with --groups authorization entries */
+static gchar *
+make_authorization_file (GRand *rand)
+{
+  static const gchar * const results[] = { "yes", "no", "auth_self", "auth_admin" };
+  GString *str;
+  guint n;
+
+  str = g_string_new (NULL);
+  for (n = 0; n < (guint) opt_groups; n++)
+    {
+      g_string_append_printf (str, "[Entry %u]\nIdentity=", n);
+      append_identity (str, rand);
+      if (g_rand_boolean (rand))
+        {
+          g_string_append_c (str, ';');
+          append_identity (str, rand);
+        }
+      g_string_append (str, "\nAction=");
+      append_action (str, rand);
+      g_string_append_printf (str,
+                              "\n"
+                              "ResultAny=no\n"
+                              "ResultInactive=%s\n"
+                              "ResultActive=%s\n"
+                              "\n",
+                              results[g_rand_int_range (rand, 0, G_N_ELEMENTS (results))],
+                              results[g_rand_int_range (rand, 0, G_N_ELEMENTS (results))]);
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* Writes the stores, and returns their directories in evaluation order */
+static GPtrArray *
+make_stores (const gchar *auth_path,
+             GRand       *rand)
+{
+  GPtrArray *ret;
+  gsize total;
+  guint n, m;
+
+  make_directory (auth_path);
+  ret = g_ptr_array_new_with_free_func (g_free);
+  total = 0;
+  for (n = 0; n < (guint) opt_stores; n++)
+    {
+      gchar *basename;
+      gchar *store_path;
+
+      basename = g_strdup_printf ("%02u-bench.d", n);
+      store_path = g_build_filename (auth_path, basename, NULL);
+      make_directory (store_path);
+      for (m = 0; m < (guint) opt_files; m++)
+        {
+          gchar *filename;
+          gchar *contents;
+
+          g_free (basename);
+          basename = g_strdup_printf ("%04u-bench.pkla", m);
+          filename = g_build_filename (store_path, basename, NULL);
+          contents = make_authorization_file (rand);
+          total += strlen (contents);
+          write_file (filename, contents);
+          g_free (contents);
+          g_free (filename);
+        }
+      g_free (basename);
+      g_ptr_array_add (ret, store_path);
+    }
+
+  printf ("%d stores, %d files per store, %d entries per file, %" G_GSIZE_FORMAT " bytes\n",
+          opt_stores, opt_files, opt_groups, total);
+
+  return ret;
+}
+
+static GList *
+new_stores (GPtrArray *store_paths)
+{
+  GList *ret;
+  guint n;
+
+  ret = NULL;
+  for (n = 0; n < store_paths->len; n++)
+    {
+      GFile *directory;
+
+      directory = g_file_new_for_path (store_paths->pdata[n]);
+      ret = g_list_append (ret, polkit_backend_local_authorization_store_new (directory, ".pkla"));
+      g_object_unref (directory);
+    }
+
+  return ret;
+}
+
+static void
+free_stores (GList *stores)
+{
+  g_list_foreach (stores, (GFunc) g_object_unref, NULL);
+  g_list_free (stores);
+}
+
+/* Reads all stores with polkit_backend_local_authorization_store_load_all(),
+   and with the first lookup in each store.  Also reports the allocations
+   made while loading and those still used by the loaded stores, if they
+   are counted, and whether the resident set size grows as the stores are
+   loaded and freed again. */
+static void
+run_load (GPtrArray *store_paths)
+{
+  PolkitIdentity *user;
+  gint64 load_time, ensure_time;
+#ifdef COUNT_ALLOCATIONS
+  gint64 allocations, retained;
+#endif
+  guint64 first_rss;
+  gint n;
+
+  user = polkit_unix_user_new (FIRST_UID);
+  load_time = 0;
+  ensure_time = 0;
+#ifdef COUNT_ALLOCATIONS
+  allocations = 0;
+  retained = 0;
+#endif
+  first_rss = 0;
+  for (n = 0; n < opt_iterations; n++)
+    {
+      GList *stores, *l;
+      gint64 start;
+#ifdef COUNT_ALLOCATIONS
+      gint start_allocations, start_frees;
+#endif
+
+      stores = new_stores (store_paths);
+#ifdef COUNT_ALLOCATIONS
+      start_allocations = g_atomic_int_get (&n_allocations);
+      start_frees = g_atomic_int_get (&n_frees);
+#endif
+      start = g_get_monotonic_time ();
+      polkit_backend_local_authorization_store_load_all (stores, MAX (opt_load_threads, 1));
+      load_time += g_get_monotonic_time () - start;
+#ifdef COUNT_ALLOCATIONS
+      allocations += g_atomic_int_get (&n_allocations) - start_allocations;
+      retained += ((g_atomic_int_get (&n_allocations) - start_allocations)
+                   - (g_atomic_int_get (&n_frees) - start_frees));
+#endif
+      if (n == 0)
+        first_rss = get_rss ();
+      free_stores (stores);
+
+      stores = new_stores (store_paths);
+      start = g_get_monotonic_time ();
+      for (l = stores; l != NULL; l = l->next)
+        {
+          PolkitImplicitAuthorization any, inactive, active;
+
+          polkit_backend_local_authorization_store_lookup (l->data, user,
+                                                           "com.example.product0.action0",
+                                                           NULL, &any, &inactive, &active);
+        }
+      ensure_time += g_get_monotonic_time () - start;
+      free_stores (stores);
+    }
+  g_object_unref (user);
+
+  printf ("%-12s %12.0f us per load, %d threads\n",
+          "load_all", (gdouble) load_time / opt_iterations, MAX (opt_load_threads, 1));
+  printf ("%-12s %12.0f us per load\n",
+          "ensure", (gdouble) ensure_time / opt_iterations);
+#ifdef COUNT_ALLOCATIONS
+  printf ("%-12s %12.0f per load, %.0f retained by the stores\n",
+          "allocations", (gdouble) allocations / opt_iterations,
+          (gdouble) retained / opt_iterations);
+#endif
+  printf ("%-12s %12" G_GUINT64_FORMAT " KiB with the first stores loaded, %" G_GUINT64_FORMAT
+          " KiB after %d loads\n", "rss", first_rss, get_rss (), opt_iterations);
+}
+
+static gint
+compare_durations (gconstpointer a,
+                   gconstpointer b)
+{
+  gint64 da = *(const gint64 *) a;
+  gint64 db = *(const gint64 *) b;
+
+  return da < db ? -1 : da > db ? 1 : 0;
+}
+
+/* Checks random actions for each user and reports percentiles */
+static void
+run_lookups (const gchar *auth_path,
+             GRand       *rand)
+{
+  PolkitBackendLocalAuthority *authority;
+  PolkitIdentity *user;
+  GArray *durations;
+  gint64 start;
+  guint n;
+  gint m;
+
+  authority = polkit_backend_local_authority_new (auth_path);
+  g_object_set (authority,
+                "group-cache-ttl", (guint) MAX (opt_group_cache_ttl, 0),
+                "netgroup-cache-ttl", (guint) MAX (opt_group_cache_ttl, 0),
+                "result-cache-size", (guint) MAX (opt_result_cache_size, 0),
+                "load-threads", (guint) MAX (opt_load_threads, 0),
+                "reverse-evaluation", opt_reverse,
+                NULL);
+
+  user = polkit_unix_user_new (FIRST_UID);
+  start = g_get_monotonic_time ();
+  polkit_backend_local_authority_check_authorization_sync (authority, user, TRUE, TRUE,
+                                                           "com.example.product0.action0",
+                                                           NULL);
+  printf ("%-12s %12.0f us\n", "first check", (gdouble) (g_get_monotonic_time () - start));
+  g_object_unref (user);
+
+  durations = g_array_sized_new (FALSE, FALSE, sizeof (gint64), opt_lookups);
+  for (n = 0; n < user_group_counts->len; n++)
+    {
+      gint64 total;
+
+      user = polkit_unix_user_new (FIRST_UID + n);
+      g_array_set_size (durations, 0);
+      total = 0;
+      for (m = 0; m < opt_lookups; m++)
+        {
+          gchar *action_id;
+          gint64 duration;
+
+          action_id = g_strdup_printf ("com.example.product%u.action%u",
+                                       g_rand_int_range (rand, 0, opt_products),
+                                       g_rand_int_range (rand, 0, N_ACTIONS_PER_PRODUCT));
+          start = g_get_monotonic_time ();
+          polkit_backend_local_authority_check_authorization_sync (authority, user, TRUE,
+                                                                   g_rand_boolean (rand),
+                                                                   action_id, NULL);
+          duration = g_get_monotonic_time () - start;
+          g_array_append_val (durations, duration);
+          total += duration;
+          g_free (action_id);
+        }
+      g_object_unref (user);
+
+      g_array_sort (durations, compare_durations);
+      printf ("%4u groups  %8.1f us mean, %8" G_GINT64_FORMAT " us p50, %8" G_GINT64_FORMAT
+              " us p99\n",
+              g_array_index (user_group_counts, guint, n), (gdouble) total / opt_lookups,
+              g_array_index (durations, gint64, durations->len / 2),
+              g_array_index (durations, gint64, durations->len * 99 / 100));
+    }
+  g_array_free (durations, TRUE);
+  g_object_unref (authority);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_context;
+  GError *error = NULL;
+  GPtrArray *store_paths;
+  GRand *rand;
+  gchar *directory;
+  gchar *auth_path;
+  gint ret;
+  guint n;
+
+  g_type_init ();
+
+  opt_context = g_option_context_new ("");
+  g_option_context_set_summary (opt_context,
+                                "Measures reading and checking synthetic authorization stores.");
+  g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+  if (!g_option_context_parse (opt_context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      g_option_context_free (opt_context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (opt_context);
+  if (opt_stores <= 0 || opt_files < 0 || opt_groups < 0 || opt_products <= 0
+      || opt_max_groups <= 0 || opt_iterations <= 0 || opt_lookups <= 0)
+    {
+      fprintf (stderr, "%s: Invalid number of stores, files, entries, products, groups, "
+               "iterations or lookups\n", g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+
+  created_files = g_ptr_array_new_with_free_func (g_free);
+  directory = g_dir_make_tmp ("pkla-bench-XXXXXX", &error);
+  if (directory == NULL)
+    g_error ("Error creating a temporary directory: %s", error->message);
+
+  rand = g_rand_new_with_seed (opt_seed);
+  auth_path = g_build_filename (directory, "localauthority", NULL);
+  store_paths = NULL;
+  ret = EXIT_FAILURE;
+  if (!make_accounts (directory))
+    {
+      fprintf (stderr, "%s: The generated users are not visible; run under mocklibc\n",
+               g_get_prgname ());
+      goto out;
+    }
+  store_paths = make_stores (auth_path, rand);
+
+  run_load (store_paths);
+  run_lookups (auth_path, rand);
+  ret = EXIT_SUCCESS;
+
+ out:
+  for (n = created_files->len; n > 0; n--)
+    g_remove (created_files->pdata[n - 1]);
+  g_rmdir (directory);
+
+  g_ptr_array_unref (created_files);
+  g_array_free (user_group_counts, TRUE);
+  if (store_paths != NULL)
+    g_ptr_array_unref (store_paths);
+  g_rand_free (rand);
+  g_free (auth_path);
+  g_free (directory);
+
+  return ret;
+}
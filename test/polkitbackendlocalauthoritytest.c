@@ -22,15 +22,27 @@
 #include "config.h"
 #include "glib.h"
 
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
 #include <polkit/polkit.h>
 
+#include "../src/polkitbackendlocalauthority.h"
 #include "polkittesthelper.h"
 
 #define BUILD_UTILITIES_DIR "src"
 #define PKLA_ADMIN_IDENTITIES_PATH BUILD_UTILITIES_DIR "/pkla-admin-identities"
 #define PKLA_CHECK_AUTHORIZATION_PATH BUILD_UTILITIES_DIR "/pkla-check-authorization"
+#define PKLA_COMPILE_PATH BUILD_UTILITIES_DIR "/pkla-compile"
 #define TEST_CONFIG_PATH "etc/polkit-1/localauthority.conf.d"
 #define TEST_AUTH_PATH1 "etc/polkit-1/localauthority"
 #define TEST_AUTH_PATH2 "var/lib/polkit-1/localauthority"
@@ -46,15 +58,336 @@ struct auth_context {
   PolkitImplicitAuthorization expect;
 };
 
+/* Daemon started on demand by the daemon tests */
+static gchar *daemon_directory;
+static gchar *daemon_socket_path;
+static gchar *daemon_metrics_path;
+static GPid daemon_pid;
+
+static GSocketConnection *
+connect_to_daemon (void)
+{
+  GSocketClient *client;
+  GSocketAddress *address;
+  GSocketConnection *connection;
+
+  client = g_socket_client_new ();
+  address = g_unix_socket_address_new (daemon_socket_path);
+  connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+					NULL, NULL);
+  g_object_unref (address);
+  g_object_unref (client);
+
+  return connection;
+}
+
+static void
+ensure_daemon (void)
+{
+  gchar *auth_path1, *auth_path2, *auth_paths, *argv[11];
+  GSocketConnection *connection;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  if (daemon_socket_path != NULL)
+    return;
+
+  daemon_directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  daemon_socket_path = g_build_filename (daemon_directory, "socket", NULL);
+  daemon_metrics_path = g_build_filename (daemon_directory, "pkla.prom", NULL);
+
+  auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
+  auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
+
+  argv[0] = PKLA_CHECK_AUTHORIZATION_PATH;
+  argv[1] = "--serve";
+  argv[2] = "-p";
+  argv[3] = auth_paths;
+  argv[4] = "--socket";
+  argv[5] = daemon_socket_path;
+  argv[6] = "--metrics-file";
+  argv[7] = daemon_metrics_path;
+  argv[8] = "--metrics-interval";
+  argv[9] = "1";
+  argv[10] = NULL;
+  ok = g_spawn_async (".", argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+		      &daemon_pid, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  /* Wait until the daemon accepts connections */
+  connection = NULL;
+  for (n = 0; n < 200 && connection == NULL; n++)
+    {
+      g_usleep (G_USEC_PER_SEC / 50);
+      connection = connect_to_daemon ();
+    }
+  g_assert (connection != NULL);
+  g_object_unref (connection);
+
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+}
+
+static void
+stop_daemon (void)
+{
+  if (daemon_socket_path == NULL)
+    return;
+
+  kill (daemon_pid, SIGTERM);
+  waitpid (daemon_pid, NULL, 0);
+  g_spawn_close_pid (daemon_pid);
+
+  g_unlink (daemon_socket_path);
+  g_unlink (daemon_metrics_path);
+  g_rmdir (daemon_directory);
+  g_free (daemon_socket_path);
+  g_free (daemon_metrics_path);
+  g_free (daemon_directory);
+}
+
+/* Sends a raw request line to the daemon and returns the reply line */
+static gchar *
+daemon_request (const gchar *request)
+{
+  GSocketConnection *connection;
+  GDataInputStream *input;
+  GOutputStream *output;
+  GError *error = NULL;
+  gchar *reply;
+  gboolean ok;
+
+  ensure_daemon ();
+
+  connection = connect_to_daemon ();
+  g_assert (connection != NULL);
+
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  ok = g_output_stream_write_all (output, request, strlen (request), NULL, NULL,
+				  &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  reply = g_data_input_stream_read_line (input, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (reply != NULL);
+
+  g_object_unref (input);
+  g_object_unref (connection);
+
+  return reply;
+}
+
+/* Snapshot of the test data written on demand by the snapshot tests */
+static gchar *snapshot_directory;
+static gchar *snapshot_path;
+
+/* Runs pkla-compile for @auth_paths and @config_path, writing @path */
+static void
+compile_snapshot (const gchar *auth_paths,
+		  const gchar *config_path,
+		  const gchar *path)
+{
+  gchar *argv[8], *stdout_, *stderr_;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+
+  argv[0] = PKLA_COMPILE_PATH;
+  argv[1] = "-p";
+  argv[2] = (gchar *)auth_paths;
+  argv[3] = "-c";
+  argv[4] = (gchar *)config_path;
+  argv[5] = "-o";
+  argv[6] = (gchar *)path;
+  argv[7] = NULL;
+
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  ok = g_spawn_check_exit_status (status, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_assert_cmpstr (stdout_, ==, "");
+  g_assert_cmpstr (stderr_, ==, "");
+  g_assert (g_file_test (path, G_FILE_TEST_IS_REGULAR));
+
+  g_free (stdout_);
+  g_free (stderr_);
+}
+
+/* Runs pkla-compile --invalidate for @path */
+static void
+invalidate_snapshot (const gchar *path)
+{
+  gchar *argv[5], *stdout_, *stderr_;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+
+  argv[0] = PKLA_COMPILE_PATH;
+  argv[1] = "--invalidate";
+  argv[2] = "-o";
+  argv[3] = (gchar *)path;
+  argv[4] = NULL;
+
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  ok = g_spawn_check_exit_status (status, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_assert_cmpstr (stdout_, ==, "");
+  g_assert_cmpstr (stderr_, ==, "");
+
+  g_free (stdout_);
+  g_free (stderr_);
+}
+
+/* Removes the snapshot @path and its stamp file */
+static void
+unlink_snapshot (const gchar *path)
+{
+  gchar *stamp_path;
+
+  stamp_path = g_strconcat (path, ".stamp", NULL);
+  g_unlink (stamp_path);
+  g_unlink (path);
+  g_free (stamp_path);
+}
+
+static const gchar *
+ensure_snapshot (void)
+{
+  gchar *auth_path1, *auth_path2, *auth_paths, *config_path;
+  GError *error = NULL;
+
+  if (snapshot_path != NULL)
+    return snapshot_path;
+
+  snapshot_directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  snapshot_path = g_build_filename (snapshot_directory, "snapshot", NULL);
+
+  auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
+  auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
+  config_path = polkit_test_get_data_path (TEST_CONFIG_PATH);
+  compile_snapshot (auth_paths, config_path, snapshot_path);
+
+  g_free (config_path);
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+
+  return snapshot_path;
+}
+
+static void
+remove_snapshot (void)
+{
+  if (snapshot_path == NULL)
+    return;
+
+  unlink_snapshot (snapshot_path);
+  g_rmdir (snapshot_directory);
+  g_free (snapshot_path);
+  g_free (snapshot_directory);
+}
+
+/* Runs pkla-check-authorization with @snapshot and @engine, if not %NULL,
+   and returns its output without the trailing newline */
+static gchar *
+check_authorization_with_engine (const gchar *auth_paths,
+				 const gchar *snapshot,
+				 const gchar *engine,
+				 const gchar *user,
+				 const gchar *subject_is_local,
+				 const gchar *subject_is_active,
+				 const gchar *action_id)
+{
+  gchar *argv[11], *stdout_, *stderr_, *engine_arg;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  n = 0;
+  argv[n++] = PKLA_CHECK_AUTHORIZATION_PATH;
+  argv[n++] = "-p";
+  argv[n++] = (gchar *)auth_paths;
+  if (snapshot != NULL)
+    {
+      argv[n++] = "--snapshot";
+      argv[n++] = (gchar *)snapshot;
+    }
+  engine_arg = NULL;
+  if (engine != NULL)
+    {
+      engine_arg = g_strconcat ("--engine=", engine, NULL);
+      argv[n++] = engine_arg;
+    }
+  argv[n++] = (gchar *)user;
+  argv[n++] = (gchar *)subject_is_local;
+  argv[n++] = (gchar *)subject_is_active;
+  argv[n++] = (gchar *)action_id;
+  argv[n] = NULL;
+
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  ok = g_spawn_check_exit_status (status, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_assert_cmpstr (stderr_, ==, "");
+
+  gchar *stdout_end = strchr (stdout_, '\0');
+  if (stdout_end > stdout_ && stdout_end[-1] == '\n')
+    stdout_end[-1] = '\0';
+
+  g_free (stderr_);
+  g_free (engine_arg);
+
+  return stdout_;
+}
+
+static gchar *
+check_authorization (const gchar *auth_paths,
+		     const gchar *snapshot,
+		     const gchar *user,
+		     const gchar *subject_is_local,
+		     const gchar *subject_is_active,
+		     const gchar *action_id)
+{
+  return check_authorization_with_engine (auth_paths, snapshot, NULL, user,
+					  subject_is_local, subject_is_active,
+					  action_id);
+}
+
 /* Test implementations */
 
 static void
-test_check_authorization_sync (const void *_ctx)
+check_authorization_with_snapshot (const struct auth_context *ctx,
+				   const gchar               *snapshot,
+				   const gchar               *engine)
 {
   static const gchar *boolean[2] = { "false", "true" };
 
-  const struct auth_context *ctx = (const struct auth_context *) _ctx;
-
   gchar *auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
   gchar *auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
   gchar *auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
@@ -62,19 +395,437 @@ test_check_authorization_sync (const void *_ctx)
   g_assert (auth_path2 != NULL);
   g_assert (auth_paths != NULL);
 
+  gchar *stdout_;
+  gboolean ok;
+
+  stdout_ = check_authorization_with_engine (auth_paths, snapshot, engine,
+					     ctx->user,
+					     boolean[ctx->subject_is_local],
+					     boolean[ctx->subject_is_active],
+					     ctx->action_id);
+
+  PolkitImplicitAuthorization auth;
+  if (*stdout_ == '\0')
+    auth = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
+  else
+    {
+      ok = polkit_implicit_authorization_from_string (stdout_, &auth);
+      g_assert (ok);
+    }
+
+  g_assert_cmpint (auth, ==, ctx->expect);
+
+  g_free (stdout_);
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+}
+
+static void
+test_check_authorization_sync (const void *_ctx)
+{
+  check_authorization_with_snapshot ((const struct auth_context *) _ctx, NULL, NULL);
+}
+
+/* The reverse engine used by default must agree with the forward one */
+static void
+test_check_authorization_forward (const void *_ctx)
+{
+  check_authorization_with_snapshot ((const struct auth_context *) _ctx, NULL,
+				     "forward");
+}
+
+static void
+test_check_authorization_snapshot (const void *_ctx)
+{
+  check_authorization_with_snapshot ((const struct auth_context *) _ctx,
+				     ensure_snapshot (), NULL);
+}
+
+/* Writes @contents to @directory/@subdirectory/@name */
+static gchar *
+write_authorization_file (const gchar *directory,
+			  const gchar *subdirectory,
+			  const gchar *name,
+			  const gchar *contents)
+{
+  gchar *destination_directory, *destination;
+  GError *error = NULL;
+  gboolean ok;
+
+  destination_directory = g_build_filename (directory, subdirectory, NULL);
+  g_assert_cmpint (g_mkdir_with_parents (destination_directory, 0700), ==, 0);
+  destination = g_build_filename (destination_directory, name, NULL);
+  ok = g_file_set_contents (destination, contents, -1, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_free (destination_directory);
+
+  return destination;
+}
+
+static void
+test_snapshot_out_of_date (void)
+{
+  static const gchar deny_john[] =
+    "[Deny John Foo]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.foo\n"
+    "ResultActive=no\n";
+  static const gchar self_john[] =
+    "[Deny John Foo]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.foo\n"
+    "ResultActive=auth_self\n";
+  static const gchar admin_john[] =
+    "[Admin John Foo]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.foo\n"
+    "ResultActive=auth_admin\n";
+
+  gchar *directory, *auth_path, *config_path, *snapshot, *source, *contents, *result;
+  gchar *files[3];
+  FILE *stream;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  /* The snapshot must not be inside the authorization directories */
+  directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  auth_path = g_build_filename (directory, "localauthority", NULL);
+  config_path = polkit_test_get_data_path (TEST_CONFIG_PATH);
+  snapshot = g_build_filename (directory, "snapshot", NULL);
+
+  source = polkit_test_get_data_path (TEST_AUTH_PATH1 "/10-test/com.example.pkla");
+  g_assert (source != NULL);
+  ok = g_file_get_contents (source, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+  files[0] = write_authorization_file (auth_path, "10-test", "com.example.pkla",
+				       contents);
+  g_free (contents);
+  g_free (source);
+
+  compile_snapshot (auth_path, config_path, snapshot);
+  result = check_authorization (auth_path, snapshot, "john", "true", "true",
+				"com.example.awesomeproduct.foo");
+  g_assert_cmpstr (result, ==, "yes");
+  g_free (result);
+
+  /* A file added to a store must be noticed */
+  files[1] = write_authorization_file (auth_path, "10-test", "deny-john.pkla",
+				       deny_john);
+  result = check_authorization (auth_path, snapshot, "john", "true", "true",
+				"com.example.awesomeproduct.foo");
+  g_assert_cmpstr (result, ==, "no");
+  g_free (result);
+
+  /* ... and a file changed in place, without changing the directory */
+  compile_snapshot (auth_path, config_path, snapshot);
+  stream = g_fopen (files[1], "w");
+  g_assert (stream != NULL);
+  g_assert_cmpint (fputs (self_john, stream), >=, 0);
+  g_assert_cmpint (fclose (stream), ==, 0);
+  result = check_authorization (auth_path, snapshot, "john", "true", "true",
+				"com.example.awesomeproduct.foo");
+  g_assert_cmpstr (result, ==, "auth_self");
+  g_free (result);
+
+  /* ... and so must a new store */
+  compile_snapshot (auth_path, config_path, snapshot);
+  files[2] = write_authorization_file (auth_path, "20-test", "admin-john.pkla",
+				       admin_john);
+  result = check_authorization (auth_path, snapshot, "john", "true", "true",
+				"com.example.awesomeproduct.foo");
+  g_assert_cmpstr (result, ==, "auth_admin");
+  g_free (result);
+
+  /* The snapshot is not used for other paths */
+  source = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  result = check_authorization (source, snapshot, "john", "true", "true",
+				"com.example.awesomeproduct.foo");
+  g_assert_cmpstr (result, ==, "yes");
+  g_free (result);
+  g_free (source);
+
+  for (n = 0; n < G_N_ELEMENTS (files); n++)
+    {
+      gchar *store_directory;
+
+      store_directory = g_path_get_dirname (files[n]);
+      g_unlink (files[n]);
+      g_rmdir (store_directory);
+      g_free (store_directory);
+      g_free (files[n]);
+    }
+  g_rmdir (auth_path);
+  unlink_snapshot (snapshot);
+  g_rmdir (directory);
+  g_free (snapshot);
+  g_free (config_path);
+  g_free (auth_path);
+  g_free (directory);
+}
+
+static void
+test_check_authorization_daemon (const void *_ctx)
+{
+  static const gchar *boolean[2] = { "false", "true" };
+
+  const struct auth_context *ctx = (const struct auth_context *) _ctx;
+  gchar *request, *reply, *expect;
+
+  request = g_strdup_printf ("%s\t%s\t%s\t%s\n", ctx->user,
+			     boolean[ctx->subject_is_local],
+			     boolean[ctx->subject_is_active], ctx->action_id);
+  reply = daemon_request (request);
+
+  if (ctx->expect == POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+    expect = g_strdup ("OK");
+  else
+    expect = g_strconcat ("OK ",
+			  polkit_implicit_authorization_to_string (ctx->expect),
+			  NULL);
+  g_assert_cmpstr (reply, ==, expect);
+
+  g_free (expect);
+  g_free (reply);
+  g_free (request);
+}
+
+static void
+test_daemon_malformed_request (void)
+{
+  gchar *reply;
+
+  reply = daemon_request ("root\ttrue\tcom.example.awesomeproduct.foo\n");
+  g_assert (g_str_has_prefix (reply, "ERROR "));
+  g_free (reply);
+
+  reply = daemon_request ("root\tmaybe\ttrue\tcom.example.awesomeproduct.foo\n");
+  g_assert (g_str_has_prefix (reply, "ERROR "));
+  g_free (reply);
+}
+
+/* A daemon for other paths must not use the default socket, where clients
+   using the default paths would query it */
+static void
+test_daemon_paths_need_socket (void)
+{
+  gchar *auth_path, *argv[5], *stdout_, *stderr_;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+
+  auth_path = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  g_assert (auth_path != NULL);
+
+  argv[0] = PKLA_CHECK_AUTHORIZATION_PATH;
+  argv[1] = "--serve";
+  argv[2] = "-p";
+  argv[3] = auth_path;
+  argv[4] = NULL;
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_assert (!g_spawn_check_exit_status (status, NULL));
+  g_assert (strstr (stderr_, "--socket") != NULL);
+
+  g_free (stdout_);
+  g_free (stderr_);
+  g_free (auth_path);
+}
+
+/* Arguments with field or line separators are not sent to the daemon,
+   where they would change the request */
+static void
+test_daemon_client_separators (void)
+{
   gchar *argv[8], *stdout_, *stderr_;
   gint status;
   GError *error = NULL;
   gboolean ok;
 
+  ensure_daemon ();
+
+  argv[0] = PKLA_CHECK_AUTHORIZATION_PATH;
+  argv[1] = "--socket";
+  argv[2] = daemon_socket_path;
+  argv[3] = "john";
+  argv[4] = "true";
+  argv[5] = "true";
+  argv[6] = "com.example.awesomeproduct.foo\n"
+    "john\ttrue\ttrue\tcom.example.awesomeproduct.foo";
+  argv[7] = NULL;
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  /* The daemon would have answered "yes" to the first line */
+  g_assert_cmpstr (stdout_, ==, "");
+
+  g_free (stdout_);
+  g_free (stderr_);
+}
+
+/* Returns the value of the daemon counter @name */
+static guint64
+get_daemon_statistic (const gchar *name)
+{
+  gchar *reply, **pairs, *prefix;
+  guint64 value;
+  guint n;
+
+  reply = daemon_request ("STATS\n");
+  g_assert (g_str_has_prefix (reply, "OK "));
+
+  prefix = g_strconcat (name, "=", NULL);
+  pairs = g_strsplit (reply + 3, " ", 0);
+  for (n = 0; pairs[n] != NULL; n++)
+    {
+      if (g_str_has_prefix (pairs[n], prefix))
+	break;
+    }
+  g_assert (pairs[n] != NULL);
+  value = g_ascii_strtoull (pairs[n] + strlen (prefix), NULL, 10);
+
+  g_strfreev (pairs);
+  g_free (prefix);
+  g_free (reply);
+
+  return value;
+}
+
+static void
+test_daemon_group_cache (void)
+{
+  guint64 hits, misses;
+  gchar *reply;
+
+  reply = daemon_request ("john\ttrue\ttrue\tcom.example.awesomeproduct.foo\n");
+  g_assert_cmpstr (reply, ==, "OK yes");
+  g_free (reply);
+  hits = get_daemon_statistic ("group_cache_hits");
+  misses = get_daemon_statistic ("group_cache_misses");
+
+  /* The groups of john are now cached; a different query is needed to
+     bypass the result cache */
+  reply = daemon_request ("john\ttrue\tfalse\tcom.example.awesomeproduct.foo\n");
+  g_assert_cmpstr (reply, ==, "OK auth_self");
+  g_free (reply);
+  g_assert_cmpuint (get_daemon_statistic ("group_cache_hits"), ==, hits + 1);
+  g_assert_cmpuint (get_daemon_statistic ("group_cache_misses"), ==, misses);
+}
+
+static void
+test_daemon_result_cache (void)
+{
+  guint64 result_hits, group_hits, group_misses;
+  gchar *reply;
+
+  reply = daemon_request ("jane\tfalse\tfalse\tcom.example.awesomeproduct.foo\n");
+  g_assert_cmpstr (reply, ==, "OK no");
+  g_free (reply);
+  result_hits = get_daemon_statistic ("result_cache_hits");
+  group_hits = get_daemon_statistic ("group_cache_hits");
+  group_misses = get_daemon_statistic ("group_cache_misses");
+
+  /* Answered without looking at the groups again */
+  reply = daemon_request ("jane\tfalse\tfalse\tcom.example.awesomeproduct.foo\n");
+  g_assert_cmpstr (reply, ==, "OK no");
+  g_free (reply);
+  g_assert_cmpuint (get_daemon_statistic ("result_cache_hits"), ==, result_hits + 1);
+  g_assert_cmpuint (get_daemon_statistic ("group_cache_hits"), ==, group_hits);
+  g_assert_cmpuint (get_daemon_statistic ("group_cache_misses"), ==, group_misses);
+}
+
+/* Returns the value of @metric in the daemon's metrics file, or -1 */
+static gint64
+get_daemon_metric (const gchar *metric)
+{
+  gchar *contents, *prefix, *p;
+  gint64 value;
+
+  if (!g_file_get_contents (daemon_metrics_path, &contents, NULL, NULL))
+    return -1;
+
+  value = -1;
+  prefix = g_strconcat ("\n", metric, " ", NULL);
+  p = strstr (contents, prefix);
+  if (p != NULL)
+    value = g_ascii_strtoll (p + strlen (prefix), NULL, 10);
+
+  g_free (prefix);
+  g_free (contents);
+
+  return value;
+}
+
+static void
+test_daemon_metrics (void)
+{
+  gchar *reply, *contents, *auth_path, *sample;
+  gint64 checks;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  reply = daemon_request ("sally\ttrue\ttrue\tcom.example.awesomeproduct.foo\n");
+  g_assert (g_str_has_prefix (reply, "OK"));
+  g_free (reply);
+
+  /* The file is updated every second */
+  checks = get_daemon_statistic ("checks");
+  for (n = 0; n < 300 && get_daemon_metric ("pkla_checks_total") < (gint64) checks; n++)
+    g_usleep (G_USEC_PER_SEC / 50);
+  g_assert_cmpint (get_daemon_metric ("pkla_checks_total"), >=, checks);
+
+  ok = g_file_get_contents (daemon_metrics_path, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  g_assert (strstr (contents, "\n# TYPE pkla_check_duration_seconds histogram\n") != NULL);
+  g_assert (strstr (contents, "\npkla_check_duration_seconds_bucket{le=\"+Inf\"} ") != NULL);
+  g_assert (strstr (contents, "\n# TYPE pkla_result_cache_hits_total counter\n") != NULL);
+
+  auth_path = polkit_test_get_data_path (TEST_AUTH_PATH1 "/10-test");
+  g_assert (auth_path != NULL);
+  sample = g_strdup_printf ("\npkla_store_parse_errors{directory=\"%s\"} 0\n", auth_path);
+  g_assert (strstr (contents, sample) != NULL);
+  g_free (sample);
+  sample = g_strdup_printf ("\npkla_store_entries{directory=\"%s\"} ", auth_path);
+  g_assert (strstr (contents, sample) != NULL);
+  g_free (sample);
+  g_free (auth_path);
+
+  g_free (contents);
+}
+
+static void
+test_check_authorization_trace (void)
+{
+  gchar *auth_path, *argv[10], *stdout_, *stderr_, *line_end, *checks;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+
+  auth_path = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  g_assert (auth_path != NULL);
   argv[0] = PKLA_CHECK_AUTHORIZATION_PATH;
   argv[1] = "-p";
-  argv[2] = auth_paths;
-  argv[3] = (gchar *)ctx->user;
-  argv[4] = (gchar *)boolean[ctx->subject_is_local];
-  argv[5] = (gchar *)boolean[ctx->subject_is_active];
-  argv[6] = (gchar *)ctx->action_id;
-  argv[7] = NULL;
+  argv[2] = auth_path;
+  argv[3] = "--trace";
+  argv[4] = "--stats";
+  argv[5] = "john";
+  argv[6] = "true";
+  argv[7] = "true";
+  argv[8] = "com.example.awesomeproduct.foo";
+  argv[9] = NULL;
 
   ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
 		     &error);
@@ -85,28 +836,30 @@ test_check_authorization_sync (const void *_ctx)
   g_assert_no_error (error);
   g_assert (ok);
 
-  g_assert_cmpstr (stderr_, ==, "");
-
-  gchar *stdout_end = strchr (stdout_, '\0');
-  if (stdout_end > stdout_ && stdout_end[-1] == '\n')
-    stdout_end[-1] = '\0';
+  g_assert_cmpstr (stdout_, ==, "yes\n");
 
-  PolkitImplicitAuthorization auth;
-  if (*stdout_ == '\0')
-    auth = POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN;
-  else
-    {
-      ok = polkit_implicit_authorization_from_string (stdout_, &auth);
-      g_assert (ok);
-    }
+  /* One line for the query, naming the deciding entry... */
+  g_assert (g_str_has_prefix (stderr_,
+			      "pkla-check-authorization: trace: user=john"
+			      " action=com.example.awesomeproduct.foo result=yes cached=no "));
+  line_end = strchr (stderr_, '\n');
+  g_assert (line_end != NULL);
+  *line_end = '\0';
+  g_assert (strstr (stderr_, " entries_matched=") != NULL);
+  g_assert (strstr (stderr_, "/10-test/com.example.pkla::Users and Root can do Foo\"")
+	    != NULL);
+  g_assert (strstr (stderr_, " store=") != NULL);
 
-  g_assert_cmpint (auth, ==, ctx->expect);
+  /* ... then the counters */
+  g_assert (g_str_has_prefix (line_end + 1, "pkla-check-authorization: statistics: "));
+  checks = strstr (line_end + 1, " checks=1");
+  g_assert (checks != NULL);
+  checks += strlen (" checks=1");
+  g_assert (*checks == ' ' || *checks == '\n');
 
   g_free (stdout_);
   g_free (stderr_);
-  g_free (auth_paths);
-  g_free (auth_path2);
-  g_free (auth_path1);
+  g_free (auth_path);
 }
 
 static void
@@ -179,6 +932,226 @@ test_get_admin_identities (void)
   g_free (config_path);
 }
 
+/* Returns the output of pkla-admin-identities using @config_path,
+   @snapshot_path if not %NULL, and @cache_path */
+static gchar *
+get_admin_identities (const gchar *config_path,
+		      const gchar *snapshot_path,
+		      const gchar *cache_path)
+{
+  gchar *snapshot_option, *cache_option, *argv[6], *stdout_, *stderr_;
+  gint status;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  snapshot_option = NULL;
+  cache_option = g_strdup_printf ("--cache=%s", cache_path);
+  n = 0;
+  argv[n++] = PKLA_ADMIN_IDENTITIES_PATH;
+  argv[n++] = "-c";
+  argv[n++] = (gchar *) config_path;
+  if (snapshot_path != NULL)
+    {
+      snapshot_option = g_strdup_printf ("--snapshot=%s", snapshot_path);
+      argv[n++] = snapshot_option;
+    }
+  argv[n++] = cache_option;
+  argv[n] = NULL;
+  ok = g_spawn_sync (".", argv, NULL, 0, NULL, NULL, &stdout_, &stderr_, &status,
+		     &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+  ok = g_spawn_check_exit_status (status, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+  g_assert_cmpstr (stderr_, ==, "");
+
+  g_free (stderr_);
+  g_free (cache_option);
+  g_free (snapshot_option);
+  return stdout_;
+}
+
+/* Writes @contents to @path, and makes it and its directory look old enough
+   to be cached */
+static void
+write_old_config_file (const gchar *path,
+		       const gchar *contents)
+{
+  struct utimbuf times;
+  gchar *directory;
+  GError *error = NULL;
+  gboolean ok;
+
+  ok = g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  times.actime = times.modtime = time (NULL) - 60;
+  directory = g_path_get_dirname (path);
+  g_assert_cmpint (g_utime (path, &times), ==, 0);
+  g_assert_cmpint (g_utime (directory, &times), ==, 0);
+  g_free (directory);
+}
+
+static void
+test_admin_identities_cache (void)
+{
+  gchar *directory, *config_path, *config_file, *low_config_file, *cache_path, *result;
+  struct utimbuf times;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  config_path = g_build_filename (directory, "localauthority.conf.d", NULL);
+  config_file = g_build_filename (config_path, "50-test.conf", NULL);
+  cache_path = g_build_filename (directory, "cache", NULL);
+  g_assert_cmpint (g_mkdir (config_path, 0700), ==, 0);
+
+  write_old_config_file (config_file,
+			 "[Configuration]\n"
+			 "AdminIdentities=unix-user:root;unix-group:admin\n");
+  result = get_admin_identities (config_path, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:root\nunix-group:admin\n");
+  g_free (result);
+  g_assert (g_file_test (cache_path, G_FILE_TEST_IS_REGULAR));
+
+  /* The cached value gives the same result */
+  result = get_admin_identities (config_path, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:root\nunix-group:admin\n");
+  g_free (result);
+
+  /* Changed files must be noticed, even if the cache is not rewritten */
+  ok = g_file_set_contents (config_file,
+			    "[Configuration]\n"
+			    "AdminIdentities=unix-user:john\n",
+			    -1, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+  result = get_admin_identities (config_path, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:john\n");
+  g_free (result);
+
+  /* A missing value is cached as well */
+  write_old_config_file (config_file, "[Configuration]\n");
+  result = get_admin_identities (config_path, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "");
+  g_free (result);
+  result = get_admin_identities (config_path, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "");
+  g_free (result);
+
+  /* Values are merged from all files, later files taking precedence, both
+     when read and when cached */
+  low_config_file = g_build_filename (config_path, "10-low.conf", NULL);
+  write_old_config_file (low_config_file,
+			 "[Configuration]\n"
+			 "AdminIdentities=unix-user:jane\n");
+  /* The directory may have had the same time before */
+  times.actime = times.modtime = time (NULL) - 120;
+  g_assert_cmpint (g_utime (config_path, &times), ==, 0);
+  for (n = 0; n < 2; n++)
+    {
+      result = get_admin_identities (config_path, NULL, cache_path);
+      g_assert_cmpstr (result, ==, "unix-user:jane\n");
+      g_free (result);
+    }
+  write_old_config_file (config_file,
+			 "[Configuration]\n"
+			 "AdminIdentities=unix-group:admin\n");
+  for (n = 0; n < 2; n++)
+    {
+      result = get_admin_identities (config_path, NULL, cache_path);
+      g_assert_cmpstr (result, ==, "unix-group:admin\n");
+      g_free (result);
+    }
+  g_unlink (low_config_file);
+  g_free (low_config_file);
+
+  /* The cache is not used for other directories */
+  g_free (config_file);
+  config_file = polkit_test_get_data_path (TEST_CONFIG_PATH);
+  result = get_admin_identities (config_file, NULL, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:root\nunix-netgroup:bar\nunix-group:admin\n");
+  g_free (result);
+  g_free (config_file);
+
+  config_file = g_build_filename (config_path, "50-test.conf", NULL);
+  g_unlink (config_file);
+  g_rmdir (config_path);
+  g_unlink (cache_path);
+  g_rmdir (directory);
+  g_free (cache_path);
+  g_free (config_file);
+  g_free (config_path);
+  g_free (directory);
+}
+
+static void
+test_shared_snapshot (void)
+{
+  PolkitBackendLocalAuthority *authority;
+  gchar *directory, *auth_path, *config_path, *config_file, *snapshot, *cache_path, *result;
+  GError *error = NULL;
+
+  directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  auth_path = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  config_path = g_build_filename (directory, "localauthority.conf.d", NULL);
+  config_file = g_build_filename (config_path, "50-test.conf", NULL);
+  snapshot = g_build_filename (directory, "snapshot", NULL);
+  cache_path = g_build_filename (directory, "cache", NULL);
+  g_assert_cmpint (g_mkdir (config_path, 0700), ==, 0);
+  write_old_config_file (config_file,
+			 "[Configuration]\n"
+			 "AdminIdentities=unix-user:jane\n");
+
+  /* Both programs use the same snapshot */
+  compile_snapshot (auth_path, config_path, snapshot);
+  authority = polkit_backend_local_authority_new_from_snapshot (auth_path, snapshot, &error);
+  g_assert_no_error (error);
+  g_assert (authority != NULL);
+  g_object_unref (authority);
+  result = get_admin_identities (config_path, snapshot, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:jane\n");
+  g_free (result);
+  /* ... so the configuration files were not read */
+  g_assert (!g_file_test (cache_path, G_FILE_TEST_EXISTS));
+
+  /* An invalidated snapshot is used by neither */
+  invalidate_snapshot (snapshot);
+  authority = polkit_backend_local_authority_new_from_snapshot (auth_path, snapshot, &error);
+  g_assert_error (error, POLKIT_ERROR, POLKIT_ERROR_FAILED);
+  g_assert (authority == NULL);
+  g_clear_error (&error);
+  result = get_admin_identities (config_path, snapshot, cache_path);
+  g_assert_cmpstr (result, ==, "unix-user:jane\n");
+  g_free (result);
+  g_assert (g_file_test (cache_path, G_FILE_TEST_IS_REGULAR));
+
+  /* ... until it is written again */
+  compile_snapshot (auth_path, config_path, snapshot);
+  authority = polkit_backend_local_authority_new_from_snapshot (auth_path, snapshot, &error);
+  g_assert_no_error (error);
+  g_assert (authority != NULL);
+  g_object_unref (authority);
+
+  g_unlink (config_file);
+  g_rmdir (config_path);
+  g_unlink (cache_path);
+  unlink_snapshot (snapshot);
+  g_rmdir (directory);
+  g_free (cache_path);
+  g_free (snapshot);
+  g_free (config_file);
+  g_free (config_path);
+  g_free (auth_path);
+  g_free (directory);
+}
+
 
 /* Variations of the check_authorization_sync */
 struct auth_context check_authorization_test_data [] = {
@@ -238,9 +1211,489 @@ struct auth_context check_authorization_test_data [] = {
       POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
       POLKIT_IMPLICIT_AUTHORIZATION_ADMINISTRATOR_AUTHENTICATION_REQUIRED},
 
+  /* Test a user in more groups than fit the initial getgrouplist() buffer */
+  {"walter", TRUE, TRUE, "com.example.awesomeproduct.many-groups",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED},
+  {"john", TRUE, TRUE, "com.example.awesomeproduct.many-groups",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN},
+
+  /* Test identities given as numeric user and group IDs */
+  {"henry", TRUE, TRUE, "com.example.awesomeproduct.numeric",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED},
+  {"jane", TRUE, TRUE, "com.example.awesomeproduct.numeric",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED},
+  {"sally", TRUE, TRUE, "com.example.awesomeproduct.numeric",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN},
+
+  /* Test that globs only match names, not numeric IDs */
+  {"john", TRUE, TRUE, "com.example.awesomeproduct.numeric-glob",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN},
+  {"henry", TRUE, TRUE, "com.example.awesomeproduct.numeric-glob",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN},
+
+  /* Test that the last matching entry of a store decides for it even if
+   * the relevant result is unset, so that an earlier store is consulted */
+  {"jane", TRUE, TRUE, "com.example.awesomeproduct.fallthrough",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED},
+  {"jane", TRUE, FALSE, "com.example.awesomeproduct.fallthrough",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_NOT_AUTHORIZED},
+  {"jane", FALSE, FALSE, "com.example.awesomeproduct.fallthrough",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN},
+
+  /* Test that user entries in an earlier store override group entries in
+   * a later one */
+  {"john", TRUE, TRUE, "com.example.awesomeproduct.precedence",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_AUTHENTICATION_REQUIRED},
+  {"jane", TRUE, TRUE, "com.example.awesomeproduct.precedence",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_NOT_AUTHORIZED},
+  {"john", FALSE, FALSE, "com.example.awesomeproduct.precedence",
+      POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN,
+      POLKIT_IMPLICIT_AUTHORIZATION_ADMINISTRATOR_AUTHENTICATION_REQUIRED},
+
   {NULL},
 };
 
+/* Sends every request of the test data to the daemon @_n_rounds times */
+static gpointer
+send_daemon_requests (gpointer _n_rounds)
+{
+  guint n_rounds = GPOINTER_TO_UINT (_n_rounds);
+  guint round, i;
+
+  for (round = 0; round < n_rounds; round++)
+    {
+      for (i = 0; check_authorization_test_data[i].user; i++)
+	test_check_authorization_daemon (&check_authorization_test_data[i]);
+    }
+
+  return NULL;
+}
+
+static void
+test_daemon_concurrent_requests (void)
+{
+  GThread *threads[8];
+  GError *error = NULL;
+  guint n;
+
+  ensure_daemon ();
+
+  /* Requests served by different worker threads at the same time get the
+     same replies as when they are sent one by one */
+  for (n = 0; n < G_N_ELEMENTS (threads); n++)
+    {
+      threads[n] = g_thread_create (send_daemon_requests, GUINT_TO_POINTER (5),
+				    TRUE, &error);
+      g_assert_no_error (error);
+    }
+  for (n = 0; n < G_N_ELEMENTS (threads); n++)
+    g_thread_join (threads[n]);
+}
+
+static void
+test_check_authorization_batch (void)
+{
+  static const gchar *boolean[2] = { "false", "true" };
+
+  gchar *auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  gchar *auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
+  gchar *auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
+  g_assert (auth_path1 != NULL);
+  g_assert (auth_path2 != NULL);
+  g_assert (auth_paths != NULL);
+
+  gchar *argv[5];
+  GPid pid;
+  gint stdin_fd, stdout_fd, status;
+  GError *error = NULL;
+  gboolean ok;
+
+  argv[0] = PKLA_CHECK_AUTHORIZATION_PATH;
+  argv[1] = "--batch";
+  argv[2] = "-p";
+  argv[3] = auth_paths;
+  argv[4] = NULL;
+
+  ok = g_spawn_async_with_pipes (".", argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD
+				 | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+				 &pid, &stdin_fd, &stdout_fd, NULL, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  /* All queries, with a malformed one in the middle that must not affect
+     the following lines */
+  GString *input = g_string_new (NULL);
+  unsigned int i;
+  for (i = 0; check_authorization_test_data[i].user; i++)
+    {
+      const struct auth_context *ctx = &check_authorization_test_data[i];
+
+      g_string_append_printf (input, "%s\t%s\t%s\t%s\n", ctx->user,
+			      boolean[ctx->subject_is_local],
+			      boolean[ctx->subject_is_active], ctx->action_id);
+      if (i == 0)
+	g_string_append (input, "root\tmaybe\ttrue\tcom.example.awesomeproduct.foo\n");
+    }
+  g_assert_cmpint (write (stdin_fd, input->str, input->len), ==, (gssize) input->len);
+  close (stdin_fd);
+  g_string_free (input, TRUE);
+
+  GString *output = g_string_new (NULL);
+  gchar buf[4096];
+  gssize len;
+  while ((len = read (stdout_fd, buf, sizeof (buf))) > 0)
+    g_string_append_len (output, buf, len);
+  g_assert_cmpint (len, ==, 0);
+  close (stdout_fd);
+
+  g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+  g_spawn_close_pid (pid);
+  g_assert (WIFEXITED (status));
+  g_assert_cmpint (WEXITSTATUS (status), ==, EXIT_FAILURE);
+
+  gchar **result = g_strsplit (output->str, "\n", 0);
+  guint result_len = g_strv_length (result);
+  unsigned int line;
+  for (i = 0, line = 0; check_authorization_test_data[i].user; i++, line++)
+    {
+      const struct auth_context *ctx = &check_authorization_test_data[i];
+
+      g_assert_cmpint (line, <, result_len);
+      if (ctx->expect == POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN)
+	g_assert_cmpstr (result[line], ==, "");
+      else
+	g_assert_cmpstr (result[line], ==,
+			 polkit_implicit_authorization_to_string (ctx->expect));
+      if (i == 0)
+	{
+	  line++;
+	  g_assert_cmpint (line, <, result_len);
+	  g_assert_cmpstr (result[line], ==, "");
+	}
+    }
+  /* The output ends with a newline */
+  g_assert_cmpint (line + 1, ==, result_len);
+  g_assert_cmpstr (result[line], ==, "");
+
+  g_strfreev (result);
+  g_string_free (output, TRUE);
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+}
+
+/* Checks started by test_check_authorization_async() */
+struct async_checks {
+  GMainLoop *loop;
+  PolkitImplicitAuthorization *results;
+  guint n_pending;
+};
+
+struct async_check {
+  struct async_checks *checks;
+  guint index;
+};
+
+static void
+on_check_authorization_done (GObject      *source_object,
+			     GAsyncResult *res,
+			     gpointer      user_data)
+{
+  struct async_check *check = user_data;
+  GError *error = NULL;
+
+  check->checks->results[check->index] =
+    polkit_backend_local_authority_check_authorization_finish (POLKIT_BACKEND_LOCAL_AUTHORITY (source_object),
+							       res, &error);
+  g_assert_no_error (error);
+  if (--check->checks->n_pending == 0)
+    g_main_loop_quit (check->checks->loop);
+  g_free (check);
+}
+
+static void
+test_check_authorization_async (void)
+{
+  PolkitBackendLocalAuthority *authority;
+  struct async_checks checks;
+  gchar *auth_path1, *auth_path2, *auth_paths;
+  guint n_data, round, i;
+
+  auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
+  auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
+  authority = polkit_backend_local_authority_new (auth_paths);
+  g_object_set (authority, "group-cache-ttl", 60, "group-lookup-timeout", 100, NULL);
+
+  for (n_data = 0; check_authorization_test_data[n_data].user; n_data++)
+    ;
+  checks.loop = g_main_loop_new (NULL, FALSE);
+  checks.results = g_new0 (PolkitImplicitAuthorization, n_data);
+
+  /* All checks at once, so that those for the same user share group
+     lookups; the second round finds the groups in the cache */
+  for (round = 0; round < 2; round++)
+    {
+      checks.n_pending = n_data;
+      for (i = 0; i < n_data; i++)
+	{
+	  const struct auth_context *ctx = &check_authorization_test_data[i];
+	  struct async_check *check;
+	  PolkitIdentity *user;
+	  GError *error = NULL;
+
+	  user = polkit_unix_user_new_for_name (ctx->user, &error);
+	  g_assert_no_error (error);
+	  check = g_new0 (struct async_check, 1);
+	  check->checks = &checks;
+	  check->index = i;
+	  polkit_backend_local_authority_check_authorization (authority, user,
+							      ctx->subject_is_local,
+							      ctx->subject_is_active,
+							      ctx->action_id, NULL, NULL,
+							      on_check_authorization_done,
+							      check);
+	  g_object_unref (user);
+	}
+      g_main_loop_run (checks.loop);
+
+      for (i = 0; i < n_data; i++)
+	g_assert_cmpint (checks.results[i], ==, check_authorization_test_data[i].expect);
+    }
+
+  g_free (checks.results);
+  g_main_loop_unref (checks.loop);
+  g_object_unref (authority);
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+}
+
+/* Finds one counter of polkit_backend_local_authority_foreach_statistic() */
+struct statistic_lookup {
+  const gchar *name;
+  guint64 value;
+  gboolean found;
+};
+
+static void
+find_statistic (const gchar *name,
+		guint64      value,
+		gpointer     user_data)
+{
+  struct statistic_lookup *lookup = user_data;
+
+  if (strcmp (name, lookup->name) == 0)
+    {
+      lookup->value = value;
+      lookup->found = TRUE;
+    }
+}
+
+static guint64
+get_authority_statistic (PolkitBackendLocalAuthority *authority,
+			 const gchar                 *name)
+{
+  struct statistic_lookup lookup = { name, 0, FALSE };
+
+  polkit_backend_local_authority_foreach_statistic (authority, find_statistic, &lookup);
+  g_assert (lookup.found);
+
+  return lookup.value;
+}
+
+static void
+test_check_authorization_decision_table (void)
+{
+  PolkitBackendLocalAuthority *authority, *reference;
+  gchar *auth_path1, *auth_path2, *auth_paths;
+  guint round, i, waited;
+
+  auth_path1 = polkit_test_get_data_path (TEST_AUTH_PATH1);
+  auth_path2 = polkit_test_get_data_path (TEST_AUTH_PATH2);
+  auth_paths = g_strconcat (auth_path1, ";", auth_path2, NULL);
+  authority = polkit_backend_local_authority_new (auth_paths);
+  g_object_set (authority, "decision-table", TRUE, NULL);
+  reference = polkit_backend_local_authority_new (auth_paths);
+
+  /* The first check starts tabulating the rules; the second round uses
+     the table where possible, and must agree with evaluating the stores
+     on the results and the deciding entries */
+  for (round = 0; round < 2; round++)
+    {
+      if (round == 1)
+	{
+	  for (waited = 0;
+	       get_authority_statistic (authority, "decision_table_builds") == 0 && waited < 1000;
+	       waited++)
+	    g_usleep (10000);
+	  g_assert_cmpuint (get_authority_statistic (authority, "decision_table_builds"), ==, 1);
+	  g_assert_cmpuint (get_authority_statistic (authority, "decision_table_entries"), >, 0);
+	}
+
+      for (i = 0; check_authorization_test_data[i].user; i++)
+	{
+	  const struct auth_context *ctx = &check_authorization_test_data[i];
+	  PolkitBackendLocalAuthorityTrace trace, reference_trace;
+	  PolkitImplicitAuthorization result;
+	  PolkitIdentity *user;
+	  GError *error = NULL;
+
+	  user = polkit_unix_user_new_for_name (ctx->user, &error);
+	  g_assert_no_error (error);
+	  result = polkit_backend_local_authority_check_authorization_traced (authority, user,
+									     ctx->subject_is_local,
+									     ctx->subject_is_active,
+									     ctx->action_id, NULL,
+									     &trace);
+	  g_assert_cmpint (result, ==, ctx->expect);
+	  polkit_backend_local_authority_check_authorization_traced (reference, user,
+								     ctx->subject_is_local,
+								     ctx->subject_is_active,
+								     ctx->action_id, NULL,
+								     &reference_trace);
+	  g_assert_cmpstr (trace.deciding_id, ==, reference_trace.deciding_id);
+	  polkit_backend_local_authority_trace_clear (&reference_trace);
+	  polkit_backend_local_authority_trace_clear (&trace);
+	  g_object_unref (user);
+	}
+    }
+  g_assert_cmpuint (get_authority_statistic (authority, "decision_table_hits"), >, 0);
+  g_assert_cmpuint (get_authority_statistic (reference, "decision_table_hits"), ==, 0);
+
+  g_object_unref (reference);
+  g_object_unref (authority);
+  g_free (auth_paths);
+  g_free (auth_path2);
+  g_free (auth_path1);
+}
+
+static void
+on_authority_changed (PolkitBackendLocalAuthority *authority,
+		      gpointer                     user_data)
+{
+  gboolean *changed = user_data;
+
+  *changed = TRUE;
+}
+
+static PolkitImplicitAuthorization
+check_user (PolkitBackendLocalAuthority *authority,
+	    const gchar                 *user_name,
+	    gboolean                     subject_is_local,
+	    gboolean                     subject_is_active,
+	    const gchar                 *action_id)
+{
+  PolkitImplicitAuthorization ret;
+  PolkitIdentity *user;
+  GError *error = NULL;
+
+  user = polkit_unix_user_new_for_name (user_name, &error);
+  g_assert_no_error (error);
+  ret = polkit_backend_local_authority_check_authorization_sync (authority, user,
+								 subject_is_local,
+								 subject_is_active,
+								 action_id, NULL);
+  g_object_unref (user);
+
+  return ret;
+}
+
+/* Only the results for actions that changed entries match are forgotten
+   when the files are reloaded */
+static void
+test_result_cache_reload (void)
+{
+  static const gchar foo_file[] =
+    "[John Foo]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.foo\n"
+    "ResultActive=yes\n";
+  static const gchar bar_file[] =
+    "[John Bar]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.bar\n"
+    "ResultActive=auth_self\n";
+  static const gchar changed_bar_file[] =
+    "[John Bar]\n"
+    "Identity=unix-user:john\n"
+    "Action=com.example.awesomeproduct.bar\n"
+    "ResultActive=no\n";
+
+  PolkitBackendLocalAuthority *authority;
+  gchar *directory, *store_path, *foo_path, *bar_path;
+  guint64 result_hits;
+  gboolean changed = FALSE;
+  GError *error = NULL;
+  guint n;
+
+  directory = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  store_path = g_build_filename (directory, "10-test", NULL);
+  foo_path = write_authorization_file (directory, "10-test", "foo.pkla", foo_file);
+  bar_path = write_authorization_file (directory, "10-test", "bar.pkla", bar_file);
+
+  authority = polkit_backend_local_authority_new (directory);
+  g_object_set (authority,
+		"group-cache-ttl", 60,
+		"netgroup-cache-ttl", 60,
+		"result-cache-size", 16,
+		NULL);
+  g_signal_connect (authority, "changed", G_CALLBACK (on_authority_changed), &changed);
+  g_assert_cmpint (check_user (authority, "john", TRUE, TRUE, "com.example.awesomeproduct.foo"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED);
+  /* Several results for the changed action, which are all dropped */
+  g_assert_cmpint (check_user (authority, "john", TRUE, TRUE, "com.example.awesomeproduct.bar"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_AUTHENTICATION_REQUIRED);
+  g_assert_cmpint (check_user (authority, "john", FALSE, FALSE, "com.example.awesomeproduct.bar"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+  g_assert_cmpint (check_user (authority, "jane", TRUE, TRUE, "com.example.awesomeproduct.bar"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_UNKNOWN);
+
+  g_free (write_authorization_file (directory, "10-test", "bar.pkla", changed_bar_file));
+  for (n = 0; n < 1000 && !changed; n++)
+    {
+      while (g_main_context_iteration (NULL, FALSE))
+	;
+      if (!changed)
+	g_usleep (G_USEC_PER_SEC / 100);
+    }
+  g_assert (changed);
+  g_assert_cmpuint (get_authority_statistic (authority, "result_cache_kept"), >=, 1);
+  g_assert_cmpuint (get_authority_statistic (authority, "result_cache_invalidated"), ==, 3);
+  g_assert_cmpuint (get_authority_statistic (authority, "store_reloads"), ==, 1);
+
+  result_hits = get_authority_statistic (authority, "result_cache_hits");
+  g_assert_cmpint (check_user (authority, "john", TRUE, TRUE, "com.example.awesomeproduct.foo"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_AUTHORIZED);
+  g_assert_cmpuint (get_authority_statistic (authority, "result_cache_hits"), ==, result_hits + 1);
+  g_assert_cmpint (check_user (authority, "john", TRUE, TRUE, "com.example.awesomeproduct.bar"), ==,
+		   POLKIT_IMPLICIT_AUTHORIZATION_NOT_AUTHORIZED);
+  g_assert_cmpuint (get_authority_statistic (authority, "result_cache_hits"), ==, result_hits + 1);
+
+  g_object_unref (authority);
+  g_assert_cmpint (g_unlink (bar_path), ==, 0);
+  g_assert_cmpint (g_unlink (foo_path), ==, 0);
+  g_assert_cmpint (g_rmdir (store_path), ==, 0);
+  g_assert_cmpint (g_rmdir (directory), ==, 0);
+  g_free (bar_path);
+  g_free (foo_path);
+  g_free (store_path);
+  g_free (directory);
+}
+
 
 /* Automatically create many variations of the check_authorization_sync test */
 static void
@@ -252,6 +1705,21 @@ add_check_authorization_tests (void) {
         "/PolkitBackendLocalAuthority/check_authorization_sync_%d", i);
     g_test_add_data_func (test_name, ctx, test_check_authorization_sync);
     g_free (test_name);
+
+    test_name = g_strdup_printf (
+        "/PolkitBackendLocalAuthority/check_authorization_forward_%d", i);
+    g_test_add_data_func (test_name, ctx, test_check_authorization_forward);
+    g_free (test_name);
+
+    test_name = g_strdup_printf (
+        "/PolkitBackendLocalAuthority/check_authorization_snapshot_%d", i);
+    g_test_add_data_func (test_name, ctx, test_check_authorization_snapshot);
+    g_free (test_name);
+
+    test_name = g_strdup_printf (
+        "/PolkitBackendLocalAuthority/check_authorization_daemon_%d", i);
+    g_test_add_data_func (test_name, ctx, test_check_authorization_daemon);
+    g_free (test_name);
   }
 };
 
@@ -259,12 +1727,32 @@ add_check_authorization_tests (void) {
 int
 main (int argc, char *argv[])
 {
+  int ret;
+
   g_type_init ();
   g_test_init (&argc, &argv, NULL);
   polkit_test_redirect_logs ();
 
   add_check_authorization_tests ();
+  g_test_add_func ("/PolkitBackendLocalAuthority/check_authorization_batch", test_check_authorization_batch);
+  g_test_add_func ("/PolkitBackendLocalAuthority/check_authorization_async", test_check_authorization_async);
+  g_test_add_func ("/PolkitBackendLocalAuthority/check_authorization_decision_table", test_check_authorization_decision_table);
+  g_test_add_func ("/PolkitBackendLocalAuthority/result_cache_reload", test_result_cache_reload);
+  g_test_add_func ("/PolkitBackendLocalAuthority/snapshot_out_of_date", test_snapshot_out_of_date);
+  g_test_add_func ("/PolkitBackendLocalAuthority/check_authorization_trace", test_check_authorization_trace);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_malformed_request", test_daemon_malformed_request);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_client_separators", test_daemon_client_separators);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_paths_need_socket", test_daemon_paths_need_socket);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_concurrent_requests", test_daemon_concurrent_requests);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_group_cache", test_daemon_group_cache);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_result_cache", test_daemon_result_cache);
+  g_test_add_func ("/PolkitBackendLocalAuthority/daemon_metrics", test_daemon_metrics);
   g_test_add_func ("/PolkitBackendLocalAuthority/get_admin_identities", test_get_admin_identities);
+  g_test_add_func ("/PolkitBackendLocalAuthority/admin_identities_cache", test_admin_identities_cache);
+  g_test_add_func ("/PolkitBackendLocalAuthority/shared_snapshot", test_shared_snapshot);
 
-  return g_test_run ();
+  ret = g_test_run ();
+  stop_daemon ();
+  remove_snapshot ();
+  return ret;
 };
@@ -22,6 +22,9 @@
 #include "config.h"
 #include "glib.h"
 
+#include <string.h>
+
+#include <glib/gstdio.h>
 #include <polkit/polkit.h>
 
 #include "../src/polkitbackendlocalauthorizationstore.h"
@@ -29,6 +32,9 @@
 
 #define DATA_DIR "etc/polkit-1/localauthority/10-test"
 #define DATA_EXT ".pkla"
+#define PATTERNS_DATA_DIR "patterns"
+#define SHADOWED_DATA_DIR1 "shadowed/10-first"
+#define SHADOWED_DATA_DIR2 "shadowed/20-second"
 
 static void
 test_new (void)
@@ -128,6 +134,582 @@ test_lookup (void)
   g_assert (!ok);
 }
 
+/* Matching of the different kinds of Action patterns */
+static void
+test_lookup_action_patterns (void)
+{
+  static const struct
+  {
+    const gchar *identity;
+    const gchar *action_id;
+    const gchar *expect;  /* ResultAny, or NULL for no match */
+  } cases[] = {
+    /* Later entries override earlier ones, whatever the kind of pattern */
+    { "unix-user:root", "org.example.literal", "auth_admin" },
+    { "unix-user:root", "org.example.literalx", NULL },
+    { "unix-user:root", "org.example.prefix.a", "auth_self" },
+    /* '*' also matches an empty string */
+    { "unix-user:root", "org.example.prefix.", "auth_self" },
+    { "unix-user:root", "org.example.prefix", NULL },
+    { "unix-user:root", "org.example.prefix.bar", "auth_admin_keep" },
+    { "unix-user:root", "org.example.foo.glob", "auth_admin" },
+    { "unix-user:root", "org.example.glob", NULL },
+    { "unix-user:jane", "org.example.literal", "no" },
+    { "unix-user:jane", "com.example.anything", "no" },
+    { "unix-user:john", "org.example.literal", NULL },
+    /* Patterns with a leading '*', or with both a leading and a trailing one */
+    { "unix-user:root", "org.example.a.suffix", "yes" },
+    { "unix-user:root", "org.example.suffixx", NULL },
+    { "unix-user:john", "org.example.contains.a", "auth_self" },
+    { "unix-user:john", "org.example.contains.", "auth_self" },
+    { "unix-user:john", "org.example.contains", NULL },
+    { "unix-user:jane", "org.example.contains.a", "no" },
+    { "unix-user:sally", "org.example.identity-suffix", "yes" },
+    { "unix-user:john", "org.example.identity-suffix", NULL },
+  };
+
+  gchar *data_dir_path;
+  GFile *data_dir;
+  PolkitBackendLocalAuthorizationStore *store;
+  PolkitDetails *details;
+  guint n;
+
+  data_dir_path = polkit_test_get_data_path (PATTERNS_DATA_DIR);
+  g_assert (data_dir_path);
+
+  data_dir = g_file_new_for_path (data_dir_path);
+  g_assert (data_dir);
+  g_free (data_dir_path);
+
+  store = polkit_backend_local_authorization_store_new (data_dir, DATA_EXT);
+  g_assert (store);
+  g_object_unref (data_dir);
+
+  details = polkit_details_new ();
+
+  for (n = 0; n < G_N_ELEMENTS (cases); n++)
+    {
+      PolkitIdentity *identity;
+      GError *error = NULL;
+      PolkitImplicitAuthorization ret_any;
+      PolkitImplicitAuthorization ret_inactive;
+      PolkitImplicitAuthorization ret_active;
+      gboolean ok;
+
+      identity = polkit_identity_from_string (cases[n].identity, &error);
+      g_assert_no_error (error);
+      g_assert (identity);
+
+      ok = polkit_backend_local_authorization_store_lookup (store,
+                                                            identity,
+                                                            cases[n].action_id,
+                                                            details,
+                                                            &ret_any,
+                                                            &ret_inactive,
+                                                            &ret_active);
+      if (cases[n].expect == NULL)
+        g_assert (!ok);
+      else
+        {
+          g_assert (ok);
+          g_assert_cmpstr (cases[n].expect, ==,
+                           polkit_implicit_authorization_to_string (ret_any));
+        }
+
+      g_object_unref (identity);
+    }
+
+  g_object_unref (details);
+  g_object_unref (store);
+}
+
+/* A lookup of several identities at once must give the same results as
+   separate lookups */
+static void
+test_lookup_identities (void)
+{
+  static const gchar *identity_strings[] = {
+    NULL,
+    "unix-group:users",
+    "unix-group:admin",
+    "unix-user:john",
+    "unix-user:jane",
+    "unix-group:users",
+  };
+  static const gchar *action_ids[] = {
+    "com.example.awesomeproduct.foo",
+    "com.example.awesomeproduct.bar",
+    "com.example.awesomeproduct.defaults-test",
+    "com.example.missingproduct.foo",
+  };
+
+  gchar *data_dir_path;
+  GFile *data_dir;
+  PolkitBackendLocalAuthorizationStore *store;
+  PolkitBackendLocalIdentitySet *identities;
+  PolkitIdentity *identity_objects[G_N_ELEMENTS (identity_strings)];
+  PolkitBackendLocalAuthorizationMatch matches[G_N_ELEMENTS (identity_strings)];
+  PolkitDetails *details;
+  guint n, m;
+
+  data_dir_path = polkit_test_get_data_path (DATA_DIR);
+  g_assert (data_dir_path);
+
+  data_dir = g_file_new_for_path (data_dir_path);
+  g_assert (data_dir);
+  g_free (data_dir_path);
+
+  store = polkit_backend_local_authorization_store_new (data_dir, DATA_EXT);
+  g_assert (store);
+  g_object_unref (data_dir);
+
+  details = polkit_details_new ();
+
+  identities = polkit_backend_local_identity_set_new ();
+  for (n = 0; n < G_N_ELEMENTS (identity_strings); n++)
+    {
+      GError *error = NULL;
+
+      identity_objects[n] = NULL;
+      if (identity_strings[n] != NULL)
+        {
+          identity_objects[n] = polkit_identity_from_string (identity_strings[n], &error);
+          g_assert_no_error (error);
+          g_assert (identity_objects[n]);
+        }
+      g_assert_cmpuint (polkit_backend_local_identity_set_add (identities, identity_objects[n]), ==, n);
+    }
+  g_assert_cmpuint (polkit_backend_local_identity_set_get_size (identities), ==,
+                    G_N_ELEMENTS (identity_strings));
+
+  for (m = 0; m < G_N_ELEMENTS (action_ids); m++)
+    {
+      polkit_backend_local_authorization_store_lookup_identities (store,
+                                                                  identities,
+                                                                  action_ids[m],
+                                                                  details,
+                                                                  matches);
+      for (n = 0; n < G_N_ELEMENTS (identity_strings); n++)
+        {
+          PolkitImplicitAuthorization ret_any;
+          PolkitImplicitAuthorization ret_inactive;
+          PolkitImplicitAuthorization ret_active;
+          gboolean ok;
+
+          ok = polkit_backend_local_authorization_store_lookup (store,
+                                                                identity_objects[n],
+                                                                action_ids[m],
+                                                                details,
+                                                                &ret_any,
+                                                                &ret_inactive,
+                                                                &ret_active);
+          g_assert_cmpint (matches[n].matched, ==, ok);
+          if (ok)
+            {
+              g_assert_cmpint (matches[n].result_any, ==, ret_any);
+              g_assert_cmpint (matches[n].result_inactive, ==, ret_inactive);
+              g_assert_cmpint (matches[n].result_active, ==, ret_active);
+            }
+        }
+    }
+
+  /* Check that the test covers some matches */
+  g_assert (matches[0].matched == FALSE);
+  polkit_backend_local_authorization_store_lookup_identities (store,
+                                                              identities,
+                                                              "com.example.awesomeproduct.defaults-test",
+                                                              details,
+                                                              matches);
+  g_assert (matches[0].matched);
+  g_assert_cmpstr ("auth_self", ==,
+                   polkit_implicit_authorization_to_string (matches[2].result_active));
+  g_assert_cmpstr ("yes", ==,
+                   polkit_implicit_authorization_to_string (matches[3].result_active));
+  g_assert (!matches[4].matched);
+
+  for (n = 0; n < G_N_ELEMENTS (identity_strings); n++)
+    {
+      if (identity_objects[n] != NULL)
+        g_object_unref (identity_objects[n]);
+    }
+  polkit_backend_local_identity_set_free (identities);
+  g_object_unref (details);
+  g_object_unref (store);
+}
+
+
+/* Reading the files in threads gives the same entries in the same order */
+static void
+test_load_all (void)
+{
+  const gchar *dirs[] = { DATA_DIR, PATTERNS_DATA_DIR };
+  GList *stores;
+  GList *l;
+  guint n;
+
+  stores = NULL;
+  for (n = 0; n < G_N_ELEMENTS (dirs); n++)
+    {
+      gchar *path;
+      GFile *directory;
+
+      path = polkit_test_get_data_path (dirs[n]);
+      g_assert (path != NULL);
+      directory = g_file_new_for_path (path);
+      stores = g_list_append (stores,
+			      polkit_backend_local_authorization_store_new (directory, DATA_EXT));
+      g_object_unref (directory);
+      g_free (path);
+    }
+
+  polkit_backend_local_authorization_store_load_all (stores, 4);
+
+  for (l = stores, n = 0; l != NULL; l = l->next, n++)
+    {
+      PolkitBackendLocalAuthorizationStore *serial_store;
+      GVariant *expected, *value;
+      gchar *path;
+      GFile *directory;
+
+      path = polkit_test_get_data_path (dirs[n]);
+      directory = g_file_new_for_path (path);
+      serial_store = polkit_backend_local_authorization_store_new (directory, DATA_EXT);
+      g_object_unref (directory);
+      g_free (path);
+
+      expected = g_variant_ref_sink (polkit_backend_local_authorization_store_serialize (serial_store));
+      value = g_variant_ref_sink (polkit_backend_local_authorization_store_serialize (l->data));
+      g_assert (g_variant_equal (value, expected));
+      g_variant_unref (value);
+      g_variant_unref (expected);
+      g_object_unref (serial_store);
+    }
+
+  g_list_foreach (stores, (GFunc) g_object_unref, NULL);
+  g_list_free (stores);
+}
+
+/* Writes an authorization file in @directory allowing root ResultAny
+   @result for com.example.reload */
+static void
+write_reload_file (const gchar *directory,
+		   const gchar *name,
+		   const gchar *result)
+{
+  gchar *path, *contents;
+  GError *error = NULL;
+
+  path = g_build_filename (directory, name, NULL);
+  contents = g_strdup_printf ("[Reload]\n"
+			      "Identity=unix-user:root\n"
+			      "Action=com.example.reload\n"
+			      "ResultAny=%s\n", result);
+  g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+  g_free (contents);
+  g_free (path);
+}
+
+static void
+on_store_changed (PolkitBackendLocalAuthorizationStore *store,
+		  gpointer                              user_data)
+{
+  gboolean *changed = user_data;
+
+  *changed = TRUE;
+}
+
+/* Runs the main loop until @store reports a change */
+static void
+wait_for_change (gboolean *changed)
+{
+  guint n;
+
+  for (n = 0; n < 1000 && !*changed; n++)
+    {
+      while (g_main_context_iteration (NULL, FALSE))
+	;
+      if (!*changed)
+	g_usleep (G_USEC_PER_SEC / 100);
+    }
+  g_assert (*changed);
+  *changed = FALSE;
+}
+
+static const gchar *
+lookup_reload_result (PolkitBackendLocalAuthorizationStore *store)
+{
+  PolkitIdentity *identity;
+  PolkitDetails *details;
+  PolkitImplicitAuthorization ret_any, ret_inactive, ret_active;
+  GError *error = NULL;
+  gboolean ok;
+
+  identity = polkit_identity_from_string ("unix-user:root", &error);
+  g_assert_no_error (error);
+  details = polkit_details_new ();
+  ok = polkit_backend_local_authorization_store_lookup (store, identity,
+							 "com.example.reload",
+							 details, &ret_any,
+							 &ret_inactive,
+							 &ret_active);
+  g_object_unref (details);
+  g_object_unref (identity);
+
+  return ok ? polkit_implicit_authorization_to_string (ret_any) : NULL;
+}
+
+/* Changed files are re-read and spliced in at their position in the
+   basename order, in which later files take precedence */
+static void
+test_reload_file (void)
+{
+  PolkitBackendLocalAuthorizationStore *store;
+  gchar *directory_path, *path;
+  GFile *directory;
+  gboolean changed = FALSE;
+  GError *error = NULL;
+
+  directory_path = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  write_reload_file (directory_path, "10-a.pkla", "yes");
+  write_reload_file (directory_path, "30-c.pkla", "no");
+
+  directory = g_file_new_for_path (directory_path);
+  store = polkit_backend_local_authorization_store_new (directory, DATA_EXT);
+  g_signal_connect (store, "changed", G_CALLBACK (on_store_changed), &changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "no");
+
+  /* A new file in the middle does not override the last one */
+  write_reload_file (directory_path, "20-b.pkla", "auth_self");
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "no");
+
+  path = g_build_filename (directory_path, "30-c.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "auth_self");
+
+  write_reload_file (directory_path, "20-b.pkla", "auth_admin");
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "auth_admin");
+
+  path = g_build_filename (directory_path, "20-b.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "yes");
+
+  path = g_build_filename (directory_path, "10-a.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, NULL);
+
+  g_object_unref (store);
+  g_object_unref (directory);
+  g_assert_cmpint (g_rmdir (directory_path), ==, 0);
+  g_free (directory_path);
+}
+
+/* A burst of changes within the coalescing timeout causes one reload */
+static void
+test_coalesce (void)
+{
+  PolkitBackendLocalAuthorizationStore *store;
+  gchar *directory_path, *path;
+  GFile *directory;
+  gboolean changed = FALSE;
+  guint64 change_events, reloads;
+  GError *error = NULL;
+
+  directory_path = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  directory = g_file_new_for_path (directory_path);
+  store = polkit_backend_local_authorization_store_new (directory, DATA_EXT);
+  g_object_set (store, "coalesce-timeout", 500, NULL);
+  g_signal_connect (store, "changed", G_CALLBACK (on_store_changed), &changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, NULL);
+
+  write_reload_file (directory_path, "10-a.pkla", "yes");
+  write_reload_file (directory_path, "20-b.pkla", "auth_self");
+  write_reload_file (directory_path, "30-c.pkla", "no");
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "no");
+
+  polkit_backend_local_authorization_store_get_reload_stats (store,
+							      &change_events,
+							      &reloads,
+							      NULL);
+  g_assert_cmpuint (change_events, >=, 3);
+  g_assert_cmpuint (reloads, ==, 1);
+
+  g_object_unref (store);
+  g_object_unref (directory);
+  path = g_build_filename (directory_path, "10-a.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  path = g_build_filename (directory_path, "20-b.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  path = g_build_filename (directory_path, "30-c.pkla", NULL);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  g_assert_cmpint (g_rmdir (directory_path), ==, 0);
+  g_free (directory_path);
+}
+
+/* Writing a file again without changing its entries is not a reload */
+static void
+test_reload_unchanged (void)
+{
+  static const gchar commented_file[] =
+    "# Only a comment was added\n"
+    "[Reload]\n"
+    "Identity=unix-user:root\n"
+    "Action=com.example.reload\n"
+    "ResultAny=yes\n";
+
+  PolkitBackendLocalAuthorizationStore *store;
+  gchar *directory_path, *path;
+  GFile *directory;
+  gboolean changed = FALSE;
+  guint64 change_events, reloads;
+  GError *error = NULL;
+  guint n;
+
+  directory_path = g_dir_make_tmp ("pkla-test-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (directory_path, "10-a.pkla", NULL);
+  write_reload_file (directory_path, "10-a.pkla", "yes");
+
+  directory = g_file_new_for_path (directory_path);
+  store = polkit_backend_local_authorization_store_new (directory, DATA_EXT);
+  g_object_set (store, "coalesce-timeout", 100, NULL);
+  g_signal_connect (store, "changed", G_CALLBACK (on_store_changed), &changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "yes");
+
+  g_file_set_contents (path, commented_file, -1, &error);
+  g_assert_no_error (error);
+  /* Give the notifications time to arrive and be handled */
+  for (n = 0; n < 100; n++)
+    {
+      while (g_main_context_iteration (NULL, FALSE))
+	;
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+  g_assert (!changed);
+  polkit_backend_local_authorization_store_get_reload_stats (store,
+							      &change_events,
+							      &reloads,
+							      NULL);
+  g_assert_cmpuint (change_events, >=, 1);
+  g_assert_cmpuint (reloads, ==, 0);
+
+  write_reload_file (directory_path, "10-a.pkla", "no");
+  wait_for_change (&changed);
+  g_assert_cmpstr (lookup_reload_result (store), ==, "no");
+  polkit_backend_local_authorization_store_get_reload_stats (store, NULL,
+							      &reloads,
+							      NULL);
+  g_assert_cmpuint (reloads, ==, 1);
+
+  g_object_unref (store);
+  g_object_unref (directory);
+  g_assert_cmpint (g_unlink (path), ==, 0);
+  g_free (path);
+  g_assert_cmpint (g_rmdir (directory_path), ==, 0);
+  g_free (directory_path);
+}
+
+static void
+append_shadowed (const gchar *id,
+                 const gchar *shadowed_by_id,
+                 gpointer     user_data)
+{
+  GString *str = user_data;
+
+  g_string_append_printf (str, "%s > %s\n",
+                          strrchr (id, ':') + 1, strrchr (shadowed_by_id, ':') + 1);
+}
+
+static gboolean
+lookup_shadowed (PolkitBackendLocalAuthorizationStore *store,
+                 const gchar                          *identity_string,
+                 const gchar                          *action_id)
+{
+  PolkitIdentity *identity;
+  PolkitDetails *details;
+  PolkitImplicitAuthorization ret_any, ret_inactive, ret_active;
+  GError *error = NULL;
+  gboolean ok;
+
+  identity = polkit_identity_from_string (identity_string, &error);
+  g_assert_no_error (error);
+  details = polkit_details_new ();
+  ok = polkit_backend_local_authorization_store_lookup (store, identity, action_id,
+                                                         details, &ret_any,
+                                                         &ret_inactive, &ret_active);
+  g_object_unref (details);
+  g_object_unref (identity);
+
+  return ok;
+}
+
+/* Entries overridden by later ones in the same store, or by complete
+   entries at the end of later stores, are found and left out */
+static void
+test_shadowed (void)
+{
+  const gchar *dirs[] = { SHADOWED_DATA_DIR1, SHADOWED_DATA_DIR2 };
+  PolkitBackendLocalAuthorizationStore *first;
+  GList *stores;
+  GString *str;
+  guint n;
+
+  stores = NULL;
+  for (n = 0; n < G_N_ELEMENTS (dirs); n++)
+    {
+      gchar *path;
+      GFile *directory;
+
+      path = polkit_test_get_data_path (dirs[n]);
+      g_assert (path != NULL);
+      directory = g_file_new_for_path (path);
+      stores = g_list_append (stores,
+                              polkit_backend_local_authorization_store_new (directory, DATA_EXT));
+      g_object_unref (directory);
+      g_free (path);
+    }
+  first = stores->data;
+
+  str = g_string_new (NULL);
+  polkit_backend_local_authorization_store_foreach_shadowed (stores, append_shadowed, str);
+  g_assert_cmpstr (str->str, ==,
+                   "Shadowed in store > Covers in store\n"
+                   "Shadowed by later store > Complete for c\n"
+                   "Sally in first store > Any action for sally\n"
+                   "Complete for d > Partial later rule\n");
+  g_string_free (str, TRUE);
+
+  /* Listing them leaves all entries in lookups */
+  g_assert (lookup_shadowed (first, "unix-user:sally", "com.example.shadowed.f"));
+
+  g_assert_cmpuint (polkit_backend_local_authorization_store_eliminate_shadowed (stores), ==, 4);
+  g_assert (!lookup_shadowed (first, "unix-user:sally", "com.example.shadowed.f"));
+  g_assert (!lookup_shadowed (first, "unix-group:users", "com.example.shadowed.c"));
+  g_assert (lookup_shadowed (first, "unix-user:jane", "com.example.shadowed.d"));
+  g_assert (lookup_shadowed (first, "unix-user:john", "com.example.shadowed.e"));
+
+  polkit_backend_local_authorization_store_restore_shadowed (stores);
+  g_assert (lookup_shadowed (first, "unix-user:sally", "com.example.shadowed.f"));
+  g_assert (lookup_shadowed (first, "unix-group:users", "com.example.shadowed.c"));
+
+  g_list_foreach (stores, (GFunc) g_object_unref, NULL);
+  g_list_free (stores);
+}
 
 int
 main (int argc, char *argv[])
@@ -137,5 +719,12 @@ main (int argc, char *argv[])
   polkit_test_redirect_logs ();
   g_test_add_func ("/PolkitBackendLocalAuthorizationStore/new", test_new);
   g_test_add_func ("/PolkitBackendLocalAuthorizationStore/lookup", test_lookup);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/lookup_action_patterns", test_lookup_action_patterns);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/lookup_identities", test_lookup_identities);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/load_all", test_load_all);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/reload_file", test_reload_file);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/coalesce", test_coalesce);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/reload_unchanged", test_reload_unchanged);
+  g_test_add_func ("/PolkitBackendLocalAuthorizationStore/shadowed", test_shadowed);
   return g_test_run ();
 }
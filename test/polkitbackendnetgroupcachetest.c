@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2011 Google Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+#include "glib.h"
+
+#include <polkit/polkit.h>
+
+#include "../src/polkitbackendnetgroupcache.h"
+#include "polkittesthelper.h"
+
+/* Test helper types */
+
+struct netgroup_context {
+  const gchar *netgroup;
+  const gchar *user;
+  gboolean expect;
+};
+
+/* Memberships in test/data/etc/netgroup */
+static const struct netgroup_context netgroup_test_data [] = {
+  {"foo", "john", TRUE},
+  {"foo", "jane", FALSE},
+  {"bar", "jane", TRUE},
+  {"baz", "john", TRUE},
+  {"baz", "jane", TRUE},
+  {"baz", "root", FALSE},
+  {"missing", "john", FALSE},
+  {NULL},
+};
+
+/* Test implementations */
+
+static void
+check_netgroup_test_data (PolkitBackendNetgroupCache *cache)
+{
+  guint n;
+
+  for (n = 0; netgroup_test_data[n].netgroup != NULL; n++)
+    {
+      const struct netgroup_context *ctx = &netgroup_test_data[n];
+
+      g_assert_cmpint (polkit_backend_netgroup_cache_contains_user (cache, ctx->netgroup,
+                                                                    ctx->user, NULL),
+                       ==, ctx->expect);
+    }
+}
+
+static void
+test_disabled (void)
+{
+  PolkitBackendNetgroupCache *cache;
+  guint64 hits, misses;
+  guint entries;
+
+  cache = polkit_backend_netgroup_cache_new (0);
+
+  check_netgroup_test_data (cache);
+  check_netgroup_test_data (cache);
+
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, &entries);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (misses, ==, 0);
+  g_assert_cmpuint (entries, ==, 0);
+
+  polkit_backend_netgroup_cache_free (cache);
+}
+
+static void
+test_hits (void)
+{
+  PolkitBackendNetgroupCache *cache;
+  guint64 hits, misses;
+  guint entries;
+  guint n_queries;
+
+  for (n_queries = 0; netgroup_test_data[n_queries].netgroup != NULL; n_queries++)
+    ;
+
+  cache = polkit_backend_netgroup_cache_new (G_MAXUINT);
+
+  check_netgroup_test_data (cache);
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, &entries);
+  g_assert_cmpuint (hits, ==, 0);
+  g_assert_cmpuint (misses, ==, n_queries);
+  g_assert_cmpuint (entries, ==, n_queries);
+
+  /* Negative answers are remembered as well */
+  check_netgroup_test_data (cache);
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, &entries);
+  g_assert_cmpuint (hits, ==, n_queries);
+  g_assert_cmpuint (misses, ==, n_queries);
+  g_assert_cmpuint (entries, ==, n_queries);
+
+  polkit_backend_netgroup_cache_clear (cache);
+  polkit_backend_netgroup_cache_get_stats (cache, NULL, NULL, &entries);
+  g_assert_cmpuint (entries, ==, 0);
+
+  check_netgroup_test_data (cache);
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, NULL);
+  g_assert_cmpuint (hits, ==, n_queries);
+  g_assert_cmpuint (misses, ==, 2 * n_queries);
+
+  polkit_backend_netgroup_cache_free (cache);
+}
+
+static void
+test_expiry (void)
+{
+  PolkitBackendNetgroupCache *cache;
+  guint64 hits, misses;
+  guint entries;
+
+  cache = polkit_backend_netgroup_cache_new (1);
+
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", NULL));
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", NULL));
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, NULL);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 1);
+
+  /* An expired answer is looked up again, reusing its entry */
+  g_usleep (G_USEC_PER_SEC + G_USEC_PER_SEC / 10);
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", NULL));
+  polkit_backend_netgroup_cache_get_stats (cache, &hits, &misses, &entries);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 2);
+  g_assert_cmpuint (entries, ==, 1);
+
+  polkit_backend_netgroup_cache_free (cache);
+}
+
+static void
+test_expires_at (void)
+{
+  PolkitBackendNetgroupCache *cache;
+  gint64 start, first, second;
+
+  cache = polkit_backend_netgroup_cache_new (10);
+
+  start = g_get_monotonic_time ();
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", &first));
+  g_assert_cmpint (first, >=, start + 10 * G_USEC_PER_SEC);
+  g_assert_cmpint (first, <=, g_get_monotonic_time () + 10 * G_USEC_PER_SEC);
+
+  /* A remembered answer expires when it was going to, not a full TTL
+     after it is used again */
+  g_usleep (G_USEC_PER_SEC / 10);
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", &second));
+  g_assert_cmpint (second, ==, first);
+
+  polkit_backend_netgroup_cache_set_ttl (cache, G_MAXUINT);
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", &first));
+  g_assert_cmpint (first, ==, G_MAXINT64);
+
+  polkit_backend_netgroup_cache_set_ttl (cache, 0);
+  start = g_get_monotonic_time ();
+  g_assert (polkit_backend_netgroup_cache_contains_user (cache, "foo", "john", &first));
+  g_assert_cmpint (first, >=, start);
+  g_assert_cmpint (first, <=, g_get_monotonic_time ());
+
+  polkit_backend_netgroup_cache_free (cache);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+  polkit_test_redirect_logs ();
+  g_test_add_func ("/PolkitBackendNetgroupCache/disabled", test_disabled);
+  g_test_add_func ("/PolkitBackendNetgroupCache/hits", test_hits);
+  g_test_add_func ("/PolkitBackendNetgroupCache/expiry", test_expiry);
+  g_test_add_func ("/PolkitBackendNetgroupCache/expires_at", test_expires_at);
+  return g_test_run ();
+}
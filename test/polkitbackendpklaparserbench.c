@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2011 Google Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Compares reading a large authorization file with GKeyFile, as done for
+   files polkit_backend_pkla_parse() does not handle, to the parser.  Not
+   run by "make check"; build it with "make bench" and run it by hand
+   after changing either path. */
+
+#include "config.h"
+#include "glib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "../src/polkitbackendpklaparser.h"
+
+static gint opt_groups = 10000;
+static gint opt_iterations = 20;
+
+static const GOptionEntry opt_entries[] =
+  {
+    { "groups", 0, 0, G_OPTION_ARG_INT, &opt_groups,
+      "Number of authorization entries in the file", "N" },
+    { "iterations", 0, 0, G_OPTION_ARG_INT, &opt_iterations,
+      "Number of times the file is read", "N" },
+    { NULL, '\0', 0, 0, NULL, NULL, NULL }
+  };
+
+/* Returns the contents of a file with @n_groups authorization entries */
+static gchar *
+make_corpus (guint n_groups)
+{
+  GString *str;
+  guint n;
+
+  str = g_string_new (NULL);
+  for (n = 0; n < n_groups; n++)
+    {
+      g_string_append_printf (str,
+                              "[Entry %u]\n"
+                              "Identity=unix-user:user%u;unix-group:group%u;unix-netgroup:net%u\n"
+                              "Action=com.example.product%u.action;com.example.product%u.*\n"
+                              "ResultAny=no\n"
+                              "ResultInactive=auth_admin\n"
+                              "ResultActive=%s\n",
+                              n, n, n % 100, n % 10, n, n % 50,
+                              n % 2 == 0 ? "yes" : "auth_self");
+      if (n % 10 == 0)
+        g_string_append (str, "ReturnValue=reason=bench;level=1\n");
+      g_string_append_c (str, '\n');
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* Retrieves the values like local_authorization_file_add_from_key_file() */
+static guint
+read_with_key_file (const gchar *filename)
+{
+  GKeyFile *key_file;
+  gchar **groups;
+  GError *error = NULL;
+  guint ret;
+  guint n;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, &error))
+    g_error ("Error loading key-file %s: %s", filename, error->message);
+
+  ret = 0;
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (n = 0; groups[n] != NULL; n++)
+    {
+      gchar **strv;
+      gchar *str;
+
+      strv = g_key_file_get_string_list (key_file, groups[n], "Identity", NULL, NULL);
+      g_strfreev (strv);
+      strv = g_key_file_get_string_list (key_file, groups[n], "Action", NULL, NULL);
+      g_strfreev (strv);
+      str = g_key_file_get_string (key_file, groups[n], "ResultAny", NULL);
+      g_free (str);
+      str = g_key_file_get_string (key_file, groups[n], "ResultInactive", NULL);
+      g_free (str);
+      str = g_key_file_get_string (key_file, groups[n], "ResultActive", NULL);
+      g_free (str);
+      strv = g_key_file_get_string_list (key_file, groups[n], "ReturnValue", NULL, NULL);
+      g_strfreev (strv);
+      ret++;
+    }
+  g_strfreev (groups);
+  g_key_file_free (key_file);
+
+  return ret;
+}
+
+static void
+count_group (PolkitBackendPklaGroup *group,
+             gpointer                user_data)
+{
+  guint *count = user_data;
+
+  (*count)++;
+}
+
+static guint
+read_with_parser (const gchar *filename)
+{
+  GMappedFile *mapped_file;
+  GError *error = NULL;
+  guint ret;
+
+  mapped_file = g_mapped_file_new (filename, FALSE, &error);
+  if (mapped_file == NULL)
+    g_error ("Error mapping %s: %s", filename, error->message);
+
+  ret = 0;
+  if (!polkit_backend_pkla_parse (g_mapped_file_get_contents (mapped_file),
+                                  g_mapped_file_get_length (mapped_file),
+                                  count_group, &ret))
+    g_error ("%s was not parsed", filename);
+  g_mapped_file_unref (mapped_file);
+
+  return ret;
+}
+
+/* Returns the average microseconds per read */
+static gdouble
+run (const gchar *name,
+     guint      (*read_func) (const gchar *filename),
+     const gchar *filename)
+{
+  gint64 start;
+  gdouble ret;
+  gint n;
+
+  start = g_get_monotonic_time ();
+  for (n = 0; n < opt_iterations; n++)
+    {
+      if (read_func (filename) != (guint) opt_groups)
+        g_error ("%s did not read all entries", name);
+    }
+  ret = (gdouble) (g_get_monotonic_time () - start) / opt_iterations;
+
+  printf ("%-8s %12.0f us per file, %8.2f us per entry\n",
+          name, ret, ret / MAX (opt_groups, 1));
+
+  return ret;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *opt_context;
+  GError *error = NULL;
+  gchar *directory;
+  gchar *filename;
+  gchar *contents;
+  gdouble key_file_time;
+  gdouble parser_time;
+
+  g_type_init ();
+
+  opt_context = g_option_context_new ("");
+  g_option_context_set_summary (opt_context,
+                                "Compares GKeyFile with the authorization file parser.");
+  g_option_context_add_main_entries (opt_context, opt_entries, NULL);
+  if (!g_option_context_parse (opt_context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s: %s\n", g_get_prgname (), error->message);
+      g_error_free (error);
+      g_option_context_free (opt_context);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (opt_context);
+  if (opt_groups < 0 || opt_iterations <= 0)
+    {
+      fprintf (stderr, "%s: Invalid number of groups or iterations\n", g_get_prgname ());
+      return EXIT_FAILURE;
+    }
+
+  directory = g_dir_make_tmp ("pkla-bench-XXXXXX", &error);
+  if (directory == NULL)
+    g_error ("Error creating a temporary directory: %s", error->message);
+  filename = g_build_filename (directory, "bench.pkla", NULL);
+  contents = make_corpus (opt_groups);
+  if (!g_file_set_contents (filename, contents, -1, &error))
+    g_error ("Error writing %s: %s", filename, error->message);
+  printf ("%d entries, %" G_GSIZE_FORMAT " bytes, %d iterations\n",
+          opt_groups, strlen (contents), opt_iterations);
+  g_free (contents);
+
+  /* Warm up the page cache */
+  read_with_key_file (filename);
+
+  key_file_time = run ("GKeyFile", read_with_key_file, filename);
+  parser_time = run ("parser", read_with_parser, filename);
+  if (parser_time > 0)
+    printf ("speedup  %12.2fx\n", key_file_time / parser_time);
+
+  g_unlink (filename);
+  g_rmdir (directory);
+  g_free (filename);
+  g_free (directory);
+
+  return EXIT_SUCCESS;
+}
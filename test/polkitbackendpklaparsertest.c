@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2011 Google Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+#include "glib.h"
+
+#include <string.h>
+
+#include "../src/polkitbackendpklaparser.h"
+#include "polkittesthelper.h"
+
+/* Test helper functions */
+
+static void
+append_list (GString      *str,
+             gchar * const *list)
+{
+  guint n;
+
+  g_string_append_c (str, '|');
+  if (list == NULL)
+    {
+      g_string_append (str, "(none)");
+      return;
+    }
+  for (n = 0; list[n] != NULL; n++)
+    {
+      if (n > 0)
+        g_string_append_c (str, ',');
+      g_string_append_printf (str, "<%s>", list[n]);
+    }
+}
+
+static void
+append_value (GString     *str,
+              const gchar *value)
+{
+  g_string_append_c (str, '|');
+  g_string_append (str, value != NULL ? value : "(none)");
+}
+
+/* Formats the values of a group, one line per group */
+static void
+append_group (GString      *str,
+              const gchar  *name,
+              gchar * const *identity_strings,
+              gchar * const *action_strings,
+              const gchar  *result_any,
+              const gchar  *result_inactive,
+              const gchar  *result_active,
+              gchar * const *return_value_strings)
+{
+  g_string_append (str, name);
+  append_list (str, identity_strings);
+  append_list (str, action_strings);
+  append_value (str, result_any);
+  append_value (str, result_inactive);
+  append_value (str, result_active);
+  append_list (str, return_value_strings);
+  g_string_append_c (str, '\n');
+}
+
+static void
+append_parsed_group (PolkitBackendPklaGroup *group,
+                     gpointer                user_data)
+{
+  append_group (user_data, group->name, group->identity_strings, group->action_strings,
+                group->result_any, group->result_inactive, group->result_active,
+                group->return_value_strings);
+}
+
+/* Returns the formatted groups of @data, or NULL if it was not parsed */
+static gchar *
+parse (const gchar *data,
+       gsize        length)
+{
+  GString *str;
+
+  str = g_string_new (NULL);
+  if (!polkit_backend_pkla_parse (data, length, append_parsed_group, str))
+    {
+      /* Nothing must be reported before giving up */
+      g_assert_cmpstr (str->str, ==, "");
+      g_string_free (str, TRUE);
+      return NULL;
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+/* Returns the formatted groups of @data as read by GKeyFile */
+static gchar *
+parse_with_key_file (const gchar *data,
+                     gsize        length)
+{
+  GKeyFile *key_file;
+  gchar **groups;
+  GString *str;
+  GError *error = NULL;
+  gboolean ok;
+  guint n;
+
+  key_file = g_key_file_new ();
+  ok = g_key_file_load_from_data (key_file, data, length, G_KEY_FILE_NONE, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  str = g_string_new (NULL);
+  groups = g_key_file_get_groups (key_file, NULL);
+  for (n = 0; groups[n] != NULL; n++)
+    {
+      gchar **identity_strings, **action_strings, **return_value_strings;
+      gchar *result_any, *result_inactive, *result_active;
+
+      identity_strings = g_key_file_get_string_list (key_file, groups[n], "Identity", NULL, NULL);
+      action_strings = g_key_file_get_string_list (key_file, groups[n], "Action", NULL, NULL);
+      result_any = g_key_file_get_string (key_file, groups[n], "ResultAny", NULL);
+      result_inactive = g_key_file_get_string (key_file, groups[n], "ResultInactive", NULL);
+      result_active = g_key_file_get_string (key_file, groups[n], "ResultActive", NULL);
+      return_value_strings = g_key_file_get_string_list (key_file, groups[n], "ReturnValue",
+                                                         NULL, NULL);
+
+      append_group (str, groups[n], identity_strings, action_strings,
+                    result_any, result_inactive, result_active, return_value_strings);
+
+      g_strfreev (identity_strings);
+      g_strfreev (action_strings);
+      g_free (result_any);
+      g_free (result_inactive);
+      g_free (result_active);
+      g_strfreev (return_value_strings);
+    }
+  g_strfreev (groups);
+  g_key_file_free (key_file);
+
+  return g_string_free (str, FALSE);
+}
+
+/* Test implementations */
+
+static void
+test_parse (void)
+{
+  static const gchar data[] =
+    "# A comment\n"
+    "\n"
+    "[First]\n"
+    "Identity=unix-user:john;unix-group:users;\n"
+    "Action = com.example.foo\r\n"
+    "  ResultActive=no\n"
+    "ResultActive=yes\n"
+    "Unknown=ignored\n"
+    "ReturnValue=a=b;c;\n"
+    "[Second]  \n"
+    "Identity=unix-user:jane;;unix-user:sally\n"
+    "Action=\n"
+    "ResultAny=auth_admin\n"
+    "ResultInactive=auth_self\n"
+    "\t# Another comment";
+  gchar *result;
+  gchar *expected;
+
+  result = parse (data, strlen (data));
+  g_assert_cmpstr (result, ==,
+                   "First|<unix-user:john>,<unix-group:users>|<com.example.foo>"
+                   "|(none)|(none)|yes|<a=b>,<c>\n"
+                   "Second|<unix-user:jane>,<>,<unix-user:sally>|"
+                   "|auth_admin|auth_self|(none)|(none)\n");
+
+  /* The same as GKeyFile */
+  expected = parse_with_key_file (data, strlen (data));
+  g_assert_cmpstr (result, ==, expected);
+  g_free (expected);
+  g_free (result);
+
+  /* The data need not be nul-terminated */
+  result = parse ("[Group]\nIdentity=a\nAction=b\nResultAny=yesXXX",
+                  strlen ("[Group]\nIdentity=a\nAction=b\nResultAny=yes"));
+  g_assert_cmpstr (result, ==, "Group|<a>|<b>|yes|(none)|(none)|(none)\n");
+  g_free (result);
+
+  result = parse ("", 0);
+  g_assert_cmpstr (result, ==, "");
+  g_free (result);
+}
+
+static void
+test_fallback (void)
+{
+  static const gchar * const inputs[] =
+    {
+      /* Escape sequences and trailing whitespace */
+      "[Group]\nIdentity=unix-user:a\\;b\nAction=b\nResultAny=yes\n",
+      "[Group]\nIdentity=a\nAction=b\nResultAny=yes \n",
+      /* Keys before the first group */
+      "Identity=a\n[Group]\nIdentity=a\nAction=b\nResultAny=yes\n",
+      /* Groups split in several parts */
+      "[Group]\nIdentity=a\nAction=b\n[Other]\nIdentity=a\nAction=b\n[Group]\nResultAny=yes\n",
+      /* Missing Identity or Action */
+      "[Group]\nIdentity=a\nResultAny=yes\n",
+      "[Group]\nAction=b\nResultAny=yes\n",
+      /* Lines that are not groups, keys or comments */
+      "[Group]\nIdentity=a\nAction=b\nResultAny=yes\nfoo\n",
+      "[Group]\n=a\nIdentity=a\nAction=b\nResultAny=yes\n",
+      "[Group] foo\nIdentity=a\nAction=b\nResultAny=yes\n",
+      "[]\nIdentity=a\nAction=b\nResultAny=yes\n",
+      "[Group\nIdentity=a\nAction=b\nResultAny=yes\n",
+      /* Locale suffixes and encodings */
+      "[Group]\nIdentity=a\nIdentity[de]=b\nAction=b\nResultAny=yes\n",
+      "[Group]\nEncoding=UTF-8\nIdentity=a\nAction=b\nResultAny=yes\n",
+      /* Invalid UTF-8 */
+      "[Group]\nIdentity=\xff\nAction=b\nResultAny=yes\n",
+    };
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (inputs); n++)
+    g_assert (parse (inputs[n], strlen (inputs[n])) == NULL);
+}
+
+static void
+test_test_data (void)
+{
+  static const gchar * const files[] =
+    {
+      "etc/polkit-1/localauthority/10-test/com.example.pkla",
+      "patterns/patterns.pkla",
+    };
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (files); n++)
+    {
+      gchar *path;
+      gchar *contents;
+      gsize length;
+      gchar *result;
+      gchar *expected;
+      GError *error = NULL;
+      gboolean ok;
+
+      path = polkit_test_get_data_path (files[n]);
+      g_assert (path != NULL);
+      ok = g_file_get_contents (path, &contents, &length, &error);
+      g_assert_no_error (error);
+      g_assert (ok);
+
+      result = parse (contents, length);
+      g_assert (result != NULL);
+      expected = parse_with_key_file (contents, length);
+      g_assert_cmpstr (result, ==, expected);
+
+      g_free (expected);
+      g_free (result);
+      g_free (contents);
+      g_free (path);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+  polkit_test_redirect_logs ();
+  g_test_add_func ("/PolkitBackendPklaParser/parse", test_parse);
+  g_test_add_func ("/PolkitBackendPklaParser/fallback", test_fallback);
+  g_test_add_func ("/PolkitBackendPklaParser/test_data", test_test_data);
+  return g_test_run ();
+}